@@ -71,35 +71,87 @@
 #include <common.h>
 #include <auth.h>
 
+#if defined(__x86_64__) && \
+    (defined(__clang__) || (defined(__GNUC__) && __GNUC__ >= 5))
+#define HAVE_SHA_NI
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
+
 #define PADLEN 64
 #define IPAD 0x36
 #define OPAD 0x5C
 
-#define HMACMD5_KEYLENGTH 64
+#define HASH_BLOCKLEN	64	/* for MD5 and SHA-256 alike */
+#define HASH_MAXDIGESTLEN	SHA256_DIGESTLENGTH
+
+/*
+ * A hash function over 64-byte blocks, padded with its length in bits.
+ * The compression function digests whole blocks where they are.
+ */
+struct hashalg {
+	int alg;			/* DHCP6_AUTHALG_xxx */
+	size_t digestlen;
+	int bigendian;			/* the length and the digest */
+	int words;			/* of the state */
+	const u_int32_t *iv;
+	void (*blocks) __P((u_int32_t *, const unsigned char *, size_t));
+};
 
 typedef struct {
-	u_int32_t buf[4];
-	u_int32_t bytes[2];
-	u_int32_t in[16];
-} md5_t;
+	const struct hashalg *hash;
+	u_int32_t state[8];
+	u_int64_t bytes;
+	unsigned char in[HASH_BLOCKLEN];	/* a partial block */
+} hash_t;
 
 typedef struct {
-	md5_t md5ctx;
-	unsigned char key[HMACMD5_KEYLENGTH];
-} hmacmd5_t;
-
-static void hmacmd5_init __P((hmacmd5_t *, const unsigned char *,
-    unsigned int));
-static void hmacmd5_invalidate __P((hmacmd5_t *));
-static void hmacmd5_update __P((hmacmd5_t *, const unsigned char *,
-    unsigned int));
-static void hmacmd5_sign __P((hmacmd5_t *, unsigned char *));
-static int hmacmd5_verify __P((hmacmd5_t *, unsigned char *));
-
-static void md5_init __P((md5_t *));
-static void md5_invalidate __P((md5_t *));
-static void md5_final __P((md5_t *, unsigned char *));
-static void md5_update __P((md5_t *, const unsigned char *, unsigned int));
+	hash_t hashctx;
+	u_int32_t *ostate;	/* of the key */
+} hmac_t;
+
+static const struct hashalg *hashalg_lookup __P((int));
+static void hmac_prepare __P((struct keyinfo *, const struct hashalg *));
+static void hmac_init __P((hmac_t *, struct keyinfo *,
+    const struct hashalg *));
+static void hmac_update __P((hmac_t *, const unsigned char *, size_t));
+static void hmac_sign __P((hmac_t *, unsigned char *));
+static int hmac_verify __P((hmac_t *, unsigned char *));
+
+static void hash_init __P((hash_t *, const struct hashalg *));
+static void hash_resume __P((hash_t *, const struct hashalg *,
+    u_int32_t *, u_int64_t));
+static void hash_update __P((hash_t *, const unsigned char *, size_t));
+static void hash_final __P((hash_t *, unsigned char *));
+
+static void md5_blocks __P((u_int32_t *, const unsigned char *, size_t));
+static void sha256_blocks __P((u_int32_t *, const unsigned char *, size_t));
+static void sha256_blocks_generic __P((u_int32_t *, const unsigned char *,
+    size_t));
+#ifdef HAVE_SHA_NI
+static int sha256_have_shani __P((void));
+static void sha256_blocks_shani __P((u_int32_t *, const unsigned char *,
+    size_t));
+#endif
+
+static const u_int32_t md5_iv[4] = {
+	0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476
+};
+static const u_int32_t sha256_iv[8] = {
+	0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+	0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+};
+
+static const struct hashalg hashalgs[] = {
+	{ DHCP6_AUTHALG_HMACMD5, MD5_DIGESTLENGTH, 0, 4, md5_iv,
+	  md5_blocks },
+	{ DHCP6_AUTHALG_HMACSHA256, SHA256_DIGESTLENGTH, 1, 8, sha256_iv,
+	  sha256_blocks },
+};
+
+/* the SHA-256 compression function this CPU runs best */
+static void (*sha256_engine) __P((u_int32_t *, const unsigned char *,
+    size_t));
 
 int
 dhcp6_validate_key(key)
@@ -126,15 +178,16 @@ dhcp6_calc_mac(buf, len, proto, alg, off, key)
 	int proto, alg;
 	struct keyinfo *key;
 {
-	hmacmd5_t ctx;
-	unsigned char digest[MD5_DIGESTLENGTH];
+	const struct hashalg *hash;
+	hmac_t ctx;
+	unsigned char digest[HASH_MAXDIGESTLEN];
 
 	/* right now, we don't care about the protocol */
 
-	if (alg != DHCP6_AUTHALG_HMACMD5)
+	if ((hash = hashalg_lookup(alg)) == NULL)
 		return (-1);
 
-	if (off + MD5_DIGESTLENGTH > len) {
+	if (off + hash->digestlen > len) {
 		/*
 		 * this should be assured by the caller, but check it here
 		 * for safety.
@@ -142,11 +195,11 @@ dhcp6_calc_mac(buf, len, proto, alg, off, key)
 		return (-1);
 	}
 
-	hmacmd5_init(&ctx, key->secret, key->secretlen);
-	hmacmd5_update(&ctx, buf, len);
-	hmacmd5_sign(&ctx, digest);
+	hmac_init(&ctx, key, hash);
+	hmac_update(&ctx, (unsigned char *)buf, len);
+	hmac_sign(&ctx, digest);
 
-	memcpy(buf + off, digest, MD5_DIGESTLENGTH);
+	memcpy(buf + off, digest, hash->digestlen);
 
 	return (0);
 }
@@ -159,70 +212,104 @@ dhcp6_verify_mac(buf, len, proto, alg, off, key)
 	size_t off;
 	struct keyinfo *key;
 {
-	hmacmd5_t ctx;
-	unsigned char digest[MD5_DIGESTLENGTH];
+	const struct hashalg *hash;
+	hmac_t ctx;
+	unsigned char digest[HASH_MAXDIGESTLEN];
 	int result;
 
 	/* right now, we don't care about the protocol */
 
-	if (alg != DHCP6_AUTHALG_HMACMD5)
+	if ((hash = hashalg_lookup(alg)) == NULL)
 		return (-1);
 
-	if (off + MD5_DIGESTLENGTH > len)
+	if (off + hash->digestlen > len)
 		return (-1);
 
 	/*
 	 * Copy the MAC value and clear the field.
 	 * XXX: should we make a local working copy?
 	 */
-	memcpy(digest, buf + off, sizeof(digest));
-	memset(buf + off, 0, sizeof(digest));
+	memcpy(digest, buf + off, hash->digestlen);
+	memset(buf + off, 0, hash->digestlen);
 
-	hmacmd5_init(&ctx, key->secret, key->secretlen);
-	hmacmd5_update(&ctx, buf, len);
-	result = hmacmd5_verify(&ctx, digest);
+	hmac_init(&ctx, key, hash);
+	hmac_update(&ctx, (unsigned char *)buf, len);
+	result = hmac_verify(&ctx, digest);
 
 	/* copy back the digest value (XXX) */
-	memcpy(buf + off, digest, sizeof(digest));
+	memcpy(buf + off, digest, hash->digestlen);
 
 	return (result);
 }
 
+static const struct hashalg *
+hashalg_lookup(alg)
+	int alg;
+{
+	int i;
+
+	for (i = 0; i < sizeof(hashalgs) / sizeof(hashalgs[0]); i++) {
+		if (hashalgs[i].alg == alg)
+			return (&hashalgs[i]);
+	}
+
+	return (NULL);
+}
+
 /*
- * This code implements the HMAC-MD5 keyed hash algorithm
- * described in RFC 2104.
+ * This code implements the HMAC keyed hash algorithm described in
+ * RFC 2104, with MD5 or SHA-256.
  */
 /*
- * Start HMAC-MD5 process.  Initialize an md5 context and digest the key.
+ * Digest the padded key into the inner and outer hash states.  They are
+ * the same for every message, so this is done once per key.
  */
 static void
-hmacmd5_init(hmacmd5_t *ctx, const unsigned char *key, unsigned int len)
+hmac_prepare(struct keyinfo *key, const struct hashalg *hash)
 {
-	unsigned char ipad[PADLEN];
+	unsigned char k[PADLEN], pad[PADLEN];
+	hash_t hashctx;
 	int i;
 
-	memset(ctx->key, 0, sizeof(ctx->key));
-	if (len > sizeof(ctx->key)) {
-		md5_t md5ctx;
-		md5_init(&md5ctx);
-		md5_update(&md5ctx, key, len);
-		md5_final(&md5ctx, ctx->key);
+	memset(k, 0, sizeof(k));
+	if (key->secretlen > sizeof(k)) {
+		hash_init(&hashctx, hash);
+		hash_update(&hashctx, (unsigned char *)key->secret,
+		    key->secretlen);
+		hash_final(&hashctx, k);
 	} else
-		memcpy(ctx->key, key, len);
+		memcpy(k, key->secret, key->secretlen);
 
-	md5_init(&ctx->md5ctx);
-	memset(ipad, IPAD, sizeof(ipad));
 	for (i = 0; i < PADLEN; i++)
-		ipad[i] ^= ctx->key[i];
-	md5_update(&ctx->md5ctx, ipad, sizeof(ipad));
+		pad[i] = k[i] ^ IPAD;
+	hash_init(&hashctx, hash);
+	hash_update(&hashctx, pad, sizeof(pad));
+	memcpy(key->hmac_istate, hashctx.state, sizeof(key->hmac_istate));
+
+	for (i = 0; i < PADLEN; i++)
+		pad[i] = k[i] ^ OPAD;
+	hash_init(&hashctx, hash);
+	hash_update(&hashctx, pad, sizeof(pad));
+	memcpy(key->hmac_ostate, hashctx.state, sizeof(key->hmac_ostate));
+
+	memset(&hashctx, 0, sizeof(hashctx));
+	memset(k, 0, sizeof(k));
+	memset(pad, 0, sizeof(pad));
+	key->hmac_alg = hash->alg;
 }
 
+/*
+ * Start HMAC process.  Initialize a hash context as if the padded key
+ * had been digested.
+ */
 static void
-hmacmd5_invalidate(hmacmd5_t *ctx)
+hmac_init(hmac_t *ctx, struct keyinfo *key, const struct hashalg *hash)
 {
-	md5_invalidate(&ctx->md5ctx);
-	memset(ctx->key, 0, sizeof(ctx->key));
-	memset(ctx, 0, sizeof(ctx));
+	if (key->hmac_alg != hash->alg)
+		hmac_prepare(key, hash);
+
+	hash_resume(&ctx->hashctx, hash, key->hmac_istate, PADLEN);
+	ctx->ostate = key->hmac_ostate;
 }
 
 /*
@@ -230,96 +317,148 @@ hmacmd5_invalidate(hmacmd5_t *ctx)
  * of bytes.
  */
 static void
-hmacmd5_update(hmacmd5_t *ctx, const unsigned char *buf, unsigned int len)
+hmac_update(hmac_t *ctx, const unsigned char *buf, size_t len)
 {
-	md5_update(&ctx->md5ctx, buf, len);
+	hash_update(&ctx->hashctx, buf, len);
 }
 
 /*
- * Compute signature - finalize MD5 operation and reapply MD5.
+ * Compute signature - finalize the inner hash and reapply the hash.
  */
 static void
-hmacmd5_sign(hmacmd5_t *ctx, unsigned char *digest)
+hmac_sign(hmac_t *ctx, unsigned char *digest)
 {
-	unsigned char opad[PADLEN];
-	int i;
+	const struct hashalg *hash = ctx->hashctx.hash;
 
-	md5_final(&ctx->md5ctx, digest);
+	hash_final(&ctx->hashctx, digest);
 
-	memset(opad, OPAD, sizeof(opad));
-	for (i = 0; i < PADLEN; i++)
-		opad[i] ^= ctx->key[i];
-
-	md5_init(&ctx->md5ctx);
-	md5_update(&ctx->md5ctx, opad, sizeof(opad));
-	md5_update(&ctx->md5ctx, digest, MD5_DIGESTLENGTH);
-	md5_final(&ctx->md5ctx, digest);
-	hmacmd5_invalidate(ctx);
+	hash_resume(&ctx->hashctx, hash, ctx->ostate, PADLEN);
+	hash_update(&ctx->hashctx, digest, hash->digestlen);
+	hash_final(&ctx->hashctx, digest);
+	ctx->ostate = NULL;
 }
 
 /*
- * Verify signature - finalize MD5 operation and reapply MD5, then
- * compare to the supplied digest.
+ * Verify signature - compute the signature, then compare to the
+ * supplied digest.
  */
 static int
-hmacmd5_verify(hmacmd5_t *ctx, unsigned char *digest) {
-	unsigned char newdigest[MD5_DIGESTLENGTH];
+hmac_verify(hmac_t *ctx, unsigned char *digest)
+{
+	unsigned char newdigest[HASH_MAXDIGESTLEN];
+	size_t len = ctx->hashctx.hash->digestlen;
 
-	hmacmd5_sign(ctx, newdigest);
-	return (memcmp(digest, newdigest, MD5_DIGESTLENGTH));
+	hmac_sign(ctx, newdigest);
+	return (memcmp(digest, newdigest, len));
 }
 
-/*
- * This code implements the MD5 message-digest algorithm.
- * The algorithm is due to Ron Rivest.  This code was
- * written by Colin Plumb in 1993, no copyright is claimed.
- * This code is in the public domain; do with it what you wish.
- *
- * Equivalent code is available from RSA Data Security, Inc.
- * This code has been tested against that, and is equivalent,
- * except that you don't need to include two pages of legalese
- * with every copy.
- *
- * To compute the message digest of a chunk of bytes, declare an
- * MD5Context structure, pass it to MD5Init, call MD5Update as
- * needed on buffers full of bytes, and then call MD5Final, which
- * will fill a supplied 16-byte array with the digest.
- */
+#define GET32LE(p) \
+	((u_int32_t)(p)[0] | (u_int32_t)(p)[1] << 8 | \
+	 (u_int32_t)(p)[2] << 16 | (u_int32_t)(p)[3] << 24)
+#define GET32BE(p) \
+	((u_int32_t)(p)[0] << 24 | (u_int32_t)(p)[1] << 16 | \
+	 (u_int32_t)(p)[2] << 8 | (u_int32_t)(p)[3])
 
 static void
-byteSwap(u_int32_t *buf, unsigned words)
+hash_init(hash_t *ctx, const struct hashalg *hash)
 {
-	unsigned char *p = (unsigned char *)buf;
+	hash_resume(ctx, hash, (u_int32_t *)hash->iv, 0);
+}
 
-	do {
-		*buf++ = (u_int32_t)((unsigned)p[3] << 8 | p[2]) << 16 |
-			((unsigned)p[1] << 8 | p[0]);
-		p += 4;
-	} while (--words);
+/* start from a state reached after some whole blocks */
+static void
+hash_resume(hash_t *ctx, const struct hashalg *hash, u_int32_t *state,
+    u_int64_t bytes)
+{
+	ctx->hash = hash;
+	memcpy(ctx->state, state, hash->words * sizeof(u_int32_t));
+	ctx->bytes = bytes;
 }
 
-/*
- * Start MD5 accumulation.  Set bit count to 0 and buffer to mysterious
- * initialization constants.
- */
 static void
-md5_init(md5_t *ctx)
+hash_update(hash_t *ctx, const unsigned char *buf, size_t len)
 {
-	ctx->buf[0] = 0x67452301;
-	ctx->buf[1] = 0xefcdab89;
-	ctx->buf[2] = 0x98badcfe;
-	ctx->buf[3] = 0x10325476;
+	size_t used = ctx->bytes % HASH_BLOCKLEN, n;
+
+	ctx->bytes += len;
+
+	/* fill up the partial block first */
+	if (used > 0) {
+		n = HASH_BLOCKLEN - used;
+		if (len < n) {
+			memcpy(ctx->in + used, buf, len);
+			return;
+		}
+		memcpy(ctx->in + used, buf, n);
+		(*ctx->hash->blocks)(ctx->state, ctx->in, 1);
+		buf += n;
+		len -= n;
+	}
+
+	/* whole blocks are digested in place, without a copy */
+	if ((n = len / HASH_BLOCKLEN) > 0) {
+		(*ctx->hash->blocks)(ctx->state, buf, n);
+		buf += n * HASH_BLOCKLEN;
+		len -= n * HASH_BLOCKLEN;
+	}
 
-	ctx->bytes[0] = 0;
-	ctx->bytes[1] = 0;
+	memcpy(ctx->in, buf, len);
 }
 
+/*
+ * Final wrapup - pad to 64-byte boundary with the bit pattern
+ * 1 0* (64-bit count of bits processed)
+ */
 static void
-md5_invalidate(md5_t *ctx)
+hash_final(hash_t *ctx, unsigned char *digest)
 {
-	memset(ctx, 0, sizeof(md5_t));
+	const struct hashalg *hash = ctx->hash;
+	size_t used = ctx->bytes % HASH_BLOCKLEN;
+	u_int64_t bits = ctx->bytes << 3;
+	u_int32_t w;
+	int i;
+
+	/* Set the first char of padding to 0x80.  There is always room. */
+	ctx->in[used++] = 0x80;
+
+	if (used > HASH_BLOCKLEN - 8) {	/* Padding forces an extra block */
+		memset(ctx->in + used, 0, HASH_BLOCKLEN - used);
+		(*hash->blocks)(ctx->state, ctx->in, 1);
+		used = 0;
+	}
+	memset(ctx->in + used, 0, HASH_BLOCKLEN - 8 - used);
+
+	/* Append length in bits and transform */
+	for (i = 0; i < 8; i++) {
+		ctx->in[hash->bigendian ? HASH_BLOCKLEN - 1 - i :
+		    HASH_BLOCKLEN - 8 + i] = (bits >> (i * 8)) & 0xff;
+	}
+	(*hash->blocks)(ctx->state, ctx->in, 1);
+
+	for (i = 0; i < hash->digestlen / 4; i++) {
+		w = ctx->state[i];
+		if (hash->bigendian) {
+			digest[i * 4] = w >> 24;
+			digest[i * 4 + 1] = w >> 16;
+			digest[i * 4 + 2] = w >> 8;
+			digest[i * 4 + 3] = w;
+		} else {
+			digest[i * 4] = w;
+			digest[i * 4 + 1] = w >> 8;
+			digest[i * 4 + 2] = w >> 16;
+			digest[i * 4 + 3] = w >> 24;
+		}
+	}
+	memset(ctx, 0, sizeof(*ctx));	/* In case it's sensitive */
 }
 
+/*
+ * This code implements the MD5 message-digest algorithm.
+ * The algorithm is due to Ron Rivest.  The core steps were
+ * written by Colin Plumb in 1993, no copyright is claimed.
+ * This code is in the public domain; do with it what you wish.
+ */
+
 /* The four core functions - F1 is optimized somewhat */
 
 /* #define F1(x, y, z) (x & y | ~x & z) */
@@ -332,166 +471,303 @@ md5_invalidate(md5_t *ctx)
 #define MD5STEP(f,w,x,y,z,in,s) \
 	 (w += f(x,y,z) + in, w = (w<<s | w>>(32-s)) + x)
 
+/*
+ * F2 is the sum of two terms with no carries between them, and the one
+ * not involving x can be added before x is known.
+ */
+#define MD5STEP2(w,x,y,z,in,s) \
+	 (w += (y & ~z) + in, w += x & z, w = (w<<s | w>>(32-s)) + x)
+
+/*
+ * The words of the block being digested.  They are loaded from the data
+ * as they are needed, which compilers turn into plain loads on
+ * little-endian machines; no aligned, byte-swapped copy is made.
+ */
+#define X(i) GET32LE(p + (i) * 4)
+
 /*
  * The core of the MD5 algorithm, this alters an existing MD5 hash to
- * reflect the addition of 16 longwords of new data.  MD5Update blocks
- * the data and converts bytes into longwords for this routine.
+ * reflect the addition of n blocks of 16 longwords of new data.
  */
 static void
-transform(u_int32_t buf[4], u_int32_t const in[16]) {
+md5_blocks(u_int32_t *buf, const unsigned char *p, size_t n)
+{
 	register u_int32_t a, b, c, d;
 
-	a = buf[0];
-	b = buf[1];
-	c = buf[2];
-	d = buf[3];
-
-	MD5STEP(F1, a, b, c, d, in[0] + 0xd76aa478, 7);
-	MD5STEP(F1, d, a, b, c, in[1] + 0xe8c7b756, 12);
-	MD5STEP(F1, c, d, a, b, in[2] + 0x242070db, 17);
-	MD5STEP(F1, b, c, d, a, in[3] + 0xc1bdceee, 22);
-	MD5STEP(F1, a, b, c, d, in[4] + 0xf57c0faf, 7);
-	MD5STEP(F1, d, a, b, c, in[5] + 0x4787c62a, 12);
-	MD5STEP(F1, c, d, a, b, in[6] + 0xa8304613, 17);
-	MD5STEP(F1, b, c, d, a, in[7] + 0xfd469501, 22);
-	MD5STEP(F1, a, b, c, d, in[8] + 0x698098d8, 7);
-	MD5STEP(F1, d, a, b, c, in[9] + 0x8b44f7af, 12);
-	MD5STEP(F1, c, d, a, b, in[10] + 0xffff5bb1, 17);
-	MD5STEP(F1, b, c, d, a, in[11] + 0x895cd7be, 22);
-	MD5STEP(F1, a, b, c, d, in[12] + 0x6b901122, 7);
-	MD5STEP(F1, d, a, b, c, in[13] + 0xfd987193, 12);
-	MD5STEP(F1, c, d, a, b, in[14] + 0xa679438e, 17);
-	MD5STEP(F1, b, c, d, a, in[15] + 0x49b40821, 22);
-
-	MD5STEP(F2, a, b, c, d, in[1] + 0xf61e2562, 5);
-	MD5STEP(F2, d, a, b, c, in[6] + 0xc040b340, 9);
-	MD5STEP(F2, c, d, a, b, in[11] + 0x265e5a51, 14);
-	MD5STEP(F2, b, c, d, a, in[0] + 0xe9b6c7aa, 20);
-	MD5STEP(F2, a, b, c, d, in[5] + 0xd62f105d, 5);
-	MD5STEP(F2, d, a, b, c, in[10] + 0x02441453, 9);
-	MD5STEP(F2, c, d, a, b, in[15] + 0xd8a1e681, 14);
-	MD5STEP(F2, b, c, d, a, in[4] + 0xe7d3fbc8, 20);
-	MD5STEP(F2, a, b, c, d, in[9] + 0x21e1cde6, 5);
-	MD5STEP(F2, d, a, b, c, in[14] + 0xc33707d6, 9);
-	MD5STEP(F2, c, d, a, b, in[3] + 0xf4d50d87, 14);
-	MD5STEP(F2, b, c, d, a, in[8] + 0x455a14ed, 20);
-	MD5STEP(F2, a, b, c, d, in[13] + 0xa9e3e905, 5);
-	MD5STEP(F2, d, a, b, c, in[2] + 0xfcefa3f8, 9);
-	MD5STEP(F2, c, d, a, b, in[7] + 0x676f02d9, 14);
-	MD5STEP(F2, b, c, d, a, in[12] + 0x8d2a4c8a, 20);
-
-	MD5STEP(F3, a, b, c, d, in[5] + 0xfffa3942, 4);
-	MD5STEP(F3, d, a, b, c, in[8] + 0x8771f681, 11);
-	MD5STEP(F3, c, d, a, b, in[11] + 0x6d9d6122, 16);
-	MD5STEP(F3, b, c, d, a, in[14] + 0xfde5380c, 23);
-	MD5STEP(F3, a, b, c, d, in[1] + 0xa4beea44, 4);
-	MD5STEP(F3, d, a, b, c, in[4] + 0x4bdecfa9, 11);
-	MD5STEP(F3, c, d, a, b, in[7] + 0xf6bb4b60, 16);
-	MD5STEP(F3, b, c, d, a, in[10] + 0xbebfbc70, 23);
-	MD5STEP(F3, a, b, c, d, in[13] + 0x289b7ec6, 4);
-	MD5STEP(F3, d, a, b, c, in[0] + 0xeaa127fa, 11);
-	MD5STEP(F3, c, d, a, b, in[3] + 0xd4ef3085, 16);
-	MD5STEP(F3, b, c, d, a, in[6] + 0x04881d05, 23);
-	MD5STEP(F3, a, b, c, d, in[9] + 0xd9d4d039, 4);
-	MD5STEP(F3, d, a, b, c, in[12] + 0xe6db99e5, 11);
-	MD5STEP(F3, c, d, a, b, in[15] + 0x1fa27cf8, 16);
-	MD5STEP(F3, b, c, d, a, in[2] + 0xc4ac5665, 23);
-
-	MD5STEP(F4, a, b, c, d, in[0] + 0xf4292244, 6);
-	MD5STEP(F4, d, a, b, c, in[7] + 0x432aff97, 10);
-	MD5STEP(F4, c, d, a, b, in[14] + 0xab9423a7, 15);
-	MD5STEP(F4, b, c, d, a, in[5] + 0xfc93a039, 21);
-	MD5STEP(F4, a, b, c, d, in[12] + 0x655b59c3, 6);
-	MD5STEP(F4, d, a, b, c, in[3] + 0x8f0ccc92, 10);
-	MD5STEP(F4, c, d, a, b, in[10] + 0xffeff47d, 15);
-	MD5STEP(F4, b, c, d, a, in[1] + 0x85845dd1, 21);
-	MD5STEP(F4, a, b, c, d, in[8] + 0x6fa87e4f, 6);
-	MD5STEP(F4, d, a, b, c, in[15] + 0xfe2ce6e0, 10);
-	MD5STEP(F4, c, d, a, b, in[6] + 0xa3014314, 15);
-	MD5STEP(F4, b, c, d, a, in[13] + 0x4e0811a1, 21);
-	MD5STEP(F4, a, b, c, d, in[4] + 0xf7537e82, 6);
-	MD5STEP(F4, d, a, b, c, in[11] + 0xbd3af235, 10);
-	MD5STEP(F4, c, d, a, b, in[2] + 0x2ad7d2bb, 15);
-	MD5STEP(F4, b, c, d, a, in[9] + 0xeb86d391, 21);
-
-	buf[0] += a;
-	buf[1] += b;
-	buf[2] += c;
-	buf[3] += d;
+	for (; n > 0; n--, p += HASH_BLOCKLEN) {
+		a = buf[0];
+		b = buf[1];
+		c = buf[2];
+		d = buf[3];
+
+		MD5STEP(F1, a, b, c, d, X(0) + 0xd76aa478, 7);
+		MD5STEP(F1, d, a, b, c, X(1) + 0xe8c7b756, 12);
+		MD5STEP(F1, c, d, a, b, X(2) + 0x242070db, 17);
+		MD5STEP(F1, b, c, d, a, X(3) + 0xc1bdceee, 22);
+		MD5STEP(F1, a, b, c, d, X(4) + 0xf57c0faf, 7);
+		MD5STEP(F1, d, a, b, c, X(5) + 0x4787c62a, 12);
+		MD5STEP(F1, c, d, a, b, X(6) + 0xa8304613, 17);
+		MD5STEP(F1, b, c, d, a, X(7) + 0xfd469501, 22);
+		MD5STEP(F1, a, b, c, d, X(8) + 0x698098d8, 7);
+		MD5STEP(F1, d, a, b, c, X(9) + 0x8b44f7af, 12);
+		MD5STEP(F1, c, d, a, b, X(10) + 0xffff5bb1, 17);
+		MD5STEP(F1, b, c, d, a, X(11) + 0x895cd7be, 22);
+		MD5STEP(F1, a, b, c, d, X(12) + 0x6b901122, 7);
+		MD5STEP(F1, d, a, b, c, X(13) + 0xfd987193, 12);
+		MD5STEP(F1, c, d, a, b, X(14) + 0xa679438e, 17);
+		MD5STEP(F1, b, c, d, a, X(15) + 0x49b40821, 22);
+
+		MD5STEP2(a, b, c, d, X(1) + 0xf61e2562, 5);
+		MD5STEP2(d, a, b, c, X(6) + 0xc040b340, 9);
+		MD5STEP2(c, d, a, b, X(11) + 0x265e5a51, 14);
+		MD5STEP2(b, c, d, a, X(0) + 0xe9b6c7aa, 20);
+		MD5STEP2(a, b, c, d, X(5) + 0xd62f105d, 5);
+		MD5STEP2(d, a, b, c, X(10) + 0x02441453, 9);
+		MD5STEP2(c, d, a, b, X(15) + 0xd8a1e681, 14);
+		MD5STEP2(b, c, d, a, X(4) + 0xe7d3fbc8, 20);
+		MD5STEP2(a, b, c, d, X(9) + 0x21e1cde6, 5);
+		MD5STEP2(d, a, b, c, X(14) + 0xc33707d6, 9);
+		MD5STEP2(c, d, a, b, X(3) + 0xf4d50d87, 14);
+		MD5STEP2(b, c, d, a, X(8) + 0x455a14ed, 20);
+		MD5STEP2(a, b, c, d, X(13) + 0xa9e3e905, 5);
+		MD5STEP2(d, a, b, c, X(2) + 0xfcefa3f8, 9);
+		MD5STEP2(c, d, a, b, X(7) + 0x676f02d9, 14);
+		MD5STEP2(b, c, d, a, X(12) + 0x8d2a4c8a, 20);
+
+		MD5STEP(F3, a, b, c, d, X(5) + 0xfffa3942, 4);
+		MD5STEP(F3, d, a, b, c, X(8) + 0x8771f681, 11);
+		MD5STEP(F3, c, d, a, b, X(11) + 0x6d9d6122, 16);
+		MD5STEP(F3, b, c, d, a, X(14) + 0xfde5380c, 23);
+		MD5STEP(F3, a, b, c, d, X(1) + 0xa4beea44, 4);
+		MD5STEP(F3, d, a, b, c, X(4) + 0x4bdecfa9, 11);
+		MD5STEP(F3, c, d, a, b, X(7) + 0xf6bb4b60, 16);
+		MD5STEP(F3, b, c, d, a, X(10) + 0xbebfbc70, 23);
+		MD5STEP(F3, a, b, c, d, X(13) + 0x289b7ec6, 4);
+		MD5STEP(F3, d, a, b, c, X(0) + 0xeaa127fa, 11);
+		MD5STEP(F3, c, d, a, b, X(3) + 0xd4ef3085, 16);
+		MD5STEP(F3, b, c, d, a, X(6) + 0x04881d05, 23);
+		MD5STEP(F3, a, b, c, d, X(9) + 0xd9d4d039, 4);
+		MD5STEP(F3, d, a, b, c, X(12) + 0xe6db99e5, 11);
+		MD5STEP(F3, c, d, a, b, X(15) + 0x1fa27cf8, 16);
+		MD5STEP(F3, b, c, d, a, X(2) + 0xc4ac5665, 23);
+
+		MD5STEP(F4, a, b, c, d, X(0) + 0xf4292244, 6);
+		MD5STEP(F4, d, a, b, c, X(7) + 0x432aff97, 10);
+		MD5STEP(F4, c, d, a, b, X(14) + 0xab9423a7, 15);
+		MD5STEP(F4, b, c, d, a, X(5) + 0xfc93a039, 21);
+		MD5STEP(F4, a, b, c, d, X(12) + 0x655b59c3, 6);
+		MD5STEP(F4, d, a, b, c, X(3) + 0x8f0ccc92, 10);
+		MD5STEP(F4, c, d, a, b, X(10) + 0xffeff47d, 15);
+		MD5STEP(F4, b, c, d, a, X(1) + 0x85845dd1, 21);
+		MD5STEP(F4, a, b, c, d, X(8) + 0x6fa87e4f, 6);
+		MD5STEP(F4, d, a, b, c, X(15) + 0xfe2ce6e0, 10);
+		MD5STEP(F4, c, d, a, b, X(6) + 0xa3014314, 15);
+		MD5STEP(F4, b, c, d, a, X(13) + 0x4e0811a1, 21);
+		MD5STEP(F4, a, b, c, d, X(4) + 0xf7537e82, 6);
+		MD5STEP(F4, d, a, b, c, X(11) + 0xbd3af235, 10);
+		MD5STEP(F4, c, d, a, b, X(2) + 0x2ad7d2bb, 15);
+		MD5STEP(F4, b, c, d, a, X(9) + 0xeb86d391, 21);
+
+		buf[0] += a;
+		buf[1] += b;
+		buf[2] += c;
+		buf[3] += d;
+	}
 }
 
+#undef X
+
 /*
- * Update context to reflect the concatenation of another buffer full
- * of bytes.
+ * This code implements the SHA-256 secure hash algorithm described in
+ * FIPS 180-4.
  */
+static const u_int32_t sha256_k[64] = {
+	0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5,
+	0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+	0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+	0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+	0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc,
+	0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+	0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7,
+	0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+	0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+	0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+	0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3,
+	0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+	0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5,
+	0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+	0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+	0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+#define ROTR(x, n)	((x) >> (n) | (x) << (32 - (n)))
+#define SHA_CH(x, y, z)	((z) ^ ((x) & ((y) ^ (z))))
+#define SHA_MAJ(x, y, z) (((x) & (y)) | ((z) & ((x) | (y))))
+#define SHA_S0(x)	(ROTR(x, 2) ^ ROTR(x, 13) ^ ROTR(x, 22))
+#define SHA_S1(x)	(ROTR(x, 6) ^ ROTR(x, 11) ^ ROTR(x, 25))
+#define SHA_s0(x)	(ROTR(x, 7) ^ ROTR(x, 18) ^ (x) >> 3)
+#define SHA_s1(x)	(ROTR(x, 17) ^ ROTR(x, 19) ^ (x) >> 10)
+
 static void
-md5_update(md5_t *ctx, const unsigned char *buf, unsigned int len)
+sha256_blocks(u_int32_t *state, const unsigned char *p, size_t n)
 {
-	u_int32_t t;
-
-	/* Update byte count */
+	if (sha256_engine == NULL) {
+		sha256_engine = sha256_blocks_generic;
+#ifdef HAVE_SHA_NI
+		if (sha256_have_shani())
+			sha256_engine = sha256_blocks_shani;
+#endif
+	}
 
-	t = ctx->bytes[0];
-	if ((ctx->bytes[0] = t + len) < t)
-		ctx->bytes[1]++;	/* Carry from low to high */
+	(*sha256_engine)(state, p, n);
+}
 
-	t = 64 - (t & 0x3f);	/* Space available in ctx->in (at least 1) */
-	if (t > len) {
-		memcpy((unsigned char *)ctx->in + 64 - t, buf, len);
-		return;
+/*
+ * Run SHA-256 on the portable code, or with shani on the SHA extensions,
+ * rather than the best this CPU has; for dhcp6bench to compare them.
+ * Returns -1 if the extensions are not available.
+ */
+int
+dhcp6_sha256_engine(shani)
+	int shani;
+{
+	if (!shani) {
+		sha256_engine = sha256_blocks_generic;
+		return (0);
+	}
+#ifdef HAVE_SHA_NI
+	if (sha256_have_shani()) {
+		sha256_engine = sha256_blocks_shani;
+		return (0);
 	}
-	/* First chunk is an odd size */
-	memcpy((unsigned char *)ctx->in + 64 - t, buf, t);
-	byteSwap(ctx->in, 16);
-	transform(ctx->buf, ctx->in);
-	buf += t;
-	len -= t;
-
-	/* Process data in 64-byte chunks */
-	while (len >= 64) {
-		memcpy(ctx->in, buf, 64);
-		byteSwap(ctx->in, 16);
-		transform(ctx->buf, ctx->in);
-		buf += 64;
-		len -= 64;
+#endif
+
+	return (-1);
+}
+
+static void
+sha256_blocks_generic(u_int32_t *state, const unsigned char *p, size_t n)
+{
+	u_int32_t w[16], a, b, c, d, e, f, g, h, t1, t2;
+	int i;
+
+	for (; n > 0; n--, p += HASH_BLOCKLEN) {
+		a = state[0];
+		b = state[1];
+		c = state[2];
+		d = state[3];
+		e = state[4];
+		f = state[5];
+		g = state[6];
+		h = state[7];
+
+		/* the schedule is kept in a ring of the last 16 words */
+		for (i = 0; i < 64; i++) {
+			if (i < 16)
+				w[i] = GET32BE(p + i * 4);
+			else {
+				w[i & 15] += SHA_s1(w[(i - 2) & 15]) +
+				    w[(i - 7) & 15] + SHA_s0(w[(i - 15) & 15]);
+			}
+			t1 = h + SHA_S1(e) + SHA_CH(e, f, g) + sha256_k[i] +
+			    w[i & 15];
+			t2 = SHA_S0(a) + SHA_MAJ(a, b, c);
+			h = g;
+			g = f;
+			f = e;
+			e = d + t1;
+			d = c;
+			c = b;
+			b = a;
+			a = t1 + t2;
+		}
+
+		state[0] += a;
+		state[1] += b;
+		state[2] += c;
+		state[3] += d;
+		state[4] += e;
+		state[5] += f;
+		state[6] += g;
+		state[7] += h;
 	}
+}
 
-	/* Handle any remaining bytes of data. */
-	memcpy(ctx->in, buf, len);
+#ifdef HAVE_SHA_NI
+#ifndef bit_SHA
+#define bit_SHA		(1 << 29)
+#endif
+
+static int
+sha256_have_shani()
+{
+	unsigned int eax, ebx, ecx, edx;
+
+	if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx) ||
+	    !(ecx & bit_SSSE3) || !(ecx & bit_SSE4_1))
+		return (0);
+	if (__get_cpuid_max(0, NULL) < 7)
+		return (0);
+	__cpuid_count(7, 0, eax, ebx, ecx, edx);
+
+	return ((ebx & bit_SHA) != 0);
 }
 
 /*
- * Final wrapup - pad to 64-byte boundary with the bit pattern
- * 1 0* (64-bit count of bits processed, MSB-first)
+ * SHA-256 with the SHA extensions of x86.  The state is kept as the
+ * ABEF and CDGH halves sha256rnds2 works on; each instruction does two
+ * rounds, and the schedule is made four words at a time.
  */
+__attribute__((target("sha,ssse3,sse4.1")))
 static void
-md5_final(md5_t *ctx, unsigned char *digest)
+sha256_blocks_shani(u_int32_t *state, const unsigned char *p, size_t n)
 {
-	int count = ctx->bytes[0] & 0x3f;    /* Number of bytes in ctx->in */
-	unsigned char *p = (unsigned char *)ctx->in + count;
-
-	/* Set the first char of padding to 0x80.  There is always room. */
-	*p++ = 0x80;
-
-	/* Bytes of padding needed to make 56 bytes (-8..55) */
-	count = 56 - 1 - count;
+	const __m128i bswap = _mm_set_epi64x(0x0c0d0e0f08090a0bULL,
+	    0x0405060700010203ULL);
+	__m128i abef, cdgh, abef0, cdgh0, tmp, msg, w[4];
+	int i;
 
-	if (count < 0) {	/* Padding forces an extra block */
-		memset(p, 0, count + 8);
-		byteSwap(ctx->in, 16);
-		transform(ctx->buf, ctx->in);
-		p = (unsigned char *)ctx->in;
-		count = 56;
+	tmp = _mm_loadu_si128((const __m128i *)&state[0]);	/* DCBA */
+	cdgh = _mm_loadu_si128((const __m128i *)&state[4]);	/* HGFE */
+	tmp = _mm_shuffle_epi32(tmp, 0xb1);			/* CDAB */
+	cdgh = _mm_shuffle_epi32(cdgh, 0x1b);			/* EFGH */
+	abef = _mm_alignr_epi8(tmp, cdgh, 8);			/* ABEF */
+	cdgh = _mm_blend_epi16(cdgh, tmp, 0xf0);		/* CDGH */
+
+	for (; n > 0; n--, p += HASH_BLOCKLEN) {
+		abef0 = abef;
+		cdgh0 = cdgh;
+
+		for (i = 0; i < 4; i++) {
+			w[i] = _mm_shuffle_epi8(_mm_loadu_si128(
+			    (const __m128i *)(p + i * 16)), bswap);
+		}
+		for (i = 0; i < 16; i++) {
+			if (i >= 4) {
+				/* W[t-16] + s0(W[t-15]) + W[t-7] + s1(W[t-2]) */
+				tmp = _mm_sha256msg1_epu32(w[i & 3],
+				    w[(i - 3) & 3]);
+				tmp = _mm_add_epi32(tmp, _mm_alignr_epi8(
+				    w[(i - 1) & 3], w[(i - 2) & 3], 4));
+				w[i & 3] = _mm_sha256msg2_epu32(tmp,
+				    w[(i - 1) & 3]);
+			}
+			msg = _mm_add_epi32(w[i & 3],
+			    _mm_loadu_si128((const __m128i *)&sha256_k[i * 4]));
+			cdgh = _mm_sha256rnds2_epu32(cdgh, abef, msg);
+			msg = _mm_shuffle_epi32(msg, 0x0e);
+			abef = _mm_sha256rnds2_epu32(abef, cdgh, msg);
+		}
+
+		abef = _mm_add_epi32(abef, abef0);
+		cdgh = _mm_add_epi32(cdgh, cdgh0);
 	}
-	memset(p, 0, count);
-	byteSwap(ctx->in, 14);
-
-	/* Append length in bits and transform */
-	ctx->in[14] = ctx->bytes[0] << 3;
-	ctx->in[15] = ctx->bytes[1] << 3 | ctx->bytes[0] >> 29;
-	transform(ctx->buf, ctx->in);
 
-	byteSwap(ctx->buf, 4);
-	memcpy(digest, ctx->buf, 16);
-	memset(ctx, 0, sizeof(md5_t));	/* In case it's sensitive */
+	tmp = _mm_shuffle_epi32(abef, 0x1b);			/* FEBA */
+	cdgh = _mm_shuffle_epi32(cdgh, 0xb1);			/* DCHG */
+	abef = _mm_blend_epi16(tmp, cdgh, 0xf0);		/* DCBA */
+	cdgh = _mm_alignr_epi8(cdgh, tmp, 8);			/* HGFE */
+	_mm_storeu_si128((__m128i *)&state[0], abef);
+	_mm_storeu_si128((__m128i *)&state[4], cdgh);
 }
+#endif /* HAVE_SHA_NI */
@@ -38,6 +38,7 @@ typedef uint32_t u_int32_t;
 #endif
 
 #define MD5_DIGESTLENGTH 16
+#define SHA256_DIGESTLENGTH 32
 
 /* secret key information for delayed authentication */
 struct keyinfo {
@@ -51,6 +52,16 @@ struct keyinfo {
 	char *secret;		/* binary key */
 	size_t secretlen;	/* length of the key */
 	time_t expire;		/* expiration time (0 means forever) */
+
+	/*
+	 * Hash states past the inner and outer padded key, made at the
+	 * first use of the key with the algorithm hmac_alg.  A zeroed
+	 * keyinfo has none.  They are kept for one algorithm only, so a
+	 * key used with both has them remade at every switch.
+	 */
+	int hmac_alg;
+	u_int32_t hmac_istate[8];
+	u_int32_t hmac_ostate[8];
 };
 
 extern int dhcp6_validate_key __P((struct keyinfo *));
@@ -58,3 +69,4 @@ extern int dhcp6_calc_mac __P((char *, size_t, int, int, size_t,
     struct keyinfo *));
 extern int dhcp6_verify_mac __P((char *, ssize_t, int, int, size_t,
     struct keyinfo *));
+extern int dhcp6_sha256_engine __P((int));
@@ -115,9 +115,10 @@ static void cleanup_cflist __P((struct cf_list *));
 %token INFO_ONLY
 %token SCRIPT DELAYEDKEY
 %token AUTHENTICATION PROTOCOL ALGORITHM DELAYED RECONFIG HMACMD5 MONOCOUNTER
+%token HMACSHA256
 %token AUTHNAME RDM KEY
 %token KEYINFO REALM KEYID SECRET KEYNAME EXPIRE
-%token ADDRPOOL POOLNAME RANGE TO ADDRESS_POOL
+%token ADDRPOOL POOLNAME RANGE TO ADDRESS_POOL RANDOM_ALLOCATION
 %token INCLUDE
 
 %token NUMBER SLASH EOS BCL ECL STRING QSTRING PREFIX INFINITY
@@ -597,6 +598,14 @@ declaration:
 
 			MAKE_CFLIST(l, DECL_ADDRESSPOOL, $2, NULL);
 
+			$$ = l;
+		}
+	|	RANDOM_ALLOCATION EOS
+		{
+			struct cf_list *l;
+
+			MAKE_CFLIST(l, DECL_RANDOMALLOC, NULL, NULL);
+
 			$$ = l;
 		}
 	;
@@ -1134,6 +1143,7 @@ authproto:
 
 authalg:
 	HMACMD5 { $$ = DHCP6_AUTHALG_HMACMD5; }
+	|	HMACSHA256 { $$ = DHCP6_AUTHALG_HMACSHA256; }
 	;
 
 authrdm:
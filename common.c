@@ -85,24 +85,19 @@
 #include <config.h>
 #include <common.h>
 #include <timer.h>
-
-#ifdef __linux__
-/* from /usr/include/linux/ipv6.h */
-
-struct in6_ifreq {
-	struct in6_addr ifr6_addr;
-	u_int32_t ifr6_prefixlen;
-	unsigned int ifr6_ifindex;
-};
-#endif
+#include <rtnl.h>
 
 #define MAXDNAME 255
 
 int foreground;
-int debug_thresh;
+int debug_thresh = LOG_DEBUG;
+u_int32_t duidhash_seed;
+struct dhcp6_arena *dhcp6_arena;
 
 static int dhcp6_count_list __P((struct dhcp6_list *));
+#ifndef __linux__
 static int in6_matchflags __P((struct sockaddr *, char *, int));
+#endif
 static ssize_t dnsencode __P((const char *, char *, size_t));
 static char *dnsdecode __P((u_char **, u_char *, char *, size_t));
 static int copyout_option __P((char *, char *, struct dhcp6_listval *));
@@ -114,6 +109,81 @@ static ssize_t gethwid __P((char *, int, const char *, u_int16_t *));
 static char *sprint_uint64 __P((char *, int, u_int64_t));
 static char *sprint_auth __P((struct dhcp6_optinfo *));
 
+struct dhcp6_arena *
+dhcp6_arena_create(size)
+	size_t size;
+{
+	struct dhcp6_arena *arena;
+
+	if ((arena = malloc(sizeof(*arena))) == NULL) {
+		dprintf(LOG_ERR, FNAME, "memory allocation failed");
+		return (NULL);
+	}
+	memset(arena, 0, sizeof(*arena));
+	if ((arena->base = malloc(size)) == NULL) {
+		dprintf(LOG_ERR, FNAME, "memory allocation failed");
+		free(arena);
+		return (NULL);
+	}
+	arena->size = size;
+
+	return (arena);
+}
+
+void
+dhcp6_arena_reset(arena)
+	struct dhcp6_arena *arena;
+{
+	arena->used = 0;
+}
+
+/*
+ * Allocate memory from the current arena, if any.  When the arena is
+ * exhausted, fall back to malloc(); dhcp6_free() can tell the two apart.
+ */
+void *
+dhcp6_malloc(size)
+	size_t size;
+{
+	struct dhcp6_arena *arena = dhcp6_arena;
+	void *p;
+
+	if (arena == NULL)
+		return (malloc(size));
+
+	/*
+	 * Keep the same alignment as malloc() would for our structures.
+	 * Even an empty allocation takes room, so that dhcp6_free() never
+	 * sees an address past the end of the arena.
+	 */
+	if (size == 0)
+		size = 1;
+	size = (size + 15) & ~(size_t)15;
+	if (size > arena->size - arena->used) {
+		arena->overflows++;
+		return (malloc(size));
+	}
+	p = arena->base + arena->used;
+	arena->used += size;
+	arena->allocs++;
+
+	return (p);
+}
+
+/* Free memory from dhcp6_malloc().  Arena memory is only freed by reset. */
+void
+dhcp6_free(p)
+	void *p;
+{
+	struct dhcp6_arena *arena = dhcp6_arena;
+
+	if (arena != NULL && (char *)p >= arena->base &&
+	    (char *)p < arena->base + arena->size) {
+		return;
+	}
+	free(p);
+}
+
 int
 dhcp6_copy_list(dst, src)
 	struct dhcp6_list *dst, *src;
@@ -184,7 +254,7 @@ dhcp6_clear_listval(lv)
 	default:		/* nothing to do */
 		break;
 	}
-	free(lv);
+	dhcp6_free(lv);
 }
 
 /*
@@ -264,7 +334,7 @@ dhcp6_add_listval(head, type, val, sublist)
 {
 	struct dhcp6_listval *lv = NULL;
 
-	if ((lv = malloc(sizeof(*lv))) == NULL) {
+	if ((lv = dhcp6_malloc(sizeof(*lv))) == NULL) {
 		dprintf(LOG_ERR, FNAME,
 		    "failed to allocate memory for list entry");
 		goto fail;
@@ -312,7 +382,7 @@ dhcp6_add_listval(head, type, val, sublist)
 
   fail:
 	if (lv)
-		free(lv);
+		dhcp6_free(lv);
 
 	return (NULL);
 }
@@ -321,7 +391,7 @@ int
 dhcp6_vbuf_copy(dst, src)
 	struct dhcp6_vbuf *dst, *src;
 {
-	dst->dv_buf = malloc(src->dv_len);
+	dst->dv_buf = dhcp6_malloc(src->dv_len);
 	if (dst->dv_buf == NULL)
 		return (-1);
 
@@ -335,7 +405,7 @@ void
 dhcp6_vbuf_free(vbuf)
 	struct dhcp6_vbuf *vbuf;
 {
-	free(vbuf->dv_buf);
+	dhcp6_free(vbuf->dv_buf);
 
 	vbuf->dv_len = 0;
 	vbuf->dv_buf = NULL;
@@ -404,7 +474,7 @@ dhcp6_set_addr(type, list, p, optep, len)
 
 	tmpbuf = NULL;
 	optlen = dhcp6_count_list(list) * sizeof(struct in6_addr);
-	if ((tmpbuf = malloc(optlen)) == NULL) {
+	if ((tmpbuf = dhcp6_malloc(optlen)) == NULL) {
 		dprintf(LOG_ERR, FNAME,
 		    "memory allocation failed for %s options",
 		    dhcp6optstr(type));
@@ -414,11 +484,11 @@ dhcp6_set_addr(type, list, p, optep, len)
 	for (d = TAILQ_FIRST(list); d; d = TAILQ_NEXT(d, link), in6++)
 		memcpy(in6, &d->val_addr6, sizeof(*in6));
 	if (copy_option(type, optlen, tmpbuf, p, optep, len) != 0) {
-		free(tmpbuf);
+		dhcp6_free(tmpbuf);
 		return -1;
 	}
 
-	free(tmpbuf);
+	dhcp6_free(tmpbuf);
 	return 0;
 }
 
@@ -484,7 +554,7 @@ dhcp6_set_domain(type, list, p, optep, len)
 	}
 
 	tmpbuf = NULL;
-	if ((tmpbuf = malloc(optlen)) == NULL) {
+	if ((tmpbuf = dhcp6_malloc(optlen)) == NULL) {
 		dprintf(LOG_ERR, FNAME, "memory allocation failed for "
 		    "%s domain options", dhcp6optstr(type));
 		return -1;
@@ -500,24 +570,24 @@ dhcp6_set_domain(type, list, p, optep, len)
 			dprintf(LOG_ERR, FNAME,
 			    "failed to encode a %s domain name",
 			    dhcp6optstr(type));
-			free(tmpbuf);
+			dhcp6_free(tmpbuf);
 			return -1;
 		}
 		if (ep - cp < nlen) {
 			dprintf(LOG_ERR, FNAME,
 			    "buffer length for %s domain name is too short",
 			    dhcp6optstr(type));
-			free(tmpbuf);
+			dhcp6_free(tmpbuf);
 			return -1;
 		}
 		memcpy(cp, name, nlen);
 		cp += nlen;
 	}
 	if (copy_option(type, cp - tmpbuf, tmpbuf, p, optep, len) != 0) {
-		free(tmpbuf);
+		dhcp6_free(tmpbuf);
 		return -1;
 	}
-	free(tmpbuf);
+	dhcp6_free(tmpbuf);
 
 	return 0;
 }
@@ -683,6 +753,19 @@ getifaddr(addr, ifnam, prefix, plen, strong, ignoreflags)
 	int strong;		/* if strong host model is required or not */
 	int ignoreflags;
 {
+#ifdef __linux__
+	unsigned int ifindex;
+
+	/* IN6_IFF_INVALID is empty: no flags to be ignored */
+	if ((ifindex = rtnl_nametoindex(ifnam)) == 0)
+		return (-1);
+	/* any interface but the link's own is in another zone */
+	if (!strong && !IN6_IS_ADDR_LINKLOCAL(prefix) &&
+	    !IN6_IS_ADDR_MC_LINKLOCAL(prefix))
+		ifindex = 0;
+
+	return (rtnl_findaddr(ifindex, prefix, plen, 0, addr));
+#else
 	struct ifaddrs *ifap, *ifa;
 	struct sockaddr_in6 sin6;
 	int error = -1;
@@ -752,6 +835,7 @@ getifaddr(addr, ifnam, prefix, plen, strong, ignoreflags)
 
 	freeifaddrs(ifap);
 	return (error);
+#endif
 }
 
 int
@@ -759,6 +843,15 @@ getifidfromaddr(addr, ifidp)
 	struct in6_addr *addr;
 	unsigned int *ifidp;
 {
+#ifdef __linux__
+	unsigned int ifid;
+
+	if ((ifid = rtnl_addrtoindex(addr)) == 0)
+		return (-1);
+	*ifidp = ifid;
+
+	return (0);
+#else
 	struct ifaddrs *ifap, *ifa;
 	struct sockaddr_in6 *sa6;
 	unsigned int ifid;
@@ -792,6 +885,7 @@ getifidfromaddr(addr, ifidp)
   end:
 	freeifaddrs(ifap);
 	return (retval);
+#endif
 }
 
 int
@@ -955,6 +1049,7 @@ in6_scope(addr)
 	return (14);		/* global */
 }
 
+#ifndef __linux__
 static int
 in6_matchflags(addr, ifnam, flags)
 	struct sockaddr *addr;
@@ -987,6 +1082,7 @@ in6_matchflags(addr, ifnam, flags)
 	return (0);
 #endif
 }
+#endif
 
 int
 get_duid(idfile, duid)
@@ -1349,7 +1445,7 @@ dhcp6_clear_options(optinfo)
 	switch (optinfo->authproto) {
 	case DHCP6_AUTHPROTO_DELAYED:
 		if (optinfo->delayedauth_realmval != NULL) {
-			free(optinfo->delayedauth_realmval);
+			dhcp6_free(optinfo->delayedauth_realmval);
 		}
 		break;
 	}
@@ -1375,10 +1471,10 @@ dhcp6_clear_options(optinfo)
 	dhcp6_clear_list(&optinfo->bcmcsname_list);
 
 	if (optinfo->relaymsg_msg != NULL)
-		free(optinfo->relaymsg_msg);
+		dhcp6_free(optinfo->relaymsg_msg);
 
 	if (optinfo->ifidopt_id != NULL)
-		free(optinfo->ifidopt_id);
+		dhcp6_free(optinfo->ifidopt_id);
 
 	dhcp6_init_options(optinfo);
 }
@@ -1425,12 +1521,14 @@ dhcp6_copy_options(dst, src)
 		goto fail;
 	if (dhcp6_copy_list(&dst->bcmcsname_list, &src->bcmcsname_list))
 		goto fail;
+	dst->optblob = src->optblob;
 	dst->elapsed_time = src->elapsed_time;
 	dst->refreshtime = src->refreshtime;
 	dst->pref = src->pref;
 
 	if (src->relaymsg_msg != NULL) {
-		if ((dst->relaymsg_msg = malloc(src->relaymsg_len)) == NULL)
+		dst->relaymsg_msg = dhcp6_malloc(src->relaymsg_len);
+		if (dst->relaymsg_msg == NULL)
 			goto fail;
 		dst->relaymsg_len = src->relaymsg_len;
 		memcpy(dst->relaymsg_msg, src->relaymsg_msg,
@@ -1438,7 +1536,8 @@ dhcp6_copy_options(dst, src)
 	}
 
 	if (src->ifidopt_id != NULL) {
-		if ((dst->ifidopt_id = malloc(src->ifidopt_len)) == NULL)
+		dst->ifidopt_id = dhcp6_malloc(src->ifidopt_len);
+		if (dst->ifidopt_id == NULL)
 			goto fail;
 		dst->ifidopt_len = src->ifidopt_len;
 		memcpy(dst->ifidopt_id, src->ifidopt_id, src->ifidopt_len);
@@ -1457,7 +1556,7 @@ dhcp6_copy_options(dst, src)
 		dst->delayedauth_realmlen = src->delayedauth_realmlen;
 		if (src->delayedauth_realmval != NULL) {
 			if ((dst->delayedauth_realmval =
-			    malloc(src->delayedauth_realmlen)) == NULL) {
+			    dhcp6_malloc(src->delayedauth_realmlen)) == NULL) {
 				goto fail;
 			}
 			memcpy(dst->delayedauth_realmval,
@@ -1495,7 +1594,7 @@ dhcp6_get_options(p, ep, optinfo)
 	struct dhcp6opt_ia optia;
 	struct dhcp6_ia ia;
 	struct dhcp6_list sublist;
-	int authinfolen;
+	int authinfolen, maclen;
 
 	bp = (char *)p;
 	for (; p + 1 <= ep; p = np) {
@@ -1622,7 +1721,8 @@ dhcp6_get_options(p, ep, optinfo)
 				optinfo->elapsed_time = val16;
 			break;
 		case DH6OPT_RELAY_MSG:
-			if ((optinfo->relaymsg_msg = malloc(optlen)) == NULL)
+			optinfo->relaymsg_msg = dhcp6_malloc(optlen);
+			if (optinfo->relaymsg_msg == NULL)
 				goto fail;
 			memcpy(optinfo->relaymsg_msg, cp, optlen);
 			optinfo->relaymsg_len = optlen;
@@ -1660,15 +1760,17 @@ dhcp6_get_options(p, ep, optinfo)
 					break;
 				}
 				/* XXX: should we reject an empty realm? */
+				maclen = DHCP6_AUTHALG_MACLEN(
+				    optinfo->authalgorithm);
 				if (authinfolen <
-				    sizeof(optinfo->delayedauth_keyid) + 16) {
+				    sizeof(optinfo->delayedauth_keyid) + maclen) {
 					goto malformed;
 				}
 
 				optinfo->delayedauth_realmlen = authinfolen -
-				    (sizeof(optinfo->delayedauth_keyid) + 16);
+				    (sizeof(optinfo->delayedauth_keyid) + maclen);
 				optinfo->delayedauth_realmval =
-				    malloc(optinfo->delayedauth_realmlen);
+				    dhcp6_malloc(optinfo->delayedauth_realmlen);
 				if (optinfo->delayedauth_realmval == NULL) {
 					dprintf(LOG_WARNING, FNAME, "failed "
 					    "allocate memory for auth realm");
@@ -1685,7 +1787,7 @@ dhcp6_get_options(p, ep, optinfo)
 				cp += sizeof(optinfo->delayedauth_keyid);
 
 				optinfo->delayedauth_offset = cp - bp;
-				cp += 16;
+				cp += maclen;
 
 				dprintf(LOG_DEBUG, "", "  auth key ID: %x, "
 				    "offset=%d, realmlen=%d",
@@ -1710,7 +1812,8 @@ dhcp6_get_options(p, ep, optinfo)
 			optinfo->rapidcommit = 1;
 			break;
 		case DH6OPT_INTERFACE_ID:
-			if ((optinfo->ifidopt_id = malloc(optlen)) == NULL)
+			optinfo->ifidopt_id = dhcp6_malloc(optlen);
+			if (optinfo->ifidopt_id == NULL)
 				goto fail;
 			memcpy(optinfo->ifidopt_id, cp, optlen);
 			optinfo->ifidopt_len = optlen;
@@ -2187,6 +2290,9 @@ sprint_auth(optinfo)
 	case DHCP6_AUTHALG_HMACMD5:
 		alg = "HMAC-MD5";
 		break;
+	case DHCP6_AUTHALG_HMACSHA256:
+		alg = "HMAC-SHA256";
+		break;
 	default:
 		snprintf(alg0, sizeof(alg0), "unknown(%d)",
 		    optinfo->authalgorithm & 0xff);
@@ -2238,6 +2344,54 @@ copy_option(type, len, val, optp, ep, totallenp)
 	return (0);
 }
 
+/*
+ * Encapsulate the message of *lenp bytes at *msgp into a Relay-forward or
+ * Relay-reply message in place.  The relay header and the Relay Message
+ * option header are written in the DHCP6_RELAY_HEADROOM bytes just before
+ * the message, and the Interface-ID option, if any, just after it, so the
+ * caller must have reserved that much room around the message.  This
+ * produces the same message as dhcp6_set_options() with relaymsg and
+ * ifidopt, without copying the relayed message.  On return, *msgp and
+ * *lenp describe the relay message.
+ */
+void
+dhcp6_encap_relay(msgp, lenp, type, hcnt, linkaddr, peeraddr, ifid, ifidlen)
+	char **msgp;
+	int *lenp;
+	int type, hcnt;
+	struct in6_addr *linkaddr, *peeraddr;
+	void *ifid;
+	int ifidlen;
+{
+	struct dhcp6_relay dh6relay;
+	struct dhcp6opt opth;
+	char *msg = *msgp;
+	int len = *lenp;
+
+	if (ifid != NULL) {
+		opth.dh6opt_type = htons(DH6OPT_INTERFACE_ID);
+		opth.dh6opt_len = htons(ifidlen);
+		memcpy(msg + len, &opth, sizeof(opth));
+		memcpy(msg + len + sizeof(opth), ifid, ifidlen);
+	}
+
+	opth.dh6opt_type = htons(DH6OPT_RELAY_MSG);
+	opth.dh6opt_len = htons(len);
+	memcpy(msg - sizeof(opth), &opth, sizeof(opth));
+
+	memset(&dh6relay, 0, sizeof(dh6relay));
+	dh6relay.dh6relay_msgtype = type;
+	dh6relay.dh6relay_hcnt = hcnt;
+	if (linkaddr != NULL)
+		dh6relay.dh6relay_linkaddr = *linkaddr;
+	dh6relay.dh6relay_peeraddr = *peeraddr;
+	memcpy(msg - DHCP6_RELAY_HEADROOM, &dh6relay, sizeof(dh6relay));
+
+	*msgp = msg - DHCP6_RELAY_HEADROOM;
+	*lenp = DHCP6_RELAY_HEADROOM + len +
+	    (ifid != NULL ? sizeof(opth) + ifidlen : 0);
+}
+
 int
 dhcp6_set_options(type, optbp, optep, optinfo)
 	int type;
@@ -2277,7 +2431,7 @@ dhcp6_set_options(type, optbp, optep, optinfo)
 			dprintf(LOG_INFO, FNAME, "short buffer");
 			goto fail;
 		}
-		if ((tmpbuf = malloc(optlen)) == NULL) {
+		if ((tmpbuf = dhcp6_malloc(optlen)) == NULL) {
 			dprintf(LOG_NOTICE, FNAME,
 			    "memory allocation failed for IA_NA options");
 			goto fail;
@@ -2288,7 +2442,7 @@ dhcp6_set_options(type, optbp, optep, optinfo)
 			goto fail;
 		}
 		memcpy(p, tmpbuf, optlen);
-		free(tmpbuf);
+		dhcp6_free(tmpbuf);
 		tmpbuf = NULL;
 		p = (struct dhcp6opt *)((char *)p + optlen);
 		len += optlen;
@@ -2339,7 +2493,7 @@ dhcp6_set_options(type, optbp, optep, optinfo)
 		tmpbuf = NULL;
 		buflen = dhcp6_count_list(&optinfo->reqopt_list) *
 			sizeof(u_int16_t);
-		if ((tmpbuf = malloc(buflen)) == NULL) {
+		if ((tmpbuf = dhcp6_malloc(buflen)) == NULL) {
 			dprintf(LOG_ERR, FNAME,
 			    "memory allocation failed for options");
 			goto fail;
@@ -2369,10 +2523,21 @@ dhcp6_set_options(type, optbp, optep, optinfo)
 		    optep, &len) != 0) {
 			goto fail;
 		}
-		free(tmpbuf);
+		dhcp6_free(tmpbuf);
 		tmpbuf = NULL;
 	}
 
+	if (optinfo->optblob != NULL) {
+		optlen = optinfo->optblob->dv_len;
+		if ((void *)optep - (void *)p < optlen) {
+			dprintf(LOG_INFO, FNAME, "short buffer");
+			goto fail;
+		}
+		memcpy(p, optinfo->optblob->dv_buf, optlen);
+		p = (struct dhcp6opt *)((char *)p + optlen);
+		len += optlen;
+	}
+
 	if (dhcp6_set_domain(DH6OPT_SIP_SERVER_D, &optinfo->sipname_list,
 	    &p, optep, &len) != 0)
 		goto fail;
@@ -2431,7 +2596,7 @@ dhcp6_set_options(type, optbp, optep, optinfo)
 			dprintf(LOG_INFO, FNAME, "short buffer");
 			goto fail;
 		}
-		if ((tmpbuf = malloc(optlen)) == NULL) {
+		if ((tmpbuf = dhcp6_malloc(optlen)) == NULL) {
 			dprintf(LOG_NOTICE, FNAME,
 			    "memory allocation failed for IA_PD options");
 			goto fail;
@@ -2442,7 +2607,7 @@ dhcp6_set_options(type, optbp, optep, optinfo)
 			goto fail;
 		}
 		memcpy(p, tmpbuf, optlen);
-		free(tmpbuf);
+		dhcp6_free(tmpbuf);
 		tmpbuf = NULL;
 		p = (struct dhcp6opt *)((char *)p + optlen);
 		len += optlen;
@@ -2481,9 +2646,10 @@ dhcp6_set_options(type, optbp, optep, optinfo)
 		if (!(optinfo->authflags & DHCP6OPT_AUTHFLAG_NOINFO)) {
 			switch (optinfo->authproto) {
 			case DHCP6_AUTHPROTO_DELAYED:
-				/* Realm + key ID + HMAC-MD5 */
+				/* Realm + key ID + HMAC */
 				authlen += optinfo->delayedauth_realmlen +
-				    sizeof(optinfo->delayedauth_keyid) + 16;
+				    sizeof(optinfo->delayedauth_keyid) +
+				    DHCP6_AUTHALG_MACLEN(optinfo->authalgorithm);
 				break;
 #ifdef notyet
 			case DHCP6_AUTHPROTO_RECONFIG:
@@ -2497,7 +2663,7 @@ dhcp6_set_options(type, optbp, optep, optinfo)
 				goto fail;
 			}
 		}
-		if ((auth = malloc(authlen)) == NULL) {
+		if ((auth = dhcp6_malloc(authlen)) == NULL) {
 			dprintf(LOG_WARNING, FNAME, "failed to allocate "
 			    "memory for authentication information");
 			goto fail;
@@ -2532,7 +2698,8 @@ dhcp6_set_options(type, optbp, optep, optinfo)
 				 * calculate the HMAC.
 				 */
 				optinfo->delayedauth_offset =
-				    ((char *)p - (char *)optbp) + authlen - 16;
+				    ((char *)p - (char *)optbp) + authlen -
+				    DHCP6_AUTHALG_MACLEN(optinfo->authalgorithm);
 
 				dprintf(LOG_DEBUG, FNAME,
 				    "key ID %x, offset %d",
@@ -2545,7 +2712,7 @@ dhcp6_set_options(type, optbp, optep, optinfo)
 			default:
 				dprintf(LOG_ERR, FNAME,
 				    "unexpected authentication protocol");
-				free(auth);
+				dhcp6_free(auth);
 				goto fail;
 			}
 		}
@@ -2554,14 +2721,14 @@ dhcp6_set_options(type, optbp, optep, optinfo)
 		    &auth->dh6_auth_proto, &p, optep, &len) != 0) {
 			goto fail;
 		}
-		free(auth);
+		dhcp6_free(auth);
 	}
 
 	return (len);
 
   fail:
 	if (tmpbuf)
-		free(tmpbuf);
+		dhcp6_free(tmpbuf);
 	return (-1);
 }
 #undef COPY_OPTION
@@ -2880,7 +3047,7 @@ duidcpy(dd, ds)
 	struct duid *dd, *ds;
 {
 	dd->duid_len = ds->duid_len;
-	if ((dd->duid_id = malloc(dd->duid_len)) == NULL) {
+	if ((dd->duid_id = dhcp6_malloc(dd->duid_len)) == NULL) {
 		dprintf(LOG_ERR, FNAME, "memory allocation failed");
 		return (-1);
 	}
@@ -2904,11 +3071,83 @@ duidfree(duid)
 	struct duid *duid;
 {
 	if (duid->duid_id)
-		free(duid->duid_id);
+		dhcp6_free(duid->duid_id);
 	duid->duid_id = NULL;
 	duid->duid_len = 0;
 }
 
+/*
+ * A general purpose hash function for lookup tables (MurmurHash3, x86_32).
+ * The seed allows callers to combine several fields into one hash value.
+ */
+u_int32_t
+dhcp6_hash(key, len, seed)
+	const void *key;
+	size_t len;
+	u_int32_t seed;
+{
+	const u_int8_t *p = key;
+	u_int32_t h = seed, k;
+	size_t i;
+
+#define ROTL32(x, r) (((x) << (r)) | ((x) >> (32 - (r))))
+	for (i = 0; i + 4 <= len; i += 4) {
+		memcpy(&k, p + i, sizeof(k));
+		k *= 0xcc9e2d51;
+		k = ROTL32(k, 15);
+		k *= 0x1b873593;
+		h ^= k;
+		h = ROTL32(h, 13);
+		h = h * 5 + 0xe6546b64;
+	}
+
+	k = 0;
+	switch (len & 3) {
+	case 3:
+		k ^= p[i + 2] << 16;
+		/* FALLTHROUGH */
+	case 2:
+		k ^= p[i + 1] << 8;
+		/* FALLTHROUGH */
+	case 1:
+		k ^= p[i];
+		k *= 0xcc9e2d51;
+		k = ROTL32(k, 15);
+		k *= 0x1b873593;
+		h ^= k;
+	}
+#undef ROTL32
+
+	h ^= (u_int32_t)len;
+	h ^= h >> 16;
+	h *= 0x85ebca6b;
+	h ^= h >> 13;
+	h *= 0xc2b2ae35;
+	h ^= h >> 16;
+
+	return (h);
+}
+
+/*
+ * duidhash() is the same in every process and across restarts, for
+ * assigning clients to workers and journals.  Lookup tables use
+ * duidhash_local() instead: its seed, set at startup, keeps clients
+ * from choosing DUIDs that collide.
+ */
+u_int32_t
+duidhash(duid)
+	struct duid *duid;
+{
+	return (dhcp6_hash(duid->duid_id, duid->duid_len, 0));
+}
+
+u_int32_t
+duidhash_local(duid)
+	struct duid *duid;
+{
+	return (dhcp6_hash(duid->duid_id, duid->duid_len, duidhash_seed));
+}
+
 /*
  * Provide an NTP-format timestamp as a replay detection counter
  * as mentioned in RFC3315.
@@ -3182,62 +3421,286 @@ void
 setloglevel(debuglevel)
 	int debuglevel;
 {
-	if (foreground) {
-		switch(debuglevel) {
-		case 0:
-			debug_thresh = LOG_ERR;
-			break;
-		case 1:
-			debug_thresh = LOG_INFO;
-			break;
-		default:
-			debug_thresh = LOG_DEBUG;
-			break;
-		}
-	} else {
-		switch(debuglevel) {
-		case 0:
-			setlogmask(LOG_UPTO(LOG_ERR));
-			break;
-		case 1:
-			setlogmask(LOG_UPTO(LOG_INFO));
-			break;
-		}
+	/*
+	 * debug_thresh is checked by the dprintf() macro before the
+	 * arguments are evaluated, so it applies to syslog, too.
+	 */
+	switch(debuglevel) {
+	case 0:
+		debug_thresh = LOG_ERR;
+		break;
+	case 1:
+		debug_thresh = LOG_INFO;
+		break;
+	default:
+		debug_thresh = LOG_DEBUG;
+		break;
 	}
+	if (!foreground)
+		setlogmask(LOG_UPTO(debug_thresh));
+}
+
+/*
+ * Deferred logging: when enabled by setlogbuffer(), messages are
+ * formatted straight into a flat buffer and written out by flushlog(),
+ * which the daemons call once per event loop round, i.e., after a batch
+ * of packets has been answered.  The buffer is flushed in place only
+ * when it runs out of room, so nothing is lost.
+ */
+struct logrec {
+	int level;
+	time_t when;
+	const char *fname;
+	size_t len;		/* of the message text following this */
+};
+#define LOGREC_ALIGN(n) (((n) + sizeof(void *) - 1) & ~(sizeof(void *) - 1))
+
+static char *logbuf, *stderrbuf;
+static size_t logbuf_size, logbuf_used;
+
+/*
+ * Rate limiting: each call site, identified by its format string, may
+ * log LOGRATE_BURST messages per second at levels more severe than
+ * LOG_DEBUG.  The rest are counted and reported once the second is over:
+ * by the next message from the same site, or by a timer if the site has
+ * gone quiet, and at exit at the latest.
+ */
+#define LOGRATE_SLOTS	64
+#define LOGRATE_BURST	10
+static struct lograte {
+	const char *fmt;
+	const char *fname;
+	int level;
+	time_t sec;
+	int count;
+	int suppressed;
+} lograte[LOGRATE_SLOTS];
+
+static struct dhcp6_timer *lograte_timer;
+static int lograte_timer_armed;
+
+static void logout __P((int, time_t, const char *, const char *));
+static int lograte_check __P((int, const char *, const char *, time_t));
+static void lograte_report __P((struct lograte *));
+static void lograte_arm __P((void));
+static struct dhcp6_timer *lograte_timo __P((void *));
+static void lograte_exit __P((void));
+
+int
+setlogbuffer(size)
+	size_t size;
+{
+	if (logbuf != NULL)
+		return (0);
+	if (size < LOGREC_ALIGN(sizeof(struct logrec)) + LINE_MAX)
+		size = LOGREC_ALIGN(sizeof(struct logrec)) + LINE_MAX;
+	if ((logbuf = malloc(size)) == NULL) {
+		dprintf(LOG_ERR, FNAME, "memory allocation failed");
+		return (-1);
+	}
+	logbuf_size = size;
+	logbuf_used = 0;
+
+	/*
+	 * We write out a whole buffer at a time.  stderr may have been used
+	 * unbuffered already, so give it a real buffer.
+	 */
+	if (foreground && (stderrbuf = malloc(BUFSIZ)) != NULL)
+		setvbuf(stderr, stderrbuf, _IOFBF, BUFSIZ);
+	atexit(flushlog);
+
+	return (0);
 }
 
 void
-dprintf(int level, const char *fname, const char *fmt, ...)
+flushlog()
 {
-	va_list ap;
-	char logbuf[LINE_MAX];
-	int printfname = 1;
+	size_t off;
+	struct logrec *rec;
+
+	for (off = 0; off < logbuf_used;
+	    off += LOGREC_ALIGN(sizeof(*rec)) + LOGREC_ALIGN(rec->len + 1)) {
+		rec = (struct logrec *)(logbuf + off);
+		logout(rec->level, rec->when, rec->fname,
+		    (char *)rec + LOGREC_ALIGN(sizeof(*rec)));
+	}
+	logbuf_used = 0;
+	if (foreground)
+		fflush(stderr);
+}
 
-	va_start(ap, fmt);
-	vsnprintf(logbuf, sizeof(logbuf), fmt, ap);
+static int
+lograte_check(level, fname, fmt, now)
+	int level;
+	const char *fname, *fmt;
+	time_t now;
+{
+	struct lograte *lr;
+
+	if (level >= LOG_DEBUG)
+		return (1);
+
+	lr = &lograte[((unsigned long)fmt >> 3) % LOGRATE_SLOTS];
+	if (lr->fmt != fmt || lr->sec != now) {
+		lograte_report(lr);
+		lr->fmt = fmt;
+		lr->fname = fname;
+		lr->level = level;
+		lr->sec = now;
+		lr->count = 0;
+	}
+	if (++lr->count <= LOGRATE_BURST)
+		return (1);
+	if (lr->suppressed++ == 0)
+		lograte_arm();
+	return (0);
+}
+
+static void
+lograte_report(lr)
+	struct lograte *lr;
+{
+	int suppressed = lr->suppressed;
+
+	if (suppressed == 0)
+		return;
+	lr->suppressed = 0;
+	dhcp6_dprintf(lr->level, lr->fname,
+	    "%d similar messages suppressed", suppressed);
+}
+
+/* make sure the counts are reported even if no message follows */
+static void
+lograte_arm()
+{
+	static int initialized;
+	struct timeval timo;
+
+	if (!initialized) {
+		initialized = 1;
+		atexit(lograte_exit);
+		lograte_timer = dhcp6_add_timer(lograte_timo, NULL);
+	}
+	if (lograte_timer == NULL || lograte_timer_armed)
+		return;
+
+	timo.tv_sec = 1;
+	timo.tv_usec = 0;
+	dhcp6_set_timer(&timo, lograte_timer);
+	lograte_timer_armed = 1;
+}
+
+static struct dhcp6_timer *
+lograte_timo(arg)
+	void *arg;
+{
+	struct lograte *lr;
+	time_t now = time(NULL);
+	int pending = 0;
+
+	lograte_timer_armed = 0;
+	for (lr = lograte; lr < lograte + LOGRATE_SLOTS; lr++) {
+		if (lr->sec != now)
+			lograte_report(lr);
+		else if (lr->suppressed)
+			pending = 1;
+	}
+	if (pending)
+		lograte_arm();
+
+	return (lograte_timer);
+}
+
+static void
+lograte_exit()
+{
+	struct lograte *lr;
+
+	for (lr = lograte; lr < lograte + LOGRATE_SLOTS; lr++)
+		lograte_report(lr);
+	/* flushlog() may have run already if it was registered first */
+	if (logbuf != NULL)
+		flushlog();
+}
 
-	if (*fname == '\0')
-		printfname = 0;
+static void
+logout(level, when, fname, msg)
+	int level;
+	time_t when;
+	const char *fname, *msg;
+{
+	int printfname = (*fname != '\0');
 
-	if (foreground && debug_thresh >= level) {
-		time_t now;
-		struct tm *tm_now;
+	if (foreground) {
+		static time_t tm_when = -1;
+		static struct tm tm_cache;
+		struct tm *tm_now = &tm_cache;
 		const char *month[] = {
 			"Jan", "Feb", "Mar", "Apr", "May", "Jun",
 			"Jul", "Aug", "Sep", "Oct", "Nov", "Dec",
 		};
 
-		if ((now = time(NULL)) < 0)
-			exit(1); /* XXX */
-		tm_now = localtime(&now);
+		/* most messages are made in the same second as the last one */
+		if (when != tm_when) {
+			localtime_r(&when, &tm_cache);
+			tm_when = when;
+		}
 		fprintf(stderr, "%3s/%02d/%04d %02d:%02d:%02d: %s%s%s\n",
 		    month[tm_now->tm_mon], tm_now->tm_mday,
 		    tm_now->tm_year + 1900,
 		    tm_now->tm_hour, tm_now->tm_min, tm_now->tm_sec,
-		    fname, printfname ? ": " : "",
-		    logbuf);
+		    fname, printfname ? ": " : "", msg);
 	} else
-		syslog(level, "%s%s%s", fname, printfname ? ": " : "", logbuf);
+		syslog(level, "%s%s%s", fname, printfname ? ": " : "", msg);
+}
+
+/*
+ * Don't call this directly: the dprintf() macro skips the call, and the
+ * evaluation of its arguments, for the levels disabled by setloglevel().
+ */
+void
+dhcp6_dprintf(int level, const char *fname, const char *fmt, ...)
+{
+	va_list ap;
+	char linebuf[LINE_MAX];
+	struct logrec *rec = NULL;
+	char *buf;
+	size_t len;
+	time_t now;
+	int n;
+
+	if ((now = time(NULL)) < 0)
+		exit(1); /* XXX */
+	if (!lograte_check(level, fname, fmt, now))
+		return;
+
+	if (logbuf == NULL) {
+		buf = linebuf;
+		len = sizeof(linebuf);
+	} else {
+		if (logbuf_size - logbuf_used <
+		    LOGREC_ALIGN(sizeof(*rec)) + LINE_MAX)
+			flushlog();
+		rec = (struct logrec *)(logbuf + logbuf_used);
+		buf = (char *)rec + LOGREC_ALIGN(sizeof(*rec));
+		len = LINE_MAX;
+	}
+
+	va_start(ap, fmt);
+	n = vsnprintf(buf, len, fmt, ap);
+	va_end(ap);
+
+	if (logbuf == NULL) {
+		logout(level, now, fname, buf);
+		return;
+	}
+
+	rec->level = level;
+	rec->when = now;
+	rec->fname = fname;
+	rec->len = (n < 0) ? 0 : ((size_t)n >= len ? len - 1 : (size_t)n);
+	buf[rec->len] = '\0';
+	logbuf_used += LOGREC_ALIGN(sizeof(*rec)) + LOGREC_ALIGN(rec->len + 1);
 }
 
 int
@@ -3249,13 +3712,14 @@ ifaddrconf(cmd, ifname, addr, plen, pltime, vltime)
 	int pltime;
 	int vltime;
 {
+#ifdef __linux__
+	/* queued to rtnl.c, which sends the requests of a round at once */
+	return (rtnl_ifaddr(cmd, ifname, &addr->sin6_addr, plen,
+	    (u_int32_t)pltime, (u_int32_t)vltime));
+#else
 #ifdef __KAME__
 	struct in6_aliasreq req;
 #endif
-#ifdef __linux__
-	struct in6_ifreq req;
-	struct ifreq ifr;
-#endif
 #ifdef __sun__
 	struct lifreq req;
 #endif
@@ -3269,9 +3733,6 @@ ifaddrconf(cmd, ifname, addr, plen, pltime, vltime)
 #ifdef __KAME__
 		ioctl_cmd = SIOCAIFADDR_IN6;
 #endif
-#ifdef __linux__
-		ioctl_cmd = SIOCSIFADDR;
-#endif
 #ifdef __sun__
 		ioctl_cmd = SIOCLIFADDIF;
 #endif
@@ -3281,9 +3742,6 @@ ifaddrconf(cmd, ifname, addr, plen, pltime, vltime)
 #ifdef __KAME__
 		ioctl_cmd = SIOCDIFADDR_IN6;
 #endif
-#ifdef __linux__
-		ioctl_cmd = SIOCDIFADDR;
-#endif
 #ifdef __sun__
 		ioctl_cmd = SIOCLIFREMOVEIF;
 #endif
@@ -3307,19 +3765,6 @@ ifaddrconf(cmd, ifname, addr, plen, pltime, vltime)
 	req.ifra_lifetime.ia6t_vltime = vltime;
 	req.ifra_lifetime.ia6t_pltime = pltime;
 #endif
-#ifdef __linux__
-	memset(&ifr, 0, sizeof(ifr));
-	strncpy(ifr.ifr_name, ifname, IFNAMSIZ - 1);
-	if (ioctl(s, SIOGIFINDEX, &ifr) < 0) {
-		dprintf(LOG_NOTICE, FNAME, "failed to get the index of %s: %s",
-		    ifname, strerror(errno));
-		close(s); 
-		return (-1); 
-	}
-	memcpy(&req.ifr6_addr, &addr->sin6_addr, sizeof(struct in6_addr));
-	req.ifr6_prefixlen = plen;
-	req.ifr6_ifindex = ifr.ifr_ifindex;
-#endif
 #ifdef __sun__
 	strncpy(req.lifr_name, ifname, sizeof (req.lifr_name));
 #endif
@@ -3346,6 +3791,7 @@ ifaddrconf(cmd, ifname, addr, plen, pltime, vltime)
 
 	close(s);
 	return (0);
+#endif
 }
 
 int
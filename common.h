@@ -119,13 +119,44 @@ sysdep_sa_len (const struct sockaddr *sa)
 
 extern int foreground;
 extern int debug_thresh;
+extern u_int32_t duidhash_seed;
 extern char *device;
 
+/* room for the headers prepended by dhcp6_encap_relay() */
+#define DHCP6_RELAY_HEADROOM \
+	(sizeof(struct dhcp6_relay) + sizeof(struct dhcp6opt))
+
+/*
+ * Allocation arena for data that lives no longer than one packet.
+ * While dhcp6_arena is set, the option and list routines below take
+ * their memory from it, and dhcp6_arena_reset() releases everything at
+ * once.  Data that outlives the packet must be allocated while
+ * dhcp6_arena is NULL.
+ */
+struct dhcp6_arena {
+	char *base;
+	size_t size;
+	size_t used;
+
+	u_int64_t allocs;	/* allocations served from the arena */
+	u_int64_t overflows;	/* allocations passed on to malloc() */
+};
+#define DHCP6_ARENA_SIZE	65536
+
+/* size of the deferred log buffer enabled by setlogbuffer() */
+#define DHCP6_LOGBUF_SIZE	65536
+
+extern struct dhcp6_arena *dhcp6_arena;
+
 /* search option for dhcp6_find_listval() */
 #define MATCHLIST_PREFIXLEN 0x1
 
 /* common.c */
 typedef enum { IFADDRCONF_ADD, IFADDRCONF_REMOVE } ifaddrconf_cmd_t;
+extern struct dhcp6_arena *dhcp6_arena_create __P((size_t));
+extern void dhcp6_arena_reset __P((struct dhcp6_arena *));
+extern void *dhcp6_malloc __P((size_t));
+extern void dhcp6_free __P((void *));
 extern int dhcp6_copy_list __P((struct dhcp6_list *, struct dhcp6_list *));
 extern void dhcp6_move_list __P((struct dhcp6_list *, struct dhcp6_list *));
 extern void dhcp6_clear_list __P((struct dhcp6_list *));
@@ -155,7 +186,14 @@ extern char *in6addr2str __P((struct in6_addr *, int));
 extern int in6_addrscopebyif __P((struct in6_addr *, char *));
 extern int in6_scope __P((struct in6_addr *));
 extern void setloglevel __P((int));
-extern void dprintf __P((int, const char *, const char *, ...));
+extern void dhcp6_dprintf __P((int, const char *, const char *, ...));
+/* check the level first, so that disabled messages cost no more than that */
+#define dprintf(level, fname, ...) do { \
+	if ((level) <= debug_thresh) \
+		dhcp6_dprintf((level), (fname), __VA_ARGS__); \
+} while (0)
+extern int setlogbuffer __P((size_t));
+extern void flushlog __P((void));
 extern int get_duid __P((char *, struct duid *));
 extern void dhcp6_init_options __P((struct dhcp6_optinfo *));
 extern void dhcp6_clear_options __P((struct dhcp6_optinfo *));
@@ -165,6 +203,9 @@ extern int dhcp6_get_options __P((struct dhcp6opt *, struct dhcp6opt *,
 				  struct dhcp6_optinfo *));
 extern int dhcp6_set_options __P((int, struct dhcp6opt *, struct dhcp6opt *,
 				  struct dhcp6_optinfo *));
+extern void dhcp6_encap_relay __P((char **, int *, int, int,
+				  struct in6_addr *, struct in6_addr *,
+				  void *, int));
 extern void dhcp6_set_timeoparam __P((struct dhcp6_event *));
 extern void dhcp6_reset_timer __P((struct dhcp6_event *));
 extern char *dhcp6optstr __P((int));
@@ -176,6 +217,9 @@ extern int get_rdvalue __P((int, void *, size_t));
 extern int duidcpy __P((struct duid *, struct duid *));
 extern int duidcmp __P((struct duid *, struct duid *));
 extern void duidfree __P((struct duid *));
+extern u_int32_t duidhash __P((struct duid *));
+extern u_int32_t duidhash_local __P((struct duid *));
+extern u_int32_t dhcp6_hash __P((const void *, size_t, u_int32_t));
 extern int ifaddrconf __P((ifaddrconf_cmd_t, char *, struct sockaddr_in6 *,
 			   int, int, int));
 extern int safefile __P((const char *));
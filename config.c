@@ -38,9 +38,6 @@
 #ifdef __KAME__
 #include <net/if_dl.h>
 #endif
-#ifdef __linux__
-#include <linux/if_packet.h>
-#endif
 
 #include <syslog.h>
 #include <stdlib.h>
@@ -59,10 +56,12 @@
 #include <auth.h>
 #include <base64.h>
 #include <lease.h>
+#include <rtnl.h>
 
 extern int errno;
 
 struct prefix_ifconf *prefix_ifconflist;
+struct pool_conf *pool_conflist;
 struct dhcp6_list siplist, sipnamelist, dnslist, dnsnamelist, ntplist;
 struct dhcp6_list nislist, nisnamelist;
 struct dhcp6_list nisplist, nispnamelist;
@@ -79,17 +78,67 @@ static struct dhcp6_list nislist0, nisnamelist0;
 static struct dhcp6_list nisplist0, nispnamelist0;
 static struct dhcp6_list bcmcslist0, bcmcsnamelist0;
 static long long optrefreshtime0 = -1;
+
+/*
+ * Hash index of host_conflist by DUID, rebuilt when the configuration is
+ * committed.  It doesn't change in between, so open addressing with
+ * linear probing and no deletion does.
+ */
+struct hostconf_slot {
+	u_int32_t hash;
+	struct host_conf *host;		/* NULL: empty */
+};
+static struct hostconf_slot *hostconf_index;
+static size_t hostconf_indexsize;	/* a power of 2, 0 without the index */
+
+/* the same for key_list by realm and key ID */
+struct keyinfo_slot {
+	u_int32_t hash;
+	struct keyinfo *key;		/* NULL: empty */
+};
+static struct keyinfo_slot *keyinfo_index;
+static size_t keyinfo_indexsize;	/* a power of 2, 0 without the index */
+
+/*
+ * Host configurations made for clients without one, in the order of the
+ * last use, and hashed by DUID.  Looking one up moves it to the head.
+ * The entries are carved from a slab allocated at the first use, and the
+ * one at the tail is reused once the slab has run out.  The slab comes
+ * from calloc(), so the pages of the entries not used yet cost no memory.
+ */
 #ifndef DHCP6_DYNAMIC_HOSTCONF_MAX
 #define DHCP6_DYNAMIC_HOSTCONF_MAX	1024
 #endif
+#define DHCP6_DYNAMIC_DUIDLEN	20	/* DUIDs not longer are kept inline */
 struct dynamic_hostconf {
 	TAILQ_ENTRY(dynamic_hostconf) link;
-	struct host_conf *host;
+	LIST_ENTRY(dynamic_hostconf) hlink;	/* hash chain */
+	u_int32_t hash;
+	struct host_conf host;
+	char duid[DHCP6_DYNAMIC_DUIDLEN];
 };
+LIST_HEAD(dynamic_hostconf_chain, dynamic_hostconf);
 static TAILQ_HEAD(dynamic_hostconf_listhead, dynamic_hostconf)
 	dynamic_hostconf_head;
-static unsigned int dynamic_hostconf_count;
-static struct pool_conf *pool_conflist, *pool_conflist0;
+static struct dynamic_hostconf_chain *dynamic_hostconf_hash;
+static size_t dynamic_hostconf_hashsize;	/* a power of 2 */
+static struct dynamic_hostconf *dynamic_hostconf_slab;
+static size_t dynamic_hostconf_max = DHCP6_DYNAMIC_HOSTCONF_MAX;
+static size_t dynamic_hostconf_used;	/* entries taken from the slab */
+static size_t dynamic_hostconf_duidbytes;	/* DUIDs not kept inline */
+static struct dynamic_hostconf_stats dynamic_hostconf_stats;
+
+/*
+ * Names of the pools referred to by interfaces and hosts.  There are few
+ * of them and they are never freed, so the host configurations share
+ * them, even across reloads.
+ */
+struct poolname {
+	struct poolname *next;
+	char name[1];
+};
+static struct poolname *poolnames;
+static struct pool_conf *pool_conflist0;
 
 enum { DHCPOPTCODE_SEND, DHCPOPTCODE_REQUEST, DHCPOPTCODE_ALLOW };
 
@@ -139,10 +188,13 @@ static int configure_addr __P((struct cf_list *, struct dhcp6_list *, char *));
 static int configure_domain __P((struct cf_list *, struct dhcp6_list *, char *));
 static int get_default_ifid __P((struct prefix_ifconf *));
 static void clear_poolconf __P((struct pool_conf *));
-static struct pool_conf *create_pool __P((char *, struct dhcp6_range *));
+static struct pool_conf *create_pool __P((char *, struct dhcp6_range *, int));
 struct host_conf *find_dynamic_hostconf __P((struct duid *));
+static char *intern_poolname __P((char *));
+static void make_hostconf_index __P((void));
+static void make_keyinfo_index __P((void));
+static u_int32_t keyhash __P((char *, size_t, u_int32_t));
 static int in6_addr_cmp __P((struct in6_addr *, struct in6_addr *));
-static void in6_addr_inc __P((struct in6_addr *));
 
 int
 configure_interface(iflist)
@@ -288,11 +340,9 @@ configure_interface(iflist)
 						goto bad;
 					}
 					ifc->pool = *spec;
-					if ((ifc->pool.name = strdup(spec->name)) == NULL) {
-						dprintf(LOG_ERR, FNAME,
-							"memory allocation failed");
+					if ((ifc->pool.name =
+					    intern_poolname(spec->name)) == NULL)
 						goto bad;
-					}
 					dprintf(LOG_DEBUG, FNAME,
 						"pool '%s' is specified to the interface '%s'",
 						ifc->pool.name, ifc->ifname);
@@ -626,11 +676,9 @@ configure_host(hostlist)
 						goto bad;
 					}
 					hconf->pool = *spec;
-					if ((hconf->pool.name = strdup(spec->name)) == NULL) {
-						dprintf(LOG_ERR, FNAME,
-							"memory allocation failed");
+					if ((hconf->pool.name =
+					    intern_poolname(spec->name)) == NULL)
 						goto bad;
-					}
 					dprintf(LOG_DEBUG, FNAME,
 						"pool '%s' is specified to the host '%s'",
 						hconf->pool.name, hconf->name);
@@ -1184,19 +1232,47 @@ static int
 get_default_ifid(pif)
 	struct prefix_ifconf *pif;
 {
+#ifdef __linux__
+	u_char cp[RTNL_HWADDRLEN];
+	int hwlen;
+#else
 	struct ifaddrs *ifa, *ifap;
+#endif
 #ifdef __KAME__
 	struct sockaddr_dl *sdl;
 #endif
-#ifdef __linux__
-	struct sockaddr_ll *sll;
-#endif
 
 	if (pif->ifid_len < 64) {
 		dprintf(LOG_NOTICE, FNAME, "ID length too short");
 		return (-1);
 	}
 
+#ifdef __linux__
+	if ((hwlen = rtnl_gethwaddr(pif->ifname, cp, sizeof(cp),
+	    NULL)) < 0) {
+		dprintf(LOG_INFO, FNAME,
+		    "cannot find interface information for %s", pif->ifname);
+		return (-1);
+	}
+	if (hwlen < 6) {
+		dprintf(LOG_NOTICE, FNAME,
+		    "link layer address is too short (%s)", pif->ifname);
+		return (-1);
+	}
+
+	memset(pif->ifid, 0, sizeof(pif->ifid));
+	pif->ifid[8] = cp[0];
+	pif->ifid[8] ^= 0x02; /* reverse the u/l bit*/
+	pif->ifid[9] = cp[1];
+	pif->ifid[10] = cp[2];
+	pif->ifid[11] = 0xff;
+	pif->ifid[12] = 0xfe;
+	pif->ifid[13] = cp[3];
+	pif->ifid[14] = cp[4];
+	pif->ifid[15] = cp[5];
+
+	return (0);
+#else
 	if (getifaddrs(&ifap) < 0) {
 		dprintf(LOG_ERR, FNAME, "getifaddrs failed: %s",
 		    strerror(errno));
@@ -1226,21 +1302,6 @@ get_default_ifid(pif)
 
 		memset(pif->ifid, 0, sizeof(pif->ifid));
 		cp = (char *)(sdl->sdl_data + sdl->sdl_nlen);
-#endif
-#ifdef __linux__
-		if (ifa->ifa_addr->sa_family != AF_PACKET)
-			continue;
-
-		sll = (struct sockaddr_ll *)ifa->ifa_addr;
-		if (sll->sll_halen < 6) {
-			dprintf(LOG_NOTICE, FNAME,
-			    "link layer address is too short (%s)",
-			    pif->ifname);
-			goto fail;
-		}
-
-		memset(pif->ifid, 0, sizeof(pif->ifid));
-		cp = (char *)(sll->sll_addr);
 #endif
 		pif->ifid[8] = cp[0];
 		pif->ifid[8] ^= 0x02; /* reverse the u/l bit*/
@@ -1267,6 +1328,7 @@ get_default_ifid(pif)
   fail:
 	freeifaddrs(ifap);
 	return (-1);
+#endif
 }
 
 void
@@ -1344,7 +1406,6 @@ configure_commit()
 			ifp->authrdm = ifc->authinfo->rdm;
 		}
 		ifp->pool = ifc->pool;
-		ifc->pool.name = NULL;
 	}
 
 	clear_ifconf(dhcp6_ifconflist);
@@ -1361,11 +1422,13 @@ configure_commit()
 	clear_hostconf(host_conflist);
 	host_conflist = host_conflist0;
 	host_conflist0 = NULL;
+	make_hostconf_index();
 
 	/* commit secret key information */
 	clear_keys(key_list);
 	key_list = key_list0;
 	key_list0 = NULL;
+	make_keyinfo_index();
 
 	/* commit authentication information */
 	clear_authinfo(auth_list);
@@ -1441,8 +1504,6 @@ clear_ifconf(iflist)
 		if (ifc->scriptpath)
 			free(ifc->scriptpath);
 
-		if (ifc->pool.name)
-			free(ifc->pool.name);
 		free(ifc);
 	}
 }
@@ -1501,8 +1562,6 @@ clear_hostconf(hlist)
 		dhcp6_clear_list(&host->addr_list);
 		if (host->duid.duid_id)
 			free(host->duid.duid_id);
-		if (host->pool.name)
-			free(host->pool.name);
 		free(host);
 	}
 }
@@ -1818,16 +1877,74 @@ find_iaconf(head, type, iaid)
 	return (NULL);
 }
 
+/*
+ * Index host_conflist.  Without the index, find_hostconf() walks the
+ * list as it used to.
+ */
+static void
+make_hostconf_index()
+{
+	struct host_conf *host;
+	struct hostconf_slot *slot;
+	size_t n, size, i;
+	u_int32_t hash;
+
+	if (hostconf_index != NULL)
+		free(hostconf_index);
+	hostconf_index = NULL;
+	hostconf_indexsize = 0;
+
+	for (n = 0, host = host_conflist; host; host = host->next)
+		n++;
+	if (n == 0)
+		return;
+
+	/* keep the load factor at 1/2 or below */
+	for (size = 16; size < n * 2; size *= 2)
+		;
+	if ((hostconf_index = calloc(size, sizeof(*slot))) == NULL) {
+		dprintf(LOG_WARNING, FNAME,
+		    "failed to allocate the host index");
+		return;
+	}
+	hostconf_indexsize = size;
+
+	/* entries of the same DUID are probed in the order of the list */
+	for (host = host_conflist; host; host = host->next) {
+		hash = duidhash_local(&host->duid);
+		for (i = hash & (size - 1); hostconf_index[i].host != NULL;
+		    i = (i + 1) & (size - 1))
+			;
+		hostconf_index[i].hash = hash;
+		hostconf_index[i].host = host;
+	}
+}
+
 struct host_conf *
 find_hostconf(duid)
 	struct duid *duid;
 {
 	struct host_conf *host;
+	struct hostconf_slot *slot;
+	u_int32_t hash;
+	size_t i, mask;
 
 	if ((host = find_dynamic_hostconf(duid)) != NULL) {
 		return (host);
 	}
 
+	if (hostconf_indexsize > 0) {
+		hash = duidhash_local(duid);
+		mask = hostconf_indexsize - 1;
+		for (i = hash & mask; (slot = &hostconf_index[i])->host != NULL;
+		    i = (i + 1) & mask) {
+			if (slot->hash == hash &&
+			    duidcmp(&slot->host->duid, duid) == 0)
+				return (slot->host);
+		}
+		return (NULL);
+	}
+
 	for (host = host_conflist; host; host = host->next) {
 		if (host->duid.duid_len == duid->duid_len &&
 		    memcmp(host->duid.duid_id, duid->duid_id,
@@ -1870,6 +1987,54 @@ find_prefix6(list, prefix)
 	return (NULL);
 }
 
+static u_int32_t
+keyhash(realm, realmlen, id)
+	char *realm;
+	size_t realmlen;
+	u_int32_t id;
+{
+	return (dhcp6_hash(realm, realmlen, id));
+}
+
+static void
+make_keyinfo_index()
+{
+	struct keyinfo *key;
+	struct keyinfo_slot *slot;
+	size_t n, size, i;
+	u_int32_t hash;
+
+	if (keyinfo_index != NULL)
+		free(keyinfo_index);
+	keyinfo_index = NULL;
+	keyinfo_indexsize = 0;
+
+	for (n = 0, key = key_list; key; key = key->next)
+		n++;
+	if (n == 0)
+		return;
+
+	/* keep the load factor at 1/2 or below */
+	for (size = 16; size < n * 2; size *= 2)
+		;
+	if ((keyinfo_index = calloc(size, sizeof(*slot))) == NULL) {
+		dprintf(LOG_WARNING, FNAME,
+		    "failed to allocate the key index");
+		return;
+	}
+	keyinfo_indexsize = size;
+
+	/* keys of the same realm and ID are probed in the order of the list */
+	for (key = key_list; key; key = key->next) {
+		hash = keyhash(key->realm, key->realmlen, key->keyid);
+		for (i = hash & (size - 1); keyinfo_index[i].key != NULL;
+		    i = (i + 1) & (size - 1))
+			;
+		keyinfo_index[i].hash = hash;
+		keyinfo_index[i].key = key;
+	}
+}
+
 struct keyinfo *
 find_key(realm, realmlen, id)
 	char *realm;
@@ -1877,6 +2042,23 @@ find_key(realm, realmlen, id)
 	u_int32_t id;
 {
 	struct keyinfo *key;
+	struct keyinfo_slot *slot;
+	u_int32_t hash;
+	size_t i, mask;
+
+	if (keyinfo_indexsize > 0) {
+		hash = keyhash(realm, realmlen, id);
+		mask = keyinfo_indexsize - 1;
+		for (i = hash & mask; (slot = &keyinfo_index[i])->key != NULL;
+		    i = (i + 1) & mask) {
+			key = slot->key;
+			if (slot->hash == hash && key->realmlen == realmlen &&
+			    memcmp(key->realm, realm, realmlen) == 0 &&
+			    key->keyid == id)
+				return (key);
+		}
+		return (NULL);
+	}
 
 	for (key = key_list; key; key = key->next) {
 		if (key->realmlen == realmlen &&
@@ -1928,12 +2110,16 @@ configure_pool(poollist)
 		struct pool_conf *pool = NULL;
 		struct dhcp6_range *range = NULL;
 		struct cf_list *cfl;
+		int flags = 0;
 
 		for (cfl = plp->params; cfl; cfl = cfl->next) {
 			switch(cfl->type) {
 			case DECL_RANGE:
 				range = cfl->ptr;
 				break;
+			case DECL_RANDOMALLOC:
+				flags |= POOLF_RANDOM;
+				break;
 			default:
 				dprintf(LOG_ERR, FNAME, "%s:%d "
 					"invalid pool configuration",
@@ -1949,7 +2135,7 @@ configure_pool(poollist)
 				plp->name);
 			goto bad;
 		}
-		if ((pool = create_pool(plp->name, range)) == NULL) {
+		if ((pool = create_pool(plp->name, range, flags)) == NULL) {
 			dprintf(LOG_ERR, FNAME,
 				"faled to craete pool '%s'", plp->name);
 			goto bad;
@@ -1975,91 +2161,117 @@ clear_poolconf(plist)
 
 	for (pool = plist; pool; pool = pool_next) {
 		pool_next = pool->next;
+		lease_pool_destroy(pool->leases);
 		free(pool->name);
 		free(pool);
 	}
 }
 
+/*
+ * Set the number of host configurations to be made for clients without
+ * one.  It can't be changed once they have been made.
+ */
+int
+set_dynamic_hostconf_max(max)
+	size_t max;
+{
+	if (dynamic_hostconf_slab != NULL) {
+		dprintf(LOG_ERR, FNAME, "host configurations are already made");
+		return (-1);
+	}
+	if (max == 0) {
+		dprintf(LOG_ERR, FNAME, "invalid number of host configurations");
+		return (-1);
+	}
+	dynamic_hostconf_max = max;
+
+	return (0);
+}
+
 struct host_conf *
 create_dynamic_hostconf(duid, pool)
 	struct duid *duid;
 	struct dhcp6_poolspec *pool;
 {
-	struct dynamic_hostconf *dynconf = NULL;
+	struct dynamic_hostconf *dynconf;
 	struct host_conf *host;
-	char* strid = NULL;
-	static int init = 1;
-
-	if (init) {
+	char *id = NULL;
+
+	if (dynamic_hostconf_slab == NULL) {
+		size_t size;
+
+		for (size = 16; size < dynamic_hostconf_max; size *= 2)
+			;
+		/* calloc() leaves the hash chains empty */
+		if ((dynamic_hostconf_slab = calloc(dynamic_hostconf_max,
+		    sizeof(*dynamic_hostconf_slab))) == NULL ||
+		    (dynamic_hostconf_hash = calloc(size,
+		    sizeof(*dynamic_hostconf_hash))) == NULL) {
+			dprintf(LOG_ERR, FNAME, "memory allocation failed");
+			free(dynamic_hostconf_slab);
+			dynamic_hostconf_slab = NULL;
+			return (NULL);
+		}
+		dynamic_hostconf_hashsize = size;
 		TAILQ_INIT(&dynamic_hostconf_head);
-		dynamic_hostconf_count = 0;
-		init = 0;
+		dynamic_hostconf_used = 0;
 	}
 
-	if (dynamic_hostconf_count >= DHCP6_DYNAMIC_HOSTCONF_MAX) {
+	if (duid->duid_len > sizeof(dynconf->duid) &&
+	    (id = malloc(duid->duid_len)) == NULL) {
+		dprintf(LOG_ERR, FNAME, "memory allocation failed");
+		return (NULL);
+	}
+
+	if (dynamic_hostconf_used < dynamic_hostconf_max) {
+		dynconf = &dynamic_hostconf_slab[dynamic_hostconf_used++];
+	} else {
 		struct dynamic_hostconf_listhead *head = &dynamic_hostconf_head;
 
 		dprintf(LOG_DEBUG, FNAME, "reached to the max count (count=%lu)",
-			dynamic_hostconf_count);
-
-		/* Find the last entry that doesn't need authentication */
-		TAILQ_FOREACH_REVERSE(dynconf, head, dynamic_hostconf_listhead, link)
-			if (dynconf->host->delayedkey == NULL)
-				break;
-		if (dynconf == NULL)
-			dynconf = TAILQ_LAST(head, dynamic_hostconf_listhead);
+			(unsigned long)dynamic_hostconf_used);
+
+		/*
+		 * Reuse the least recently used entry.  They never need
+		 * authentication, as delayed keys are only configured for
+		 * static hosts.
+		 */
+		dynconf = TAILQ_LAST(head, dynamic_hostconf_listhead);
 		TAILQ_REMOVE(head, dynconf, link);
-		dynamic_hostconf_count--;
-		clear_hostconf(dynconf->host);
-	} else {
-		if ((dynconf = malloc(sizeof(*dynconf))) == NULL) {
-			dprintf(LOG_ERR, FNAME, "memory allocation failed");
-			return (NULL);
+		LIST_REMOVE(dynconf, hlink);
+		if (dynconf->host.duid.duid_id != dynconf->duid) {
+			dynamic_hostconf_duidbytes -=
+			    dynconf->host.duid.duid_len;
+			free(dynconf->host.duid.duid_id);
 		}
+		dynamic_hostconf_stats.evictions++;
 	}
-	memset(dynconf, 0, sizeof(*dynconf));
 
-	if ((host = malloc(sizeof(*host))) == NULL) {
-		dprintf(LOG_ERR, FNAME, "memory allocation failed");
-		goto bad;
-	}
+	/* they go by the DUID: see clientstr() of dhcp6s */
+	host = &dynconf->host;
 	memset(host, 0, sizeof(*host));
 	TAILQ_INIT(&host->prefix_list);
 	TAILQ_INIT(&host->addr_list);
-
-	if ((strid = duidstr(duid)) == NULL)
-		strid = "???";
-	if ((host->name = strdup(strid)) == NULL) {
-		dprintf(LOG_ERR, FNAME, "memory allocation failed");
-		goto bad;
-	}
-	if (duidcpy(&host->duid, duid) != 0) {
-		goto bad;
-	}
-	if (pool->name) {
-		if ((host->pool.name = strdup(pool->name)) == NULL) {
-			dprintf(LOG_ERR, FNAME, "memory allocation failed");
-			goto bad;
-		}
-	}
+	if (id != NULL)
+		dynamic_hostconf_duidbytes += duid->duid_len;
+	else
+		id = dynconf->duid;
+	memcpy(id, duid->duid_id, duid->duid_len);
+	host->duid.duid_id = id;
+	host->duid.duid_len = duid->duid_len;
+	host->pool.name = pool->name;	/* interned */
 	host->pool.pltime = pool->pltime;
 	host->pool.vltime = pool->vltime;
 
-	dynconf->host = host;
+	dynconf->hash = duidhash_local(duid);
 	TAILQ_INSERT_HEAD(&dynamic_hostconf_head, dynconf, link);
-	dynamic_hostconf_count++; 
+	LIST_INSERT_HEAD(&dynamic_hostconf_hash[dynconf->hash &
+	    (dynamic_hostconf_hashsize - 1)], dynconf, hlink);
+	dynamic_hostconf_stats.inserts++;
 
-	dprintf(LOG_DEBUG, FNAME, "created host_conf (name=%s)", host->name);
+	dprintf(LOG_DEBUG, FNAME, "created host_conf for %s", duidstr(duid));
 
 	return (host);
-
-bad:
-	if (host)
-		clear_hostconf(host);	/* host->next must be NULL */
-	if (dynconf)
-		free(dynconf);
-
-	return (NULL);
 }
 
 struct host_conf *
@@ -2067,11 +2279,16 @@ find_dynamic_hostconf(duid)
 	struct duid *duid;
 {
 	struct dynamic_hostconf *dynconf = NULL;
+	u_int32_t hash;
 
-	TAILQ_FOREACH(dynconf, &dynamic_hostconf_head, link) {
-		if (dynconf->host->duid.duid_len == duid->duid_len &&
-			memcmp(dynconf->host->duid.duid_id, duid->duid_id,
-			   duid->duid_len) == 0)
+	if (dynamic_hostconf_used == 0)
+		return (NULL);
+
+	hash = duidhash_local(duid);
+	LIST_FOREACH(dynconf, &dynamic_hostconf_hash[hash &
+	    (dynamic_hostconf_hashsize - 1)], hlink) {
+		if (dynconf->hash == hash &&
+		    duidcmp(&dynconf->host.duid, duid) == 0)
 			break;
 	}
 
@@ -2079,17 +2296,57 @@ find_dynamic_hostconf(duid)
 		/* relocation */
 		TAILQ_REMOVE(&dynamic_hostconf_head, dynconf, link);
 		TAILQ_INSERT_HEAD(&dynamic_hostconf_head, dynconf, link);
+		dynamic_hostconf_stats.hits++;
 
-		return (dynconf->host);
+		return (&dynconf->host);
 	}
 
 	return (NULL);
 }
 
+struct dynamic_hostconf_stats *
+get_dynamic_hostconf_stats()
+{
+	struct dynamic_hostconf_stats *st = &dynamic_hostconf_stats;
+
+	st->size = dynamic_hostconf_max;
+	st->entries = dynamic_hostconf_used;
+	st->bytes = dynamic_hostconf_used * sizeof(*dynamic_hostconf_slab) +
+	    dynamic_hostconf_hashsize * sizeof(*dynamic_hostconf_hash) +
+	    dynamic_hostconf_duidbytes;
+
+	return (st);
+}
+
+static char *
+intern_poolname(name)
+	char *name;
+{
+	struct poolname *pn;
+	size_t len;
+
+	for (pn = poolnames; pn; pn = pn->next) {
+		if (strcmp(pn->name, name) == 0)
+			return (pn->name);
+	}
+
+	len = strlen(name);
+	if ((pn = malloc(sizeof(*pn) + len)) == NULL) {
+		dprintf(LOG_ERR, FNAME, "memory allocation failed");
+		return (NULL);
+	}
+	memcpy(pn->name, name, len + 1);
+	pn->next = poolnames;
+	poolnames = pn;
+
+	return (pn->name);
+}
+
 struct pool_conf *
-create_pool(name, range)
+create_pool(name, range, flags)
 	char *name;
 	struct dhcp6_range *range;
+	int flags;
 {
 	struct pool_conf *pool = NULL;
 
@@ -2118,6 +2375,14 @@ create_pool(name, range)
 	}
 	pool->min = range->min;
 	pool->max = range->max;
+	pool->flags = flags;
+
+	if ((pool->leases = lease_pool_create(&pool->min, &pool->max,
+	    (flags & POOLF_RANDOM))) == NULL) {
+		free(pool->name);
+		free(pool);
+		return (NULL);
+	}
 
 	return (pool);
 }
@@ -2150,26 +2415,15 @@ get_free_address_from_pool(pool, addr)
 	struct pool_conf *pool;
 	struct in6_addr *addr;
 {
-	struct in6_addr cur;
 	if (!pool || !addr)
 		return (0);
 
 	dprintf(LOG_DEBUG, FNAME, "called (pool=%s)", pool->name);
 
-	for (cur = pool->min; in6_addr_cmp(&cur, &pool->max) <= 0;
-	    in6_addr_inc(&cur)) {
-		if (!is_leased(&cur) &&
-		    !IN6_IS_ADDR_MULTICAST(&cur) &&
-		    !IN6_IS_ADDR_LINKLOCAL(&cur) &&
-		    !IN6_IS_ADDR_SITELOCAL(&cur)) {
-			dprintf(LOG_DEBUG, FNAME, "found %s",
-				in6addr2str(&cur, 0));
-			*addr= cur;
-			return 1;
-		}
-
-		dprintf(LOG_DEBUG, FNAME, "next address %s",
-			in6addr2str(&cur, 0));
+	/* the free space map excludes leased and unusable addresses */
+	if (lease_pool_alloc(pool->leases, addr)) {
+		dprintf(LOG_DEBUG, FNAME, "found %s", in6addr2str(addr, 0));
+		return 1;
 	}
 
 	dprintf(LOG_NOTICE, FNAME, "no available address");
@@ -2219,15 +2473,3 @@ in6_addr_cmp(addr1, addr2)
 
 	return (0);
 }
-
-static void
-in6_addr_inc(addr)
-	struct in6_addr *addr;
-{
-	int i;
-
-	for (i = 15; i >= 0; i--) {
-		if (++(addr->s6_addr[i]) != 0x00)
-			break;
-	}
-}
@@ -51,6 +51,9 @@ struct pool_conf {
 
 	struct in6_addr min;
 	struct in6_addr max;
+	int flags;
+#define POOLF_RANDOM	0x1	/* randomized address allocation */
+	struct lease_pool *leases; /* free address space */
 };
 
 /* per-interface information */
@@ -229,6 +232,16 @@ struct host_conf {
 	u_int64_t previous_rd;
 };
 
+/* counters of the host configurations made for clients without one */
+struct dynamic_hostconf_stats {
+	u_int64_t size;		/* how many can be made */
+	u_int64_t entries;	/* how many have been made */
+	u_int64_t bytes;	/* memory taken by them */
+	u_int64_t inserts;
+	u_int64_t evictions;	/* reused for another client */
+	u_int64_t hits;
+};
+
 /* DHCPv6 authentication information */
 struct authinfo {
 	struct authinfo *next;
@@ -265,7 +278,7 @@ struct cf_list {
 enum { DECL_SEND, DECL_ALLOW, DECL_INFO_ONLY, DECL_REQUEST, DECL_DUID,
        DECL_PREFIX, DECL_PREFERENCE, DECL_SCRIPT, DECL_DELAYEDKEY,
        DECL_ADDRESS,
-       DECL_RANGE, DECL_ADDRESSPOOL,
+       DECL_RANGE, DECL_ADDRESSPOOL, DECL_RANDOMALLOC,
        IFPARAM_SLA_ID, IFPARAM_SLA_LEN,
        DHCPOPT_RAPID_COMMIT, DHCPOPT_AUTHINFO,
        DHCPOPT_DNS, DHCPOPT_DNSNAME,
@@ -288,6 +301,7 @@ extern const dhcp6_mode_t dhcp6_mode;
 extern struct dhcp6_if *dhcp6_if;
 extern struct dhcp6_ifconf *dhcp6_iflist;
 extern struct prefix_ifconf *prefix_ifconflist;
+extern struct pool_conf *pool_conflist;
 extern struct dhcp6_list siplist;
 extern struct dhcp6_list sipnamelist;
 extern struct dhcp6_list dnslist;
@@ -328,4 +342,6 @@ extern int get_free_address_from_pool __P((struct pool_conf *,
 	struct in6_addr *));
 struct host_conf *create_dynamic_hostconf __P((struct duid *,
 	struct dhcp6_poolspec *));
+extern int set_dynamic_hostconf_max __P((size_t));
+extern struct dynamic_hostconf_stats *get_dynamic_hostconf_stats __P((void));
 extern char *qstrdup __P((char *));
@@ -56,6 +56,7 @@ typedef uint32_t u_int32_t;
 #define DHCP6CTL_COMMAND_REMOVE 2
 #define DHCP6CTL_COMMAND_START 3
 #define DHCP6CTL_COMMAND_STOP 4
+#define DHCP6CTL_COMMAND_STATS 5
 
 /* control objects */
 #define DHCP6CTL_BINDING 1
@@ -197,6 +197,11 @@ struct dhcp6_optinfo {
 	struct dhcp6_list nispname_list; /* NIS+ domain list */
 	struct dhcp6_list bcmcs_list; /* BCMC server list */
 	struct dhcp6_list bcmcsname_list; /* BCMC domain list */
+	/*
+	 * Pre-encoded options, copied in place of the lists above.
+	 * The buffer is not owned by the structure.
+	 */
+	struct dhcp6_vbuf *optblob;
 
 	struct dhcp6_vbuf relay_msg; /* relay message */
 #define relaymsg_len relay_msg.dv_len
@@ -273,6 +278,7 @@ struct dhcp6_relay {
 #  define DH6OPT_AUTH_PROTO_DELAYED 2
 #  define DH6OPT_AUTH_RRECONFIGURE 3
 #  define DH6OPT_AUTH_ALG_HMACMD5 1
+#  define DH6OPT_AUTH_ALG_HMACSHA256 2	/* private: not assigned by IANA */
 #define DH6OPT_UNICAST 12
 #define DH6OPT_STATUS_CODE 13
 #  define DH6OPT_STCODE_SUCCESS 0
@@ -379,7 +385,11 @@ struct dhcp6opt_auth {
 
 enum { DHCP6_AUTHPROTO_UNDEF = -1, DHCP6_AUTHPROTO_DELAYED = 2,
        DHCP6_AUTHPROTO_RECONFIG = 3 };
-enum { DHCP6_AUTHALG_UNDEF = -1, DHCP6_AUTHALG_HMACMD5 = 1 };
+enum { DHCP6_AUTHALG_UNDEF = -1, DHCP6_AUTHALG_HMACMD5 = 1,
+       DHCP6_AUTHALG_HMACSHA256 = 2 };
+/* the length of the MAC in the authentication information, by algorithm */
+#define DHCP6_AUTHALG_MACLEN(alg) \
+	((alg) == DHCP6_AUTHALG_HMACSHA256 ? 32 : 16)
 enum { DHCP6_AUTHRDM_UNDEF = -1, DHCP6_AUTHRDM_MONOCOUNTER = 0 };
 
 #endif /*__DHCP6_H_DEFINED*/
@@ -60,12 +60,14 @@
 #include <base64.h>
 #include <control.h>
 #include <dhcp6_ctl.h>
+#include <evloop.h>
 
 TAILQ_HEAD(dhcp6_commandqueue, dhcp6_commandctx);
 
 static struct dhcp6_commandqueue commandqueue_head;
 static int max_commands;
 static int commands = 0;
+static struct dhcp6_commandctx *curcommand;	/* being executed */
 
 struct dhcp6_commandctx {
 	TAILQ_ENTRY(dhcp6_commandctx) link;
@@ -77,6 +79,8 @@ struct dhcp6_commandctx {
 	int (*callback) __P((char *, ssize_t));
 };
 
+static void dhcp6_ctl_readcommand __P((int, void *));
+
 int
 dhcp6_ctl_init(addr, port, max, sockp)
 	char *addr, *port;
@@ -252,6 +256,10 @@ dhcp6_ctl_acceptcommand(sl, callback)
 	new->s = s;
 	new->callback = callback;
 	new->input_len = sizeof(struct dhcp6ctl);
+	if (evloop_add(s, 0, dhcp6_ctl_readcommand, new) != 0) {
+		free(new);
+		goto fail;
+	}
 	TAILQ_INSERT_TAIL(&commandqueue_head, new, link);
 	commands++;
 
@@ -267,6 +275,7 @@ void
 dhcp6_ctl_closecommand(ctx)
 	struct dhcp6_commandctx *ctx;
 {
+	evloop_remove(ctx->s);
 	close(ctx->s);
 	free(ctx);
 
@@ -280,89 +289,92 @@ dhcp6_ctl_closecommand(ctx)
 	return;
 }
 
+/*
+ * Send a reply to the command being executed, before the connection is
+ * closed.  The reply is written without blocking, as the peer might not
+ * read it; it is sent only if the socket buffer takes all of it.
+ */
 int
-dhcp6_ctl_readcommand(read_fds)
-	fd_set *read_fds;
+dhcp6_ctl_reply(buf, len)
+	char *buf;
+	size_t len;
 {
-	struct dhcp6_commandctx *ctx, *ctx_next;
-	char *cp;
-	int cc, resid, result;
-	struct dhcp6ctl *ctlhead;
+	ssize_t cc;
 
-	for (ctx = TAILQ_FIRST(&commandqueue_head); ctx != NULL;
-	    ctx = ctx_next) {
-		ctx_next = TAILQ_NEXT(ctx, link);
-
-		if (FD_ISSET(ctx->s, read_fds)) {
-			cp = ctx->inputbuf + ctx->input_filled;
-			resid = ctx->input_len - ctx->input_filled;
-
-			cc = read(ctx->s, cp, resid);
-			if (cc < 0) {
-				dprintf(LOG_WARNING, FNAME, "read failed: %s",
-				    strerror(errno));
-				goto closecommand;
-			}
-			if (cc == 0) {
-				dprintf(LOG_INFO, FNAME,
-				    "control channel was reset by peer");
-				goto closecommand;
-			}
-
-			ctx->input_filled += cc;
-			if (ctx->input_filled < ctx->input_len)
-				continue; /* we need more data */
-			else if (ctx->input_filled == sizeof(*ctlhead)) { 
-				ctlhead = (struct dhcp6ctl *)ctx->inputbuf;
-				ctx->input_len += ntohs(ctlhead->len);
-			}
-
-			if (ctx->input_filled == ctx->input_len) {
-				/* we're done.  execute the command. */
-				result = (ctx->callback)(ctx->inputbuf,
-				    ctx->input_len);
-
-				switch (result) {
-				case DHCP6CTL_R_DONE:
-				case DHCP6CTL_R_FAILURE:
-					goto closecommand;
-				default:
-					break;
-				}
-			} else if (ctx->input_len > sizeof(ctx->inputbuf)) {
-				dprintf(LOG_INFO, FNAME,
-				    "too large command (%d bytes)",
-				    ctx->input_len);
-				goto closecommand;
-			}
-
-			continue;
-
-		  closecommand:
-			TAILQ_REMOVE(&commandqueue_head, ctx, link);
-			dhcp6_ctl_closecommand(ctx);
-		}
+	if (curcommand == NULL) {
+		dprintf(LOG_ERR, FNAME, "no command to reply to");
+		return (-1);
+	}
+
+	if ((cc = send(curcommand->s, buf, len, MSG_DONTWAIT)) < 0) {
+		dprintf(LOG_WARNING, FNAME, "failed to send a reply: %s",
+		    strerror(errno));
+		return (-1);
+	}
+	if (cc != len) {
+		dprintf(LOG_WARNING, FNAME, "reply was truncated "
+		    "(%d of %d bytes)", (int)cc, (int)len);
+		return (-1);
 	}
 
 	return (0);
 }
 
-int
-dhcp6_ctl_setreadfds(read_fds, maxfdp)
-	fd_set *read_fds;
-	int *maxfdp;
+static void
+dhcp6_ctl_readcommand(s, arg)
+	int s;
+	void *arg;
 {
-	int maxfd = *maxfdp;
-	struct dhcp6_commandctx *ctx;
+	struct dhcp6_commandctx *ctx = arg;
+	char *cp;
+	int cc, resid, result;
+	struct dhcp6ctl *ctlhead;
+
+	cp = ctx->inputbuf + ctx->input_filled;
+	resid = ctx->input_len - ctx->input_filled;
+
+	cc = read(ctx->s, cp, resid);
+	if (cc < 0) {
+		dprintf(LOG_WARNING, FNAME, "read failed: %s",
+		    strerror(errno));
+		goto closecommand;
+	}
+	if (cc == 0) {
+		dprintf(LOG_INFO, FNAME,
+		    "control channel was reset by peer");
+		goto closecommand;
+	}
+
+	ctx->input_filled += cc;
+	if (ctx->input_filled < ctx->input_len)
+		return;	/* we need more data */
+	else if (ctx->input_filled == sizeof(*ctlhead)) { 
+		ctlhead = (struct dhcp6ctl *)ctx->inputbuf;
+		ctx->input_len += ntohs(ctlhead->len);
+	}
 
-	for (ctx = TAILQ_FIRST(&commandqueue_head); ctx != NULL;
-	    ctx = TAILQ_NEXT(ctx, link)) {
-		FD_SET(ctx->s, read_fds);
-		if (ctx->s > maxfd)
-			maxfd = ctx->s;
+	if (ctx->input_filled == ctx->input_len) {
+		/* we're done.  execute the command. */
+		curcommand = ctx;
+		result = (ctx->callback)(ctx->inputbuf, ctx->input_len);
+		curcommand = NULL;
+
+		switch (result) {
+		case DHCP6CTL_R_DONE:
+		case DHCP6CTL_R_FAILURE:
+			goto closecommand;
+		default:
+			break;
+		}
+	} else if (ctx->input_len > sizeof(ctx->inputbuf)) {
+		dprintf(LOG_INFO, FNAME,
+		    "too large command (%d bytes)", ctx->input_len);
+		goto closecommand;
 	}
 
-	*maxfdp = maxfd;
+	return;
 
-	return (0);
+  closecommand:
+	TAILQ_REMOVE(&commandqueue_head, ctx, link);
+	dhcp6_ctl_closecommand(ctx);
 }
@@ -84,9 +84,9 @@ main(argc, argv)
 	int argc;
 	char *argv[];
 {
-	int cc, ch, s, error, passed;
+	int cc, ch, s, error, passed, rlen;
 	int Cflag = 0, Sflag = 0;
-	char *cbuf;
+	char *cbuf, rbuf[BUFSIZ];
 	size_t clen;
 	struct addrinfo hints, *res0, *res;
 	int digestlen;
@@ -195,6 +195,18 @@ main(argc, argv)
 	if (cc != clen)
 		errx(1, "failed to send complete command");
 
+	/* the server replies to some commands, then closes the connection */
+	if (ntohs(((struct dhcp6ctl *)cbuf)->command) ==
+	    DHCP6CTL_COMMAND_STATS) {
+		for (rlen = 0; (cc = read(s, rbuf, sizeof(rbuf))) > 0;
+		    rlen += cc)
+			fwrite(rbuf, 1, cc, stdout);
+		if (cc < 0)
+			err(1, "read reply");
+		if (rlen == 0)
+			errx(1, "no reply from the server");
+	}
+
 	close(s);
 	free(cbuf);
 
@@ -211,7 +223,7 @@ setup_auth(keyfile, key, digestlenp)
 	char line[1024], secret[1024];
 	int secretlen;
 
-	key->secret = NULL;
+	memset(key, 0, sizeof(*key));
 
 	/* Currently, we only support HMAC-MD5 for authentication. */
 	*digestlenp = MD5_DIGESTLENGTH;
@@ -349,7 +361,13 @@ make_command(argc, argv, bufp, lenp, key, authlen)
 
 	if (strcmp(argv[0], "reload") == 0)
 		ctl.command = htons(DHCP6CTL_COMMAND_RELOAD);
-	else if (strcmp(argv[0], "remove") == 0) {
+	else if (strcmp(argv[0], "stats") == 0) {
+		if (ctltype != CTLSERVER) {
+			warnx("stats command is only for server");
+			return (-1);
+		}
+		ctl.command = htons(DHCP6CTL_COMMAND_STATS);
+	} else if (strcmp(argv[0], "remove") == 0) {
 		if (ctltype != CTLSERVER) {
 			warnx("remove command is only for server");
 			return (-1);
@@ -0,0 +1,901 @@
+/*
+ * Copyright (C) 2026 WIDE Project.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the project nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE PROJECT AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE PROJECT OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * dhcp6bench: a load generator for DHCPv6 servers.
+ *
+ * A number of virtual clients, each with its own DUID, go through
+ * Solicit/Advertise, Request/Reply, Renew/Reply and Release/Reply
+ * exchanges for an IA_NA, with a bounded number of clients in progress
+ * at a time.  The messages are built and parsed with the option routines
+ * of common.c, optionally wrapped in Relay-forward messages as if they
+ * came through many relays.  At the end, the throughput, the latency
+ * percentiles of each exchange and the losses are reported.
+ */
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/queue.h>
+#include <sys/uio.h>
+#if TIME_WITH_SYS_TIME
+# include <sys/time.h>
+# include <time.h>
+#else
+# if HAVE_SYS_TIME_H
+#  include <sys/time.h>
+# else
+#  include <time.h>
+# endif
+#endif
+
+#include <net/if.h>
+#include <netinet/in.h>
+
+#include <netdb.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <syslog.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <err.h>
+#include <string.h>
+
+#include <dhcp6.h>
+#include <config.h>
+#include <common.h>
+#include <timer.h>
+#include <evloop.h>
+#include <pktbatch.h>
+#include <auth.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define BENCH_TICKS()		__rdtsc()
+#define BENCH_TICKUNIT		"cycles"
+#else
+#define BENCH_TICKS()		now_ns()
+#define BENCH_TICKUNIT		"ns"
+#endif
+
+#define BENCH_MAXCLIENTS	(1 << 20)	/* the low 20 bits of XIDs */
+#define BENCH_XID(c)		(((c)->gen & 0xf) << 20 | (c)->idx)
+#define BENCH_MAXRELAYS		65535
+#define BENCH_RETRIES		3		/* retransmissions per exchange */
+#define BENCH_SOCKBUF		(1024 * 1024)
+#define BENCH_DUIDMAX		128		/* of a server DUID */
+#define BENCH_MACMSGLEN		160		/* a Reply with IA_NA and Auth */
+#define BENCH_MACTIME		1000000000	/* ns per measurement */
+#define BENCH_HASHTIME		200000000	/* ns per hash measurement */
+#define BENCH_HASHMAXLEN	16384
+
+/* the exchanges of a cycle, in order */
+#define X_SOLICIT	0
+#define X_REQUEST	1
+#define X_RENEW		2
+#define X_RELEASE	3
+#define X_MAX		4
+
+static struct exchange {
+	char *name;
+	int msgtype;
+	int replytype;
+
+	u_int64_t sent;		/* messages sent, including retransmissions */
+	u_int64_t replies;	/* replies received in time */
+	u_int64_t lost;		/* messages not replied in time */
+	u_int32_t *lat;		/* latency of each reply in ns */
+	size_t nlat, maxlat;
+} exchanges[X_MAX] = {
+	{ "Solicit", DH6_SOLICIT, DH6_ADVERTISE },
+	{ "Request", DH6_REQUEST, DH6_REPLY },
+	{ "Renew", DH6_RENEW, DH6_REPLY },
+	{ "Release", DH6_RELEASE, DH6_REPLY },
+};
+
+struct vclient {
+	TAILQ_ENTRY(vclient) link;
+
+	u_int32_t idx;
+	int exchange;		/* X_xxx in progress */
+	int gen;		/* changed for each transmission */
+	int retries;
+	int cycles;		/* cycles left */
+	int waiting;		/* for a reply */
+	u_int64_t sent;		/* when the message was sent, in ns */
+	struct dhcp6_timer *timer;	/* left armed after a reply */
+
+	struct duid duid;
+	char duidbuf[10];	/* DUID-LL with a made-up MAC address */
+	struct duid serverid;
+	char serveridbuf[BENCH_DUIDMAX];
+	struct in6_addr addr;	/* leased address */
+};
+TAILQ_HEAD(, vclient) waitlist;
+
+const dhcp6_mode_t dhcp6_mode = DHCP6_MODE_CLIENT;
+
+static int debug = 0;
+static sig_atomic_t sig_flags = 0;
+#define SIGF_TERM 0x1
+
+static int nclients = 1000;
+static int ncycles = 1;
+static int window = 64;
+static int nrelays = 0;
+static int keepbinding = 0;
+static long timeout = 1000;		/* ms */
+static char *serveraddr = DH6ADDR_ALLAGENT;
+
+static struct vclient *clients;
+static int active, completed, failed;
+static u_int64_t unexpected;
+
+static int sock;
+static struct sockaddr_in6 sa6_server;
+static struct pktbatch_rx *rxbatch;
+static struct pktbatch_tx *txbatch;
+static struct dhcp6_arena *arena;
+
+static void usage __P((void));
+static void bench_init __P((char *));
+static void bench_signal __P((int));
+static void bench_input __P((int, void *));
+static void bench_recv __P((char *, ssize_t));
+static void bench_report __P((double));
+static void client_start __P((struct vclient *));
+static void client_send __P((struct vclient *));
+static void client_next __P((struct vclient *));
+static void client_done __P((struct vclient *, int));
+static struct dhcp6_timer *client_timo __P((void *));
+static u_int64_t now_ns __P((void));
+static int cmp_u32 __P((const void *, const void *));
+static void mac_bench __P((void));
+static double mac_verify_ns __P((int, int));
+static void hash_bench __P((void));
+static double hash_ticks __P((int, size_t));
+
+static void
+usage()
+{
+	fprintf(stderr,
+	    "usage: dhcp6bench [-dk] [-c clients] [-n cycles] [-r relays] "
+	    "[-s serveraddr] [-t timeout] [-w window] interface\n"
+	    "       dhcp6bench -m\n");
+	exit(1);
+}
+
+int
+main(argc, argv)
+	int argc;
+	char *argv[];
+{
+	int ch, i, macbench = 0;
+	char *p;
+	u_int64_t start;
+
+	while ((ch = getopt(argc, argv, "c:dkmn:r:s:t:w:")) != -1) {
+		p = NULL;
+		switch (ch) {
+		case 'c':
+			nclients = (int)strtol(optarg, &p, 10);
+			if (!*optarg || *p ||
+			    nclients < 1 || nclients > BENCH_MAXCLIENTS)
+				errx(1, "illegal number of clients: %s", optarg);
+			break;
+		case 'd':
+			debug++;
+			break;
+		case 'k':
+			keepbinding = 1;
+			break;
+		case 'm':
+			macbench = 1;
+			break;
+		case 'n':
+			ncycles = (int)strtol(optarg, &p, 10);
+			if (!*optarg || *p || ncycles < 1)
+				errx(1, "illegal number of cycles: %s", optarg);
+			break;
+		case 'r':
+			nrelays = (int)strtol(optarg, &p, 10);
+			if (!*optarg || *p ||
+			    nrelays < 0 || nrelays > BENCH_MAXRELAYS)
+				errx(1, "illegal number of relays: %s", optarg);
+			break;
+		case 's':
+			serveraddr = optarg;
+			break;
+		case 't':
+			timeout = strtol(optarg, &p, 10);
+			if (!*optarg || *p || timeout < 1 || timeout > 4000)
+				errx(1, "illegal timeout: %s", optarg);
+			break;
+		case 'w':
+			window = (int)strtol(optarg, &p, 10);
+			if (!*optarg || *p || window < 1)
+				errx(1, "illegal window: %s", optarg);
+			break;
+		default:
+			usage();
+			/* NOTREACHED */
+		}
+	}
+	argc -= optind;
+	argv += optind;
+
+	if (macbench) {
+		if (argc != 0)
+			usage();
+		mac_bench();
+		exit(0);
+	}
+	if (argc != 1) {
+		usage();
+		/* NOTREACHED */
+	}
+
+	foreground = 1;
+	setloglevel(debug);
+
+	bench_init(argv[0]);
+
+	printf("%d clients, %d cycle%s each, %d at a time", nclients,
+	    ncycles, ncycles > 1 ? "s" : "", window);
+	if (nrelays)
+		printf(", through %d relays", nrelays);
+	printf("\n");
+
+	start = now_ns();
+	for (i = 0; i < window && !TAILQ_EMPTY(&waitlist); i++)
+		client_start(TAILQ_FIRST(&waitlist));
+
+	while (active > 0 && !(sig_flags & SIGF_TERM)) {
+		(void)pktbatch_tx_flush(txbatch);
+		evloop_dispatch();
+	}
+
+	bench_report((now_ns() - start) / 1e9);
+	exit(failed ? 1 : 0);
+}
+
+static void
+bench_init(ifname)
+	char *ifname;
+{
+	struct addrinfo hints, *res;
+	struct sockaddr_in6 sa6;
+	unsigned int ifindex;
+	int i, error, on = 1, bufsiz = BENCH_SOCKBUF;
+	struct vclient *c;
+
+	if ((ifindex = if_nametoindex(ifname)) == 0)
+		errx(1, "unknown interface %s", ifname);
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_INET6;
+	hints.ai_socktype = SOCK_DGRAM;
+	hints.ai_protocol = IPPROTO_UDP;
+	error = getaddrinfo(serveraddr, DH6PORT_UPSTREAM, &hints, &res);
+	if (error)
+		errx(1, "getaddrinfo(%s): %s", serveraddr, gai_strerror(error));
+	memcpy(&sa6_server, res->ai_addr, sizeof(sa6_server));
+	freeaddrinfo(res);
+	if ((IN6_IS_ADDR_MULTICAST(&sa6_server.sin6_addr) ||
+	    IN6_IS_ADDR_LINKLOCAL(&sa6_server.sin6_addr)) &&
+	    sa6_server.sin6_scope_id == 0)
+		sa6_server.sin6_scope_id = ifindex;
+
+	/* replies come to the client port, or to the server port of relays */
+	if ((sock = socket(AF_INET6, SOCK_DGRAM, IPPROTO_UDP)) < 0)
+		err(1, "socket");
+	(void)setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+	(void)setsockopt(sock, SOL_SOCKET, SO_RCVBUF, &bufsiz,
+	    sizeof(bufsiz));
+	(void)setsockopt(sock, SOL_SOCKET, SO_SNDBUF, &bufsiz,
+	    sizeof(bufsiz));
+	if (setsockopt(sock, IPPROTO_IPV6, IPV6_MULTICAST_IF, &ifindex,
+	    sizeof(ifindex)) < 0)
+		err(1, "setsockopt(IPV6_MULTICAST_IF)");
+	memset(&sa6, 0, sizeof(sa6));
+	sa6.sin6_family = AF_INET6;
+#ifdef HAVE_SA_LEN
+	sa6.sin6_len = sizeof(sa6);
+#endif
+	sa6.sin6_port = htons(nrelays ? 547 : 546);
+	if (bind(sock, (struct sockaddr *)&sa6, sizeof(sa6)) < 0)
+		err(1, "bind(port %d)", ntohs(sa6.sin6_port));
+
+	if ((rxbatch = pktbatch_rx_create(PKTBATCH_DEFAULT, BUFSIZ, 0)) ==
+	    NULL ||
+	    (txbatch = pktbatch_tx_create(PKTBATCH_DEFAULT, BUFSIZ)) == NULL ||
+	    (arena = dhcp6_arena_create(DHCP6_ARENA_SIZE)) == NULL)
+		errx(1, "memory allocation failed");
+
+	dhcp6_timer_init();
+	if (evloop_init() != 0 ||
+	    evloop_add(sock, EVLOOP_EDGE, bench_input, NULL) != 0)
+		errx(1, "failed to set up the event loop");
+
+	if (signal(SIGINT, bench_signal) == SIG_ERR ||
+	    signal(SIGTERM, bench_signal) == SIG_ERR)
+		err(1, "signal");
+
+	for (i = 0; i < X_MAX; i++) {
+		exchanges[i].maxlat = nclients * ncycles;
+		if ((exchanges[i].lat = malloc(exchanges[i].maxlat *
+		    sizeof(u_int32_t))) == NULL)
+			errx(1, "memory allocation failed");
+	}
+
+	TAILQ_INIT(&waitlist);
+	if ((clients = calloc(nclients, sizeof(*clients))) == NULL)
+		errx(1, "memory allocation failed");
+	for (i = 0; i < nclients; i++) {
+		c = &clients[i];
+		c->idx = i;
+		c->cycles = ncycles;
+		if ((c->timer = dhcp6_add_timer(client_timo, c)) == NULL)
+			errx(1, "failed to add a timer");
+
+		/* DUID-LL, Ethernet, 02:00 followed by the index */
+		c->duidbuf[1] = 3;
+		c->duidbuf[3] = 1;
+		c->duidbuf[4] = 0x02;
+		c->duidbuf[6] = (i >> 24) & 0xff;
+		c->duidbuf[7] = (i >> 16) & 0xff;
+		c->duidbuf[8] = (i >> 8) & 0xff;
+		c->duidbuf[9] = i & 0xff;
+		c->duid.duid_len = sizeof(c->duidbuf);
+		c->duid.duid_id = c->duidbuf;
+		c->serverid.duid_id = c->serveridbuf;
+
+		TAILQ_INSERT_TAIL(&waitlist, c, link);
+	}
+}
+
+static void
+bench_signal(sig)
+	int sig;
+{
+	sig_flags |= SIGF_TERM;
+}
+
+static void
+client_start(c)
+	struct vclient *c;
+{
+	TAILQ_REMOVE(&waitlist, c, link);
+	active++;
+
+	c->exchange = X_SOLICIT;
+	c->retries = 0;
+	client_send(c);
+}
+
+/*
+ * Build the message of the current exchange with the option routines of
+ * common.c, wrap it in a Relay-forward message if needed, and queue it.
+ */
+static void
+client_send(c)
+	struct vclient *c;
+{
+	char buf[BUFSIZ];
+	struct exchange *x = &exchanges[c->exchange];
+	struct dhcp6_optinfo optinfo;
+	struct dhcp6_list sublist;
+	struct dhcp6_statefuladdr sa;
+	struct dhcp6_ia ia;
+	struct dhcp6 *dh6;
+	struct in6_addr linkaddr, peeraddr;
+	struct timeval tv;
+	u_int32_t ifid;
+	char *msg;
+	int len, optlen, r;
+
+	dhcp6_arena = arena;
+
+	/* leave room for the relay headers */
+	dh6 = (struct dhcp6 *)(buf + DHCP6_RELAY_HEADROOM);
+	memset(dh6, 0, sizeof(*dh6));
+	c->gen++;
+	dh6->dh6_xid = htonl(BENCH_XID(c));
+	dh6->dh6_msgtype = x->msgtype;
+
+	dhcp6_init_options(&optinfo);
+	optinfo.clientID = c->duid;
+	if (c->exchange != X_SOLICIT)
+		optinfo.serverID = c->serverid;
+
+	memset(&ia, 0, sizeof(ia));
+	ia.iaid = 1;
+	TAILQ_INIT(&sublist);
+	if (c->exchange != X_SOLICIT) {
+		memset(&sa, 0, sizeof(sa));
+		sa.addr = c->addr;
+		if (dhcp6_add_listval(&sublist, DHCP6_LISTVAL_STATEFULADDR6,
+		    &sa, NULL) == NULL)
+			goto end;
+	}
+	if (dhcp6_add_listval(&optinfo.iana_list, DHCP6_LISTVAL_IANA, &ia,
+	    &sublist) == NULL)
+		goto end;
+
+	if ((optlen = dhcp6_set_options(x->msgtype, (struct dhcp6opt *)(dh6 + 1),
+	    (struct dhcp6opt *)(buf + sizeof(buf) - sizeof(struct dhcp6opt) -
+	    sizeof(ifid)), &optinfo)) < 0) {
+		dprintf(LOG_ERR, FNAME, "failed to construct options");
+		goto end;
+	}
+	msg = (char *)dh6;
+	len = sizeof(*dh6) + optlen;
+
+	if (nrelays) {
+		/* relay r is on link 2001:db8:r::/64 with interface-ID r */
+		r = c->idx % nrelays;
+		memset(&linkaddr, 0, sizeof(linkaddr));
+		linkaddr.s6_addr[0] = 0x20;
+		linkaddr.s6_addr[1] = 0x01;
+		linkaddr.s6_addr[2] = 0x0d;
+		linkaddr.s6_addr[3] = 0xb8;
+		linkaddr.s6_addr[4] = (r >> 8) & 0xff;
+		linkaddr.s6_addr[5] = r & 0xff;
+		linkaddr.s6_addr[15] = 1;
+		memset(&peeraddr, 0, sizeof(peeraddr));
+		peeraddr.s6_addr[0] = 0xfe;
+		peeraddr.s6_addr[1] = 0x80;
+		memcpy(&peeraddr.s6_addr[8], &c->duidbuf[4], 2);
+		memcpy(&peeraddr.s6_addr[12], &c->duidbuf[6], 4);
+		ifid = htonl(r);
+		dhcp6_encap_relay(&msg, &len, DH6_RELAY_FORW, 0, &linkaddr,
+		    &peeraddr, &ifid, sizeof(ifid));
+	}
+
+	c->sent = now_ns();
+	c->waiting = 1;
+	if (pktbatch_send(sock, txbatch, msg, len, &sa6_server, NULL,
+	    0) != 0) {
+		dprintf(LOG_ERR, FNAME, "failed to send %s: %s", x->name,
+		    strerror(errno));
+	}
+	x->sent++;
+
+  end:
+	dhcp6_clear_list(&sublist);
+	/* the DUIDs are borrowed from the client */
+	optinfo.clientID.duid_id = NULL;
+	optinfo.serverID.duid_id = NULL;
+	dhcp6_clear_options(&optinfo);
+	dhcp6_arena_reset(arena);
+	dhcp6_arena = NULL;
+
+	/* a message that failed to be built is treated as lost */
+	c->waiting = 1;
+	tv.tv_sec = timeout / 1000;
+	tv.tv_usec = (timeout % 1000) * 1000;
+	dhcp6_set_timer(&tv, c->timer);
+}
+
+static struct dhcp6_timer *
+client_timo(arg)
+	void *arg;
+{
+	struct vclient *c = (struct vclient *)arg;
+	struct timeval tv;
+
+	if (!c->waiting)
+		return (NULL);	/* replied, or done */
+
+	exchanges[c->exchange].lost++;
+	dprintf(LOG_DEBUG, FNAME, "client %u: %s timed out", c->idx,
+	    exchanges[c->exchange].name);
+
+	if (++c->retries > BENCH_RETRIES) {
+		client_done(c, 0);
+		if (active > 0)
+			return (NULL);
+
+		/* expire once more to wake up the loop, which then finishes */
+		timerclear(&tv);
+		dhcp6_set_timer(&tv, c->timer);
+		return (c->timer);
+	}
+	client_send(c);
+
+	return (c->timer);
+}
+
+static void
+bench_input(s, arg)
+	int s;
+	void *arg;
+{
+	struct msghdr *mhdr;
+	ssize_t len;
+	int i, n;
+
+	do {
+		if ((n = pktbatch_recv(s, rxbatch)) < 0) {
+			dprintf(LOG_WARNING, FNAME, "recvmsg: %s",
+			    strerror(errno));
+			return;
+		}
+		for (i = 0; i < n; i++) {
+			mhdr = pktbatch_rx_msg(rxbatch, i, &len);
+			bench_recv(mhdr->msg_iov[0].iov_base, len);
+		}
+		(void)pktbatch_tx_flush(txbatch);
+	} while (n == pktbatch_rx_size(rxbatch));
+}
+
+static void
+bench_recv(buf, len)
+	char *buf;
+	ssize_t len;
+{
+	struct dhcp6 *dh6 = (struct dhcp6 *)buf;
+	struct dhcp6_optinfo optinfo;
+	struct dhcp6_listval *iav, *lv;
+	struct vclient *c;
+	struct exchange *x;
+	u_int32_t xid, idx;
+	u_int64_t lat;
+	int next = -1;
+
+	dhcp6_arena = arena;
+	dhcp6_init_options(&optinfo);
+
+	/* unwrap the message for the relay */
+	if (len >= sizeof(struct dhcp6_relay) &&
+	    dh6->dh6_msgtype == DH6_RELAY_REPLY) {
+		if (dhcp6_get_options((struct dhcp6opt *)
+		    ((struct dhcp6_relay *)buf + 1),
+		    (struct dhcp6opt *)(buf + len), &optinfo) < 0 ||
+		    optinfo.relaymsg_msg == NULL)
+			goto bad;
+		dh6 = (struct dhcp6 *)optinfo.relaymsg_msg;
+		len = optinfo.relaymsg_len;
+		dhcp6_clear_options(&optinfo);
+		dhcp6_init_options(&optinfo);
+	}
+	if (len < sizeof(*dh6))
+		goto bad;
+
+	xid = ntohl(dh6->dh6_xid) & DH6_XIDMASK;
+	idx = xid & (BENCH_MAXCLIENTS - 1);
+	if (idx >= nclients)
+		goto bad;
+	c = &clients[idx];
+	x = &exchanges[c->exchange];
+	if (!c->waiting || xid != BENCH_XID(c) ||
+	    dh6->dh6_msgtype != x->replytype) {
+		/* e.g. a reply to a message that has been retransmitted */
+		goto bad;
+	}
+	if (dhcp6_get_options((struct dhcp6opt *)(dh6 + 1),
+	    (struct dhcp6opt *)((char *)dh6 + len), &optinfo) < 0)
+		goto bad;
+
+	lat = now_ns() - c->sent;
+	if (x->nlat < x->maxlat)
+		x->lat[x->nlat++] = lat > 0xffffffff ? 0xffffffff : lat;
+	x->replies++;
+	c->waiting = 0;
+
+	switch (c->exchange) {
+	case X_SOLICIT:
+		if (optinfo.serverID.duid_len > sizeof(c->serveridbuf))
+			goto fail;
+		memcpy(c->serveridbuf, optinfo.serverID.duid_id,
+		    optinfo.serverID.duid_len);
+		c->serverid.duid_len = optinfo.serverID.duid_len;
+		/* FALLTHROUGH */
+	case X_REQUEST:
+		/* take the first address of the first IA_NA */
+		if ((iav = TAILQ_FIRST(&optinfo.iana_list)) == NULL)
+			goto fail;
+		for (lv = TAILQ_FIRST(&iav->sublist); lv;
+		    lv = TAILQ_NEXT(lv, link)) {
+			if (lv->type == DHCP6_LISTVAL_STATEFULADDR6)
+				break;
+		}
+		if (lv == NULL)
+			goto fail;
+		c->addr = lv->val_statefuladdr6.addr;
+		break;
+	}
+	next = 1;
+	goto end;
+
+  fail:
+	dprintf(LOG_INFO, FNAME, "client %u: no address in %s", c->idx,
+	    dhcp6msgstr(dh6->dh6_msgtype));
+	next = 0;
+	goto end;
+
+  bad:
+	unexpected++;
+  end:
+	dhcp6_clear_options(&optinfo);
+	dhcp6_arena_reset(arena);
+	dhcp6_arena = NULL;
+
+	/* this may send the next message, which reuses the arena */
+	if (next > 0)
+		client_next(c);
+	else if (next == 0)
+		client_done(c, 0);
+}
+
+/* go on to the next exchange, or the next cycle */
+static void
+client_next(c)
+	struct vclient *c;
+{
+	c->retries = 0;
+	if (c->exchange == X_RENEW && keepbinding)
+		c->exchange = X_MAX;
+	else
+		c->exchange++;
+	if (c->exchange == X_MAX) {
+		if (--c->cycles == 0) {
+			client_done(c, 1);
+			return;
+		}
+		c->exchange = X_SOLICIT;
+	}
+	client_send(c);
+}
+
+static void
+client_done(c, ok)
+	struct vclient *c;
+	int ok;
+{
+	if (ok)
+		completed++;
+	else
+		failed++;
+	active--;
+	c->waiting = 0;
+
+	/* let a waiting client take its place */
+	if (!TAILQ_EMPTY(&waitlist) && !(sig_flags & SIGF_TERM))
+		client_start(TAILQ_FIRST(&waitlist));
+}
+
+static void
+bench_report(elapsed)
+	double elapsed;
+{
+	struct exchange *x;
+	u_int64_t sent = 0, replies = 0, lost = 0;
+	int i;
+
+	for (i = 0; i < X_MAX; i++) {
+		sent += exchanges[i].sent;
+		replies += exchanges[i].replies;
+		lost += exchanges[i].lost;
+	}
+
+	printf("%llu exchanges in %.3f seconds: %.0f exchanges/s\n",
+	    (unsigned long long)replies, elapsed,
+	    elapsed > 0 ? replies / elapsed : 0.0);
+	printf("%-10s %10s %10s %8s %10s %10s %10s\n", "exchange", "sent",
+	    "replies", "lost", "p50(us)", "p99(us)", "p99.9(us)");
+	for (i = 0; i < X_MAX; i++) {
+		x = &exchanges[i];
+		if (x->sent == 0)
+			continue;
+		qsort(x->lat, x->nlat, sizeof(x->lat[0]), cmp_u32);
+		printf("%-10s %10llu %10llu %8llu", x->name,
+		    (unsigned long long)x->sent,
+		    (unsigned long long)x->replies,
+		    (unsigned long long)x->lost);
+		if (x->nlat == 0) {
+			printf("\n");
+			continue;
+		}
+		printf(" %10.1f %10.1f %10.1f\n",
+		    x->lat[x->nlat * 50 / 100] / 1e3,
+		    x->lat[x->nlat * 99 / 100] / 1e3,
+		    x->lat[x->nlat * 999 / 1000] / 1e3);
+	}
+	printf("%-10s %10llu %10llu %8llu (%.2f%% lost)\n", "total",
+	    (unsigned long long)sent, (unsigned long long)replies,
+	    (unsigned long long)lost, sent ? lost * 100.0 / sent : 0.0);
+	printf("%d clients completed, %d failed, %d not finished; "
+	    "%llu unexpected replies\n", completed, failed,
+	    nclients - completed - failed, (unsigned long long)unexpected);
+}
+
+static u_int64_t
+now_ns()
+{
+	struct timespec ts;
+
+	(void)clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((u_int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec);
+}
+
+static int
+cmp_u32(a, b)
+	const void *a, *b;
+{
+	u_int32_t x = *(const u_int32_t *)a, y = *(const u_int32_t *)b;
+
+	return (x < y ? -1 : x > y);
+}
+
+/*
+ * Measure how fast dhcp6s verifies the MAC of an authenticated message,
+ * with the hash states of the key kept from message to message as they
+ * are, and remade for every message as they were before.
+ */
+static void
+mac_bench()
+{
+	static struct {
+		char *name;
+		int alg;
+	} algs[] = {
+		{ "HMAC-MD5", DHCP6_AUTHALG_HMACMD5 },
+		{ "HMAC-SHA256", DHCP6_AUTHALG_HMACSHA256 },
+	};
+	double cached, fresh;
+	int i;
+
+	printf("MAC verification of a %d-byte message\n", BENCH_MACMSGLEN);
+	printf("%-12s %14s %10s %14s\n", "algorithm", "messages/s",
+	    "ns/msg", "ns/msg (cold)");
+	for (i = 0; i < sizeof(algs) / sizeof(algs[0]); i++) {
+		cached = mac_verify_ns(algs[i].alg, 0);
+		fresh = mac_verify_ns(algs[i].alg, 1);
+		printf("%-12s %14.0f %10.1f %14.1f\n", algs[i].name,
+		    1e9 / cached, cached, fresh);
+	}
+
+	hash_bench();
+}
+
+/* nanoseconds per verification; cold makes the key states every time */
+static double
+mac_verify_ns(alg, cold)
+	int alg, cold;
+{
+	struct keyinfo key;
+	char msg[BENCH_MACMSGLEN], secret[16];
+	size_t off;
+	u_int64_t start, elapsed;
+	long n = 0;
+	int i;
+
+	for (i = 0; i < sizeof(msg); i++)
+		msg[i] = (char)i;
+	for (i = 0; i < sizeof(secret); i++)
+		secret[i] = (char)(0xa0 + i);
+	memset(&key, 0, sizeof(key));
+	key.secret = secret;
+	key.secretlen = sizeof(secret);
+
+	/* the MAC ends the message, as in the Authentication option */
+	off = sizeof(msg) - DHCP6_AUTHALG_MACLEN(alg);
+	memset(msg + off, 0, DHCP6_AUTHALG_MACLEN(alg));
+	if (dhcp6_calc_mac(msg, sizeof(msg), DHCP6_AUTHPROTO_DELAYED, alg,
+	    off, &key) != 0)
+		errx(1, "failed to compute a MAC");
+
+	start = now_ns();
+	do {
+		for (i = 0; i < 1024; i++) {
+			if (cold)
+				key.hmac_alg = 0;
+			if (dhcp6_verify_mac(msg, sizeof(msg),
+			    DHCP6_AUTHPROTO_DELAYED, alg, off, &key) != 0)
+				errx(1, "MAC verification failed");
+		}
+		n += i;
+	} while ((elapsed = now_ns() - start) < BENCH_MACTIME);
+
+	return ((double)elapsed / n);
+}
+
+/*
+ * The cost per byte of each hash engine, through dhcp6_calc_mac() and
+ * so the same dispatch as the server, for messages of a few sizes.
+ * Cycles are those of the time stamp counter on x86.
+ */
+static void
+hash_bench()
+{
+	static struct {
+		char *name;
+		int alg;
+		int shani;
+	} engines[] = {
+		{ "MD5", DHCP6_AUTHALG_HMACMD5, -1 },
+		{ "SHA-256", DHCP6_AUTHALG_HMACSHA256, 0 },
+		{ "SHA-256/NI", DHCP6_AUTHALG_HMACSHA256, 1 },
+	};
+	static size_t lens[] = { 64, 160, 1500, BENCH_HASHMAXLEN };
+	int i, j;
+
+	printf("\nHMAC %s per byte\n%-12s", BENCH_TICKUNIT, "engine");
+	for (j = 0; j < sizeof(lens) / sizeof(lens[0]); j++)
+		printf(" %9luB", (unsigned long)lens[j]);
+	printf("\n");
+	for (i = 0; i < sizeof(engines) / sizeof(engines[0]); i++) {
+		printf("%-12s", engines[i].name);
+		if (engines[i].shani >= 0 &&
+		    dhcp6_sha256_engine(engines[i].shani) != 0) {
+			printf(" not available on this CPU\n");
+			continue;
+		}
+		for (j = 0; j < sizeof(lens) / sizeof(lens[0]); j++) {
+			printf(" %10.2f",
+			    hash_ticks(engines[i].alg, lens[j]) / lens[j]);
+		}
+		printf("\n");
+	}
+}
+
+/* ticks per MAC of a len-byte message */
+static double
+hash_ticks(alg, len)
+	int alg;
+	size_t len;
+{
+	static char msg[BENCH_HASHMAXLEN];
+	struct keyinfo key;
+	char secret[16];
+	size_t off = len - DHCP6_AUTHALG_MACLEN(alg);
+	u_int64_t start, ticks;
+	long n = 0;
+	int i;
+
+	memset(secret, 0xa5, sizeof(secret));
+	memset(&key, 0, sizeof(key));
+	key.secret = secret;
+	key.secretlen = sizeof(secret);
+
+	start = now_ns();
+	ticks = BENCH_TICKS();
+	do {
+		for (i = 0; i < 64; i++) {
+			if (dhcp6_calc_mac(msg, len, DHCP6_AUTHPROTO_DELAYED,
+			    alg, off, &key) != 0)
+				errx(1, "failed to compute a MAC");
+		}
+		n += i;
+	} while (now_ns() - start < BENCH_HASHTIME);
+
+	return ((double)(BENCH_TICKS() - ticks) / n);
+}
@@ -72,6 +72,9 @@
 #include <config.h>
 #include <common.h>
 #include <timer.h>
+#include <evloop.h>
+#include <script.h>
+#include <rtnl.h>
 #include <dhcp6c.h>
 #include <control.h>
 #include <dhcp6_ctl.h>
@@ -125,6 +128,8 @@ static struct dhcp6_serverinfo *find_server __P((struct dhcp6_event *,
 						 struct duid *));
 static struct dhcp6_serverinfo *select_server __P((struct dhcp6_event *));
 static void client6_recv __P((void));
+static void client6_input __P((int, void *));
+static void client6_ctlaccept __P((int, void *));
 static int client6_recvadvert __P((struct dhcp6_if *, struct dhcp6 *,
 				   ssize_t, struct dhcp6_optinfo *));
 static int client6_recvreply __P((struct dhcp6_if *, struct dhcp6 *,
@@ -146,7 +151,8 @@ struct dhcp6_timer *client6_timo __P((void *));
 int client6_start __P((struct dhcp6_if *));
 static void info_printf __P((const char *, ...));
 
-extern int client6_script __P((char *, int, struct dhcp6_optinfo *));
+extern int client6_script __P((char *, char *, int,
+    struct dhcp6_optinfo *));
 
 #define MAX_ELAPSED_TIME 0xffff
 
@@ -368,6 +374,15 @@ client6_init()
 		exit(1);
 	}
 
+	if (evloop_init() != 0 ||
+	    evloop_add(sock, 0, client6_input, NULL) != 0 ||
+	    (ctlsock >= 0 &&
+	    evloop_add(ctlsock, 0, client6_ctlaccept, NULL) != 0) ||
+	    script_init() != 0) {
+		dprintf(LOG_ERR, FNAME, "failed to set up the event loop");
+		exit(1);
+	}
+
 	if (signal(SIGHUP, client6_signal) == SIG_ERR) {
 		dprintf(LOG_WARNING, FNAME, "failed to set signal: %s",
 		    strerror(errno));
@@ -486,6 +501,9 @@ check_exit()
 	/* We have no existing event.  Do exit. */
 	dprintf(LOG_INFO, FNAME, "exiting");
 
+	rtnl_flush(1);
+	script_wait();
+
 	exit(0);
 }
 
@@ -510,50 +528,31 @@ process_signals()
 static void
 client6_mainloop()
 {
-	struct timeval *w;
-	int ret, maxsock;
-	fd_set r;
-
 	while(1) {
 		if (sig_flags)
 			process_signals();
 
-		w = dhcp6_check_timer();
+		evloop_dispatch();
 
-		FD_ZERO(&r);
-		FD_SET(sock, &r);
-		maxsock = sock;
-		if (ctlsock >= 0) {
-			FD_SET(ctlsock, &r);
-			maxsock = (sock > ctlsock) ? sock : ctlsock;
-			(void)dhcp6_ctl_setreadfds(&r, &maxsock);
-		}
+		/* configure the addresses changed in this round */
+		rtnl_flush(0);
+	}
+}
 
-		ret = select(maxsock + 1, &r, NULL, NULL, w);
+static void
+client6_input(s, arg)
+	int s;
+	void *arg;
+{
+	client6_recv();
+}
 
-		switch (ret) {
-		case -1:
-			if (errno != EINTR) {
-				dprintf(LOG_ERR, FNAME, "select: %s",
-				    strerror(errno));
-				exit(1);
-			}
-			continue;
-		case 0:	/* timeout */
-			break;	/* dhcp6_check_timer() will treat the case */
-		default:
-			break;
-		}
-		if (FD_ISSET(sock, &r))
-			client6_recv();
-		if (ctlsock >= 0) {
-			if (FD_ISSET(ctlsock, &r)) {
-				(void)dhcp6_ctl_acceptcommand(ctlsock,
-				    client6_do_ctlcommand);
-			}
-			(void)dhcp6_ctl_readcommand(&r);
-		}
-	}
+static void
+client6_ctlaccept(s, arg)
+	int s;
+	void *arg;
+{
+	(void)dhcp6_ctl_acceptcommand(s, client6_do_ctlcommand);
 }
 
 static inline int
@@ -1833,7 +1832,7 @@ client6_recvreply(ifp, dh6, len, optinfo)
 	 */
 	if (ifp->scriptpath != NULL && strlen(ifp->scriptpath) != 0) {
 		dprintf(LOG_DEBUG, FNAME, "executes %s", ifp->scriptpath);
-		client6_script(ifp->scriptpath, state, optinfo);
+		client6_script(ifp->scriptpath, ifp->ifname, state, optinfo);
 	}
 
 	/*
@@ -1949,12 +1948,21 @@ process_auth(authparam, dh6, len, optinfo)
 			break;
 		}
 
-		if (optinfo->authalgorithm != DHCP6_AUTHALG_HMACMD5) {
+		if (optinfo->authalgorithm != DHCP6_AUTHALG_HMACMD5 &&
+		    optinfo->authalgorithm != DHCP6_AUTHALG_HMACSHA256) {
 			dprintf(LOG_INFO, FNAME, "unknown authentication "
 			    "algorithm (%d)", optinfo->authalgorithm);
 			break;
 		}
 
+		/* accepting another algorithm would be a downgrade */
+		if (optinfo->authalgorithm != authparam->authalgorithm) {
+			dprintf(LOG_INFO, FNAME, "authentication algorithm "
+			    "mismatch (%d, configured %d)",
+			    optinfo->authalgorithm, authparam->authalgorithm);
+			break;
+		}
+
 		if (optinfo->authrdm != DHCP6_AUTHRDM_MONOCOUNTER) {
 			dprintf(LOG_INFO, FNAME,"unknown RDM (%d)",
 			    optinfo->authrdm);
@@ -32,7 +32,6 @@
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <sys/queue.h>
-#include <sys/wait.h>
 #include <sys/stat.h>
 
 #if TIME_WITH_SYS_TIME
@@ -48,7 +47,6 @@
 
 #include <netinet/in.h>
 
-#include <fcntl.h>
 #include <unistd.h>
 #include <stdlib.h>
 #include <stdio.h>
@@ -59,6 +57,7 @@
 #include "dhcp6.h"
 #include "config.h"
 #include "common.h"
+#include "script.h"
 
 static char sipserver_str[] = "new_sip_servers";
 static char sipname_str[] = "new_sip_name";
@@ -73,8 +72,8 @@ static char bcmcsserver_str[] = "new_bcmcs_servers";
 static char bcmcsname_str[] = "new_bcmcs_name";
 
 int
-client6_script(scriptpath, state, optinfo)
-	char *scriptpath;
+client6_script(scriptpath, ifname, state, optinfo)
+	char *scriptpath, *ifname;
 	int state;
 	struct dhcp6_optinfo *optinfo;
 {
@@ -86,7 +85,6 @@ client6_script(scriptpath, state, optinfo)
 	char **envp, *s;
 	char reason[] = "REASON=NBI";
 	struct dhcp6_listval *v;
-	pid_t pid, wpid;
 
 	/* if a script is not specified, do nothing */
 	if (scriptpath == NULL || strlen(scriptpath) == 0)
@@ -380,53 +378,8 @@ client6_script(scriptpath, state, optinfo)
 		}
 	}
 
-	/* launch the script */
-	pid = fork();
-	if (pid < 0) {
-		dprintf(LOG_ERR, FNAME, "failed to fork: %s", strerror(errno));
-		ret = -1;
-		goto clean;
-	} else if (pid) {
-		int wstatus;
-
-		do {
-			wpid = wait(&wstatus);
-		} while (wpid != pid && wpid > 0);
-
-		if (wpid < 0)
-			dprintf(LOG_ERR, FNAME, "wait: %s", strerror(errno));
-		else {
-			dprintf(LOG_DEBUG, FNAME,
-			    "script \"%s\" terminated", scriptpath);
-		}
-	} else {
-		char *argv[2];
-		int fd;
-
-		argv[0] = scriptpath;
-		argv[1] = NULL;
-
-		if (safefile(scriptpath)) {
-			dprintf(LOG_ERR, FNAME,
-			    "script \"%s\" cannot be executed safely",
-			    scriptpath);
-			exit(1);
-		}
-
-		if (foreground == 0 && (fd = open("/dev/null", O_RDWR)) != -1) {
-			dup2(fd, STDIN_FILENO);
-			dup2(fd, STDOUT_FILENO);
-			dup2(fd, STDERR_FILENO);
-			if (fd > STDERR_FILENO)
-				close(fd);
-		}
-
-		execve(scriptpath, argv, envp);
-
-		dprintf(LOG_ERR, FNAME, "child: exec failed: %s",
-		    strerror(errno));
-		exit(0);
-	}
+	/* launch the script, which takes the environment */
+	return (script_run(scriptpath, ifname, envp));
 
   clean:
 	for (i = 0; i < envc; i++)
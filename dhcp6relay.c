@@ -60,15 +60,21 @@
 #include <dhcp6.h>
 #include <config.h>
 #include <common.h>
+#include <evloop.h>
+#include <script.h>
+#include <pktbatch.h>
+#include <trace.h>
+#include <stats.h>
+#include <metrics.h>
 
 #define DHCP6RELAY_PIDFILE "/var/run/dhcp6relay.pid"
 static char *pid_file = DHCP6RELAY_PIDFILE;
 
 static int ssock;		/* socket for relaying to servers */
 static int csock;		/* socket for clients */
-static int maxfd;		/* maxi file descriptor for select(2) */
 
 static int debug = 0;
+static int logbuffer = 0;
 static sig_atomic_t sig_flags = 0;
 #define SIGF_TERM 0x1
 
@@ -76,11 +82,12 @@ static char *relaydevice;
 static char *boundaddr;
 static char *serveraddr = DH6ADDR_ALLSERVER;
 static char *scriptpath;
+static char *trace_file;
+static char *metrics_addr;
 
-static char *rmsgctlbuf;
-static socklen_t rmsgctllen;
-static struct msghdr rmh;
-static char rdatabuf[BUFSIZ];
+static struct pktbatch_rx *rxbatch;
+static struct pktbatch_tx *txbatch;
+static int rxbatch_size = PKTBATCH_DEFAULT;
 static int relayifid;
 
 static int mhops = DHCP6_RELAY_MULTICAST_HOPS;
@@ -109,11 +116,12 @@ static void usage __P((void));
 static struct prefix_list *make_prefix __P((char *));
 static void relay6_init __P((int, char *[]));
 static void relay6_loop __P((void));
-static void relay6_recv __P((int, int));
+static void relay6_recv __P((struct msghdr *, ssize_t, int));
+static void relay6_input __P((int, void *));
 static void process_signals __P((void));
 static void relay6_signal __P((int));
-static int make_msgcontrol __P((struct msghdr *, void *, socklen_t,
-    struct in6_pktinfo *, int));
+static void relay6_drop __P((int, int));
+static size_t relay6_metrics __P((char *, size_t));
 static void relay_to_server __P((struct dhcp6 *, ssize_t,
     struct sockaddr_in6 *, char *, unsigned int));
 static void relay_to_client __P((struct dhcp6_relay *, ssize_t,
@@ -126,8 +134,9 @@ static void
 usage()
 {
 	fprintf(stderr,
-	    "usage: dhcp6relay [-dDf] [-b boundaddr] [-H hoplim] "
-	    "[-r relay-IF] [-s serveraddr] [-p pidfile] [-S script] IF ...\n");
+	    "usage: dhcp6relay [-adDf] [-b boundaddr] [-B batchsize] "
+	    "[-H hoplim] [-M [address:]port] [-r relay-IF] [-s serveraddr] "
+	    "[-p pidfile] [-S script] [-T tracefile] IF ...\n");
 	exit(0);
 }
 
@@ -146,11 +155,23 @@ main(argc, argv)
 	else
 		progname++;
 
-	while((ch = getopt(argc, argv, "b:dDfH:r:s:S:p:")) != -1) {
+	while((ch = getopt(argc, argv, "ab:B:dDfH:M:r:s:S:p:T:")) != -1) {
 		switch(ch) {
+		case 'a':
+			logbuffer = 1;
+			break;
 		case 'b':
 			boundaddr = optarg;
 			break;
+		case 'B':
+			p = NULL;
+			rxbatch_size = (int)strtol(optarg, &p, 10);
+			if (!*optarg || *p ||
+			    rxbatch_size < 1 || rxbatch_size > PKTBATCH_MAX) {
+				errx(1, "illegal batch size: %s", optarg);
+				/* NOTREACHED */
+			}
+			break;
 		case 'd':
 			debug = 1;
 			break;
@@ -172,6 +193,9 @@ main(argc, argv)
 				/* NOTREACHED */
 			}
 			break;
+		case 'M':
+			metrics_addr = optarg;
+			break;
 		case 'r':
 			relaydevice = optarg;
 			break;
@@ -184,6 +208,9 @@ main(argc, argv)
 		case 'p':
 			pid_file = optarg;
 			break;
+		case 'T':
+			trace_file = optarg;
+			break;
 		default:
 			usage();
 			exit(0);
@@ -212,6 +239,10 @@ main(argc, argv)
 		openlog(progname, LOG_NDELAY|LOG_PID, LOG_DAEMON);
 	}
 	setloglevel(debug);
+	if (logbuffer && setlogbuffer(DHCP6_LOGBUF_SIZE) != 0)
+		exit(1);
+	if (trace_file && trace_open(trace_file, TRACE_SIZE_DEFAULT) != 0)
+		exit(1);
 
 	/* dump current PID */
 	pid = getpid();
@@ -293,7 +324,6 @@ relay6_init(int ifnum, char *iflist[])
 	struct addrinfo *res, *res2;
 	int i, error, on;
 	struct ipv6_mreq mreq6;
-	static struct iovec iov[2];
 
 	/* initialize non-link-local prefixes list */
 	TAILQ_INIT(&global_prefixes);
@@ -328,16 +358,15 @@ relay6_init(int ifnum, char *iflist[])
 	memcpy(&sa6_server, res->ai_addr, sizeof (sa6_server));
 	freeaddrinfo(res);
 
-	/* initialize send/receive buffer */
-	iov[0].iov_base = (caddr_t)rdatabuf;
-	iov[0].iov_len = sizeof (rdatabuf);
-	rmh.msg_iov = iov;
-	rmh.msg_iovlen = 1;
-	rmsgctllen = CMSG_SPACE(sizeof (struct in6_pktinfo));
-	if ((rmsgctlbuf = (char *)malloc(rmsgctllen)) == NULL) {
-		dprintf(LOG_ERR, FNAME, "memory allocation failed");
+	/*
+	 * initialize receive and transmit buffers.  Received packets are
+	 * encapsulated in place for relaying to servers.
+	 */
+	if ((rxbatch = pktbatch_rx_create(rxbatch_size, BUFSIZ,
+	    DHCP6_RELAY_HEADROOM)) == NULL ||
+	    (txbatch = pktbatch_tx_create(rxbatch_size,
+	    BUFSIZ + 2 * DHCP6_RELAY_HEADROOM)) == NULL)
 		goto failexit;
-	}
 
 	/*
 	 * Setup a socket to communicate with clients.
@@ -358,8 +387,6 @@ relay6_init(int ifnum, char *iflist[])
 		dprintf(LOG_ERR, FNAME, "socket(csock): %s", strerror(errno));
 		goto failexit;
 	}
-	if (csock > maxfd)
-		maxfd = csock;
 	on = 1;
 	if (setsockopt(csock, SOL_SOCKET, SO_REUSEPORT,
 	    &on, sizeof(on)) < 0) {
@@ -436,6 +463,7 @@ relay6_init(int ifnum, char *iflist[])
 			goto failexit;
 		}
 		TAILQ_INSERT_TAIL(&ifid_list, ifd, ilink);
+		(void)stats_addif(ifp, ifd->ifid);
 		iflist++;
 	}
 	freeaddrinfo(res2);
@@ -446,6 +474,8 @@ relay6_init(int ifnum, char *iflist[])
 	relayifid = if_nametoindex(relaydevice);
 	if (relayifid == 0)
 		dprintf(LOG_ERR, FNAME, "invalid interface %s", relaydevice);
+	else
+		(void)stats_addif(relaydevice, relayifid);
 	/*
 	 * We are not really sure if we need to listen on the downstream
 	 * port to receive packets from servers.  We'll need to clarify the
@@ -465,8 +495,6 @@ relay6_init(int ifnum, char *iflist[])
 		    strerror(error));
 		goto failexit;
 	}
-	if (ssock > maxfd)
-		maxfd = ssock;
 	on = 1;
 	/*
 	 * Both a relay and a client may run on a single node.  If we need to
@@ -510,6 +538,18 @@ relay6_init(int ifnum, char *iflist[])
 	}
 #endif
 
+	if (evloop_init() != 0 ||
+	    evloop_add(csock, EVLOOP_EDGE, relay6_input, NULL) != 0 ||
+	    evloop_add(ssock, EVLOOP_EDGE, relay6_input, NULL) != 0 ||
+	    (scriptpath != NULL && script_init() != 0)) {
+		dprintf(LOG_ERR, FNAME, "failed to set up the event loop");
+		goto failexit;
+	}
+	if (metrics_addr && metrics_init(metrics_addr, relay6_metrics) != 0) {
+		dprintf(LOG_ERR, FNAME, "failed to open the metrics listener");
+		goto failexit;
+	}
+
 	if (signal(SIGTERM, relay6_signal) == SIG_ERR) {
 		dprintf(LOG_WARNING, FNAME, "failed to set signal: %s",
 		    strerror(errno));
@@ -537,85 +577,105 @@ static void
 process_signals()
 {
 	if ((sig_flags & SIGF_TERM)) {
+		pktbatch_rx_logstats(rxbatch, "receive");
+		pktbatch_tx_logstats(txbatch, "send");
+		trace_close();
+		if (scriptpath != NULL)
+			script_wait();
 		unlink(pid_file);
 		exit(0);
 	}
 }
 
+/* count a received message that is discarded */
 static void
-relay6_loop()
+relay6_drop(type, reason)
+	int type, reason;
 {
-	fd_set readfds;
-	int e;
+	stats->dropped[STATS_MSGTYPE(type)]++;
+	stats->drops[reason]++;
+}
 
+/* the OpenMetrics exposition for a scrape */
+static size_t
+relay6_metrics(buf, len)
+	char *buf;
+	size_t len;
+{
+	stats->rxbatch = *pktbatch_rx_stats(rxbatch);
+	stats->txbatch = *pktbatch_tx_stats(txbatch);
+	return (stats_format(stats, STATS_FMT_OPENMETRICS | STATS_FMT_RELAY,
+	    buf, len));
+}
+
+static void
+relay6_loop()
+{
 	while(1) {
 		if (sig_flags)
 			process_signals();
 
-		/* we'd rather use FD_COPY here, but it's not POSIX friendly */
-		FD_ZERO(&readfds);
-		FD_SET(csock, &readfds);
-		FD_SET(ssock, &readfds);
-
-		e = select(maxfd + 1, &readfds, NULL, NULL, NULL);
-		switch(e) {
-		case 0:		/* impossible in our situation */
-			errx(1, "select returned 0");
-				/* NOTREACHED */
-		case -1:
-			if (errno != EINTR) {
-				err(1, "select");
-				/* NOTREACHED */
-			}
-			continue;
-		default:
-			break;
-		}
+		evloop_dispatch();
 
-		if (FD_ISSET(csock, &readfds))
-			relay6_recv(csock, 1);
-
-		if (FD_ISSET(ssock, &readfds))
-			relay6_recv(ssock, 0);
+		flushlog();
 	}
 }
 
+/*
+ * The sockets are edge-triggered: receive batches of packets until they
+ * are drained, and relay them in the order of arrival.  The relayed
+ * packets of each batch are queued and sent together at the end.
+ */
 static void
-relay6_recv(s, fromclient)
-	int s, fromclient;
+relay6_input(s, arg)
+	int s;
+	void *arg;
 {
+	struct msghdr *mhdr;
 	ssize_t len;
-	struct sockaddr_storage from;
+	int i, n;
+
+	do {
+		if ((n = pktbatch_recv(s, rxbatch)) < 0) {
+			dprintf(LOG_WARNING, FNAME, "recvmsg: %s",
+			    strerror(errno));
+			return;
+		}
+		for (i = 0; i < n; i++) {
+			mhdr = pktbatch_rx_msg(rxbatch, i, &len);
+			relay6_recv(mhdr, len, s == csock);
+		}
+		(void)pktbatch_tx_flush(txbatch);
+	} while (n == pktbatch_rx_size(rxbatch));
+}
+
+static void
+relay6_recv(mhdr, len, fromclient)
+	struct msghdr *mhdr;
+	ssize_t len;
+	int fromclient;
+{
+	struct sockaddr *from = (struct sockaddr *)mhdr->msg_name;
 	struct in6_pktinfo *pi = NULL;
 	struct cmsghdr *cm;
 	struct dhcp6 *dh6;
 	struct ifid_list *ifd;
 	char ifname[IF_NAMESIZE];
-
-	rmh.msg_control = (caddr_t)rmsgctlbuf;
-	rmh.msg_controllen = rmsgctllen;
-
-	rmh.msg_name = &from;
-	rmh.msg_namelen = sizeof (from);
-
-	if ((len = recvmsg(s, &rmh, 0)) < 0) {
-		dprintf(LOG_WARNING, FNAME, "recvmsg: %s", strerror(errno));
-		return;
-	}
+	int ifslot;
 
 	dprintf(LOG_DEBUG, FNAME, "from %s, size %d",
-	    addr2str((struct sockaddr *)&from), len);
+	    addr2str(from), len);
 
-	if (((struct sockaddr *)&from)->sa_family != AF_INET6) {
+	if ((from)->sa_family != AF_INET6) {
 		dprintf(LOG_WARNING, FNAME,
 		    "non-IPv6 packet is received (AF %d) ",
-		    ((struct sockaddr *)&from)->sa_family);
+		    (from)->sa_family);
 		return;
 	}
 
 	/* get optional information as ancillary data (if available) */
-	for (cm = (struct cmsghdr *)CMSG_FIRSTHDR(&rmh); cm;
-	     cm = (struct cmsghdr *)CMSG_NXTHDR(&rmh, cm)) {
+	for (cm = (struct cmsghdr *)CMSG_FIRSTHDR(mhdr); cm;
+	     cm = (struct cmsghdr *)CMSG_NXTHDR(mhdr, cm)) {
 		if (cm->cmsg_level != IPPROTO_IPV6)
 			continue;
 
@@ -628,8 +688,11 @@ relay6_recv(s, fromclient)
 	if (pi == NULL) {
 		dprintf(LOG_WARNING, FNAME,
 		    "failed to get the arrival interface");
+		stats->drops[STATS_DROP_NOIF]++;
 		return;
 	}
+	trace_recv(pi->ipi6_ifindex, (struct sockaddr_in6 *)from,
+	    &pi->ipi6_addr, mhdr->msg_iov[0].iov_base, len);
 	for (ifd = TAILQ_FIRST(&ifid_list); ifd;
 	     ifd = TAILQ_NEXT(ifd, ilink)) {
 		if (pi->ipi6_ifindex == ifd->ifid)
@@ -640,24 +703,31 @@ relay6_recv(s, fromclient)
 	 * interface, when a DHCPv6 server is running on that interface.
 	 * This check prevents such reception.
 	 */
-	if (ifd == NULL && pi->ipi6_ifindex != relayifid)
+	if (ifd == NULL && pi->ipi6_ifindex != relayifid) {
+		stats->drops[STATS_DROP_NOIF]++;
 		return;
+	}
 	if (if_indextoname(pi->ipi6_ifindex, ifname) == NULL) {
 		dprintf(LOG_WARNING, FNAME,
 		    "if_indextoname(id = %d): %s",
 		    pi->ipi6_ifindex, strerror(errno));
+		stats->drops[STATS_DROP_NOIF]++;
 		return;
 	}
+	ifslot = stats_ifslot(pi->ipi6_ifindex);
 
 	/* packet validation */
 	if (len < sizeof (*dh6)) {
 		dprintf(LOG_INFO, FNAME, "short packet (%d bytes)", len);
+		stats->ifs[ifslot].rx[0]++;
+		relay6_drop(0, STATS_DROP_SHORT);
 		return;
 	}
 
-	dh6 = (struct dhcp6 *)rdatabuf;
+	dh6 = (struct dhcp6 *)mhdr->msg_iov[0].iov_base;
+	stats->ifs[ifslot].rx[STATS_MSGTYPE(dh6->dh6_msgtype)]++;
 	dprintf(LOG_DEBUG, FNAME, "received %s from %s",
-	    dhcp6msgstr(dh6->dh6_msgtype), addr2str((struct sockaddr *)&from));
+	    dhcp6msgstr(dh6->dh6_msgtype), addr2str(from));
 
 	/*
 	 * Relay the packet according to the type.  A client message or
@@ -675,7 +745,7 @@ relay6_recv(s, fromclient)
 		case DH6_DECLINE:
 		case DH6_INFORM_REQ:
 		case DH6_RELAY_FORW:
-			relay_to_server(dh6, len, (struct sockaddr_in6 *)&from,
+			relay_to_server(dh6, len, (struct sockaddr_in6 *)from,
 			    ifname, htonl(pi->ipi6_ifindex));
 			break;
 		case DH6_RELAY_REPLY:
@@ -685,13 +755,14 @@ relay6_recv(s, fromclient)
 			 * XXX: need to clarify the port issue
 			 */
 			relay_to_client((struct dhcp6_relay *)dh6, len,
-			    (struct sockaddr *)&from);
+			    from);
 			break;
 		default:
 			dprintf(LOG_INFO, FNAME,
 			    "unexpected message (%s) on the client side "
 			    "from %s", dhcp6msgstr(dh6->dh6_msgtype),
-			    addr2str((struct sockaddr *)&from));
+			    addr2str(from));
+			relay6_drop(dh6->dh6_msgtype, STATS_DROP_BADTYPE);
 			break;
 		}
 	} else {
@@ -699,58 +770,13 @@ relay6_recv(s, fromclient)
 			dprintf(LOG_INFO, FNAME,
 			    "unexpected message (%s) on the server side"
 			    "from %s", dhcp6msgstr(dh6->dh6_msgtype),
-			    addr2str((struct sockaddr *)&from));
+			    addr2str(from));
+			relay6_drop(dh6->dh6_msgtype, STATS_DROP_BADTYPE);
 			return;
 		}
 		relay_to_client((struct dhcp6_relay *)dh6, len,
-		    (struct sockaddr *)&from);
-	}
-}
-
-static int
-make_msgcontrol(mh, ctlbuf, buflen, pktinfo, hlim)
-	struct msghdr *mh;
-	void *ctlbuf;
-	socklen_t buflen;
-	struct in6_pktinfo *pktinfo;
-	int hlim;
-{
-	struct cmsghdr *cm;
-	socklen_t controllen;
-
-	controllen = 0;
-	if (pktinfo)
-		controllen += CMSG_SPACE(sizeof (*pktinfo));
-	if (hlim > 0)
-		controllen += CMSG_SPACE(sizeof (hlim));
-	if (buflen < controllen)
-		return (-1);
-
-	memset(ctlbuf, 0, buflen);
-	mh->msg_controllen = controllen;
-	mh->msg_control = ctlbuf;
-
-	cm = (struct cmsghdr *)CMSG_FIRSTHDR(mh);
-	if (pktinfo) {
-		cm->cmsg_len = CMSG_LEN(sizeof (*pktinfo));
-		cm->cmsg_level = IPPROTO_IPV6;
-		cm->cmsg_type = IPV6_PKTINFO;
-		memcpy(CMSG_DATA((struct cmsghdr *)cm), pktinfo,
-		    sizeof (*pktinfo));
-
-		cm = CMSG_NXTHDR(mh, cm);
+		    from);
 	}
-
-	if (hlim > 0) {
-		cm->cmsg_len = CMSG_LEN(sizeof (hlim));
-		cm->cmsg_level = IPPROTO_IPV6;
-		cm->cmsg_type = IPV6_HOPLIMIT;
-		*(int *)CMSG_DATA((struct cmsghdr *)cm) = hlim;
-
-		cm = CMSG_NXTHDR(mh, cm); /* just in case */
-	}
-
-	return (0);
 }
 
 static void
@@ -761,53 +787,12 @@ relay_to_server(dh6, len, from, ifname, ifid)
 	char *ifname;
 	unsigned int ifid;
 {
-	struct dhcp6_optinfo optinfo;
-	struct dhcp6_relay *dh6relay;
-	struct in6_addr linkaddr;
+	struct in6_addr linkaddr, *linkaddrp;
 	struct prefix_list *p;
-	int optlen, relaylen;
-	int cc;
-	struct msghdr mh;
-	static struct iovec iov[2];
-	u_char relaybuf[sizeof (*dh6relay) + BUFSIZ];
-	struct in6_pktinfo pktinfo;
-	char ctlbuf[CMSG_SPACE(sizeof (struct in6_pktinfo))
-	    + CMSG_SPACE(sizeof (int))];
-
-	/*
-	 * Prepare a relay forward option.
-	 */
-	dhcp6_init_options(&optinfo);
-
-	/* Relay message */
-	if ((optinfo.relaymsg_msg = malloc(len)) == NULL) {
-		dprintf(LOG_WARNING, FNAME,
-		    "failed to allocate memory to copy the original packet: "
-		    "%s", strerror(errno));
-		goto out;
-	}
-	optinfo.relaymsg_len = len;
-	memcpy(optinfo.relaymsg_msg, dh6, len);
-
-	/* Interface-id.  We always use this option. */
-	if ((optinfo.ifidopt_id = malloc(sizeof (ifid))) == NULL) {
-		dprintf(LOG_WARNING, FNAME,
-		    "failed to allocate memory for IFID: %s", strerror(errno));
-		goto out;
-	}
-	optinfo.ifidopt_len = sizeof (ifid);
-	memcpy(optinfo.ifidopt_id, &ifid, sizeof (ifid));
-
-	/*
-	 * Construct a relay forward message.
-	 */
-	memset(relaybuf, 0, sizeof (relaybuf));
-
-	dh6relay = (struct dhcp6_relay *)relaybuf;
-	memset(dh6relay, 0, sizeof (*dh6relay));
-	dh6relay->dh6relay_msgtype = DH6_RELAY_FORW;
-	memcpy(&dh6relay->dh6relay_peeraddr, &from->sin6_addr,
-	    sizeof (dh6relay->dh6relay_peeraddr));
+	char *relaymsg;
+	int relaylen, hcnt;
+	struct in6_pktinfo pktinfo, *pi = NULL;
+	int hlim = 0;
 
 	/* find a global address to fill in the link address field */
 	memset(&linkaddr, 0, sizeof (linkaddr));
@@ -826,8 +811,10 @@ relay_to_server(dh6, len, from, ifname, ifid)
 		 * XXX: this may be too strong for the stateless case, but
 		 * the DHCPv6 specification seems to require the behavior. 
 		 */
-		if (dh6->dh6_msgtype != DH6_RELAY_FORW)
-			goto out;
+		if (dh6->dh6_msgtype != DH6_RELAY_FORW) {
+			relay6_drop(dh6->dh6_msgtype, STATS_DROP_NOLINK);
+			return;
+		}
 	}
 
 	if (dh6->dh6_msgtype == DH6_RELAY_FORW) {
@@ -843,71 +830,55 @@ relay_to_server(dh6, len, from, ifname, ifid)
 		 */
 		if (dh6relay0->dh6relay_hcnt >= DHCP6_RELAY_HOP_COUNT_LIMIT) {
 			dprintf(LOG_INFO, FNAME, "too many relay forwardings");
-			goto out;
+			relay6_drop(DH6_RELAY_FORW, STATS_DROP_HOPLIMIT);
+			return;
 		}
 
-		dh6relay->dh6relay_hcnt = dh6relay0->dh6relay_hcnt + 1;
+		hcnt = dh6relay0->dh6relay_hcnt + 1;
 
 		/*
 		 * We can keep the link-address field 0, regardless of the
 		 * scope of the source address, since we always include
 		 * interface-ID option.
 		 */
+		linkaddrp = NULL;
 	} else {
 		/* Relaying a Message from a Client */
-		memcpy(&dh6relay->dh6relay_linkaddr, &linkaddr,
-		    sizeof (dh6relay->dh6relay_linkaddr));
-		dh6relay->dh6relay_hcnt = 0;
+		linkaddrp = &linkaddr;
+		hcnt = 0;
 	}
 
-	relaylen = sizeof (*dh6relay);
-	if ((optlen = dhcp6_set_options(DH6_RELAY_FORW,
-	    (struct dhcp6opt *)(dh6relay + 1),
-	    (struct dhcp6opt *)(relaybuf + sizeof (relaybuf)),
-	    &optinfo)) < 0) {
-		dprintf(LOG_INFO, FNAME,
-		    "failed to construct relay options");
-		goto out;
-	}
-	relaylen += optlen;
+	/*
+	 * Construct a relay forward message around the received one,
+	 * in the room reserved in the receive buffer.  We always use the
+	 * interface-id option.
+	 */
+	relaymsg = (char *)dh6;
+	relaylen = len;
+	dhcp6_encap_relay(&relaymsg, &relaylen, DH6_RELAY_FORW, hcnt,
+	    linkaddrp, &from->sin6_addr, &ifid, sizeof (ifid));
 
 	/*
-	 * Forward the message.
+	 * Forward the message.  It is actually sent when the current
+	 * batch is flushed.
 	 */
-	memset(&mh, 0, sizeof (mh));
-	iov[0].iov_base = relaybuf;
-	iov[0].iov_len = relaylen;
-	mh.msg_iov = iov;
-	mh.msg_iovlen = 1;
-	mh.msg_name = &sa6_server;
-	mh.msg_namelen = sizeof (sa6_server);
 	if (IN6_IS_ADDR_MULTICAST(&sa6_server.sin6_addr)) {
 		memset(&pktinfo, 0, sizeof (pktinfo));
 		pktinfo.ipi6_ifindex = relayifid;
-		if (make_msgcontrol(&mh, ctlbuf, sizeof (ctlbuf),
-		    &pktinfo, mhops)) {
-			dprintf(LOG_WARNING, FNAME,
-			    "failed to make message control data");
-			goto out;
-		}
+		pi = &pktinfo;
+		hlim = mhops;
 	}
 
-	if ((cc = sendmsg(ssock, &mh, 0)) < 0) {
-		dprintf(LOG_WARNING, FNAME,
-		    "sendmsg %s failed: %s",
-		    addr2str((struct sockaddr *)&sa6_server), strerror(errno));
-	} else if (cc != relaylen) {
-		dprintf(LOG_WARNING, FNAME,
-		    "failed to send a complete packet to %s",
-		    addr2str((struct sockaddr *)&sa6_server));
-	} else {
+	if (pktbatch_send(ssock, txbatch, relaymsg, relaylen, &sa6_server,
+	    pi, hlim) == 0) {
+		trace_send(pi ? pi->ipi6_ifindex : 0, &sa6_server, relaymsg,
+		    relaylen);
+		stats->ifs[stats_ifslot(relayifid)].tx[DH6_RELAY_FORW]++;
+		stats->hops[STATS_HOP(hcnt)]++;
 		dprintf(LOG_DEBUG, FNAME,
 		    "relay a message to a server %s",
 		    addr2str((struct sockaddr *)&sa6_server));
 	}
-
-  out:
-	dhcp6_clear_options(&optinfo);
 }
 
 static void
@@ -920,13 +891,9 @@ relay_to_client(dh6relay, len, from)
 	struct sockaddr_in6 peer;
 	unsigned int ifid;
 	char ifnamebuf[IFNAMSIZ];
-	int cc;
-	int relayed = 0;
+	int relayed = 0, ifslot;
 	struct dhcp6 *dh6;
-	struct msghdr mh;
 	struct in6_pktinfo pktinfo;
-	static struct iovec iov[2];
-	char ctlbuf[CMSG_SPACE(sizeof (struct in6_pktinfo))];
 
 	dprintf(LOG_DEBUG, FNAME,
 	    "dhcp6 relay reply: hop=%d, linkaddr=%s, peeraddr=%s",
@@ -941,6 +908,7 @@ relay_to_client(dh6relay, len, from)
 	if (dhcp6_get_options((struct dhcp6opt *)(dh6relay + 1),
 	    (struct dhcp6opt *)((char *)dh6relay + len), &optinfo) < 0) {
 		dprintf(LOG_INFO, FNAME, "failed to parse options");
+		relay6_drop(DH6_RELAY_REPLY, STATS_DROP_OPTIONS);
 		return;
 	}
 
@@ -948,6 +916,7 @@ relay_to_client(dh6relay, len, from)
 	if (optinfo.relaymsg_msg == NULL) {
 		dprintf(LOG_INFO, FNAME, "relay reply message from %s "
 		    "without a relay message", addr2str(from));
+		relay6_drop(DH6_RELAY_REPLY, STATS_DROP_RELAY);
 		goto out;
 	}
 
@@ -955,6 +924,7 @@ relay_to_client(dh6relay, len, from)
 	if (optinfo.relaymsg_len < sizeof (struct dhcp6)) {
 		dprintf(LOG_INFO, FNAME, "short relay message from %s",
 		    addr2str(from));
+		relay6_drop(DH6_RELAY_REPLY, STATS_DROP_RELAY);
 		goto out;
 	}
 
@@ -968,6 +938,7 @@ relay_to_client(dh6relay, len, from)
 			dprintf(LOG_INFO, FNAME,
 			    "unexpected length (%d) for Interface ID from %s",
 			    optinfo.ifidopt_len, addr2str(from));
+			relay6_drop(DH6_RELAY_REPLY, STATS_DROP_RELAY);
 			goto out;
 		} else {
 			memcpy(&ifid, optinfo.ifidopt_id, sizeof (ifid));
@@ -977,6 +948,7 @@ relay_to_client(dh6relay, len, from)
 			if ((if_indextoname(ifid, ifnamebuf)) == NULL) {
 				dprintf(LOG_INFO, FNAME,
 				    "invalid interface ID: %x", ifid);
+				relay6_drop(DH6_RELAY_REPLY, STATS_DROP_NOLINK);
 				goto out;
 			}
 		}
@@ -1000,6 +972,7 @@ relay_to_client(dh6relay, len, from)
 
 	if (ifid == 0) {
 		dprintf(LOG_INFO, FNAME, "failed to determine relay link");
+		relay6_drop(DH6_RELAY_REPLY, STATS_DROP_NOLINK);
 		goto out;
 	}
 
@@ -1019,32 +992,15 @@ relay_to_client(dh6relay, len, from)
 	if (IN6_IS_ADDR_LINKLOCAL(&peer.sin6_addr))
 		peer.sin6_scope_id = ifid; /* XXX: we assume a 1to1 map */
 
-	/* construct a message structure specifying the outgoing interface */
-	memset(&mh, 0, sizeof (mh));
-	iov[0].iov_base = optinfo.relaymsg_msg;
-	iov[0].iov_len = optinfo.relaymsg_len;
-	mh.msg_iov = iov;
-	mh.msg_iovlen = 1;
-	mh.msg_name = &peer;
-	mh.msg_namelen = sizeof (peer);
+	/* queue the packet specifying the outgoing interface */
 	memset(&pktinfo, 0, sizeof (pktinfo));
 	pktinfo.ipi6_ifindex = ifid;
-	if (make_msgcontrol(&mh, ctlbuf, sizeof (ctlbuf), &pktinfo, 0)) {
-		dprintf(LOG_WARNING, FNAME,
-		    "failed to make message control data");
-		goto out;
-	}
-
-	/* send packet */
-	if ((cc = sendmsg(csock, &mh, 0)) < 0) {
-		dprintf(LOG_WARNING, FNAME,
-		    "sendmsg to %s failed: %s",
-		    addr2str((struct sockaddr *)&peer), strerror(errno));
-	} else if (cc != optinfo.relaymsg_len) {
-		dprintf(LOG_WARNING, FNAME,
-		    "failed to send a complete packet to %s",
-		    addr2str((struct sockaddr *)&peer));
-	} else {
+	if (pktbatch_send(csock, txbatch, optinfo.relaymsg_msg,
+	    optinfo.relaymsg_len, &peer, &pktinfo, 0) == 0) {
+		trace_send(ifid, &peer, optinfo.relaymsg_msg,
+		    optinfo.relaymsg_len);
+		ifslot = stats_ifslot(ifid);
+		stats->ifs[ifslot].tx[STATS_MSGTYPE(dh6->dh6_msgtype)]++;
 		dprintf(LOG_DEBUG, FNAME,
 		    "relay a message to a client %s",
 		    addr2str((struct sockaddr *)&peer));
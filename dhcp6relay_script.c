@@ -32,7 +32,6 @@
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <sys/queue.h>
-#include <sys/wait.h>
 #include <sys/stat.h>
 
 #if TIME_WITH_SYS_TIME
@@ -48,7 +47,6 @@
 
 #include <netinet/in.h>
 
-#include <fcntl.h>
 #include <unistd.h>
 #include <stdlib.h>
 #include <stdio.h>
@@ -59,6 +57,7 @@
 #include "dhcp6.h"
 #include "config.h"
 #include "common.h"
+#include "script.h"
 
 static char client_str[] = "client";
 static char buf[BUFSIZ];
@@ -78,7 +77,6 @@ relay6_script(scriptpath, client, dh6, len)
 	int i, j, iapds, ianas, envc, elen, ret = 0;
 	char **envp, *s, *t;
 	struct dhcp6_listval *v;
-	pid_t pid, wpid;
 
 	/* if a script is not specified, do nothing */
 	if (scriptpath == NULL || strlen(scriptpath) == 0)
@@ -164,54 +162,11 @@ relay6_script(scriptpath, client, dh6, len)
 		}
 	}
 
-	/* launch the script */
-	pid = fork();
-	if (pid < 0) {
-		dprintf(LOG_ERR, FNAME, "failed to fork: %s", strerror(errno));
-		ret = -1;
-		goto clean;
-	} else if (pid) {
-		int wstatus;
-
-		do {
-			wpid = wait(&wstatus);
-		} while (wpid != pid && wpid > 0);
-
-		if (wpid < 0)
-			dprintf(LOG_ERR, FNAME, "wait: %s", strerror(errno));
-		else {
-			dprintf(LOG_DEBUG, FNAME,
-			    "script \"%s\" terminated", scriptpath);
-		}
-	} else {
-		char *argv[2];
-		int fd;
-
-		argv[0] = scriptpath;
-		argv[1] = NULL;
-
-		if (safefile(scriptpath)) {
-			dprintf(LOG_ERR, FNAME,
-			    "script \"%s\" cannot be executed safely",
-			    scriptpath);
-			exit(1);
-		}
-
-		if (foreground == 0 &&
-		    (fd = open("/dev/null", O_RDWR)) != -1) {
-			dup2(fd, STDIN_FILENO);
-			dup2(fd, STDOUT_FILENO);
-			dup2(fd, STDERR_FILENO);
-			if (fd > STDERR_FILENO)
-				close(fd);
-		}
-
-		execve(scriptpath, argv, envp);
+	/* launch the script, which takes the environment */
+	ret = script_run(scriptpath, t, envp);
+	dhcp6_clear_options(&optinfo);
 
-		dprintf(LOG_ERR, FNAME, "child: exec failed: %s",
-		    strerror(errno));
-		exit(0);
-	}
+	return (ret);
 
   clean:
 	for (i = 0; i < envc; i++)
@@ -76,11 +76,20 @@
 #include <dhcp6_ctl.h>
 #include <signal.h>
 #include <lease.h>
+#include <leasedb.h>
+#include <evloop.h>
+#include <pktbatch.h>
+#include <shard.h>
+#include <trace.h>
+#include <stats.h>
+#include <metrics.h>
 
 #define DUID_FILE LOCALDBDIR "/dhcp6s_duid"
+#define LEASEDB_FILE LOCALDBDIR "/dhcp6s_leases"
 #define DHCP6S_CONF SYSCONFDIR "/dhcp6s.conf"
 #define DEFAULT_KEYFILE SYSCONFDIR "/dhcp6sctlkey"
 #define DHCP6S_PIDFILE "/var/run/dhcp6s.pid"
+#define DHCP6S_DUMPFILE "/var/run/dhcp6s.dump"
 
 #define CTLSKEW 300
 
@@ -109,9 +118,45 @@ struct dhcp6_binding {
 	u_int32_t duration;
 	time_t updatetime;
 	struct dhcp6_timer *timer;
+
+	u_int32_t hash;		/* hash value of the identifier */
+	struct binding_client *client;
+	TAILQ_ENTRY(dhcp6_binding) clink; /* bindings of the same client */
 };
 static TAILQ_HEAD(, dhcp6_binding) dhcp6_binding_head;
 
+/* all bindings for a single client DUID */
+struct binding_client {
+	struct duid clientid;
+	u_int32_t hash;
+	TAILQ_HEAD(, dhcp6_binding) bindings;
+};
+
+/*
+ * Open-addressing hash tables (linear probing) to look up bindings by
+ * (DUID, binding type, IA type, IAID), and the binding_client of a DUID.
+ */
+struct binding_slot {
+	u_int32_t hash;
+	void *ptr;		/* NULL: empty, BINDING_SLOT_DELETED: deleted */
+};
+struct binding_htab {
+	struct binding_slot *slots;
+	size_t size;		/* always a power of 2 */
+	size_t count;		/* number of entries */
+	size_t used;		/* number of entries and deleted slots */
+};
+static char binding_slot_deleted;
+#define BINDING_SLOT_DELETED ((void *)&binding_slot_deleted)
+#define BINDING_HTAB_INITSIZE 1024
+static struct binding_htab binding_index, client_index;
+static int binding_count;
+static int binding_restoring;	/* replaying the lease database */
+/* per worker: addresses in its pool part bound by another worker */
+static struct dhcp6_list *foreign_leases;
+static int foreign_journal;	/* the journal scan_foreign_lease() reads */
+static int foreign_failed;
+
 struct relayinfo {
 	TAILQ_ENTRY(relayinfo) link;
 
@@ -126,10 +171,10 @@ TAILQ_HEAD(relayinfolist, relayinfo);
 static int debug = 0;
 static sig_atomic_t sig_flags = 0;
 #define SIGF_TERM 0x1
+#define SIGF_CHLD 0x2
+#define SIGF_USR1 0x4
 
 const dhcp6_mode_t dhcp6_mode = DHCP6_MODE_SERVER;
-char *device = NULL;
-int ifidx;
 int insock;			/* inbound UDP port */
 int outsock;			/* outbound UDP port */
 int ctlsock = -1;		/* control TCP port */
@@ -137,17 +182,30 @@ char *ctladdr = DEFAULT_SERVER_CONTROL_ADDR;
 char *ctlport = DEFAULT_SERVER_CONTROL_PORT;
 
 static const struct sockaddr_in6 *sa6_any_downstream, *sa6_any_relay;
-static struct msghdr rmh;
-static char rdatabuf[BUFSIZ];
-static int rmsgctllen;
+static struct pktbatch_rx *rxbatch;
+static struct pktbatch_tx *txbatch;
+static struct dhcp6_arena *pktarena;	/* per-packet allocations */
+static int rxbatch_size = PKTBATCH_DEFAULT;
+static int nworkers = 1;
+static long hostconf_max;	/* -H, shared out among the workers */
+static int logbuffer = 0;
+static int shardsock = -1;	/* messages from the dispatcher */
 static char *conffile = DHCP6S_CONF;
-static char *rmsgctlbuf;
 static struct duid server_duid;
 static struct dhcp6_list arg_dnslist;
 static char *ctlkeyfile = DEFAULT_KEYFILE;
 static struct keyinfo *ctlkey = NULL;
 static int ctldigestlen;
 static char *pid_file = DHCP6S_PIDFILE;
+static char *dump_file = DHCP6S_DUMPFILE;
+static char *metrics_addr = NULL;	/* -M */
+static char *leasedb_file = NULL;	/* -L */
+static char *trace_file = NULL;		/* -T */
+static char *replay_file = NULL;	/* -R */
+static struct timespec replay_start;
+static u_int64_t replay_packets;
+static struct dhcp6_vbuf statelessinfo;	/* pre-encoded stateless options */
+static int drop_reason;		/* why the current message was discarded */
 
 static inline int get_val32 __P((char **, int *, u_int32_t *));
 static inline int get_val __P((char **, int *, void *, size_t));
@@ -155,15 +213,33 @@ static inline int get_val __P((char **, int *, void *, size_t));
 static void usage __P((void));
 static void server6_init __P((void));
 static void server6_mainloop __P((void));
+static void server6_replaydone __P((void));
 static int server6_do_ctlcommand __P((char *, ssize_t));
+static void server6_ctlstats __P((void));
+static size_t server6_metrics __P((char *, size_t));
+static void server6_publish __P((void));
+static void server6_flush __P((void));
+static void server6_drop __P((int, int));
 static void server6_reload __P((void));
 static void server6_stop __P((void));
-static void server6_recv __P((int));
+static void server6_insock __P((void));
+static void server6_outsock __P((void));
+static int server6_remove_ia __P((struct duid *, u_int32_t));
+static void server6_recv __P((struct msghdr *, ssize_t));
+static struct in6_pktinfo *server6_pktinfo __P((struct msghdr *));
+static void server6_process __P((char *, ssize_t, struct sockaddr *, int,
+    struct in6_pktinfo *));
+static void server6_input __P((int, void *));
+static void server6_dispatch __P((int, void *));
+static void server6_shardinput __P((int, void *));
+static void server6_ctlaccept __P((int, void *));
 static void process_signals __P((void));
 static void server6_signal __P((int));
 static void free_relayinfo __P((struct relayinfo *));
 static int process_relayforw __P((struct dhcp6 **, struct dhcp6opt **,
     struct relayinfolist *, struct sockaddr *));
+static void make_statelessinfo __P((void));
+static int copy_statelessinfo __P((struct dhcp6_optinfo *));
 static int set_statelessinfo __P((int, struct dhcp6_optinfo *));
 static int react_solicit __P((struct dhcp6_if *, struct dhcp6 *, ssize_t,
     struct dhcp6_optinfo *, struct sockaddr *, int, struct relayinfolist *));
@@ -213,6 +289,25 @@ static struct dhcp6_binding *find_binding __P((struct duid *,
 static void update_binding __P((struct dhcp6_binding *));
 static void remove_binding __P((struct dhcp6_binding *));
 static void free_binding __P((struct dhcp6_binding *));
+static u_int32_t binding_hash __P((struct duid *, dhcp6_bindingtype_t, int,
+    u_int32_t));
+static int binding_htab_insert __P((struct binding_htab *, u_int32_t,
+    void *));
+static void binding_htab_delete __P((struct binding_htab *, u_int32_t,
+    void *));
+static int binding_index_add __P((struct dhcp6_binding *));
+static void binding_index_remove __P((struct dhcp6_binding *));
+static struct binding_client *find_binding_client __P((struct duid *));
+static void save_binding __P((struct dhcp6_binding *));
+static void dump_bindings __P((void));
+static int journal_owner __P((struct duid *));
+static int restore_binding __P((int, struct duid *, int, u_int32_t, time_t,
+    struct dhcp6_list *));
+static void restore_bindings __P((void));
+static int scan_foreign_lease __P((int, struct duid *, int, u_int32_t,
+    time_t, struct dhcp6_list *));
+static int find_foreign_leases __P((void));
+static void reserve_foreign_leases __P((void));
 static struct dhcp6_timer *binding_timo __P((void *));
 static struct dhcp6_listval *find_binding_ia __P((struct dhcp6_listval *,
     struct dhcp6_binding *));
@@ -229,7 +324,8 @@ main(argc, argv)
 	int ch, pid;
 	struct in6_addr a;
 	struct dhcp6_listval *dlv;
-	char *progname;
+	struct dhcp6_if *ifp;
+	char *progname, *p;
 	FILE *pidfp;
 
 	if ((progname = strrchr(*argv, '/')) == NULL)
@@ -251,8 +347,21 @@ main(argc, argv)
 	TAILQ_INIT(&bcmcsnamelist);
 
 	srandom(time(NULL) & getpid());
-	while ((ch = getopt(argc, argv, "c:dDfk:n:p:P:")) != -1) {
+	duidhash_seed = (u_int32_t)random();
+	while ((ch = getopt(argc, argv, "aB:c:dDF:fH:k:L:M:n:p:P:R:T:w:")) != -1) {
 		switch (ch) {
+		case 'a':
+			logbuffer = 1;
+			break;
+		case 'B':
+			p = NULL;
+			rxbatch_size = (int)strtol(optarg, &p, 10);
+			if (!*optarg || *p ||
+			    rxbatch_size < 1 || rxbatch_size > PKTBATCH_MAX) {
+				errx(1, "illegal batch size: %s", optarg);
+				/* NOTREACHED */
+			}
+			break;
 		case 'c':
 			conffile = optarg;
 			break;
@@ -262,12 +371,30 @@ main(argc, argv)
 		case 'D':
 			debug = 2;
 			break;
+		case 'F':
+			dump_file = optarg;
+			break;
 		case 'f':
 			foreground++;
 			break;
+		case 'H':
+			p = NULL;
+			hostconf_max = strtol(optarg, &p, 10);
+			if (!*optarg || *p || hostconf_max < 1) {
+				errx(1, "illegal number of host "
+				    "configurations: %s", optarg);
+				/* NOTREACHED */
+			}
+			break;
 		case 'k':
 			ctlkeyfile = optarg;
 			break;
+		case 'L':
+			leasedb_file = optarg;
+			break;
+		case 'M':
+			metrics_addr = optarg;
+			break;
 		case 'n':
 			warnx("-n dnsserv option was obsoleted.  "
 			    "use configuration file.");
@@ -288,6 +415,22 @@ main(argc, argv)
 		case 'P':
 			pid_file = optarg;
 			break;
+		case 'R':
+			replay_file = optarg;
+			break;
+		case 'T':
+			trace_file = optarg;
+			break;
+		case 'w':
+			p = NULL;
+			nworkers = (int)strtol(optarg, &p, 10);
+			if (!*optarg || *p ||
+			    nworkers < 1 || nworkers > SHARD_MAX) {
+				errx(1, "illegal number of workers: %s",
+				    optarg);
+				/* NOTREACHED */
+			}
+			break;
 		default:
 			usage();
 			/* NOTREACHED */
@@ -296,19 +439,30 @@ main(argc, argv)
 	argc -= optind;
 	argv += optind;
 
-	if (argc != 1) {
+	if (argc < 1) {
 		usage();
 		/* NOTREACHED */
 	}
-	device = argv[0];
+
+	/*
+	 * A replay must not disturb a server running on this host: it has
+	 * no PID file, and records bindings only in an explicit -L file.
+	 */
+	if (replay_file)
+		pid_file = NULL;
+	else if (leasedb_file == NULL)
+		leasedb_file = LEASEDB_FILE;
 
 	if (foreground == 0)
 		openlog(progname, LOG_NDELAY|LOG_PID, LOG_DAEMON);
 
 	setloglevel(debug);
 
-	if (ifinit(device) == NULL)
-		exit(1);
+	while (argc-- > 0) {
+		if (ifinit(*argv) == NULL)
+			exit(1);
+		argv++;
+	}
 
 	if ((cfparse(conffile)) != 0) {
 		dprintf(LOG_ERR, FNAME, "failed to parse configuration file");
@@ -322,7 +476,7 @@ main(argc, argv)
 
 	/* dump current PID */
 	pid = getpid();
-	if ((pidfp = fopen(pid_file, "w")) != NULL) {
+	if (pid_file && (pidfp = fopen(pid_file, "w")) != NULL) {
 		fprintf(pidfp, "%d\n", pid);
 		fclose(pidfp);
 	}
@@ -337,6 +491,84 @@ main(argc, argv)
 		dhcp6_move_list(&dnslist, &arg_dnslist);
 		TAILQ_INIT(&arg_dnslist);
 	}
+	make_statelessinfo();
+
+	if (hostconf_max > 0 && set_dynamic_hostconf_max((size_t)
+	    (hostconf_max + nworkers - 1) / nworkers) != 0)
+		exit(1);
+
+	/* counters for the dispatcher and each worker, shared among them */
+	if (stats_init(nworkers + 1) != 0)
+		exit(1);
+	for (ifp = dhcp6_if; ifp; ifp = ifp->next)
+		(void)stats_addif(ifp->ifname, ifp->ifid);
+
+	/*
+	 * The journals may have been written by a different number of
+	 * workers; move each binding to the journal of its owner now, or it
+	 * would be dropped and its leases given again.
+	 */
+	if (!replay_file &&
+	    leasedb_partition(leasedb_file, nworkers, journal_owner) != 0) {
+		dprintf(LOG_ERR, FNAME,
+		    "failed to arrange the lease journals for %d workers",
+		    nworkers);
+		exit(1);
+	}
+	if (!replay_file && nworkers > 1 && find_foreign_leases() != 0) {
+		dprintf(LOG_ERR, FNAME,
+		    "failed to read the addresses in the lease journals");
+		exit(1);
+	}
+
+	if (replay_file) {
+		if (nworkers > 1) {
+			dprintf(LOG_ERR, FNAME,
+			    "a trace is replayed by a single worker");
+			exit(1);
+		}
+		if (shard_replay(replay_file, &shardsock) != 0)
+			exit(1);
+	} else if (nworkers > 1) {
+		if (shard_start(nworkers, &shardsock) != 0)
+			exit(1);
+		if (SHARD_WORKER()) {
+			/* each worker has its own journal and pool slices */
+			size_t len = strlen(leasedb_file) + 16;
+
+			if ((p = malloc(len)) == NULL) {
+				dprintf(LOG_ERR, FNAME,
+				    "memory allocation failed");
+				exit(1);
+			}
+			snprintf(p, len, "%s.%d", leasedb_file, shard_id);
+			leasedb_file = p;
+			lease_partition(shard_id, shard_count);
+
+			if (trace_file) {
+				len = strlen(trace_file) + 16;
+				if ((p = malloc(len)) == NULL) {
+					dprintf(LOG_ERR, FNAME,
+					    "memory allocation failed");
+					exit(1);
+				}
+				snprintf(p, len, "%s.%d", trace_file,
+				    shard_id);
+				trace_file = p;
+			}
+		}
+	}
+
+	if (SHARD_WORKER())
+		stats_attach(shard_id + 1);
+
+	/* after forking the workers, as each process has its own buffer */
+	if (logbuffer && setlogbuffer(DHCP6_LOGBUF_SIZE) != 0)
+		exit(1);
+	/* the dispatcher only passes packets on */
+	if (trace_file && !SHARD_DISPATCHER() &&
+	    trace_open(trace_file, TRACE_SIZE_DEFAULT) != 0)
+		exit(1);
 
 	server6_init();
 
@@ -348,8 +580,11 @@ static void
 usage()
 {
 	fprintf(stderr,
-	    "usage: dhcp6s [-c configfile] [-dDf] [-k ctlkeyfile] "
-	    "[-p ctlport] [-P pidfile] intface\n");
+	    "usage: dhcp6s [-B batchsize] [-c configfile] [-adDf] "
+	    "[-F dumpfile] [-H hostconfs] [-k ctlkeyfile] [-L leasefile] "
+	    "[-M [address:]port] [-p ctlport] [-P pidfile] "
+	    "[-R tracefile] [-T tracefile] [-w workers] "
+	    "intface [intface...]\n");
 	exit(0);
 }
 
@@ -358,26 +593,20 @@ usage()
 void
 server6_init()
 {
-	struct addrinfo hints;
-	struct addrinfo *res, *res2;
-	int error;
-	int on = 1;
-	struct ipv6_mreq mreq6;
-	static struct iovec iov;
-	static struct sockaddr_in6 sa6_any_downstream_storage;
-	static struct sockaddr_in6 sa6_any_relay_storage;
+	evloop_handler_t input;
+	size_t bufsize;
 
-	TAILQ_INIT(&dhcp6_binding_head);
-	if (lease_init() != 0) {
-		dprintf(LOG_ERR, FNAME, "failed to initialize the lease table");
-		exit(1);
-	}
-
-	ifidx = if_nametoindex(device);
-	if (ifidx == 0) {
-		dprintf(LOG_ERR, FNAME, "invalid interface %s", device);
-		exit(1);
+	/* the dispatcher only passes packets to the workers */
+	if (!SHARD_DISPATCHER()) {
+		TAILQ_INIT(&dhcp6_binding_head);
+		if (lease_init() != 0) {
+			dprintf(LOG_ERR, FNAME,
+			    "failed to initialize the lease table");
+			exit(1);
+		}
+		restore_bindings();
 	}
+	reserve_foreign_leases();
 
 	/* get our DUID */
 	if (get_duid(DUID_FILE, &server_duid)) {
@@ -385,24 +614,89 @@ server6_init()
 		exit(1);
 	}
 
-	if (dhcp6_ctl_authinit(ctlkeyfile, &ctlkey, &ctldigestlen) != 0) {
+	if (!SHARD_WORKER() &&
+	    dhcp6_ctl_authinit(ctlkeyfile, &ctlkey, &ctldigestlen) != 0) {
 		dprintf(LOG_NOTICE, FNAME,
 		    "failed to initialize control message authentication");
 		/* run the server anyway */
 	}
 
-	/* initialize send/receive buffer */
-	iov.iov_base = (caddr_t)rdatabuf;
-	iov.iov_len = sizeof(rdatabuf);
-	rmh.msg_iov = &iov;
-	rmh.msg_iovlen = 1;
-	rmsgctllen = CMSG_SPACE(sizeof(struct in6_pktinfo));
-	if ((rmsgctlbuf = (char *)malloc(rmsgctllen)) == NULL) {
-		dprintf(LOG_ERR, FNAME, "memory allocation failed");
+	/* initialize receive and transmit buffers */
+	bufsize = BUFSIZ;
+	if (SHARD_WORKER())
+		bufsize += sizeof(struct shard_msg);
+	if ((rxbatch = pktbatch_rx_create(rxbatch_size, bufsize, 0)) == NULL)
+		exit(1);
+	if (!SHARD_DISPATCHER() &&
+	    (txbatch = pktbatch_tx_create(rxbatch_size, BUFSIZ)) == NULL)
+		exit(1);
+	if (!SHARD_DISPATCHER() &&
+	    (pktarena = dhcp6_arena_create(DHCP6_ARENA_SIZE)) == NULL)
+		exit(1);
+
+	/* initialize sockets */
+	if (!SHARD_WORKER())
+		server6_insock();
+	if (!SHARD_DISPATCHER())
+		server6_outsock();
+
+	/* set up control socket */
+	if (SHARD_WORKER())
+		;		/* commands come through the dispatcher */
+	else if (ctlkey == NULL)
+		dprintf(LOG_NOTICE, FNAME, "skip opening control port");
+	else if (dhcp6_ctl_init(ctladdr, ctlport,
+	    DHCP6CTL_DEF_COMMANDQUEUELEN, &ctlsock)) {
+		dprintf(LOG_ERR, FNAME,
+		    "failed to initialize control channel");
+		exit(1);
+	}
+
+	if (SHARD_WORKER())
+		input = server6_shardinput;
+	else if (SHARD_DISPATCHER())
+		input = server6_dispatch;
+	else
+		input = server6_input;
+	if (evloop_init() != 0 ||
+	    evloop_add(SHARD_WORKER() ? shardsock : insock, EVLOOP_EDGE,
+	    input, NULL) != 0 ||
+	    (ctlsock >= 0 &&
+	    evloop_add(ctlsock, 0, server6_ctlaccept, NULL) != 0)) {
+		dprintf(LOG_ERR, FNAME, "failed to set up the event loop");
+		exit(1);
+	}
+
+	/* the workers' counters are served by the dispatcher */
+	if (metrics_addr && !SHARD_WORKER() &&
+	    metrics_init(metrics_addr, server6_metrics) != 0) {
+		dprintf(LOG_ERR, FNAME, "failed to open the metrics listener");
 		exit(1);
 	}
 
-	/* initialize socket */
+	if (signal(SIGTERM, server6_signal) == SIG_ERR ||
+	    (SHARD_DISPATCHER() && signal(SIGCHLD, server6_signal) == SIG_ERR) ||
+	    signal(SIGUSR1,
+	    SHARD_WORKER() ? SIG_IGN : server6_signal) == SIG_ERR) {
+		dprintf(LOG_WARNING, FNAME, "failed to set signal: %s",
+		    strerror(errno));
+		exit(1);
+	}
+	return;
+}
+
+static void
+server6_insock()
+{
+	struct addrinfo hints;
+	struct addrinfo *res, *res2;
+	int error;
+	int on = 1;
+	struct ipv6_mreq mreq6;
+	struct dhcp6_if *ifp;
+	static char *groups[] = { DH6ADDR_ALLAGENT, DH6ADDR_ALLSERVER };
+	size_t i;
+
 	memset(&hints, 0, sizeof(hints));
 	hints.ai_family = AF_INET6;
 	hints.ai_socktype = SOCK_DGRAM;
@@ -463,50 +757,46 @@ server6_init()
 	}
 	freeaddrinfo(res);
 
-	hints.ai_flags = 0;
-	error = getaddrinfo(DH6ADDR_ALLAGENT, DH6PORT_UPSTREAM, &hints, &res2);
-	if (error) {
-		dprintf(LOG_ERR, FNAME, "getaddrinfo: %s",
-		    gai_strerror(error));
-		exit(1);
-	}
-	memset(&mreq6, 0, sizeof(mreq6));
-	mreq6.ipv6mr_interface = ifidx;
-	memcpy(&mreq6.ipv6mr_multiaddr,
-	    &((struct sockaddr_in6 *)res2->ai_addr)->sin6_addr,
-	    sizeof(mreq6.ipv6mr_multiaddr));
-	if (setsockopt(insock, IPPROTO_IPV6, IPV6_JOIN_GROUP,
-	    &mreq6, sizeof(mreq6))) {
-		dprintf(LOG_ERR, FNAME,
-		    "setsockopt(insock, IPV6_JOIN_GROUP): %s",
-		    strerror(errno));
-		exit(1);
+	/* join the multicast groups on every interface we serve */
+	for (i = 0; i < sizeof(groups) / sizeof(groups[0]); i++) {
+		hints.ai_flags = 0;
+		error = getaddrinfo(groups[i], DH6PORT_UPSTREAM, &hints, &res2);
+		if (error) {
+			dprintf(LOG_ERR, FNAME, "getaddrinfo: %s",
+			    gai_strerror(error));
+			exit(1);
+		}
+		for (ifp = dhcp6_if; ifp; ifp = ifp->next) {
+			memset(&mreq6, 0, sizeof(mreq6));
+			mreq6.ipv6mr_interface = ifp->ifid;
+			memcpy(&mreq6.ipv6mr_multiaddr,
+			    &((struct sockaddr_in6 *)res2->ai_addr)->sin6_addr,
+			    sizeof(mreq6.ipv6mr_multiaddr));
+			if (setsockopt(insock, IPPROTO_IPV6, IPV6_JOIN_GROUP,
+			    &mreq6, sizeof(mreq6))) {
+				dprintf(LOG_ERR, FNAME,
+				    "setsockopt(insock, IPV6_JOIN_GROUP) "
+				    "on %s: %s", ifp->ifname, strerror(errno));
+				exit(1);
+			}
+		}
+		freeaddrinfo(res2);
 	}
-	freeaddrinfo(res2);
+}
 
-	hints.ai_flags = 0;
-	error = getaddrinfo(DH6ADDR_ALLSERVER, DH6PORT_UPSTREAM,
-			    &hints, &res2);
-	if (error) {
-		dprintf(LOG_ERR, FNAME, "getaddrinfo: %s",
-		    gai_strerror(error));
-		exit(1);
-	}
-	memset(&mreq6, 0, sizeof(mreq6));
-	mreq6.ipv6mr_interface = ifidx;
-	memcpy(&mreq6.ipv6mr_multiaddr,
-	    &((struct sockaddr_in6 *)res2->ai_addr)->sin6_addr,
-	    sizeof(mreq6.ipv6mr_multiaddr));
-	if (setsockopt(insock, IPPROTO_IPV6, IPV6_JOIN_GROUP,
-	    &mreq6, sizeof(mreq6))) {
-		dprintf(LOG_ERR, FNAME,
-		    "setsockopt(insock, IPV6_JOIN_GROUP): %s",
-		    strerror(errno));
-		exit(1);
-	}
-	freeaddrinfo(res2);
+static void
+server6_outsock()
+{
+	struct addrinfo hints;
+	struct addrinfo *res;
+	int error;
+	static struct sockaddr_in6 sa6_any_downstream_storage;
+	static struct sockaddr_in6 sa6_any_relay_storage;
 
-	hints.ai_flags = 0;
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_INET6;
+	hints.ai_socktype = SOCK_DGRAM;
+	hints.ai_protocol = IPPROTO_UDP;
 	error = getaddrinfo(NULL, DH6PORT_DOWNSTREAM, &hints, &res);
 	if (error) {
 		dprintf(LOG_ERR, FNAME, "getaddrinfo: %s",
@@ -519,9 +809,12 @@ server6_init()
 		    strerror(errno));
 		exit(1);
 	}
-	/* set outgoing interface of multicast packets for DHCP reconfig */
+	/*
+	 * set outgoing interface of multicast packets for DHCP reconfig
+	 * XXX: only on one of the interfaces
+	 */
 	if (setsockopt(outsock, IPPROTO_IPV6, IPV6_MULTICAST_IF,
-	    &ifidx, sizeof(ifidx)) < 0) {
+	    &dhcp6_if->ifid, sizeof(dhcp6_if->ifid)) < 0) {
 		dprintf(LOG_ERR, FNAME,
 		    "setsockopt(outsock, IPV6_MULTICAST_IF): %s",
 		    strerror(errno));
@@ -566,83 +859,239 @@ server6_init()
 	sa6_any_relay =
 		(const struct sockaddr_in6*)&sa6_any_relay_storage;
 	freeaddrinfo(res);
-
-	/* set up control socket */
-	if (ctlkey == NULL)
-		dprintf(LOG_NOTICE, FNAME, "skip opening control port");
-	else if (dhcp6_ctl_init(ctladdr, ctlport,
-	    DHCP6CTL_DEF_COMMANDQUEUELEN, &ctlsock)) {
-		dprintf(LOG_ERR, FNAME,
-		    "failed to initialize control channel");
-		exit(1);
-	}
-
-	if (signal(SIGTERM, server6_signal) == SIG_ERR) {
-		dprintf(LOG_WARNING, FNAME, "failed to set signal: %s",
-		    strerror(errno));
-		exit(1);
-	}
-	return;
 }
 
 static void
 process_signals()
 {
 	if ((sig_flags & SIGF_TERM)) {
-		unlink(pid_file);
+		if (SHARD_DISPATCHER()) {
+			shard_logstats();
+			shard_stop();
+		}
+		pktbatch_rx_logstats(rxbatch,
+		    SHARD_WORKER() ? "worker" : "insock");
+		if (txbatch)
+			pktbatch_tx_logstats(txbatch, "outsock");
+		leasedb_close();
+		trace_close();
+		if (!SHARD_WORKER() && pid_file)
+			unlink(pid_file);
 		exit(0);
 	}
+	if ((sig_flags & SIGF_USR1)) {
+		sig_flags &= ~SIGF_USR1;
+
+		server6_publish();
+		if (stats_dump(dump_file) == 0) {
+			dprintf(LOG_NOTICE, FNAME, "statistics dumped to %s",
+			    dump_file);
+		}
+	}
+	if ((sig_flags & SIGF_CHLD)) {
+		sig_flags &= ~SIGF_CHLD;
+
+		/* the workers' partitions can't be taken over */
+		if (shard_reap() > 0) {
+			dprintf(LOG_ERR, FNAME, "stopping the server");
+			shard_stop();
+			if (pid_file)
+				unlink(pid_file);
+			exit(1);
+		}
+	}
 }
 
 static void
 server6_mainloop()
 {
-	struct timeval *w;
-	int ret;
-	fd_set r;
-	int maxsock;
-
-	
 	while (1) {
 		if (sig_flags)
 			process_signals();
 
-		w = dhcp6_check_timer();
+		evloop_dispatch();
+
+		/* commit binding changes made in this round */
+		leasedb_flush(binding_count);
+
+		server6_publish();
+
+		flushlog();
+	}
+}
+
+/*
+ * insock is edge-triggered: receive batches of packets until it is
+ * drained, and process them in the order of arrival.  Replies to each
+ * batch are queued by server6_send() and sent together at the end.
+ */
+static void
+server6_input(s, arg)
+	int s;
+	void *arg;
+{
+	struct msghdr *mhdr;
+	ssize_t len;
+	int i, n;
 
-		FD_ZERO(&r);
-		FD_SET(insock, &r);
-		maxsock = insock;
-		if (ctlsock >= 0) {
-			FD_SET(ctlsock, &r);
-			maxsock = (insock > ctlsock) ? insock : ctlsock;
-			(void)dhcp6_ctl_setreadfds(&r, &maxsock);
+	do {
+		if ((n = pktbatch_recv(s, rxbatch)) < 0) {
+			dprintf(LOG_ERR, FNAME, "recvmsg: %s",
+			    strerror(errno));
+			return;
 		}
+		for (i = 0; i < n; i++) {
+			mhdr = pktbatch_rx_msg(rxbatch, i, &len);
+			server6_recv(mhdr, len);
+		}
+		server6_flush();
+	} while (n == pktbatch_rx_size(rxbatch));
+}
 
-		ret = select(maxsock + 1, &r, NULL, NULL, w);
-		switch (ret) {
-		case -1:
-			if (errno != EINTR) {
-				dprintf(LOG_ERR, FNAME, "select: %s",
-				    strerror(errno));
-				exit(1);
+/*
+ * The dispatcher passes each packet to the worker that owns the client.
+ */
+static void
+server6_dispatch(s, arg)
+	int s;
+	void *arg;
+{
+	struct msghdr *mhdr;
+	struct in6_pktinfo *pi;
+	struct shard_msg msg;
+	ssize_t len;
+	int i, n;
+
+	memset(&msg, 0, sizeof(msg));
+	msg.type = SHARD_MSG_PACKET;
+
+	do {
+		if ((n = pktbatch_recv(s, rxbatch)) < 0) {
+			dprintf(LOG_ERR, FNAME, "recvmsg: %s",
+			    strerror(errno));
+			return;
+		}
+		for (i = 0; i < n; i++) {
+			mhdr = pktbatch_rx_msg(rxbatch, i, &len);
+			if ((pi = server6_pktinfo(mhdr)) == NULL) {
+				dprintf(LOG_NOTICE, FNAME,
+				    "failed to get packet info");
+				continue;
+			}
+			if (find_ifconfbyid(pi->ipi6_ifindex) == NULL ||
+			    mhdr->msg_namelen != sizeof(msg.from)) {
+				stats->drops[STATS_DROP_NOIF]++;
+				continue;
+			}
+
+			memcpy(&msg.from, mhdr->msg_name, sizeof(msg.from));
+			msg.pktinfo = *pi;
+			if (shard_send(shard_lookup(
+			    mhdr->msg_iov[0].iov_base, len, &msg.from),
+			    &msg, mhdr->msg_iov[0].iov_base, len) != 0) {
+				/* the type is known only to the worker */
+				stats->drops[STATS_DROP_BUSY]++;
 			}
-			continue;
-		case 0:		/* timeout */
-			break;
-		default:
-			break;
 		}
+	} while (n == pktbatch_rx_size(rxbatch));
+}
+
+/*
+ * A worker receives the packets of its clients and control commands from
+ * the dispatcher.
+ */
+static void
+server6_shardinput(s, arg)
+	int s;
+	void *arg;
+{
+	struct msghdr *mhdr;
+	struct shard_msg *msg;
+	struct duid duid;
+	char *data;
+	ssize_t len;
+	int i, n;
 
-		if (FD_ISSET(insock, &r))
-			server6_recv(insock);
-		if (ctlsock >= 0) {
-			if (FD_ISSET(ctlsock, &r)) {
-				(void)dhcp6_ctl_acceptcommand(ctlsock,
-				    server6_do_ctlcommand);
+	do {
+		if ((n = pktbatch_recv(s, rxbatch)) < 0) {
+			dprintf(LOG_ERR, FNAME, "recvmsg: %s",
+			    strerror(errno));
+			return;
+		}
+		for (i = 0; i < n; i++) {
+			mhdr = pktbatch_rx_msg(rxbatch, i, &len);
+			if (len == 0 && replay_file) {
+				/* the end of the trace */
+				server6_replaydone();
+				/* NOTREACHED */
+			}
+			if (len == 0) {
+				/* the dispatcher has gone */
+				dprintf(LOG_ERR, FNAME,
+				    "lost the dispatcher; exiting");
+				leasedb_close();
+				trace_close();
+				exit(1);
+			}
+			if (replay_file && replay_packets++ == 0)
+				(void)clock_gettime(CLOCK_MONOTONIC,
+				    &replay_start);
+			if (len < sizeof(*msg))
+				continue;
+			msg = (struct shard_msg *)mhdr->msg_iov[0].iov_base;
+			data = (char *)(msg + 1);
+			len -= sizeof(*msg);
+
+			switch (msg->type) {
+			case SHARD_MSG_PACKET:
+				server6_process(data, len,
+				    (struct sockaddr *)&msg->from,
+				    sizeof(msg->from), &msg->pktinfo);
+				break;
+			case SHARD_MSG_RELOAD:
+				server6_reload();
+				break;
+			case SHARD_MSG_REMOVE:
+				duid.duid_len = len;
+				duid.duid_id = data;
+				(void)server6_remove_ia(&duid, msg->iaid);
+				break;
 			}
-			(void)dhcp6_ctl_readcommand(&r);
 		}
-	}
+		server6_flush();
+	} while (n == pktbatch_rx_size(rxbatch));
+}
+
+static void
+server6_replaydone()
+{
+	struct timespec now;
+	double elapsed;
+	u_int64_t replies;
+
+	server6_flush();
+	(void)clock_gettime(CLOCK_MONOTONIC, &now);
+	elapsed = (now.tv_sec - replay_start.tv_sec) +
+	    (now.tv_nsec - replay_start.tv_nsec) / 1e9;
+	replies = pktbatch_tx_stats(txbatch)->packets;
+
+	dprintf(LOG_INFO, FNAME, "replayed %llu packets in %.3f seconds "
+	    "(%.0f packets/s), %llu replies",
+	    (unsigned long long)replay_packets, elapsed,
+	    elapsed > 0 ? replay_packets / elapsed : 0.0,
+	    (unsigned long long)replies);
+
+	leasedb_close();
+	trace_close();
+	exit(0);
+}
+
+static void
+server6_ctlaccept(s, arg)
+	int s;
+	void *arg;
+{
+	(void)dhcp6_ctl_acceptcommand(s, server6_do_ctlcommand);
 }
 
 static inline int
@@ -698,7 +1147,7 @@ server6_do_ctlcommand(buf, len)
 	u_int16_t command, version;
 	u_int32_t p32, iaid, duidlen, ts, ts0;
 	struct duid duid;
-	struct dhcp6_binding *binding;
+	struct shard_msg msg;
 	int commandlen;
 	char *bp;
 	time_t now;
@@ -762,6 +1211,14 @@ server6_do_ctlcommand(buf, len)
 		}
 		server6_stop();
 		break;
+	case DHCP6CTL_COMMAND_STATS:
+		if (commandlen != 0) {
+			dprintf(LOG_INFO, FNAME, "invalid command length "
+			    "for stats: %d", commandlen);
+			return (DHCP6CTL_R_DONE);
+		}
+		server6_ctlstats();
+		break;
 	case DHCP6CTL_COMMAND_REMOVE:
 		if (get_val32(&bp, &commandlen, &p32))
 			return (DHCP6CTL_R_FAILURE);
@@ -798,18 +1255,19 @@ server6_do_ctlcommand(buf, len)
 		duid.duid_len = (size_t)duidlen;
 		duid.duid_id = bp;
 
-		binding = find_binding(&duid, DHCP6_BINDING_IA,
-		    DHCP6_LISTVAL_IAPD, iaid);
-		if (binding == NULL) {
-			binding = find_binding(&duid, DHCP6_BINDING_IA,
-			    DHCP6_LISTVAL_IANA, iaid);
-			if (binding == NULL) {
-				dprintf(LOG_INFO, FNAME, "no such binding");
+		if (SHARD_DISPATCHER()) {
+			/* the owner of the client removes it */
+			memset(&msg, 0, sizeof(msg));
+			msg.type = SHARD_MSG_REMOVE;
+			msg.iaid = iaid;
+			if (shard_send(shard_duid(&duid), &msg, duid.duid_id,
+			    duid.duid_len) != 0)
 				return (DHCP6CTL_R_FAILURE);
-			}
+			break;
 		}
-		remove_binding(binding);
-		    
+
+		if (server6_remove_ia(&duid, iaid) != 0)
+			return (DHCP6CTL_R_FAILURE);
 		break;
 	default:
 		dprintf(LOG_INFO, FNAME,
@@ -821,15 +1279,133 @@ server6_do_ctlcommand(buf, len)
   	return (DHCP6CTL_R_DONE);
 }
 
+/* remove the client's IA, looking for the IAID in IA_PDs first */
+static int
+server6_remove_ia(duid, iaid)
+	struct duid *duid;
+	u_int32_t iaid;
+{
+	struct dhcp6_binding *binding, *b;
+	struct binding_client *client;
+
+	binding = NULL;
+	if ((client = find_binding_client(duid)) != NULL) {
+		TAILQ_FOREACH(b, &client->bindings, clink) {
+			if (b->type != DHCP6_BINDING_IA || b->iaid != iaid)
+				continue;
+			if (b->iatype == DHCP6_LISTVAL_IAPD) {
+				binding = b;
+				break;
+			}
+			if (b->iatype == DHCP6_LISTVAL_IANA)
+				binding = b;
+		}
+	}
+	if (binding == NULL) {
+		dprintf(LOG_INFO, FNAME, "no such binding");
+		return (-1);
+	}
+	remove_binding(binding);
+
+	return (0);
+}
+
+static void
+server6_ctlstats()
+{
+	static char buf[16384];
+	struct stats sum;
+	size_t len;
+
+	server6_publish();
+	stats_sum(&sum);
+	len = stats_format(&sum, STATS_FMT_TEXT, buf, sizeof(buf));
+	(void)dhcp6_ctl_reply(buf, len);
+}
+
+/* the OpenMetrics exposition for a scrape */
+static size_t
+server6_metrics(buf, len)
+	char *buf;
+	size_t len;
+{
+	static struct stats sum;
+
+	server6_publish();
+	stats_sum(&sum);
+	return (stats_format(&sum, STATS_FMT_OPENMETRICS, buf, len));
+}
+
+/*
+ * Copy the gauges and the I/O counters into our statistics.  This is
+ * cheap enough to be done at every round of the event loop.
+ */
+static void
+server6_publish()
+{
+	struct pool_conf *pool;
+	int i;
+
+	/* a worker's receive batch only holds what the dispatcher passed */
+	if (!SHARD_WORKER())
+		stats->rxbatch = *pktbatch_rx_stats(rxbatch);
+	if (SHARD_DISPATCHER())
+		return;		/* the workers have the rest */
+
+	stats->txbatch = *pktbatch_tx_stats(txbatch);
+	stats->arena_allocs = pktarena->allocs;
+	stats->arena_overflows = pktarena->overflows;
+	stats->bindings = binding_count;
+	stats->leases = lease_count();
+	stats->timers = dhcp6_timer_count();
+	stats->hostconf = *get_dynamic_hostconf_stats();
+	for (i = 0, pool = pool_conflist; pool && i < STATS_POOLS;
+	    pool = pool->next, i++) {
+		stats_setpool(i, pool->name, lease_pool_size(pool->leases),
+		    lease_pool_freecount(pool->leases));
+	}
+	stats->npools = i;
+}
+
+/* send the replies queued so far */
+static void
+server6_flush()
+{
+	struct pktbatch_stats *st = pktbatch_tx_stats(txbatch);
+	u_int64_t calls = st->calls, t;
+
+	t = stats_clock();
+	(void)pktbatch_tx_flush(txbatch);
+	if (st->calls != calls)
+		(void)stats_time(STATS_STAGE_SEND, t);
+}
+
 static void
 server6_reload()
 {
+	struct shard_msg msg;
+	int i;
+
+	if (SHARD_DISPATCHER()) {
+		/* the workers have the configuration */
+		memset(&msg, 0, sizeof(msg));
+		msg.type = SHARD_MSG_RELOAD;
+		for (i = 0; i < shard_count; i++) {
+			if (shard_send(i, &msg, NULL, 0) != 0) {
+				dprintf(LOG_WARNING, FNAME,
+				    "failed to reload worker %d", i);
+			}
+		}
+		return;
+	}
+
 	/* reload the configuration file */
 	if (cfparse(conffile) != 0) {
 		dprintf(LOG_WARNING, FNAME,
 		    "failed to reload configuration file");
 		return;
 	}
+	make_statelessinfo();
 
 	dprintf(LOG_NOTICE, FNAME, "server reloaded");
 
@@ -843,83 +1419,93 @@ server6_stop()
 
 	dprintf(LOG_NOTICE, FNAME, "exiting");
 
+	if (SHARD_DISPATCHER())
+		shard_stop();
+
 	exit (0);
 }
 
 static void
-server6_recv(s)
-	int s;
-{
+server6_recv(mhdr, len)
+	struct msghdr *mhdr;
 	ssize_t len;
-	struct sockaddr_storage from;
-	int fromlen;
-	struct msghdr mhdr;
-	struct iovec iov;
-	char cmsgbuf[BUFSIZ];
+{
+	struct in6_pktinfo *pi;
+
+	if ((pi = server6_pktinfo(mhdr)) == NULL) {
+		dprintf(LOG_NOTICE, FNAME, "failed to get packet info");
+		return;
+	}
+
+	server6_process(mhdr->msg_iov[0].iov_base, len,
+	    (struct sockaddr *)mhdr->msg_name, mhdr->msg_namelen, pi);
+}
+
+static struct in6_pktinfo *
+server6_pktinfo(mhdr)
+	struct msghdr *mhdr;
+{
 	struct cmsghdr *cm;
 	struct in6_pktinfo *pi = NULL;
+
+	for (cm = (struct cmsghdr *)CMSG_FIRSTHDR(mhdr); cm;
+	     cm = (struct cmsghdr *)CMSG_NXTHDR(mhdr, cm)) {
+		if (cm->cmsg_level == IPPROTO_IPV6 &&
+		    cm->cmsg_type == IPV6_PKTINFO &&
+		    cm->cmsg_len == CMSG_LEN(sizeof(struct in6_pktinfo))) {
+			pi = (struct in6_pktinfo *)(CMSG_DATA(cm));
+		}
+	}
+
+	return (pi);
+}
+
+static void
+server6_process(rdatabuf, len, from, fromlen, pi)
+	char *rdatabuf;
+	ssize_t len;
+	struct sockaddr *from;
+	int fromlen;
+	struct in6_pktinfo *pi;
+{
 	struct dhcp6_if *ifp;
 	struct dhcp6 *dh6;
 	struct dhcp6_optinfo optinfo;
 	struct dhcp6opt *optend;
 	struct relayinfolist relayinfohead;
 	struct relayinfo *relayinfo;
+	u_int64_t start;
+	int type, error, ifslot, hcnt;
 
 	TAILQ_INIT(&relayinfohead);
+	start = stats_clock();
 
-	memset(&iov, 0, sizeof(iov));
-	memset(&mhdr, 0, sizeof(mhdr));
-
-	iov.iov_base = rdatabuf;
-	iov.iov_len = sizeof(rdatabuf);
-	mhdr.msg_name = &from;
-	mhdr.msg_namelen = sizeof(from);
-	mhdr.msg_iov = &iov;
-	mhdr.msg_iovlen = 1;
-	mhdr.msg_control = (caddr_t)cmsgbuf;
-	mhdr.msg_controllen = sizeof(cmsgbuf);
+	trace_recv(pi->ipi6_ifindex, (struct sockaddr_in6 *)from,
+	    &pi->ipi6_addr, rdatabuf, len);
 
-	if ((len = recvmsg(insock, &mhdr, 0)) < 0) {
-		dprintf(LOG_ERR, FNAME, "recvmsg: %s", strerror(errno));
-		return;
-	}
-	fromlen = mhdr.msg_namelen;
-
-	for (cm = (struct cmsghdr *)CMSG_FIRSTHDR(&mhdr); cm;
-	     cm = (struct cmsghdr *)CMSG_NXTHDR(&mhdr, cm)) {
-		if (cm->cmsg_level == IPPROTO_IPV6 &&
-		    cm->cmsg_type == IPV6_PKTINFO &&
-		    cm->cmsg_len == CMSG_LEN(sizeof(struct in6_pktinfo))) {
-			pi = (struct in6_pktinfo *)(CMSG_DATA(cm));
-		}
-	}
-	if (pi == NULL) {
-		dprintf(LOG_NOTICE, FNAME, "failed to get packet info");
-		return;
-	}
 	/*
 	 * DHCPv6 server may receive a DHCPv6 packet from a non-listening 
 	 * interface, when a DHCPv6 relay agent is running on that interface.
 	 * This check prevents such reception.
 	 */
-	if (pi->ipi6_ifindex != ifidx)
-		return;
 	if ((ifp = find_ifconfbyid((unsigned int)pi->ipi6_ifindex)) == NULL) {
-		dprintf(LOG_INFO, FNAME, "unexpected interface (%d)",
-		    (unsigned int)pi->ipi6_ifindex);
+		stats->drops[STATS_DROP_NOIF]++;
 		return;
 	}
+	ifslot = stats_ifslot(ifp->ifid);
 
 	dh6 = (struct dhcp6 *)rdatabuf;
 
 	if (len < sizeof(*dh6)) {
 		dprintf(LOG_INFO, FNAME, "short packet (%d bytes)", len);
+		stats->ifs[ifslot].rx[0]++;
+		server6_drop(0, STATS_DROP_SHORT);
 		return;
 	}
 
 	dprintf(LOG_DEBUG, FNAME, "received %s from %s",
 	    dhcp6msgstr(dh6->dh6_msgtype),
-	    addr2str((struct sockaddr *)&from));
+	    addr2str(from));
 
 	/*
 	 * A server MUST discard any Solicit, Confirm, Rebind or
@@ -933,6 +1519,8 @@ server6_recv(s)
 	    dh6->dh6_msgtype == DH6_REBIND ||
 	    dh6->dh6_msgtype == DH6_INFORM_REQ)) {
 		dprintf(LOG_INFO, FNAME, "invalid unicast message");
+		stats->ifs[ifslot].rx[STATS_MSGTYPE(dh6->dh6_msgtype)]++;
+		server6_drop(dh6->dh6_msgtype, STATS_DROP_UNICAST);
 		return;
 	}
 
@@ -943,20 +1531,34 @@ server6_recv(s)
 	 */
 	if (dh6->dh6_msgtype == DH6_RELAY_REPLY) {
 		dprintf(LOG_INFO, FNAME, "relay reply message from %s",
-		    addr2str((struct sockaddr *)&from));
+		    addr2str(from));
+		stats->ifs[ifslot].rx[DH6_RELAY_REPLY]++;
+		server6_drop(DH6_RELAY_REPLY, STATS_DROP_BADTYPE);
 		return;
-		
 	}
 
+	/*
+	 * Everything allocated for the message itself comes from the
+	 * packet arena and is released at once when we are done.
+	 */
+	dhcp6_arena = pktarena;
+
 	optend = (struct dhcp6opt *)(rdatabuf + len);
 	if (dh6->dh6_msgtype == DH6_RELAY_FORW) {
+		hcnt = ((struct dhcp6_relay *)dh6)->dh6relay_hcnt;
+		stats->hops[STATS_HOP(hcnt)]++;
 		if (process_relayforw(&dh6, &optend, &relayinfohead,
-		    (struct sockaddr *)&from)) {
+		    from)) {
+			stats->ifs[ifslot].rx[DH6_RELAY_FORW]++;
+			server6_drop(DH6_RELAY_FORW, STATS_DROP_RELAY);
 			goto end;
 		}
 		/* dh6 and optend should have been updated. */
 		len = (ssize_t)((char *)optend - (char *)dh6);
+		stats->relayed++;
 	}
+	type = dh6->dh6_msgtype;
+	stats->ifs[ifslot].rx[STATS_MSGTYPE(type)]++;
 
 	/*
 	 * parse and validate options in the message
@@ -965,47 +1567,54 @@ server6_recv(s)
 	if (dhcp6_get_options((struct dhcp6opt *)(dh6 + 1),
 	    optend, &optinfo) < 0) {
 		dprintf(LOG_INFO, FNAME, "failed to parse options");
+		server6_drop(type, STATS_DROP_OPTIONS);
 		goto end;
 	}
+	(void)stats_time(STATS_STAGE_PARSE, start);
 
-	switch (dh6->dh6_msgtype) {
+	drop_reason = STATS_DROP_INVALID;
+	switch (type) {
 	case DH6_SOLICIT:
-		(void)react_solicit(ifp, dh6, len, &optinfo,
-		    (struct sockaddr *)&from, fromlen, &relayinfohead);
+		error = react_solicit(ifp, dh6, len, &optinfo,
+		    from, fromlen, &relayinfohead);
 		break;
 	case DH6_REQUEST:
-		(void)react_request(ifp, pi, dh6, len, &optinfo,
-		    (struct sockaddr *)&from, fromlen, &relayinfohead);
+		error = react_request(ifp, pi, dh6, len, &optinfo,
+		    from, fromlen, &relayinfohead);
 		break;
 	case DH6_RENEW:
-		(void)react_renew(ifp, pi, dh6, len, &optinfo,
-		    (struct sockaddr *)&from, fromlen, &relayinfohead);
+		error = react_renew(ifp, pi, dh6, len, &optinfo,
+		    from, fromlen, &relayinfohead);
 		break;
 	case DH6_REBIND:
-		(void)react_rebind(ifp, dh6, len, &optinfo,
-		    (struct sockaddr *)&from, fromlen, &relayinfohead);
+		error = react_rebind(ifp, dh6, len, &optinfo,
+		    from, fromlen, &relayinfohead);
 		break;
 	case DH6_RELEASE:
-		(void)react_release(ifp, pi, dh6, len, &optinfo,
-		    (struct sockaddr *)&from, fromlen, &relayinfohead);
+		error = react_release(ifp, pi, dh6, len, &optinfo,
+		    from, fromlen, &relayinfohead);
 		break;
 	case DH6_DECLINE:
-		(void)react_decline(ifp, pi, dh6, len, &optinfo,
-		    (struct sockaddr *)&from, fromlen, &relayinfohead);
+		error = react_decline(ifp, pi, dh6, len, &optinfo,
+		    from, fromlen, &relayinfohead);
 		break;
 	case DH6_CONFIRM:
-		(void)react_confirm(ifp, pi, dh6, len, &optinfo,
-		    (struct sockaddr *)&from, fromlen, &relayinfohead);
+		error = react_confirm(ifp, pi, dh6, len, &optinfo,
+		    from, fromlen, &relayinfohead);
 		break;
 	case DH6_INFORM_REQ:
-		(void)react_informreq(ifp, dh6, len, &optinfo,
-		    (struct sockaddr *)&from, fromlen, &relayinfohead);
+		error = react_informreq(ifp, dh6, len, &optinfo,
+		    from, fromlen, &relayinfohead);
 		break;
 	default:
 		dprintf(LOG_INFO, FNAME, "unknown or unsupported msgtype (%s)",
-		    dhcp6msgstr(dh6->dh6_msgtype));
+		    dhcp6msgstr(type));
+		drop_reason = STATS_DROP_BADTYPE;
+		error = -1;
 		break;
 	}
+	if (error != 0)
+		server6_drop(type, drop_reason);
 
 	dhcp6_clear_options(&optinfo);
 
@@ -1015,7 +1624,19 @@ server6_recv(s)
 		free_relayinfo(relayinfo);
 	}
 
-	return;
+	dhcp6_arena_reset(pktarena);
+	dhcp6_arena = NULL;
+
+	(void)stats_time(STATS_STAGE_TOTAL, start);
+}
+
+/* count a received message of the type that is discarded */
+static void
+server6_drop(type, reason)
+	int type, reason;
+{
+	stats->dropped[STATS_MSGTYPE(type)]++;
+	stats->drops[reason]++;
 }
 
 static void
@@ -1028,7 +1649,7 @@ free_relayinfo(relayinfo)
 	if (relayinfo->relay_msg.dv_buf)
 		dhcp6_vbuf_free(&relayinfo->relay_msg);
 
-	free(relayinfo);
+	dhcp6_free(relayinfo);
 }
 
 static int
@@ -1082,7 +1703,7 @@ process_relayforw(dh6p, optendp, relayinfohead, from)
 		return (-1);
 	}
 
-	if ((relayinfo = malloc(sizeof (*relayinfo))) == NULL) {
+	if ((relayinfo = dhcp6_malloc(sizeof (*relayinfo))) == NULL) {
 		dprintf(LOG_ERR, FNAME, "failed to allocate relay info");
 		return (-1);
 	}
@@ -1123,6 +1744,45 @@ process_relayforw(dh6p, optendp, relayinfohead, from)
 	return (-1);
 }
 
+/*
+ * Encode the stateless configuration information once, so that replies
+ * can simply copy it.  This must be called whenever the configuration
+ * changes.  The previous encoding is used until the new one is ready;
+ * if encoding fails, replies fall back to copying the lists.
+ */
+static void
+make_statelessinfo()
+{
+	struct dhcp6_optinfo optinfo;
+	struct dhcp6_vbuf newinfo;
+	char buf[BUFSIZ];
+	int len;
+
+	memset(&newinfo, 0, sizeof(newinfo));
+	dhcp6_init_options(&optinfo);
+	if (copy_statelessinfo(&optinfo) != 0 ||
+	    (len = dhcp6_set_options(DH6_REPLY, (struct dhcp6opt *)buf,
+	    (struct dhcp6opt *)(buf + sizeof(buf)), &optinfo)) < 0) {
+		dprintf(LOG_WARNING, FNAME,
+		    "failed to encode stateless options");
+	} else if (len > 0) {
+		if ((newinfo.dv_buf = malloc(len)) == NULL) {
+			dprintf(LOG_WARNING, FNAME,
+			    "memory allocation failed");
+		} else {
+			memcpy(newinfo.dv_buf, buf, len);
+			newinfo.dv_len = len;
+		}
+	}
+	dhcp6_clear_options(&optinfo);
+
+	dhcp6_vbuf_free(&statelessinfo);
+	statelessinfo = newinfo;
+
+	dprintf(LOG_DEBUG, FNAME, "stateless options: %d bytes",
+	    statelessinfo.dv_len);
+}
+
 /*
  * Set stateless configuration information to a option structure.
  * It is the caller's responsibility to deal with error cases.
@@ -1131,6 +1791,28 @@ static int
 set_statelessinfo(type, optinfo)
 	int type;
 	struct dhcp6_optinfo *optinfo;
+{
+	if (statelessinfo.dv_buf != NULL)
+		optinfo->optblob = &statelessinfo;
+	else if (copy_statelessinfo(optinfo) != 0)
+		return (-1);
+
+	/*
+	 * Information refresh time.  Only include in a response to
+	 * an Information-request message.
+	 */
+	if (type == DH6_INFORM_REQ &&
+	    optrefreshtime != DH6OPT_REFRESHTIME_UNDEF) {
+		optinfo->refreshtime = (int64_t)optrefreshtime;
+	}
+
+	return (0);
+}
+
+/* Copy the configured stateless information lists to a option structure. */
+static int
+copy_statelessinfo(optinfo)
+	struct dhcp6_optinfo *optinfo;
 {
 	/* SIP domain name */
 	if (dhcp6_copy_list(&optinfo->sipname_list, &sipnamelist)) {
@@ -1202,15 +1884,6 @@ set_statelessinfo(type, optinfo)
 		return (-1);
 	}
 
-	/*
-	 * Information refresh time.  Only include in a response to
-	 * an Information-request message.
-	 */
-	if (type == DH6_INFORM_REQ &&
-	    optrefreshtime != DH6OPT_REFRESHTIME_UNDEF) {
-		optinfo->refreshtime = (int64_t)optrefreshtime;
-	}
-
 	return (0);
 }
 
@@ -1254,7 +1927,7 @@ react_solicit(ifp, dh6, len, optinfo, from, fromlen, relayinfohead)
 	/* get per-host configuration for the client, if any. */
 	if ((client_conf = find_hostconf(&optinfo->clientID))) {
 		dprintf(LOG_DEBUG, FNAME, "found a host configuration for %s",
-		    client_conf->name);
+		    clientstr(client_conf, &optinfo->clientID));
 	}
 
 	/*
@@ -1395,6 +2068,7 @@ react_solicit(ifp, dh6, len, optinfo, from, fromlen, relayinfohead)
 			if (dhcp6_add_listval(&roptinfo.stcode_list,
 			    DHCP6_LISTVAL_STCODE, &stcode, NULL) == NULL)
 				goto fail;
+			stats->noaddrs++;
 		}
 	}
 
@@ -1472,7 +2146,8 @@ react_request(ifp, pi, dh6, len, optinfo, from, fromlen, relayinfohead)
 	/* get per-host configuration for the client, if any. */
 	if ((client_conf = find_hostconf(&optinfo->clientID))) {
 		dprintf(LOG_DEBUG, FNAME,
-		    "found a host configuration named %s", client_conf->name);
+		    "found a host configuration named %s",
+		    clientstr(client_conf, &optinfo->clientID));
 	}
 
 	/* process authentication */
@@ -1607,6 +2282,7 @@ react_request(ifp, pi, dh6, len, optinfo, from, fromlen, relayinfohead)
 					dhcp6_clear_list(&conflist);
 					goto fail;
 				}
+				stats->noaddrs++;
 			}
 		}
 
@@ -1705,7 +2381,8 @@ react_renew(ifp, pi, dh6, len, optinfo, from, fromlen, relayinfohead)
 	/* get per-host configuration for the client, if any. */
 	if ((client_conf = find_hostconf(&optinfo->clientID))) {
 		dprintf(LOG_DEBUG, FNAME,
-		    "found a host configuration named %s", client_conf->name);
+		    "found a host configuration named %s",
+		    clientstr(client_conf, &optinfo->clientID));
 	}
 
 	/* process authentication */
@@ -1824,7 +2501,8 @@ react_rebind(ifp, dh6, len, optinfo, from, fromlen, relayinfohead)
 	/* get per-host configuration for the client, if any. */
 	if ((client_conf = find_hostconf(&optinfo->clientID))) {
 		dprintf(LOG_DEBUG, FNAME,
-		    "found a host configuration named %s", client_conf->name);
+		    "found a host configuration named %s",
+		    clientstr(client_conf, &optinfo->clientID));
 	}
 
 	/* process authentication */
@@ -1936,7 +2614,8 @@ react_release(ifp, pi, dh6, len, optinfo, from, fromlen, relayinfohead)
 	/* get per-host configuration for the client, if any. */
 	if ((client_conf = find_hostconf(&optinfo->clientID))) {
 		dprintf(LOG_DEBUG, FNAME,
-		    "found a host configuration named %s", client_conf->name);
+		    "found a host configuration named %s",
+		    clientstr(client_conf, &optinfo->clientID));
 	}
 
 	/* process authentication */
@@ -2065,7 +2744,8 @@ react_decline(ifp, pi, dh6, len, optinfo, from, fromlen, relayinfohead)
 	/* get per-host configuration for the client, if any. */
 	if ((client_conf = find_hostconf(&optinfo->clientID))) {
 		dprintf(LOG_DEBUG, FNAME,
-		    "found a host configuration named %s", client_conf->name);
+		    "found a host configuration named %s",
+		    clientstr(client_conf, &optinfo->clientID));
 	}
 
 	/* process authentication */
@@ -2184,7 +2864,8 @@ react_confirm(ifp, pi, dh6, len, optinfo, from, fromlen, relayinfohead)
 	/* get per-host configuration for the client, if any. */
 	if ((client_conf = find_hostconf(&optinfo->clientID))) {
 		dprintf(LOG_DEBUG, FNAME,
-		    "found a host configuration named %s", client_conf->name);
+		    "found a host configuration named %s",
+		    clientstr(client_conf, &optinfo->clientID));
 	}
 
 	/* process authentication */
@@ -2387,7 +3068,8 @@ update_ia(msgtype, iap, retlist, optinfo)
 	/* get per-host configuration for the client, if any. */
 	if ((client_conf = find_hostconf(&optinfo->clientID))) {
 		dprintf(LOG_DEBUG, FNAME,
-		    "found a host configuration named %s", client_conf->name);
+		    "found a host configuration named %s",
+		    clientstr(client_conf, &optinfo->clientID));
 	}
 
 	if ((binding = find_binding(&optinfo->clientID, DHCP6_BINDING_IA,
@@ -2606,6 +3288,7 @@ release_binding_ia(iap, retlist, optinfo)
 				}
 			}
 		}
+		save_binding(binding);
 	}
 
 	return (0);
@@ -2674,6 +3357,7 @@ decline_binding_ia(iap, retlist, optinfo)
 			return (0);
 		}
 	}
+	save_binding(binding);
 
 	return (0);
 }
@@ -2689,6 +3373,12 @@ server6_signal(sig)
 	case SIGTERM:
 		sig_flags |= SIGF_TERM;
 		break;
+	case SIGCHLD:
+		sig_flags |= SIGF_CHLD;
+		break;
+	case SIGUSR1:
+		sig_flags |= SIGF_USR1;
+		break;
 	}
 }
 
@@ -2705,18 +3395,37 @@ server6_send(type, ifp, origmsg, optinfo, from, fromlen,
 	struct host_conf *client_conf;
 {
 	char replybuf[BUFSIZ];
+	char *msg;
 	struct sockaddr_in6 dst;
 	int len, optlen;
+	int headroom, tailroom;
 	int relayed = 0;
 	struct dhcp6 *dh6;
 	struct relayinfo *relayinfo;
+	u_int64_t t, calls;
 
-	if (sizeof(struct dhcp6) > sizeof(replybuf)) {
+	t = stats_clock();
+
+	/*
+	 * Reserve room around the reply to encapsulate it for the relays
+	 * in place.  The reply itself is kept aligned.
+	 */
+	headroom = tailroom = 0;
+	for (relayinfo = TAILQ_FIRST(relayinfohead); relayinfo;
+	    relayinfo = TAILQ_NEXT(relayinfo, link)) {
+		headroom += DHCP6_RELAY_HEADROOM;
+		if (relayinfo->relay_ifid.dv_buf) {
+			tailroom += sizeof(struct dhcp6opt) +
+			    relayinfo->relay_ifid.dv_len;
+		}
+	}
+	headroom = (headroom + 7) & ~7;
+	if (headroom + sizeof(struct dhcp6) + tailroom > sizeof(replybuf)) {
 		dprintf(LOG_ERR, FNAME, "buffer size assumption failed");
 		return (-1);
 	}
 
-	dh6 = (struct dhcp6 *)replybuf;
+	dh6 = (struct dhcp6 *)(replybuf + headroom);
 	len = sizeof(*dh6);
 	memset(dh6, 0, sizeof(*dh6));
 	dh6->dh6_msgtypexid = origmsg->dh6_msgtypexid;
@@ -2724,7 +3433,8 @@ server6_send(type, ifp, origmsg, optinfo, from, fromlen,
 
 	/* set options in the reply message */
 	if ((optlen = dhcp6_set_options(type, (struct dhcp6opt *)(dh6 + 1),
-	    (struct dhcp6opt *)(replybuf + sizeof(replybuf)), roptinfo)) < 0) {
+	    (struct dhcp6opt *)(replybuf + sizeof(replybuf) - tailroom),
+	    roptinfo)) < 0) {
 		dprintf(LOG_INFO, FNAME, "failed to construct reply options");
 		return (-1);
 	}
@@ -2752,61 +3462,33 @@ server6_send(type, ifp, origmsg, optinfo, from, fromlen,
 	}
 
 	/* construct a relay chain, if necessary */
+	msg = (char *)dh6;
 	for (relayinfo = TAILQ_FIRST(relayinfohead); relayinfo;
 	    relayinfo = TAILQ_NEXT(relayinfo, link)) {
-		struct dhcp6_optinfo relayopt;
-		struct dhcp6_vbuf relaymsgbuf;
-		struct dhcp6_relay *dh6relay;
-
 		relayed = 1;
-		dhcp6_init_options(&relayopt);
-
-		relaymsgbuf.dv_len = len;
-		relaymsgbuf.dv_buf = replybuf;
-		if (dhcp6_vbuf_copy(&relayopt.relay_msg, &relaymsgbuf))
-			return (-1);
-		if (relayinfo->relay_ifid.dv_buf &&
-		    dhcp6_vbuf_copy(&relayopt.ifidopt,
-		    &relayinfo->relay_ifid)) {
-			dhcp6_vbuf_free(&relayopt.relay_msg);
-			return (-1);
-		}
-
-		/* we can safely reuse replybuf here */
-		dh6relay = (struct dhcp6_relay *)replybuf;
-		memset(dh6relay, 0, sizeof (*dh6relay));
-		dh6relay->dh6relay_msgtype = DH6_RELAY_REPLY;
-		dh6relay->dh6relay_hcnt = relayinfo->hcnt;
-		memcpy(&dh6relay->dh6relay_linkaddr, &relayinfo->linkaddr,
-		    sizeof (dh6relay->dh6relay_linkaddr));
-		memcpy(&dh6relay->dh6relay_peeraddr, &relayinfo->peeraddr,
-		    sizeof (dh6relay->dh6relay_peeraddr));
-
-		len = sizeof(*dh6relay);
-		if ((optlen = dhcp6_set_options(DH6_RELAY_REPLY,
-		    (struct dhcp6opt *)(dh6relay + 1),
-		    (struct dhcp6opt *)(replybuf + sizeof(replybuf)),
-		    &relayopt)) < 0) {
-			dprintf(LOG_INFO, FNAME,
-			    "failed to construct relay message");
-			dhcp6_clear_options(&relayopt);
-			return (-1);
-		}
-		len += optlen;
-
-		dhcp6_clear_options(&relayopt);
+		dhcp6_encap_relay(&msg, &len, DH6_RELAY_REPLY,
+		    relayinfo->hcnt, &relayinfo->linkaddr,
+		    &relayinfo->peeraddr, relayinfo->relay_ifid.dv_buf,
+		    relayinfo->relay_ifid.dv_len);
 	}
 
+	t = stats_time(STATS_STAGE_ENCODE, t);
+
 	/* specify the destination and send the reply */
 	dst = relayed ? *sa6_any_relay : *sa6_any_downstream;
 	dst.sin6_addr = ((struct sockaddr_in6 *)from)->sin6_addr;
 	dst.sin6_scope_id = ((struct sockaddr_in6 *)from)->sin6_scope_id;
-	if (transmit_sa(outsock, (struct sockaddr *)&dst,
-	    replybuf, len) != 0) {
+	calls = pktbatch_tx_stats(txbatch)->calls;
+	if (pktbatch_send(outsock, txbatch, msg, len, &dst,
+	    NULL, 0) != 0) {
 		dprintf(LOG_ERR, FNAME, "transmit %s to %s failed",
 		    dhcp6msgstr(type), addr2str((struct sockaddr *)&dst));
 		return (-1);
 	}
+	if (pktbatch_tx_stats(txbatch)->calls != calls)
+		(void)stats_time(STATS_STAGE_SEND, t);	/* the batch was full */
+	trace_send(ifp->ifid, &dst, msg, len);
+	stats->ifs[stats_ifslot(ifp->ifid)].tx[STATS_MSGTYPE(type)]++;
 
 	dprintf(LOG_DEBUG, FNAME, "transmit %s to %s",
 	    dhcp6msgstr(type), addr2str((struct sockaddr *)&dst));
@@ -2857,6 +3539,7 @@ make_ia(spec, conflist, retlist, client_conf, do_binding)
 	struct dhcp6_listval *specia;
 	struct dhcp6_ia ia;
 	int found = 0;
+	u_int64_t t;
 
 	/*
 	 * If we happen to have a binding already, update the binding and
@@ -2896,6 +3579,8 @@ make_ia(spec, conflist, retlist, client_conf, do_binding)
 		return (1);
 	}
 
+	t = stats_clock();
+
 	/*
 	 * trivial case:
 	 * if the configuration is empty, we cannot make any IA.
@@ -2967,6 +3652,7 @@ make_ia(spec, conflist, retlist, client_conf, do_binding)
 		}
 		dhcp6_clear_list(&ialist);
 	}
+	(void)stats_time(STATS_STAGE_ALLOC, t);
 
 	return (found);
 }
@@ -3174,10 +3860,15 @@ add_binding(clientid, btype, iatype, iaid, val0)
 	void *val0;
 {
 	struct dhcp6_binding *binding = NULL;
-	u_int32_t duration = DHCP6_DURATION_INFINITE;
+	struct dhcp6_arena *arena;
+
+	/* the binding outlives the packet being processed */
+	arena = dhcp6_arena;
+	dhcp6_arena = NULL;
 
 	if ((binding = malloc(sizeof(*binding))) == NULL) {
 		dprintf(LOG_NOTICE, FNAME, "failed to allocate memory");
+		dhcp6_arena = arena;
 		return (NULL);
 	}
 	memset(binding, 0, sizeof(*binding));
@@ -3243,20 +3934,34 @@ add_binding(clientid, btype, iatype, iaid, val0)
 			dprintf(LOG_NOTICE, FNAME, "failed to add timer");
 			goto fail;
 		}
-		timo.tv_sec = (long)duration;
-		timo.tv_usec = 0;
-		dhcp6_set_timer(&timo, binding->timer);
+		/* restore_bindings() will start the timer later */
+		if (!binding_restoring) {
+			timo.tv_sec = (long)binding->duration;
+			timo.tv_usec = 0;
+			dhcp6_set_timer(&timo, binding->timer);
+		}
+	}
+
+	if (binding_index_add(binding)) {
+		dprintf(LOG_NOTICE, FNAME, "failed to index the binding");
+		if (binding->timer)
+			dhcp6_remove_timer(&binding->timer);
+		goto fail;
 	}
 
 	TAILQ_INSERT_TAIL(&dhcp6_binding_head, binding, link);
+	binding_count++;
+	save_binding(binding);
 
 	dprintf(LOG_DEBUG, FNAME, "add a new binding %s", bindingstr(binding));
 
+	dhcp6_arena = arena;
 	return (binding);
 
   fail:
 	if (binding)
 		free_binding(binding);
+	dhcp6_arena = arena;
 	return (NULL);
 }
 
@@ -3268,9 +3973,23 @@ find_binding(clientid, btype, iatype, iaid)
 	u_int32_t iaid;
 {
 	struct dhcp6_binding *bp;
+	struct binding_slot *slot;
+	u_int32_t hash;
+	size_t i, mask;
+	u_int64_t t;
 
-	for (bp = TAILQ_FIRST(&dhcp6_binding_head); bp;
-	    bp = TAILQ_NEXT(bp, link)) {
+	if (binding_index.size == 0)
+		return (NULL);
+
+	t = stats_clock();
+	hash = binding_hash(clientid, btype, iatype, iaid);
+	mask = binding_index.size - 1;
+	for (i = hash & mask; (slot = &binding_index.slots[i])->ptr != NULL;
+	    i = (i + 1) & mask) {
+		if (slot->ptr == BINDING_SLOT_DELETED || slot->hash != hash)
+			continue;
+
+		bp = (struct dhcp6_binding *)slot->ptr;
 		if (bp->type != btype || duidcmp(&bp->clientid, clientid))
 			continue;
 
@@ -3278,12 +3997,200 @@ find_binding(clientid, btype, iatype, iaid)
 		    (bp->iatype != iatype || bp->iaid != iaid))
 			continue;
 
+		(void)stats_time(STATS_STAGE_LOOKUP, t);
 		return (bp);
 	}
+	(void)stats_time(STATS_STAGE_LOOKUP, t);
+
+	return (NULL);
+}
+
+static struct binding_client *
+find_binding_client(clientid)
+	struct duid *clientid;
+{
+	struct binding_client *client;
+	struct binding_slot *slot;
+	u_int32_t hash;
+	size_t i, mask;
+
+	if (client_index.size == 0)
+		return (NULL);
+
+	hash = duidhash_local(clientid);
+	mask = client_index.size - 1;
+	for (i = hash & mask; (slot = &client_index.slots[i])->ptr != NULL;
+	    i = (i + 1) & mask) {
+		if (slot->ptr == BINDING_SLOT_DELETED || slot->hash != hash)
+			continue;
+
+		client = (struct binding_client *)slot->ptr;
+		if (duidcmp(&client->clientid, clientid) == 0)
+			return (client);
+	}
 
 	return (NULL);
 }
 
+static u_int32_t
+binding_hash(clientid, btype, iatype, iaid)
+	struct duid *clientid;
+	dhcp6_bindingtype_t btype;
+	int iatype;
+	u_int32_t iaid;
+{
+	u_int32_t key[3];
+
+	key[0] = (u_int32_t)btype;
+	key[1] = (u_int32_t)iatype;
+	key[2] = iaid;
+
+	return (dhcp6_hash(key, sizeof(key), duidhash_local(clientid)));
+}
+
+static int
+binding_htab_insert(tab, hash, ptr)
+	struct binding_htab *tab;
+	u_int32_t hash;
+	void *ptr;
+{
+	struct binding_slot *slot;
+	size_t i, mask;
+
+	/* keep the load factor (including deleted slots) below 3/4 */
+	if ((tab->used + 1) * 4 > tab->size * 3) {
+		struct binding_slot *oslots = tab->slots;
+		size_t osize = tab->size, newsize;
+
+		newsize = osize ? osize : BINDING_HTAB_INITSIZE;
+		while ((tab->count + 1) * 2 > newsize)
+			newsize *= 2;
+		if ((tab->slots = calloc(newsize, sizeof(*slot))) == NULL) {
+			dprintf(LOG_NOTICE, FNAME, "failed to allocate memory");
+			tab->slots = oslots;
+			return (-1);
+		}
+		tab->size = newsize;
+		tab->used = tab->count = 0;
+
+		mask = newsize - 1;
+		for (i = 0; i < osize; i++) {
+			size_t j;
+
+			if (oslots[i].ptr == NULL ||
+			    oslots[i].ptr == BINDING_SLOT_DELETED)
+				continue;
+			for (j = oslots[i].hash & mask;
+			    tab->slots[j].ptr != NULL; j = (j + 1) & mask)
+				;
+			tab->slots[j] = oslots[i];
+			tab->used++;
+			tab->count++;
+		}
+		if (oslots)
+			free(oslots);
+	}
+
+	mask = tab->size - 1;
+	for (i = hash & mask; (slot = &tab->slots[i])->ptr != NULL &&
+	    slot->ptr != BINDING_SLOT_DELETED; i = (i + 1) & mask)
+		;
+	if (slot->ptr == NULL)
+		tab->used++;
+	slot->hash = hash;
+	slot->ptr = ptr;
+	tab->count++;
+
+	return (0);
+}
+
+static void
+binding_htab_delete(tab, hash, ptr)
+	struct binding_htab *tab;
+	u_int32_t hash;
+	void *ptr;
+{
+	struct binding_slot *slot;
+	size_t i, mask;
+
+	if (tab->size == 0)
+		return;
+
+	mask = tab->size - 1;
+	for (i = hash & mask; (slot = &tab->slots[i])->ptr != NULL;
+	    i = (i + 1) & mask) {
+		if (slot->ptr == ptr) {
+			slot->ptr = BINDING_SLOT_DELETED;
+			tab->count--;
+			return;
+		}
+	}
+
+	dprintf(LOG_ERR, FNAME, "internal error: entry not found");
+}
+
+static int
+binding_index_add(binding)
+	struct dhcp6_binding *binding;
+{
+	struct binding_client *client;
+	int newclient = 0;
+
+	if ((client = find_binding_client(&binding->clientid)) == NULL) {
+		if ((client = malloc(sizeof(*client))) == NULL) {
+			dprintf(LOG_NOTICE, FNAME, "failed to allocate memory");
+			return (-1);
+		}
+		memset(client, 0, sizeof(*client));
+		if (duidcpy(&client->clientid, &binding->clientid)) {
+			free(client);
+			return (-1);
+		}
+		client->hash = duidhash_local(&client->clientid);
+		TAILQ_INIT(&client->bindings);
+		if (binding_htab_insert(&client_index, client->hash, client)) {
+			duidfree(&client->clientid);
+			free(client);
+			return (-1);
+		}
+		newclient = 1;
+	}
+
+	binding->hash = binding_hash(&binding->clientid, binding->type,
+	    binding->iatype, binding->iaid);
+	if (binding_htab_insert(&binding_index, binding->hash, binding)) {
+		if (newclient) {
+			binding_htab_delete(&client_index, client->hash,
+			    client);
+			duidfree(&client->clientid);
+			free(client);
+		}
+		return (-1);
+	}
+
+	TAILQ_INSERT_TAIL(&client->bindings, binding, clink);
+	binding->client = client;
+
+	return (0);
+}
+
+static void
+binding_index_remove(binding)
+	struct dhcp6_binding *binding;
+{
+	struct binding_client *client = binding->client;
+
+	binding_htab_delete(&binding_index, binding->hash, binding);
+
+	TAILQ_REMOVE(&client->bindings, binding, clink);
+	if (TAILQ_EMPTY(&client->bindings)) {
+		binding_htab_delete(&client_index, client->hash, client);
+		duidfree(&client->clientid);
+		free(client);
+	}
+	binding->client = NULL;
+}
+
 static void
 update_binding(binding)
 	struct dhcp6_binding *binding;
@@ -3297,6 +4204,8 @@ update_binding(binding)
 	binding->updatetime = time(NULL);
 	update_binding_duration(binding);
 
+	save_binding(binding);
+
 	/* if the lease duration is infinite, there's nothing to do. */
 	if (binding->duration == DHCP6_DURATION_INFINITE)
 		return;
@@ -3318,6 +4227,9 @@ remove_binding(binding)
 		dhcp6_remove_timer(&binding->timer);
 
 	TAILQ_REMOVE(&dhcp6_binding_head, binding, link);
+	binding_index_remove(binding);
+	binding_count--;
+	leasedb_remove(&binding->clientid, binding->iatype, binding->iaid);
 
 	free_binding(binding);
 }
@@ -3356,6 +4268,203 @@ free_binding(binding)
 	free(binding);
 }
 
+/* record the current state of the binding in the lease database */
+static void
+save_binding(binding)
+	struct dhcp6_binding *binding;
+{
+	leasedb_set(&binding->clientid, binding->iatype, binding->iaid,
+	    binding->updatetime, &binding->val_list);
+}
+
+static void
+dump_bindings()
+{
+	struct dhcp6_binding *binding;
+
+	TAILQ_FOREACH(binding, &dhcp6_binding_head, link)
+		save_binding(binding);
+}
+
+/* the worker of a client, as shard_duid() will tell once they've started */
+static int
+journal_owner(duid)
+	struct duid *duid;
+{
+	return (duidhash(duid) % nworkers);
+}
+
+static int
+restore_binding(op, clientid, iatype, iaid, updatetime, vals)
+	int op;
+	struct duid *clientid;
+	int iatype;
+	u_int32_t iaid;
+	time_t updatetime;
+	struct dhcp6_list *vals;
+{
+	struct dhcp6_binding *binding;
+
+	/* leasedb_partition() should have moved it to its owner */
+	if (SHARD_WORKER() && shard_duid(clientid) != shard_id) {
+		dprintf(LOG_WARNING, FNAME, "drop a binding for %s "
+		    "owned by another worker", duidstr(clientid));
+		return (0);
+	}
+
+	/* a later record always supersedes the earlier ones */
+	if ((binding = find_binding(clientid, DHCP6_BINDING_IA,
+	    iatype, iaid)) != NULL) {
+		remove_binding(binding);
+	}
+
+	if (op != LEASEDB_OP_SET)
+		return (0);
+
+	if ((binding = add_binding(clientid, DHCP6_BINDING_IA,
+	    iatype, iaid, vals)) == NULL) {
+		dprintf(LOG_NOTICE, FNAME, "failed to restore a binding for %s",
+		    duidstr(clientid));
+		return (-1);
+	}
+	binding->updatetime = updatetime;
+
+	return (0);
+}
+
+static int
+scan_foreign_lease(op, clientid, iatype, iaid, updatetime, vals)
+	int op;
+	struct duid *clientid;
+	int iatype;
+	u_int32_t iaid;
+	time_t updatetime;
+	struct dhcp6_list *vals;
+{
+	struct dhcp6_listval *lv;
+	int k;
+
+	if (op != LEASEDB_OP_SET || iatype != DHCP6_LISTVAL_IANA)
+		return (0);
+
+	TAILQ_FOREACH(lv, vals, link) {
+		k = lease_part_owner(&lv->val_statefuladdr6.addr, nworkers);
+		if (k < 0 || k == foreign_journal)
+			continue;
+		if (dhcp6_add_listval(&foreign_leases[k], DHCP6_LISTVAL_ADDR6,
+		    &lv->val_statefuladdr6.addr, NULL) == NULL) {
+			foreign_failed = 1;
+			return (-1);
+		}
+	}
+
+	return (0);
+}
+
+/*
+ * A binding follows its client to the worker that leasedb_partition()
+ * moves it to, but its addresses stay in the pool part of the worker that
+ * allocated them.  Collect, for each worker, the addresses in its part
+ * that the journal of another worker has, before the workers start and
+ * write to their journals.  A superseded or removed record keeps its
+ * addresses reserved until its journal is compacted.
+ */
+static int
+find_foreign_leases()
+{
+	size_t len = strlen(leasedb_file) + 16;
+	char *path;
+	int k;
+
+	if ((foreign_leases = calloc(nworkers,
+	    sizeof(*foreign_leases))) == NULL ||
+	    (path = malloc(len)) == NULL) {
+		dprintf(LOG_ERR, FNAME, "memory allocation failed");
+		return (-1);
+	}
+	for (k = 0; k < nworkers; k++)
+		TAILQ_INIT(&foreign_leases[k]);
+
+	for (k = 0; k < nworkers && !foreign_failed; k++) {
+		snprintf(path, len, "%s.%d", leasedb_file, k);
+		foreign_journal = k;
+		if (leasedb_scan(path, scan_foreign_lease) != 0)
+			foreign_failed = 1;
+	}
+	free(path);
+
+	return (foreign_failed ? -1 : 0);
+}
+
+/*
+ * Keep the addresses found by find_foreign_leases() in our pool part out
+ * of allocation.  They are entered in the lease table, not just taken
+ * out of the pools, so that a reload does not free them; they stay there
+ * until we restart.
+ */
+static void
+reserve_foreign_leases()
+{
+	struct dhcp6_listval *lv;
+	int k, n = 0;
+
+	if (foreign_leases == NULL)
+		return;
+
+	if (SHARD_WORKER()) {
+		TAILQ_FOREACH(lv, &foreign_leases[shard_id], link) {
+			if (!is_leased(&lv->val_addr6) &&
+			    lease_address(&lv->val_addr6))
+				n++;
+		}
+		if (n > 0) {
+			dprintf(LOG_INFO, FNAME, "reserved %d addresses bound "
+			    "by other workers", n);
+		}
+	}
+
+	for (k = 0; k < nworkers; k++)
+		dhcp6_clear_list(&foreign_leases[k]);
+	free(foreign_leases);
+	foreign_leases = NULL;
+}
+
+/*
+ * Rebuild the bindings from the lease database and start their timers
+ * according to the time that has passed since they were last updated.
+ * Bindings that expired while we were not running are cleaned up by
+ * binding_timo() as soon as the main loop starts.
+ */
+static void
+restore_bindings()
+{
+	struct dhcp6_binding *binding;
+	struct timeval timo;
+
+	if (leasedb_file == NULL) {
+		dprintf(LOG_INFO, FNAME, "no lease database for a replay");
+		return;
+	}
+
+	binding_restoring = 1;
+	if (leasedb_open(leasedb_file, restore_binding, dump_bindings)) {
+		dprintf(LOG_WARNING, FNAME, "lease database is not available; "
+		    "bindings will not survive a restart");
+	}
+	binding_restoring = 0;
+
+	TAILQ_FOREACH(binding, &dhcp6_binding_head, link) {
+		update_binding_duration(binding);
+		if (binding->timer == NULL)
+			continue;
+		timo.tv_sec = (long)binding->duration;
+		timo.tv_usec = 0;
+		dhcp6_set_timer(&timo, binding->timer);
+	}
+
+	dprintf(LOG_INFO, FNAME, "restored %d bindings", binding_count);
+}
+
 static struct dhcp6_timer *
 binding_timo(arg)
 	void *arg;
@@ -3366,6 +4475,7 @@ binding_timo(arg)
 	time_t now = time(NULL);
 	u_int32_t past, lifetime;
 	struct timeval timo;
+	int expired = 0;
 
 	past = (u_int32_t)(now >= binding->updatetime ?
 	    now - binding->updatetime : 0);
@@ -3398,6 +4508,7 @@ binding_timo(arg)
 					release_address(&iav->val_prefix6.addr);
 				TAILQ_REMOVE(ia_list, iav, link);
 				dhcp6_clear_listval(iav);
+				expired++;
 			}
 		}
 
@@ -3406,6 +4517,8 @@ binding_timo(arg)
 			remove_binding(binding);
 			return (NULL);
 		}
+		if (expired)
+			save_binding(binding);
 
 		break;
 	default:
@@ -3502,7 +4615,8 @@ process_auth(dh6, len, client_conf, optinfo, roptinfo)
 		 */
 		return (0);
 	case DHCP6_AUTHPROTO_DELAYED:
-		if (optinfo->authalgorithm != DHCP6_AUTHALG_HMACMD5) {
+		if (optinfo->authalgorithm != DHCP6_AUTHALG_HMACMD5 &&
+		    optinfo->authalgorithm != DHCP6_AUTHALG_HMACSHA256) {
 			dprintf(LOG_INFO, FNAME, "unknown authentication "
 			    "algorithm (%d) required by %s",
 			    optinfo->authalgorithm,
@@ -3628,7 +4742,7 @@ process_auth(dh6, len, client_conf, optinfo, roptinfo)
 		roptinfo->delayedauth_keyid = key->keyid;
 		roptinfo->delayedauth_realmlen = key->realmlen;
 		roptinfo->delayedauth_realmval =
-		    malloc(roptinfo->delayedauth_realmlen);
+		    dhcp6_malloc(roptinfo->delayedauth_realmlen);
 		if (roptinfo->delayedauth_realmval == NULL) {
 			dprintf(LOG_ERR, FNAME, "failed to allocate memory "
 			    "for authentication realm for %s",
@@ -3646,6 +4760,7 @@ process_auth(dh6, len, client_conf, optinfo, roptinfo)
 		    "with unsupported protocol (%d)",
 		    clientstr(client_conf, &optinfo->clientID),
 		    optinfo->authproto);
+		drop_reason = STATS_DROP_AUTH;
 		return (-1);	/* or simply ignore it? */
 	}
 
@@ -3656,6 +4771,7 @@ process_auth(dh6, len, client_conf, optinfo, roptinfo)
 			 * the server MUST discard the message.
 			 * [RFC3315 Section 21.4.5.2]
 			 */
+			drop_reason = STATS_DROP_AUTH;
 			return (-1);
 		}
 	} else {
@@ -3674,7 +4790,8 @@ clientstr(conf, duid)
 	struct host_conf *conf;
 	struct duid *duid;
 {
-	if (conf != NULL)
+	/* host configurations made for a pool have no name */
+	if (conf != NULL && conf->name != NULL)
 		return (conf->name);
 
 	return (duidstr(duid));
@@ -0,0 +1,371 @@
+/*
+ * Copyright (C) 2026 WIDE Project.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the project nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE PROJECT AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE PROJECT OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <sys/queue.h>
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#else
+#include <poll.h>
+#endif
+
+#include <netinet/in.h>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <syslog.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "dhcp6.h"
+#include "config.h"
+#include "common.h"
+#include "timer.h"
+#include "evloop.h"
+
+/*
+ * A small event loop shared by the daemons.  Descriptors are registered
+ * once with evloop_add() and stay registered until evloop_remove(), and
+ * the loop sleeps until one of them is readable (writable, with
+ * EVLOOP_WRITE) or the earliest timer of timer.c expires.  On Linux it is
+ * built on epoll(7), with a timerfd that is re-armed only when the
+ * earliest timer changes; elsewhere a persistent poll(2) array is used.
+ *
+ * Each registration gets a generation number that is carried with its
+ * events, so an event for a descriptor that a handler has removed (and
+ * possibly reused) during the same round is ignored.
+ */
+struct evloop_source {
+	int fd;
+	int flags;
+	u_int32_t gen;
+	evloop_handler_t handler;
+	void *arg;
+#ifndef __linux__
+	int pollidx;		/* position in pollfds */
+#endif
+};
+
+struct evloop_ready {
+	int fd;
+	u_int32_t gen;
+};
+
+#define EVLOOP_MAXEVENTS 64
+
+static struct evloop_source **sources;	/* indexed by descriptor */
+static int nsources;
+static u_int32_t evloop_gen;
+
+#ifdef __linux__
+#define EVLOOP_TIMER_TAG	((u_int64_t)-1)
+
+static int epfd = -1;
+static int tfd = -1;
+static int timer_armed;
+static struct timeval timer_armed_tv;
+
+static void evloop_settimer __P((void));
+#else
+static struct pollfd *pollfds;
+static int npollfds, pollfds_size;
+#endif
+
+int
+evloop_init()
+{
+#ifdef __linux__
+	struct epoll_event ev;
+
+	if ((epfd = epoll_create1(EPOLL_CLOEXEC)) < 0) {
+		dprintf(LOG_ERR, FNAME, "epoll_create1: %s", strerror(errno));
+		return (-1);
+	}
+	if ((tfd = timerfd_create(CLOCK_REALTIME,
+	    TFD_NONBLOCK | TFD_CLOEXEC)) < 0) {
+		dprintf(LOG_ERR, FNAME, "timerfd_create: %s",
+		    strerror(errno));
+		goto fail;
+	}
+	/*
+	 * The timerfd is edge-triggered, so it needn't be read: re-arming it
+	 * resets its expiration count.
+	 */
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN | EPOLLET;
+	ev.data.u64 = EVLOOP_TIMER_TAG;
+	if (epoll_ctl(epfd, EPOLL_CTL_ADD, tfd, &ev) < 0) {
+		dprintf(LOG_ERR, FNAME, "epoll_ctl: %s", strerror(errno));
+		goto fail;
+	}
+
+	return (0);
+
+  fail:
+	if (tfd >= 0)
+		close(tfd);
+	close(epfd);
+	tfd = epfd = -1;
+	return (-1);
+#else
+	return (0);
+#endif
+}
+
+int
+evloop_add(fd, flags, handler, arg)
+	int fd, flags;
+	evloop_handler_t handler;
+	void *arg;
+{
+	struct evloop_source *src;
+#ifdef __linux__
+	struct epoll_event ev;
+#endif
+
+	if (fd < 0 || handler == NULL)
+		return (-1);
+
+	if (fd >= nsources) {
+		struct evloop_source **newsources;
+		int newsize = nsources ? nsources : 64;
+
+		while (newsize <= fd)
+			newsize *= 2;
+		if ((newsources = realloc(sources,
+		    newsize * sizeof(*newsources))) == NULL) {
+			dprintf(LOG_ERR, FNAME, "memory allocation failed");
+			return (-1);
+		}
+		memset(newsources + nsources, 0,
+		    (newsize - nsources) * sizeof(*newsources));
+		sources = newsources;
+		nsources = newsize;
+	}
+	if (sources[fd] != NULL) {
+		dprintf(LOG_ERR, FNAME, "fd %d is already registered", fd);
+		return (-1);
+	}
+
+	if ((flags & EVLOOP_EDGE) &&
+	    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK) < 0) {
+		dprintf(LOG_ERR, FNAME, "fcntl(O_NONBLOCK): %s",
+		    strerror(errno));
+		return (-1);
+	}
+
+	if ((src = malloc(sizeof(*src))) == NULL) {
+		dprintf(LOG_ERR, FNAME, "memory allocation failed");
+		return (-1);
+	}
+	memset(src, 0, sizeof(*src));
+	src->fd = fd;
+	src->flags = flags;
+	src->gen = ++evloop_gen;
+	src->handler = handler;
+	src->arg = arg;
+
+#ifdef __linux__
+	memset(&ev, 0, sizeof(ev));
+	ev.events = (flags & EVLOOP_WRITE) ? EPOLLOUT : EPOLLIN;
+	if ((flags & EVLOOP_EDGE))
+		ev.events |= EPOLLET;
+	ev.data.u64 = ((u_int64_t)src->gen << 32) | (u_int32_t)fd;
+	if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+		dprintf(LOG_ERR, FNAME, "epoll_ctl(fd=%d): %s", fd,
+		    strerror(errno));
+		free(src);
+		return (-1);
+	}
+#else
+	if (npollfds == pollfds_size) {
+		struct pollfd *newpfds;
+		int newsize = pollfds_size ? pollfds_size * 2 : 16;
+
+		if ((newpfds = realloc(pollfds,
+		    newsize * sizeof(*newpfds))) == NULL) {
+			dprintf(LOG_ERR, FNAME, "memory allocation failed");
+			free(src);
+			return (-1);
+		}
+		pollfds = newpfds;
+		pollfds_size = newsize;
+	}
+	src->pollidx = npollfds++;
+	pollfds[src->pollidx].fd = fd;
+	pollfds[src->pollidx].events =
+	    (flags & EVLOOP_WRITE) ? POLLOUT : POLLIN;
+	pollfds[src->pollidx].revents = 0;
+#endif
+
+	sources[fd] = src;
+
+	return (0);
+}
+
+/* must be called before the descriptor is closed */
+void
+evloop_remove(fd)
+	int fd;
+{
+	struct evloop_source *src;
+
+	if (fd < 0 || fd >= nsources || (src = sources[fd]) == NULL)
+		return;
+
+#ifdef __linux__
+	if (epoll_ctl(epfd, EPOLL_CTL_DEL, fd, NULL) < 0) {
+		dprintf(LOG_WARNING, FNAME, "epoll_ctl(fd=%d): %s", fd,
+		    strerror(errno));
+	}
+#else
+	/* move the last entry to the hole */
+	if (src->pollidx != --npollfds) {
+		pollfds[src->pollidx] = pollfds[npollfds];
+		sources[pollfds[src->pollidx].fd]->pollidx = src->pollidx;
+	}
+#endif
+
+	sources[fd] = NULL;
+	free(src);
+}
+
+/*
+ * Run the expired timers, wait for the next event or timer expiration,
+ * and call the handlers of the ready descriptors.  Returns early if the
+ * wait is interrupted by a signal.
+ */
+void
+evloop_dispatch()
+{
+	struct evloop_ready ready[EVLOOP_MAXEVENTS];
+	struct evloop_source *src;
+	int i, n, nready = 0;
+#ifdef __linux__
+	struct epoll_event events[EVLOOP_MAXEVENTS];
+
+	(void)dhcp6_check_timer();
+	evloop_settimer();
+
+	if ((n = epoll_wait(epfd, events, EVLOOP_MAXEVENTS, -1)) < 0) {
+		if (errno == EINTR)
+			return;
+		dprintf(LOG_ERR, FNAME, "epoll_wait: %s", strerror(errno));
+		exit(1);
+	}
+
+	for (i = 0; i < n; i++) {
+		if (events[i].data.u64 == EVLOOP_TIMER_TAG) {
+			/* the timers will be run in the next round */
+			timer_armed = 0;
+			continue;
+		}
+		ready[nready].fd = (int)(events[i].data.u64 & 0xffffffff);
+		ready[nready].gen = (u_int32_t)(events[i].data.u64 >> 32);
+		nready++;
+	}
+#else
+	struct timeval *w;
+	int timeout = -1;
+
+	if ((w = dhcp6_check_timer()) != NULL) {
+		/* round up, so we don't wake up before the timer expires */
+		if (w->tv_sec >= INT_MAX / 1000 - 1)
+			timeout = INT_MAX;
+		else
+			timeout = w->tv_sec * 1000 + (w->tv_usec + 999) / 1000;
+	}
+
+	if ((n = poll(pollfds, npollfds, timeout)) < 0) {
+		if (errno == EINTR)
+			return;
+		dprintf(LOG_ERR, FNAME, "poll: %s", strerror(errno));
+		exit(1);
+	}
+
+	for (i = 0; i < npollfds && nready < n &&
+	    nready < EVLOOP_MAXEVENTS; i++) {
+		if (pollfds[i].revents == 0)
+			continue;
+		ready[nready].fd = pollfds[i].fd;
+		ready[nready].gen = sources[pollfds[i].fd]->gen;
+		nready++;
+	}
+#endif
+
+	for (i = 0; i < nready; i++) {
+		int fd = ready[i].fd;
+
+		if (fd >= nsources || (src = sources[fd]) == NULL ||
+		    src->gen != ready[i].gen) {
+			continue; /* removed by a previous handler */
+		}
+		(*src->handler)(fd, src->arg);
+	}
+}
+
+#ifdef __linux__
+/* make the timerfd expire at the earliest timer, if it has changed */
+static void
+evloop_settimer()
+{
+	struct timeval *deadline;
+	struct itimerspec its;
+
+	deadline = dhcp6_timer_deadline();
+	if (deadline == NULL && !timer_armed)
+		return;
+	if (deadline != NULL && timer_armed &&
+	    TIMEVAL_EQUAL(*deadline, timer_armed_tv))
+		return;
+
+	memset(&its, 0, sizeof(its));
+	if (deadline != NULL) {
+		its.it_value.tv_sec = deadline->tv_sec;
+		its.it_value.tv_nsec = deadline->tv_usec * 1000;
+		if (its.it_value.tv_sec == 0 && its.it_value.tv_nsec == 0)
+			its.it_value.tv_nsec = 1; /* zero would disarm it */
+	}
+	if (timerfd_settime(tfd, TFD_TIMER_ABSTIME, &its, NULL) < 0) {
+		dprintf(LOG_ERR, FNAME, "timerfd_settime: %s",
+		    strerror(errno));
+		exit(1);
+	}
+
+	if (deadline != NULL) {
+		timer_armed = 1;
+		timer_armed_tv = *deadline;
+	} else
+		timer_armed = 0;
+}
+#endif
@@ -48,11 +48,23 @@
 #include <dhcp6.h>
 #include <config.h>
 #include <common.h>
+#include <rtnl.h>
 
 extern int errno;
 
 struct dhcp6_if *dhcp6_if;
 
+/*
+ * Interfaces indexed by their interface index, so that the interface of
+ * a received packet is found in constant time however many interfaces we
+ * serve.  Interface indices are small integers allocated densely by the
+ * kernel, so a plain array does.
+ */
+static struct dhcp6_if **ifindex_table;
+static unsigned int ifindex_tablesize;
+
+static int ifindex_add __P((struct dhcp6_if *));
+
 struct dhcp6_if *
 ifinit(ifname)
 	char *ifname;
@@ -87,6 +99,10 @@ ifinit(ifname)
 	ifp->authalgorithm = DHCP6_AUTHALG_UNDEF;
 	ifp->authrdm = DHCP6_AUTHRDM_UNDEF;
 
+#ifdef __linux__
+	(void)rtnl_findaddr(ifp->ifid, (struct in6_addr *)&in6addr_any, 0,
+	    RTNL_NOLINKLOCAL, &ifp->addr);
+#else
 	{
 		struct ifaddrs *ifa, *ifap;
 		struct sockaddr_in6 *sin6;
@@ -114,6 +130,10 @@ ifinit(ifname)
 
 		freeifaddrs(ifap);
 	}
+#endif
+
+	if (ifindex_add(ifp))
+		goto fail;
 
 	ifp->next = dhcp6_if;
 	dhcp6_if = ifp;
@@ -149,6 +169,14 @@ ifreset(ifp)
 	linkid = ifid;		/* XXX: assume 1to1 mapping IFs and links */
 #endif
 
+	/* the index may have changed if the interface was recreated */
+	if (ifp->ifid != ifid && find_ifconfbyid(ifp->ifid) == ifp) {
+		ifindex_table[ifp->ifid] = NULL;
+		ifp->ifid = ifid;
+		if (ifindex_add(ifp))
+			return (-1);
+	}
+
 	ifp->ifid = ifid;
 	ifp->linkid = linkid;
 
@@ -173,12 +201,35 @@ struct dhcp6_if *
 find_ifconfbyid(id)
 	unsigned int id;
 {
-	struct dhcp6_if *ifp;
+	if (id >= ifindex_tablesize)
+		return (NULL);
 
-	for (ifp = dhcp6_if; ifp; ifp = ifp->next) {
-		if (ifp->ifid == id)
-			return (ifp);
+	return (ifindex_table[id]);
+}
+
+static int
+ifindex_add(ifp)
+	struct dhcp6_if *ifp;
+{
+	struct dhcp6_if **newtable;
+	unsigned int newsize;
+
+	if (ifp->ifid >= ifindex_tablesize) {
+		newsize = ifindex_tablesize ? ifindex_tablesize * 2 : 16;
+		if (newsize <= ifp->ifid)
+			newsize = ifp->ifid + 1;
+		if ((newtable = realloc(ifindex_table,
+		    newsize * sizeof(*newtable))) == NULL) {
+			dprintf(LOG_ERR, FNAME, "memory allocation failed");
+			return (-1);
+		}
+		memset(newtable + ifindex_tablesize, 0,
+		    (newsize - ifindex_tablesize) * sizeof(*newtable));
+		ifindex_table = newtable;
+		ifindex_tablesize = newsize;
 	}
 
-	return (NULL);
+	ifindex_table[ifp->ifid] = ifp;
+
+	return (0);
 }
@@ -44,6 +44,7 @@
 # endif
 #endif
 #include <netinet/in.h>
+#include <arpa/inet.h>
 #include "dhcp6.h"
 #include "config.h"
 #include "common.h"
@@ -53,52 +54,119 @@
 #define TRUE	!FALSE
 #endif
 
-struct hash_entry {
-	LIST_ENTRY(hash_entry) list;
-	char *val;
-	char flag;	/* 0x01: DHCP6_LEASE_DECLINED */
+/*
+ * The lease table is an open-addressing hash table (linear probing)
+ * keyed by the leased address itself, so a lease costs no allocation.
+ * When the table needs to grow, a new table is allocated and the entries
+ * of the old one are moved a few slots at a time by each subsequent
+ * update, so that a single packet never pays for rehashing the whole
+ * table.  Until the move completes, lookups consult both tables.
+ */
+struct lease_slot {
+	struct in6_addr addr;
+	u_int8_t state;
+	u_int8_t flag;
 };
 
+/* slot states */
+#define LEASE_SLOT_EMPTY	0
+#define LEASE_SLOT_USED		1
+#define LEASE_SLOT_DELETED	2
+
 /* marked as declined (e.g. someone has been using the same address) */
 #define	DHCP6_LEASE_DECLINED	0x01	
 
-LIST_HEAD(hash_head, hash_entry);
-
-typedef unsigned int (*pfn_hash_t)(void *val) ;
-typedef int (*pfh_hash_match_t)(void *val1, void *val2); 
-
-struct hash_table {
-	struct hash_head *table;
-	unsigned int size;
-	pfn_hash_t hash;
-	pfh_hash_match_t match;
+struct lease_table {
+	struct lease_slot *slots;
+	size_t size;		/* always a power of 2 */
+	size_t count;		/* number of leases */
+	size_t used;		/* number of leases and deleted slots */
 };
 
 #ifndef DHCP6_LEASE_TABLE_SIZE
-#define DHCP6_LEASE_TABLE_SIZE	256
+#define DHCP6_LEASE_TABLE_SIZE	1024
 #endif
+/* number of old slots moved to the new table per update */
+#define LEASE_REHASH_STEP	64
 
-static struct hash_table dhcp6_lease_table;
+static struct lease_table lease_table;
+static struct lease_table lease_oldtable; /* being moved to lease_table */
+static size_t lease_rehash_pos;		/* next slot of lease_oldtable */
+static u_int32_t lease_hash_seed;
 
-static unsigned int in6_addr_hash __P((void *));
-static int in6_addr_match __P((void *, void *));
+/*
+ * Free address space of an address pool.  The free addresses are kept as
+ * a set of disjoint extents in a treap ordered by their start address,
+ * where each node also counts the free addresses in its subtree.  This
+ * allows finding the lowest free address, or the n-th free one for
+ * randomized allocation, and marking an address as used or free in
+ * O(log n) of the number of extents, regardless of how full the pool is.
+ * Addresses are represented as offsets from the beginning of the pool,
+ * so a pool can span at most 2^64 - 1 addresses.
+ */
+struct lease_extent {
+	u_int64_t start;	/* first free offset */
+	u_int64_t end;		/* last free offset */
+	u_int64_t free;		/* free addresses in this subtree */
+	long prio;
+	struct lease_extent *left, *right;
+};
+
+struct lease_pool {
+	LIST_ENTRY(lease_pool) link;
+
+	struct in6_addr min;
+	u_int64_t maxoff;	/* offset of the last address */
+	u_int64_t lo, hi;	/* offsets of our part of the pool */
+	int random;		/* randomized allocation */
+	struct lease_extent *root;
+};
 
-static int hash_table_init __P((struct hash_table *, unsigned int,
-				pfn_hash_t, pfh_hash_match_t));
-static void hash_table_cleanup __P((struct hash_table *));
-static int hash_table_add __P((struct hash_table *, void *, unsigned int));
-static int hash_table_remove __P((struct hash_table *, void *));
-static struct hash_entry * hash_table_find __P((struct hash_table *, void *));
+static LIST_HEAD(, lease_pool) lease_pool_head;
+static int lease_part_id = 0, lease_part_count = 1;
+
+static u_int32_t lease_hash __P((struct in6_addr *));
+static struct lease_slot *lease_table_lookup __P((struct lease_table *,
+    struct in6_addr *, u_int32_t));
+static struct lease_slot *lease_find __P((struct in6_addr *));
+static int lease_table_add __P((struct in6_addr *));
+static int lease_table_grow __P((void));
+static void lease_rehash __P((size_t));
+static void lease_table_free __P((struct lease_table *));
+
+static int pool_offset __P((struct lease_pool *, struct in6_addr *,
+    u_int64_t *));
+static void pool_mark_used __P((struct in6_addr *));
+static void pool_mark_free __P((struct in6_addr *));
+static void pool_exclude __P((struct lease_pool *, char *, int));
+static void pool_restrict __P((struct lease_pool *));
+static struct lease_extent *extent_new __P((u_int64_t, u_int64_t));
+static void extent_update __P((struct lease_extent *));
+static void extent_split __P((struct lease_extent *, u_int64_t,
+    struct lease_extent **, struct lease_extent **));
+static struct lease_extent *extent_merge __P((struct lease_extent *,
+    struct lease_extent *));
+static struct lease_extent *extent_remove_max __P((struct lease_extent **));
+static struct lease_extent *extent_remove_min __P((struct lease_extent **));
+static void extent_free_tree __P((struct lease_extent *));
+static int extent_remove __P((struct lease_extent **, u_int64_t,
+    u_int64_t));
+static int extent_add __P((struct lease_extent **, u_int64_t));
 
 int
 lease_init(void)
 {
 	dprintf(LOG_DEBUG, FNAME, "called");
 
-	if (hash_table_init(&dhcp6_lease_table, DHCP6_LEASE_TABLE_SIZE,
-		in6_addr_hash, in6_addr_match) != 0) {
+	lease_hash_seed = (u_int32_t)random();
+
+	memset(&lease_table, 0, sizeof(lease_table));
+	if ((lease_table.slots = calloc(DHCP6_LEASE_TABLE_SIZE,
+	    sizeof(struct lease_slot))) == NULL) {
+		dprintf(LOG_ERR, FNAME, "memory allocation failed");
 		return (-1);
 	}
+	lease_table.size = DHCP6_LEASE_TABLE_SIZE;
 
 	return (0);
 }
@@ -106,7 +174,8 @@ lease_init(void)
 void
 lease_cleanup(void)
 {
-	hash_table_cleanup(&dhcp6_lease_table);
+	lease_table_free(&lease_oldtable);
+	lease_table_free(&lease_table);
 }
 
 int
@@ -118,15 +187,16 @@ lease_address(addr)
 
 	dprintf(LOG_DEBUG, FNAME, "addr=%s", in6addr2str(addr, 0));
 
-	if (hash_table_find(&dhcp6_lease_table, addr)) {
+	if (lease_find(addr)) {
 		dprintf(LOG_WARNING, FNAME, "already leased: %s",
 			in6addr2str(addr, 0));
 		return (FALSE);
 	}
 
-	if (hash_table_add(&dhcp6_lease_table, addr, sizeof(*addr)) != 0) {
+	if (lease_table_add(addr) != 0) {
 		return (FALSE);
 	}
+	pool_mark_used(addr);
 
 	return (TRUE);
 }
@@ -135,194 +205,749 @@ void
 release_address(addr)
 	struct in6_addr *addr;
 {
+	struct lease_slot *slot;
+
 	if (!addr)
 		return;
 
 	dprintf(LOG_DEBUG, FNAME, "addr=%s", in6addr2str(addr, 0));
 
-	if (hash_table_remove(&dhcp6_lease_table, addr) != 0) {
+	if ((slot = lease_find(addr)) == NULL) {
 		dprintf(LOG_WARNING, FNAME, "not found: %s", in6addr2str(addr, 0));
+		return;
 	}
+	slot->state = LEASE_SLOT_DELETED;
+	if (slot >= lease_table.slots &&
+	    slot < lease_table.slots + lease_table.size)
+		lease_table.count--;
+	else
+		lease_oldtable.count--;
+	lease_rehash(LEASE_REHASH_STEP);
+	pool_mark_free(addr);
 }
 
 void
 decline_address(addr)
 	struct in6_addr *addr;
 {
-	struct hash_entry *entry;
+	struct lease_slot *slot;
 
 	if (!addr)
 		return;
 
 	dprintf(LOG_DEBUG, FNAME, "addr=%s", in6addr2str(addr, 0));
 
-	entry = hash_table_find(&dhcp6_lease_table, addr);
-	if (entry == NULL) {
+	if ((slot = lease_find(addr)) == NULL) {
 		dprintf(LOG_WARNING, FNAME, "not found: %s",
 			in6addr2str(addr, 0));
 		return;
 	}
 
-	entry->flag |= DHCP6_LEASE_DECLINED;
+	slot->flag |= DHCP6_LEASE_DECLINED;
 }
 
 int
 is_leased(addr)
 	struct in6_addr *addr;
 {
-	return (hash_table_find(&dhcp6_lease_table, addr) != NULL);
+	return (lease_find(addr) != NULL);
 }
 
-static unsigned int
-in6_addr_hash(val)
-	void *val;
+size_t
+lease_count()
 {
-	u_int8_t *addr = ((struct in6_addr *)val)->s6_addr;
-	unsigned int hash = 0;
-	int i;
+	return (lease_table.count + lease_oldtable.count);
+}
 
-	for (i = 0; i < 16; i++) {
-		hash += addr[i];
+/*
+ * Create the free space map for an address pool ranging from min to max.
+ * Addresses that are already leased, and multicast, link-local or
+ * site-local addresses, are excluded.
+ */
+struct lease_pool *
+lease_pool_create(min, max, randomize)
+	struct in6_addr *min, *max;
+	int randomize;
+{
+	struct lease_pool *pool;
+	struct lease_table *tabs[2];
+	u_int64_t off;
+	size_t i;
+	int t;
+
+	if ((pool = malloc(sizeof(*pool))) == NULL) {
+		dprintf(LOG_ERR, FNAME, "memory allocation failed");
+		return (NULL);
+	}
+	memset(pool, 0, sizeof(*pool));
+	pool->min = *min;
+	pool->random = randomize;
+
+	/* pool->maxoff = max - min, capped to 2^64 - 2 */
+	pool->maxoff = (u_int64_t)-2;
+	if (pool_offset(pool, max, &off) == 0 && off <= pool->maxoff)
+		pool->maxoff = off;
+	else {
+		dprintf(LOG_WARNING, FNAME, "address range %s->%s is too "
+		    "large; only the first 2^64-1 addresses are used",
+		    in6addr2str(min, 0), in6addr2str(max, 0));
 	}
 
-	return (hash);
+	if ((pool->root = extent_new(0, pool->maxoff)) == NULL) {
+		free(pool);
+		return (NULL);
+	}
+	pool_exclude(pool, "ff00::", 8);
+	pool_exclude(pool, "fe80::", 10);
+	pool_exclude(pool, "fec0::", 10);
+	pool_restrict(pool);
+
+	tabs[0] = &lease_table;
+	tabs[1] = &lease_oldtable;
+	for (t = 0; t < 2; t++) {
+		for (i = 0; i < tabs[t]->size; i++) {
+			struct lease_slot *slot = &tabs[t]->slots[i];
+
+			if (slot->state == LEASE_SLOT_USED &&
+			    pool_offset(pool, &slot->addr, &off) == 0)
+				(void)extent_remove(&pool->root, off, off);
+		}
+	}
+
+	LIST_INSERT_HEAD(&lease_pool_head, pool, link);
+
+	return (pool);
 }
 
-static int
-in6_addr_match(val1, val2)
-	void *val1, *val2;
+/*
+ * Use only the id-th of count equal parts of every address pool, so that
+ * worker processes allocating from the same pools never collide.  This
+ * applies to the existing pools and the ones created later.
+ */
+void
+lease_partition(id, count)
+	int id, count;
 {
-	struct in6_addr * addr1 = val1;
-	struct in6_addr * addr2 = val2;
+	struct lease_pool *pool;
 
-	return (memcmp(addr1->s6_addr, addr2->s6_addr, 16) == 0);
+	lease_part_id = id;
+	lease_part_count = count;
+
+	LIST_FOREACH(pool, &lease_pool_head, link)
+		pool_restrict(pool);
 }
 
 /*
- * hash table
+ * The part holding addr when every pool is divided into count parts as
+ * by lease_partition(), or -1 if addr is in no pool.
  */
-static int
-hash_table_init(table, size, hash, match)
-	struct hash_table *table; 
-	unsigned int size;
-	pfn_hash_t hash;
-	pfh_hash_match_t match;
+int
+lease_part_owner(addr, count)
+	struct in6_addr *addr;
+	int count;
+{
+	struct lease_pool *pool;
+	u_int64_t off, size, part, rem;
+
+	LIST_FOREACH(pool, &lease_pool_head, link) {
+		if (pool_offset(pool, addr, &off) != 0)
+			continue;
+
+		/* the first rem parts have one more address */
+		size = pool->maxoff + 1;
+		part = size / count;
+		rem = size % count;
+		if (off < (part + 1) * rem)
+			return ((int)(off / (part + 1)));
+		return ((int)(rem + (off - (part + 1) * rem) / part));
+	}
+
+	return (-1);
+}
+
+void
+lease_pool_destroy(pool)
+	struct lease_pool *pool;
+{
+	if (!pool)
+		return;
+
+	LIST_REMOVE(pool, link);
+	extent_free_tree(pool->root);
+	free(pool);
+}
+
+/*
+ * Get a free address from the pool.  The address is not marked as used
+ * until it is actually leased by lease_address().
+ */
+int
+lease_pool_alloc(pool, addr)
+	struct lease_pool *pool;
+	struct in6_addr *addr;
 {
+	struct lease_extent *ext;
+	u_int64_t off, n, carry;
 	int i;
 
-	if (!table || !hash || !match) {
-		return (-1);
+	if (!pool || (ext = pool->root) == NULL)
+		return (FALSE);
+
+	if (pool->random) {
+		n = ((u_int64_t)random() << 33) ^ ((u_int64_t)random() << 16) ^
+		    (u_int64_t)random();
+		n %= ext->free;
+		for (;;) {
+			u_int64_t lfree = ext->left ? ext->left->free : 0;
+
+			if (n < lfree) {
+				ext = ext->left;
+				continue;
+			}
+			n -= lfree;
+			if (n <= ext->end - ext->start) {
+				off = ext->start + n;
+				break;
+			}
+			n -= ext->end - ext->start + 1;
+			ext = ext->right;
+		}
+	} else {
+		while (ext->left)
+			ext = ext->left;
+		off = ext->start;
 	}
 
-	if ((table->table = malloc(sizeof(*table->table) * size)) == NULL) {
-		return (-1);
+	/* addr = pool->min + off */
+	*addr = pool->min;
+	for (i = 15, carry = off; i >= 0 && carry; i--) {
+		carry += addr->s6_addr[i];
+		addr->s6_addr[i] = (u_int8_t)(carry & 0xff);
+		carry >>= 8;
 	}
 
-	for (i = 0; i < size; i++)
-		LIST_INIT(&table->table[i]);
+	return (TRUE);
+}
+
+u_int64_t
+lease_pool_freecount(pool)
+	struct lease_pool *pool;
+{
+	if (!pool || !pool->root)
+		return (0);
 
-	table->size = size;
-	table->hash = hash;
-	table->match = match;
+	return (pool->root->free);
+}
+
+/* the number of addresses in our part of the pool */
+u_int64_t
+lease_pool_size(pool)
+	struct lease_pool *pool;
+{
+	if (!pool || pool->hi < pool->lo)
+		return (0);
 
+	return (pool->hi - pool->lo + 1);
+}
+
+/* compute addr - pool->min; fails if it doesn't fit in 64 bits */
+static int
+pool_offset(pool, addr, offp)
+	struct lease_pool *pool;
+	struct in6_addr *addr;
+	u_int64_t *offp;
+{
+	u_int8_t diff[16];
+	int i, borrow = 0;
+	u_int64_t off = 0;
+
+	for (i = 15; i >= 0; i--) {
+		int d = addr->s6_addr[i] - pool->min.s6_addr[i] - borrow;
+
+		borrow = (d < 0);
+		diff[i] = (u_int8_t)(d & 0xff);
+	}
+	if (borrow)
+		return (-1);	/* addr < min */
+	for (i = 0; i < 8; i++) {
+		if (diff[i])
+			return (-1);
+	}
+	for (i = 8; i < 16; i++)
+		off = (off << 8) | diff[i];
+	if (off > pool->maxoff)
+		return (-1);
+
+	*offp = off;
 	return (0);
 }
 
 static void
-hash_table_cleanup(table)
-	struct hash_table *table; 
+pool_mark_used(addr)
+	struct in6_addr *addr;
 {
+	struct lease_pool *pool;
+	u_int64_t off;
+
+	LIST_FOREACH(pool, &lease_pool_head, link) {
+		if (pool_offset(pool, addr, &off) == 0)
+			(void)extent_remove(&pool->root, off, off);
+	}
+}
+
+static void
+pool_mark_free(addr)
+	struct in6_addr *addr;
+{
+	struct lease_pool *pool;
+	u_int64_t off;
+
+	LIST_FOREACH(pool, &lease_pool_head, link) {
+		if (IN6_IS_ADDR_MULTICAST(addr) ||
+		    IN6_IS_ADDR_LINKLOCAL(addr) ||
+		    IN6_IS_ADDR_SITELOCAL(addr))
+			continue;
+		if (pool_offset(pool, addr, &off) == 0 &&
+		    off >= pool->lo && off <= pool->hi)
+			(void)extent_add(&pool->root, off);
+	}
+}
+
+/* remove the addresses outside our partition from the free space */
+static void
+pool_restrict(pool)
+	struct lease_pool *pool;
+{
+	u_int64_t size, part, rem, id;
+
+	/* maxoff is at most 2^64 - 2, so the size fits */
+	size = pool->maxoff + 1;
+	part = size / lease_part_count;
+	rem = size % lease_part_count;
+	id = lease_part_id;
+
+	pool->lo = id * part + (id < rem ? id : rem);
+	if (part == 0 && id >= rem) {
+		/* nothing for us */
+		pool->lo = 1;
+		pool->hi = 0;
+		(void)extent_remove(&pool->root, 0, pool->maxoff);
+		return;
+	}
+	pool->hi = pool->lo + part - (id < rem ? 0 : 1);
+
+	if (pool->lo > 0)
+		(void)extent_remove(&pool->root, 0, pool->lo - 1);
+	if (pool->hi < pool->maxoff)
+		(void)extent_remove(&pool->root, pool->hi + 1, pool->maxoff);
+}
+
+/* remove the addresses in prefix/plen from the free space of the pool */
+static void
+pool_exclude(pool, prefix, plen)
+	struct lease_pool *pool;
+	char *prefix;
+	int plen;
+{
+	struct in6_addr lo, hi;
+	u_int64_t from, to;
 	int i;
 
-	if (!table) {
+	if (inet_pton(AF_INET6, prefix, &lo) != 1)
 		return;
+	hi = lo;
+	for (i = plen; i < 128; i++)
+		hi.s6_addr[i / 8] |= 0x80 >> (i % 8);
+
+	/* intersect [lo, hi] with the pool */
+	if (pool_offset(pool, &lo, &from) != 0) {
+		if (memcmp(&lo, &pool->min, sizeof(lo)) > 0)
+			return;	/* lo is beyond the pool */
+		from = 0;
+	}
+	if (pool_offset(pool, &hi, &to) != 0) {
+		if (memcmp(&hi, &pool->min, sizeof(hi)) < 0)
+			return;	/* hi is below the pool */
+		to = pool->maxoff;
 	}
 
-	for (i = 0; i < table->size; i++) {
-		while (!LIST_EMPTY(&table->table[i])) {
-			struct hash_entry *entry = LIST_FIRST(&table->table[i]);
-			LIST_REMOVE(entry, list);
-			if (entry->val)
-				free(entry->val);
-			free(entry);
+	(void)extent_remove(&pool->root, from, to);
+}
+
+static struct lease_extent *
+extent_new(start, end)
+	u_int64_t start, end;
+{
+	struct lease_extent *ext;
+
+	if ((ext = malloc(sizeof(*ext))) == NULL) {
+		dprintf(LOG_ERR, FNAME, "memory allocation failed");
+		return (NULL);
+	}
+	ext->start = start;
+	ext->end = end;
+	ext->prio = random();
+	ext->left = ext->right = NULL;
+	extent_update(ext);
+
+	return (ext);
+}
+
+static void
+extent_update(ext)
+	struct lease_extent *ext;
+{
+	ext->free = ext->end - ext->start + 1;
+	if (ext->left)
+		ext->free += ext->left->free;
+	if (ext->right)
+		ext->free += ext->right->free;
+}
+
+/* split the tree into extents starting before key and the others */
+static void
+extent_split(t, key, lp, rp)
+	struct lease_extent *t;
+	u_int64_t key;
+	struct lease_extent **lp, **rp;
+{
+	if (t == NULL) {
+		*lp = *rp = NULL;
+		return;
+	}
+
+	if (t->start < key) {
+		extent_split(t->right, key, &t->right, rp);
+		*lp = t;
+	} else {
+		extent_split(t->left, key, lp, &t->left);
+		*rp = t;
+	}
+	extent_update(t);
+}
+
+/* join two trees; all extents in l must precede those in r */
+static struct lease_extent *
+extent_merge(l, r)
+	struct lease_extent *l, *r;
+{
+	if (l == NULL)
+		return (r);
+	if (r == NULL)
+		return (l);
+
+	if (l->prio > r->prio) {
+		l->right = extent_merge(l->right, r);
+		extent_update(l);
+		return (l);
+	} else {
+		r->left = extent_merge(l, r->left);
+		extent_update(r);
+		return (r);
+	}
+}
+
+static struct lease_extent *
+extent_remove_max(tp)
+	struct lease_extent **tp;
+{
+	struct lease_extent *t = *tp, *ext;
+
+	if (t->right == NULL) {
+		*tp = t->left;
+		t->left = NULL;
+		extent_update(t);
+		return (t);
+	}
+	ext = extent_remove_max(&t->right);
+	extent_update(t);
+
+	return (ext);
+}
+
+static struct lease_extent *
+extent_remove_min(tp)
+	struct lease_extent **tp;
+{
+	struct lease_extent *t = *tp, *ext;
+
+	if (t->left == NULL) {
+		*tp = t->right;
+		t->right = NULL;
+		extent_update(t);
+		return (t);
+	}
+	ext = extent_remove_min(&t->left);
+	extent_update(t);
+
+	return (ext);
+}
+
+static void
+extent_free_tree(t)
+	struct lease_extent *t;
+{
+	if (t == NULL)
+		return;
+	extent_free_tree(t->left);
+	extent_free_tree(t->right);
+	free(t);
+}
+
+/* mark the offsets from a to b (inclusive) as used */
+static int
+extent_remove(tp, a, b)
+	struct lease_extent **tp;
+	u_int64_t a, b;
+{
+	struct lease_extent *l, *m, *r, *ext, *tail = NULL;
+
+	extent_split(*tp, a, &l, &r);
+
+	/* the last extent starting before a may cover [a, b] */
+	if (l) {
+		ext = extent_remove_max(&l);
+		if (ext->end >= a) {
+			if (ext->end > b &&
+			    (tail = extent_new(b + 1, ext->end)) == NULL) {
+				*tp = extent_merge(extent_merge(l, ext), r);
+				return (-1);
+			}
+			ext->end = a - 1;
+			extent_update(ext);
 		}
+		l = extent_merge(l, ext);
 	}
-	free(table->table);
-	memset(table, 0, sizeof(*table));
+
+	/* drop extents starting in [a, b], keeping the part beyond b */
+	if (b == (u_int64_t)-1)
+		m = r, r = NULL;
+	else
+		extent_split(r, b + 1, &m, &r);
+	if (m) {
+		ext = extent_remove_max(&m);
+		if (ext->end > b) {
+			ext->start = b + 1;
+			extent_update(ext);
+			tail = ext;
+		} else
+			free(ext);
+		extent_free_tree(m);
+	}
+
+	*tp = extent_merge(extent_merge(l, tail), r);
+	return (0);
 }
 
+/* mark the offset x as free */
 static int
-hash_table_add(table, val, size)
-	struct hash_table *table; 
-	void *val;
-	unsigned int size;
+extent_add(tp, x)
+	struct lease_extent **tp;
+	u_int64_t x;
 {
-	struct hash_entry *entry = NULL;
-	int i = 0;
+	struct lease_extent *l, *r, *lext = NULL, *rext = NULL, *ext;
 
-	if (!table || !val) {
-		return (-1);
+	extent_split(*tp, x, &l, &r);
+
+	if (l) {
+		lext = extent_remove_max(&l);
+		if (lext->end >= x) {
+			/* already free */
+			*tp = extent_merge(extent_merge(l, lext), r);
+			return (0);
+		}
+		if (lext->end + 1 != x) {
+			l = extent_merge(l, lext);
+			lext = NULL;
+		}
+	}
+	if (r) {
+		rext = extent_remove_min(&r);
+		if (rext->start == x) {
+			/* already free */
+			*tp = extent_merge(extent_merge(l, lext),
+			    extent_merge(rext, r));
+			return (0);
+		}
+		if (rext->start != x + 1) {
+			r = extent_merge(rext, r);
+			rext = NULL;
+		}
 	}
 
-	if ((entry = malloc(sizeof(*entry))) == NULL) {
+	/* coalesce with the adjacent extents */
+	if (lext) {
+		ext = lext;
+		if (rext) {
+			ext->end = rext->end;
+			free(rext);
+		} else
+			ext->end = x;
+	} else if (rext) {
+		ext = rext;
+		ext->start = x;
+	} else if ((ext = extent_new(x, x)) == NULL) {
+		*tp = extent_merge(l, r);
 		return (-1);
 	}
-	memset(entry, 0, sizeof(*entry));
+	extent_update(ext);
 
-	if ((entry->val = malloc(size)) == NULL) {
-		return (-1);
+	*tp = extent_merge(extent_merge(l, ext), r);
+	return (0);
+}
+
+static u_int32_t
+lease_hash(addr)
+	struct in6_addr *addr;
+{
+	return (dhcp6_hash(addr, sizeof(*addr), lease_hash_seed));
+}
+
+static struct lease_slot *
+lease_table_lookup(tab, addr, hash)
+	struct lease_table *tab;
+	struct in6_addr *addr;
+	u_int32_t hash;
+{
+	struct lease_slot *slot;
+	size_t i, mask;
+
+	if (tab->count == 0)
+		return (NULL);
+
+	mask = tab->size - 1;
+	for (i = hash & mask; (slot = &tab->slots[i])->state !=
+	    LEASE_SLOT_EMPTY; i = (i + 1) & mask) {
+		if (slot->state == LEASE_SLOT_USED &&
+		    IN6_ARE_ADDR_EQUAL(&slot->addr, addr))
+			return (slot);
 	}
-	memcpy(entry->val, val, size);
 
-	i = table->hash(val) % table->size;
-	LIST_INSERT_HEAD(&table->table[i], entry, list);
+	return (NULL);
+}
 
-	return (0);
+static struct lease_slot *
+lease_find(addr)
+	struct in6_addr *addr;
+{
+	struct lease_slot *slot;
+	u_int32_t hash = lease_hash(addr);
+
+	if ((slot = lease_table_lookup(&lease_table, addr, hash)) != NULL)
+		return (slot);
+	if (lease_oldtable.slots)
+		return (lease_table_lookup(&lease_oldtable, addr, hash));
+
+	return (NULL);
 }
 
+/* the caller must make sure that addr is not in the table yet */
 static int
-hash_table_remove(table, val)
-	struct hash_table *table; 
-	void *val;
+lease_table_add(addr)
+	struct in6_addr *addr;
 {
-	struct hash_entry *entry;
+	struct lease_slot *slot;
+	size_t i, mask;
 
-	if (!table || !val) {
+	lease_rehash(LEASE_REHASH_STEP);
+
+	/* keep the load factor (including deleted slots) below 3/4 */
+	if ((lease_table.used + 1) * 4 > lease_table.size * 3 &&
+	    lease_table_grow() != 0)
 		return (-1);
-	}
 
-	if ((entry = hash_table_find(table, val)) == NULL) {
+	mask = lease_table.size - 1;
+	for (i = lease_hash(addr) & mask;
+	    (slot = &lease_table.slots[i])->state == LEASE_SLOT_USED;
+	    i = (i + 1) & mask)
+		;
+	if (slot->state == LEASE_SLOT_EMPTY)
+		lease_table.used++;
+	slot->addr = *addr;
+	slot->state = LEASE_SLOT_USED;
+	slot->flag = 0;
+	lease_table.count++;
+
+	return (0);
+}
+
+/*
+ * Start moving the leases to a new table.  The new table is at least
+ * twice as large as the number of leases, so it can absorb all the
+ * additions made before the move completes.
+ */
+static int
+lease_table_grow()
+{
+	struct lease_slot *slots;
+	size_t count, newsize;
+
+	/* finish the previous move, if any (shouldn't happen) */
+	if (lease_oldtable.slots)
+		lease_rehash(lease_oldtable.size);
+
+	count = lease_table.count;
+	newsize = lease_table.size ? lease_table.size : DHCP6_LEASE_TABLE_SIZE;
+	while ((count + 1) * 2 > newsize ||
+	    (count + lease_table.size / LEASE_REHASH_STEP) * 4 > newsize * 3)
+		newsize *= 2;
+
+	if ((slots = calloc(newsize, sizeof(*slots))) == NULL) {
+		dprintf(LOG_NOTICE, FNAME, "failed to allocate memory");
 		return (-1);
 	}
 
-	LIST_REMOVE(entry, list);
-	if (entry->val)
-		free(entry->val);
-	free(entry);
+	dprintf(LOG_DEBUG, FNAME, "resize lease table: %lu -> %lu (%lu leases)",
+	    (unsigned long)lease_table.size, (unsigned long)newsize,
+	    (unsigned long)count);
+
+	lease_oldtable = lease_table;
+	lease_rehash_pos = 0;
+	lease_table.slots = slots;
+	lease_table.size = newsize;
+	lease_table.count = lease_table.used = 0;
 
 	return (0);
 }
 
-static struct hash_entry *
-hash_table_find(table, val)
-	struct hash_table *table; 
-	void *val;
+/* move up to n slots of the old table to the new one */
+static void
+lease_rehash(n)
+	size_t n;
 {
-	struct hash_entry *entry;
-	int i;
+	struct lease_slot *oslot;
+	size_t i, mask = lease_table.size - 1;
 
-	if (!table || !val) {
-		return (NULL);
-	}
+	if (lease_oldtable.slots == NULL)
+		return;
 
-	i = table->hash(val) % table->size;
-	LIST_FOREACH(entry, &table->table[i], list)
-	{
-		if (table->match(val, entry->val)) {
-			return (entry);
-		}
+	for (; n > 0 && lease_rehash_pos < lease_oldtable.size; n--) {
+		oslot = &lease_oldtable.slots[lease_rehash_pos++];
+		if (oslot->state != LEASE_SLOT_USED)
+			continue;
+
+		for (i = lease_hash(&oslot->addr) & mask;
+		    lease_table.slots[i].state != LEASE_SLOT_EMPTY;
+		    i = (i + 1) & mask)
+			;
+		lease_table.slots[i] = *oslot;
+		lease_table.used++;
+		lease_table.count++;
+
+		/* keep the probe sequences of the old table intact */
+		oslot->state = LEASE_SLOT_DELETED;
+		lease_oldtable.count--;
 	}
 
-	return (NULL);
+	if (lease_rehash_pos == lease_oldtable.size)
+		lease_table_free(&lease_oldtable);
 }
 
+static void
+lease_table_free(tab)
+	struct lease_table *tab;
+{
+	if (tab->slots)
+		free(tab->slots);
+	memset(tab, 0, sizeof(*tab));
+}
@@ -36,5 +36,16 @@ extern int lease_address __P((struct in6_addr *));
 extern void release_address __P((struct in6_addr *));
 extern void decline_address __P((struct in6_addr *));
 extern int is_leased __P((struct in6_addr *));
+extern size_t lease_count __P((void));
+
+struct lease_pool;
+extern struct lease_pool *lease_pool_create __P((struct in6_addr *,
+    struct in6_addr *, int));
+extern void lease_pool_destroy __P((struct lease_pool *));
+extern int lease_pool_alloc __P((struct lease_pool *, struct in6_addr *));
+extern u_int64_t lease_pool_freecount __P((struct lease_pool *));
+extern u_int64_t lease_pool_size __P((struct lease_pool *));
+extern void lease_partition __P((int, int));
+extern int lease_part_owner __P((struct in6_addr *, int));
 
 #endif
@@ -0,0 +1,1192 @@
+/*
+ * Copyright (C) 2026 WIDE Project.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the project nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE PROJECT AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE PROJECT OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Append-only lease journal for dhcp6s.
+ *
+ * Every change to a binding is appended to the journal as a record that
+ * carries the whole state of the binding (or its removal), so replaying
+ * the journal from the beginning reconstructs the binding table.  Records
+ * are accumulated in memory and written with a single write(2) per main
+ * loop iteration; the file is synced at most once per LEASEDB_SYNC_INTERVAL
+ * by a helper process, so that the server never waits for the disk.
+ * Replies are sent before the records of the changes they announce are
+ * written, so a crash of the server loses the changes of the last main
+ * loop iteration, and a crash of the host those of the last
+ * LEASEDB_SYNC_INTERVAL plus the time the helper takes to sync.
+ * When the journal has grown well beyond the number of live bindings, a
+ * child process writes a fresh snapshot into a temporary file while the
+ * server keeps running; records produced in the meantime are appended to
+ * the snapshot before it atomically replaces the journal.
+ *
+ * File format (host byte order, the file is not meant to be portable):
+ *	header:	u_int32_t magic, u_int32_t version
+ *	record:	struct leasedb_rec, DUID, lr_nvals * struct leasedb_val
+ * lr_cksum covers the record after the lr_cksum field.  A torn or corrupted
+ * tail (e.g. after a crash) is detected on replay and truncated.
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <sys/queue.h>
+#include <dirent.h>
+#if TIME_WITH_SYS_TIME
+# include <sys/time.h>
+# include <time.h>
+#else
+# if HAVE_SYS_TIME_H
+#  include <sys/time.h>
+# else
+#  include <time.h>
+# endif
+#endif
+
+#include <netinet/in.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <unistd.h>
+
+#include "dhcp6.h"
+#include "config.h"
+#include "common.h"
+#include "timer.h"
+#include "leasedb.h"
+
+#define LEASEDB_MAGIC		0x44364c44	/* "D6LD" */
+#define LEASEDB_VERSION		1
+
+#define LEASEDB_SYNC_INTERVAL	1	/* sec */
+#define LEASEDB_WRITE_THRESH	65536	/* write out pending records */
+#define LEASEDB_COMPACT_MIN	10000	/* records */
+#define LEASEDB_COMPACT_RATIO	4
+
+struct leasedb_hdr {
+	u_int32_t lh_magic;
+	u_int32_t lh_version;
+};
+
+struct leasedb_rec {
+	u_int32_t lr_len;	/* whole record length */
+	u_int32_t lr_cksum;
+	u_int8_t lr_op;
+	u_int8_t lr_iatype;
+	u_int16_t lr_duidlen;
+	u_int32_t lr_iaid;
+	u_int64_t lr_updatetime;
+	u_int32_t lr_nvals;
+	/* DUID and values follow */
+} __attribute__ ((__packed__));
+
+struct leasedb_val {
+	struct in6_addr lv_addr;
+	u_int32_t lv_pltime;
+	u_int32_t lv_vltime;
+	u_int8_t lv_plen;	/* 0 for IA_NA addresses */
+} __attribute__ ((__packed__));
+
+struct leasedb_buf {
+	char *data;
+	size_t len;
+	size_t size;
+};
+
+static int db_fd = -1;
+static char *db_path;
+static char *db_tmppath;
+static struct leasedb_buf db_pending;	/* not yet written */
+static struct leasedb_buf db_rewrite;	/* written during compaction */
+static int db_replaying;
+static int db_dirty;			/* written but not synced */
+static long db_nrecords;		/* records in the journal */
+static long db_rwrecords;		/* records in db_rewrite */
+static pid_t db_compact_pid;
+static int db_compact_nlive;
+static leasedb_dump_t db_dump;
+static struct dhcp6_timer *db_timer;
+static int db_timer_armed;
+static int db_syncsock = -1;		/* to the sync helper */
+static pid_t db_sync_pid;
+
+static u_int32_t leasedb_cksum __P((char *, size_t));
+static size_t leasedb_reclen __P((char *, size_t));
+static int leasedb_load __P((char *, char **, size_t *));
+static char *leasedb_partpath __P((char *, int, int));
+static char *leasedb_reserve __P((struct leasedb_buf *, size_t));
+static void leasedb_record __P((int, struct duid *, int, u_int32_t, time_t,
+    struct dhcp6_list *));
+static int leasedb_writebuf __P((int, struct leasedb_buf *));
+static int leasedb_replay __P((int, leasedb_replay_t));
+static size_t leasedb_walk __P((char *, size_t, leasedb_replay_t, long *));
+static void leasedb_arm_timer __P((void));
+static struct dhcp6_timer *leasedb_timo __P((void *));
+static void leasedb_sync_start __P((void));
+static void leasedb_sync_loop __P((int));
+static void leasedb_compact_start __P((int));
+static void leasedb_compact_finish __P((void));
+
+int
+leasedb_open(path, replay, dump)
+	char *path;
+	leasedb_replay_t replay;
+	leasedb_dump_t dump;
+{
+	size_t len;
+	int fd;
+
+	len = strlen(path) + sizeof(".tmp");
+	if ((db_path = strdup(path)) == NULL ||
+	    (db_tmppath = malloc(len)) == NULL) {
+		dprintf(LOG_ERR, FNAME, "failed to allocate memory");
+		goto fail;
+	}
+	snprintf(db_tmppath, len, "%s.tmp", path);
+
+	if ((fd = open(path, O_RDWR|O_CREAT|O_APPEND, 0600)) < 0) {
+		dprintf(LOG_ERR, FNAME, "failed to open lease database %s: %s",
+		    path, strerror(errno));
+		goto fail;
+	}
+
+	if ((db_timer = dhcp6_add_timer(leasedb_timo, NULL)) == NULL) {
+		dprintf(LOG_ERR, FNAME, "failed to add a timer");
+		close(fd);
+		goto fail;
+	}
+
+	if (leasedb_replay(fd, replay) != 0) {
+		dhcp6_remove_timer(&db_timer);
+		close(fd);
+		goto fail;
+	}
+
+	/* leftover from an interrupted compaction */
+	(void)unlink(db_tmppath);
+
+	db_fd = fd;
+	db_dump = dump;
+	leasedb_sync_start();
+
+	return (0);
+
+  fail:
+	if (db_path)
+		free(db_path);
+	if (db_tmppath)
+		free(db_tmppath);
+	db_path = db_tmppath = NULL;
+	return (-1);
+}
+
+void
+leasedb_close()
+{
+	if (db_fd < 0)
+		return;
+
+	if (db_compact_pid > 0) {
+		(void)kill(db_compact_pid, SIGTERM);
+		(void)waitpid(db_compact_pid, NULL, 0);
+		(void)unlink(db_tmppath);
+		db_compact_pid = 0;
+	}
+	if (db_sync_pid > 0) {
+		close(db_syncsock);
+		(void)waitpid(db_sync_pid, NULL, 0);
+		db_syncsock = -1;
+		db_sync_pid = 0;
+	}
+
+	(void)leasedb_writebuf(db_fd, &db_pending);
+	if (fsync(db_fd) != 0) {
+		dprintf(LOG_WARNING, FNAME, "fsync(%s): %s",
+		    db_path, strerror(errno));
+	}
+	close(db_fd);
+	db_fd = -1;
+}
+
+void
+leasedb_set(duid, iatype, iaid, updatetime, vals)
+	struct duid *duid;
+	int iatype;
+	u_int32_t iaid;
+	time_t updatetime;
+	struct dhcp6_list *vals;
+{
+	leasedb_record(LEASEDB_OP_SET, duid, iatype, iaid, updatetime, vals);
+}
+
+void
+leasedb_remove(duid, iatype, iaid)
+	struct duid *duid;
+	int iatype;
+	u_int32_t iaid;
+{
+	leasedb_record(LEASEDB_OP_REMOVE, duid, iatype, iaid, 0, NULL);
+}
+
+/*
+ * Write out the records accumulated since the last call.  The server calls
+ * this once per main loop iteration with the number of live bindings, so
+ * that all changes caused by a burst of packets go to disk in one write.
+ */
+void
+leasedb_flush(nlive)
+	int nlive;
+{
+	if (db_fd < 0)
+		return;
+
+	if (db_pending.len > 0) {
+		(void)leasedb_writebuf(db_fd, &db_pending);
+		db_dirty = 1;
+		leasedb_arm_timer();
+	}
+
+	if (db_compact_pid == 0 && db_nrecords > LEASEDB_COMPACT_MIN &&
+	    db_nrecords > (long)nlive * LEASEDB_COMPACT_RATIO) {
+		leasedb_compact_start(nlive);
+	}
+}
+
+static u_int32_t
+leasedb_cksum(p, len)
+	char *p;
+	size_t len;
+{
+	u_int32_t h = 2166136261U;	/* FNV-1a */
+
+	while (len-- > 0) {
+		h ^= (u_int8_t)*p++;
+		h *= 16777619U;
+	}
+
+	return (h);
+}
+
+static char *
+leasedb_reserve(buf, len)
+	struct leasedb_buf *buf;
+	size_t len;
+{
+	char *p;
+
+	if (buf->len + len > buf->size) {
+		size_t newsize = buf->size ? buf->size : LEASEDB_WRITE_THRESH;
+
+		while (newsize < buf->len + len)
+			newsize *= 2;
+		if ((p = realloc(buf->data, newsize)) == NULL) {
+			dprintf(LOG_ERR, FNAME, "failed to allocate memory");
+			return (NULL);
+		}
+		buf->data = p;
+		buf->size = newsize;
+	}
+
+	p = buf->data + buf->len;
+	buf->len += len;
+
+	return (p);
+}
+
+static void
+leasedb_record(op, duid, iatype, iaid, updatetime, vals)
+	int op;
+	struct duid *duid;
+	int iatype;
+	u_int32_t iaid;
+	time_t updatetime;
+	struct dhcp6_list *vals;
+{
+	struct leasedb_rec rec;
+	struct leasedb_val val;
+	struct dhcp6_listval *lv;
+	u_int32_t nvals = 0;
+	size_t len;
+	char *p, *cp;
+
+	if (db_fd < 0 || db_replaying)
+		return;
+
+	if (vals) {
+		for (lv = TAILQ_FIRST(vals); lv; lv = TAILQ_NEXT(lv, link)) {
+			if (lv->type == DHCP6_LISTVAL_PREFIX6 ||
+			    lv->type == DHCP6_LISTVAL_STATEFULADDR6)
+				nvals++;
+		}
+	}
+
+	len = sizeof(rec) + duid->duid_len + nvals * sizeof(val);
+	if ((p = leasedb_reserve(&db_pending, len)) == NULL) {
+		dprintf(LOG_ERR, FNAME, "lease database record dropped");
+		return;
+	}
+
+	memset(&rec, 0, sizeof(rec));
+	rec.lr_len = (u_int32_t)len;
+	rec.lr_op = (u_int8_t)op;
+	rec.lr_iatype = (u_int8_t)iatype;
+	rec.lr_duidlen = (u_int16_t)duid->duid_len;
+	rec.lr_iaid = iaid;
+	rec.lr_updatetime = (u_int64_t)updatetime;
+	rec.lr_nvals = nvals;
+	memcpy(p, &rec, sizeof(rec));
+	cp = p + sizeof(rec);
+	memcpy(cp, duid->duid_id, duid->duid_len);
+	cp += duid->duid_len;
+
+	for (lv = vals ? TAILQ_FIRST(vals) : NULL; lv;
+	    lv = TAILQ_NEXT(lv, link)) {
+		memset(&val, 0, sizeof(val));
+		switch (lv->type) {
+		case DHCP6_LISTVAL_PREFIX6:
+			val.lv_addr = lv->val_prefix6.addr;
+			val.lv_pltime = lv->val_prefix6.pltime;
+			val.lv_vltime = lv->val_prefix6.vltime;
+			val.lv_plen = (u_int8_t)lv->val_prefix6.plen;
+			break;
+		case DHCP6_LISTVAL_STATEFULADDR6:
+			val.lv_addr = lv->val_statefuladdr6.addr;
+			val.lv_pltime = lv->val_statefuladdr6.pltime;
+			val.lv_vltime = lv->val_statefuladdr6.vltime;
+			break;
+		default:
+			continue;
+		}
+		memcpy(cp, &val, sizeof(val));
+		cp += sizeof(val);
+	}
+
+	rec.lr_cksum = leasedb_cksum(p + offsetof(struct leasedb_rec, lr_op),
+	    len - offsetof(struct leasedb_rec, lr_op));
+	memcpy(p + offsetof(struct leasedb_rec, lr_cksum), &rec.lr_cksum,
+	    sizeof(rec.lr_cksum));
+	db_nrecords++;
+
+	/* keep a copy for the snapshot being written by the child */
+	if (db_compact_pid > 0) {
+		if ((cp = leasedb_reserve(&db_rewrite, len)) == NULL) {
+			/* we cannot complete the compaction any more */
+			dprintf(LOG_ERR, FNAME, "compaction aborted");
+			(void)kill(db_compact_pid, SIGTERM);
+		} else {
+			memcpy(cp, p, len);
+			db_rwrecords++;
+		}
+	}
+
+	if (db_pending.len >= LEASEDB_WRITE_THRESH)
+		(void)leasedb_writebuf(db_fd, &db_pending);
+}
+
+static int
+leasedb_writebuf(fd, buf)
+	int fd;
+	struct leasedb_buf *buf;
+{
+	char *p = buf->data;
+	size_t left = buf->len;
+	ssize_t cc;
+	int error = 0;
+
+	while (left > 0) {
+		if ((cc = write(fd, p, left)) < 0) {
+			if (errno == EINTR)
+				continue;
+			dprintf(LOG_ERR, FNAME,
+			    "failed to write lease database: %s",
+			    strerror(errno));
+			error = -1;
+			break;
+		}
+		p += cc;
+		left -= cc;
+	}
+
+	/* the records are lost on error; don't let them pile up */
+	buf->len = 0;
+
+	return (error);
+}
+
+static int
+leasedb_replay(fd, replay)
+	int fd;
+	leasedb_replay_t replay;
+{
+	struct stat st;
+	struct leasedb_hdr hdr;
+	struct timeval start, end;
+	char *data = NULL;
+	size_t off, size;
+	ssize_t cc;
+	long nrecords = 0;
+
+	if (fstat(fd, &st) != 0) {
+		dprintf(LOG_ERR, FNAME, "fstat(%s): %s",
+		    db_path, strerror(errno));
+		return (-1);
+	}
+	size = (size_t)st.st_size;
+
+	if (size == 0) {
+		/* a new database */
+		hdr.lh_magic = LEASEDB_MAGIC;
+		hdr.lh_version = LEASEDB_VERSION;
+		if (write(fd, &hdr, sizeof(hdr)) != sizeof(hdr)) {
+			dprintf(LOG_ERR, FNAME, "failed to initialize %s",
+			    db_path);
+			return (-1);
+		}
+		db_nrecords = 0;
+		return (0);
+	}
+
+	gettimeofday(&start, NULL);
+
+	if ((data = malloc(size)) == NULL) {
+		dprintf(LOG_ERR, FNAME, "failed to allocate memory");
+		return (-1);
+	}
+	for (off = 0; off < size; off += cc) {
+		if ((cc = pread(fd, data + off, size - off, off)) <= 0) {
+			if (cc < 0 && errno == EINTR) {
+				cc = 0;
+				continue;
+			}
+			dprintf(LOG_ERR, FNAME, "failed to read %s", db_path);
+			goto fail;
+		}
+	}
+
+	memcpy(&hdr, data, size < sizeof(hdr) ? size : sizeof(hdr));
+	if (size < sizeof(hdr) || hdr.lh_magic != LEASEDB_MAGIC ||
+	    hdr.lh_version != LEASEDB_VERSION) {
+		dprintf(LOG_ERR, FNAME, "%s is not a lease database", db_path);
+		goto fail;
+	}
+
+	db_replaying = 1;
+	off = leasedb_walk(data, size, replay, &nrecords);
+	db_replaying = 0;
+	if (off == 0)
+		goto fail;
+
+	if (off != size) {
+		dprintf(LOG_WARNING, FNAME,
+		    "%s: discarding %lu bytes of broken records",
+		    db_path, (unsigned long)(size - off));
+		if (ftruncate(fd, (off_t)off) != 0) {
+			dprintf(LOG_ERR, FNAME, "ftruncate(%s): %s",
+			    db_path, strerror(errno));
+			goto fail;
+		}
+	}
+
+	free(data);
+	db_nrecords = nrecords;
+
+	gettimeofday(&end, NULL);
+	timeval_sub(&end, &start, &end);
+	dprintf(LOG_INFO, FNAME, "replayed %ld records from %s in %ld.%06lds",
+	    nrecords, db_path, (long)end.tv_sec, (long)end.tv_usec);
+
+	return (0);
+
+  fail:
+	if (data)
+		free(data);
+	return (-1);
+}
+
+/*
+ * Pass the records of a journal image to replay, and return the offset
+ * of the end of the valid ones, or 0 on error.  The header has been
+ * checked.
+ */
+static size_t
+leasedb_walk(data, size, replay, countp)
+	char *data;
+	size_t size;
+	leasedb_replay_t replay;
+	long *countp;
+{
+	struct leasedb_rec rec;
+	struct leasedb_val val;
+	struct dhcp6_list vals;
+	struct dhcp6_prefix prefix;
+	struct dhcp6_statefuladdr saddr;
+	struct duid duid;
+	char *p;
+	size_t off;
+	u_int32_t i;
+	long nrecords = 0;
+
+	TAILQ_INIT(&vals);
+	for (off = sizeof(struct leasedb_hdr); off < size; off += rec.lr_len) {
+		p = data + off;
+		if (leasedb_reclen(p, size - off) == 0)
+			break;
+		memcpy(&rec, p, sizeof(rec));
+
+		duid.duid_len = rec.lr_duidlen;
+		duid.duid_id = p + sizeof(rec);
+		p += sizeof(rec) + rec.lr_duidlen;
+		for (i = 0; i < rec.lr_nvals; i++, p += sizeof(val)) {
+			void *v;
+			int type;
+
+			memcpy(&val, p, sizeof(val));
+			if (rec.lr_iatype == DHCP6_LISTVAL_IAPD) {
+				memset(&prefix, 0, sizeof(prefix));
+				prefix.addr = val.lv_addr;
+				prefix.plen = val.lv_plen;
+				prefix.pltime = val.lv_pltime;
+				prefix.vltime = val.lv_vltime;
+				type = DHCP6_LISTVAL_PREFIX6;
+				v = &prefix;
+			} else {
+				memset(&saddr, 0, sizeof(saddr));
+				saddr.addr = val.lv_addr;
+				saddr.pltime = val.lv_pltime;
+				saddr.vltime = val.lv_vltime;
+				type = DHCP6_LISTVAL_STATEFULADDR6;
+				v = &saddr;
+			}
+			if (dhcp6_add_listval(&vals, type, v, NULL) == NULL) {
+				dprintf(LOG_ERR, FNAME,
+				    "failed to allocate memory");
+				dhcp6_clear_list(&vals);
+				return (0);
+			}
+		}
+
+		(void)(*replay)(rec.lr_op, &duid, rec.lr_iatype, rec.lr_iaid,
+		    (time_t)rec.lr_updatetime, &vals);
+		dhcp6_clear_list(&vals);
+		nrecords++;
+	}
+
+	*countp = nrecords;
+	return (off);
+}
+
+/*
+ * Pass the records of the journal at path to replay without opening it
+ * for writing, e.g. to look at the journal of another process.  A missing
+ * journal is empty.
+ */
+int
+leasedb_scan(path, replay)
+	char *path;
+	leasedb_replay_t replay;
+{
+	char *data;
+	size_t size;
+	long nrecords;
+	int error = 0;
+
+	if (leasedb_load(path, &data, &size) != 0)
+		return (-1);
+	if (data != NULL && leasedb_walk(data, size, replay, &nrecords) == 0)
+		error = -1;
+	free(data);
+
+	return (error);
+}
+
+/*
+ * The length of a valid record at p, with left bytes in the file from
+ * there, or 0 if it is torn or corrupted.
+ */
+static size_t
+leasedb_reclen(p, left)
+	char *p;
+	size_t left;
+{
+	struct leasedb_rec rec;
+
+	if (left < sizeof(rec))
+		return (0);
+	memcpy(&rec, p, sizeof(rec));
+	if (rec.lr_len < sizeof(rec) || rec.lr_len > left ||
+	    rec.lr_len != sizeof(rec) + rec.lr_duidlen +
+	    rec.lr_nvals * sizeof(struct leasedb_val) ||
+	    rec.lr_cksum != leasedb_cksum(p +
+	    offsetof(struct leasedb_rec, lr_op),
+	    rec.lr_len - offsetof(struct leasedb_rec, lr_op))) {
+		return (0);
+	}
+
+	return (rec.lr_len);
+}
+
+/*
+ * Lay the journals of path out for n processes: the records of a client
+ * go to the journal of the process owning it, "path" itself if n is 1,
+ * "path.k" for process k otherwise.  Nothing is done when every record
+ * is already in place, which is the case unless the number of processes
+ * has changed since the journals were written.  Otherwise all the
+ * journals are read, in the order base, .0, .1, ..., and their records
+ * are copied in that order into new journals that replace them, so no
+ * binding is lost.  This must be called before the processes open their
+ * journals.
+ */
+int
+leasedb_partition(path, n, owner)
+	char *path;
+	int n;
+	leasedb_owner_t owner;
+{
+	struct leasedb_part {
+		char *path;
+		char *data;
+		size_t size;
+		int target;	/* the process whose journal this is */
+	} *src = NULL, *sp;
+	struct leasedb_buf *dst = NULL;
+	struct leasedb_hdr hdr;
+	struct leasedb_rec rec;
+	struct duid duid;
+	struct dirent *dp;
+	DIR *dirp = NULL;
+	char *dir = NULL, *base, *ep, *tmppath = NULL, *cp;
+	size_t off, len, baselen;
+	long nrecords = 0;
+	int nsrc = 0, maxsrc = 0, misplaced = 0, error = -1, fd, i, k;
+
+	if ((cp = strrchr(path, '/')) != NULL) {
+		base = cp + 1;
+		len = cp == path ? 1 : (size_t)(cp - path);
+	} else {
+		base = path;
+		len = 0;
+	}
+	baselen = strlen(base);
+	if ((dir = malloc(len + 2)) == NULL) {
+		dprintf(LOG_ERR, FNAME, "failed to allocate memory");
+		goto done;
+	}
+	if (len == 0)
+		strcpy(dir, ".");
+	else {
+		memcpy(dir, path, len);
+		dir[len] = '\0';
+	}
+
+	if ((dirp = opendir(dir)) == NULL) {
+		if (errno == ENOENT)
+			error = 0;	/* no journal at all */
+		else {
+			dprintf(LOG_ERR, FNAME, "opendir(%s): %s",
+			    dir, strerror(errno));
+		}
+		goto done;
+	}
+
+	/* collect the base journal and every "base.k" */
+	while ((dp = readdir(dirp)) != NULL) {
+		if (strncmp(dp->d_name, base, baselen) != 0)
+			continue;
+		if (dp->d_name[baselen] == '\0')
+			k = -1;
+		else if (dp->d_name[baselen] == '.' &&
+		    dp->d_name[baselen + 1] >= '0' &&
+		    dp->d_name[baselen + 1] <= '9') {
+			k = (int)strtol(&dp->d_name[baselen + 1], &ep, 10);
+			if (*ep != '\0' || k < 0)
+				continue;
+		} else
+			continue;
+
+		if (nsrc == maxsrc) {
+			maxsrc = maxsrc ? maxsrc * 2 : 8;
+			if ((sp = realloc(src, maxsrc * sizeof(*src))) ==
+			    NULL) {
+				dprintf(LOG_ERR, FNAME,
+				    "failed to allocate memory");
+				goto done;
+			}
+			src = sp;
+		}
+		sp = &src[nsrc];
+		memset(sp, 0, sizeof(*sp));
+		sp->target = n == 1 ? (k == -1 ? 0 : -1) :
+		    (k >= 0 && k < n ? k : -1);
+		if ((sp->path = leasedb_partpath(path, k, 0)) == NULL)
+			goto done;
+		nsrc++;
+		if (leasedb_load(sp->path, &sp->data, &sp->size) != 0)
+			goto done;
+	}
+
+	/* in the order base, .0, .1, ... */
+	for (i = 1; i < nsrc; i++) {
+		struct leasedb_part tmp;
+		int j;
+
+		tmp = src[i];
+		for (j = i; j > 0; j--) {
+			if (strlen(src[j - 1].path) < strlen(tmp.path) ||
+			    (strlen(src[j - 1].path) == strlen(tmp.path) &&
+			    strcmp(src[j - 1].path, tmp.path) < 0)) {
+				break;
+			}
+			src[j] = src[j - 1];
+		}
+		src[j] = tmp;
+	}
+
+	for (sp = src; sp < src + nsrc; sp++) {
+		for (off = sizeof(hdr); off < sp->size; off += len) {
+			if ((len = leasedb_reclen(sp->data + off,
+			    sp->size - off)) == 0) {
+				break;
+			}
+			memcpy(&rec, sp->data + off, sizeof(rec));
+			duid.duid_len = rec.lr_duidlen;
+			duid.duid_id = sp->data + off + sizeof(rec);
+			k = n == 1 ? 0 : (*owner)(&duid);
+			if (k != sp->target)
+				misplaced++;
+			nrecords++;
+		}
+		sp->size = off;		/* ignore a broken tail */
+	}
+	if (misplaced == 0) {
+		error = 0;
+		goto done;
+	}
+
+	dprintf(LOG_NOTICE, FNAME, "%d of %ld records in %d lease journals "
+	    "belong to another process; redistributing them among %d",
+	    misplaced, nrecords, nsrc, n);
+
+	if ((dst = calloc(n, sizeof(*dst))) == NULL) {
+		dprintf(LOG_ERR, FNAME, "failed to allocate memory");
+		goto done;
+	}
+	for (sp = src; sp < src + nsrc; sp++) {
+		for (off = sizeof(hdr); off < sp->size; off += len) {
+			len = leasedb_reclen(sp->data + off, sp->size - off);
+			memcpy(&rec, sp->data + off, sizeof(rec));
+			duid.duid_len = rec.lr_duidlen;
+			duid.duid_id = sp->data + off + sizeof(rec);
+			k = n == 1 ? 0 : (*owner)(&duid);
+			if ((cp = leasedb_reserve(&dst[k], len)) == NULL) {
+				dprintf(LOG_ERR, FNAME,
+				    "failed to allocate memory");
+				goto done;
+			}
+			memcpy(cp, sp->data + off, len);
+		}
+	}
+
+	/*
+	 * Replace the journals one by one.  If we stop in the middle, some
+	 * records are in two journals, the old and the new; replaying both
+	 * gives the same bindings, and the next start redoes this.
+	 */
+	hdr.lh_magic = LEASEDB_MAGIC;
+	hdr.lh_version = LEASEDB_VERSION;
+	for (k = 0; k < n; k++) {
+		if ((cp = leasedb_partpath(path, n == 1 ? -1 : k, 0)) == NULL ||
+		    (tmppath = leasedb_partpath(path, n == 1 ? -1 : k, 1)) ==
+		    NULL) {
+			free(cp);
+			goto done;
+		}
+		if ((fd = open(tmppath, O_WRONLY|O_CREAT|O_TRUNC, 0600)) < 0) {
+			dprintf(LOG_ERR, FNAME, "failed to open %s: %s",
+			    tmppath, strerror(errno));
+			free(cp);
+			goto done;
+		}
+		if (write(fd, &hdr, sizeof(hdr)) != sizeof(hdr) ||
+		    leasedb_writebuf(fd, &dst[k]) != 0 || fsync(fd) != 0) {
+			dprintf(LOG_ERR, FNAME, "failed to write %s", tmppath);
+			close(fd);
+			(void)unlink(tmppath);
+			free(cp);
+			goto done;
+		}
+		close(fd);
+		if (rename(tmppath, cp) != 0) {
+			dprintf(LOG_ERR, FNAME, "rename(%s, %s): %s",
+			    tmppath, cp, strerror(errno));
+			(void)unlink(tmppath);
+			free(cp);
+			goto done;
+		}
+		free(cp);
+		free(tmppath);
+		tmppath = NULL;
+	}
+	for (sp = src; sp < src + nsrc; sp++) {
+		if (sp->target == -1 && unlink(sp->path) != 0) {
+			dprintf(LOG_WARNING, FNAME, "unlink(%s): %s",
+			    sp->path, strerror(errno));
+		}
+	}
+	error = 0;
+
+  done:
+	if (dirp)
+		closedir(dirp);
+	for (sp = src; sp && sp < src + nsrc; sp++) {
+		free(sp->path);
+		free(sp->data);
+	}
+	free(src);
+	if (dst) {
+		for (k = 0; k < n; k++)
+			free(dst[k].data);
+		free(dst);
+	}
+	free(tmppath);
+	free(dir);
+	return (error);
+}
+
+/* "path" for k == -1, "path.k" otherwise, with ".tmp" if tmp */
+static char *
+leasedb_partpath(path, k, tmp)
+	char *path;
+	int k, tmp;
+{
+	size_t len = strlen(path) + 32;
+	char *p;
+
+	if ((p = malloc(len)) == NULL) {
+		dprintf(LOG_ERR, FNAME, "failed to allocate memory");
+		return (NULL);
+	}
+	if (k < 0)
+		snprintf(p, len, "%s%s", path, tmp ? ".tmp" : "");
+	else
+		snprintf(p, len, "%s.%d%s", path, k, tmp ? ".tmp" : "");
+
+	return (p);
+}
+
+/* read a whole journal; a missing one is empty */
+static int
+leasedb_load(path, datap, sizep)
+	char *path;
+	char **datap;
+	size_t *sizep;
+{
+	struct leasedb_hdr hdr;
+	struct stat st;
+	char *data = NULL;
+	size_t off, size;
+	ssize_t cc;
+	int fd;
+
+	*datap = NULL;
+	*sizep = 0;
+	if ((fd = open(path, O_RDONLY)) < 0) {
+		if (errno == ENOENT)
+			return (0);
+		dprintf(LOG_ERR, FNAME, "failed to open %s: %s",
+		    path, strerror(errno));
+		return (-1);
+	}
+	if (fstat(fd, &st) != 0) {
+		dprintf(LOG_ERR, FNAME, "fstat(%s): %s", path, strerror(errno));
+		goto fail;
+	}
+	if ((size = (size_t)st.st_size) == 0) {
+		close(fd);
+		return (0);
+	}
+
+	if ((data = malloc(size)) == NULL) {
+		dprintf(LOG_ERR, FNAME, "failed to allocate memory");
+		goto fail;
+	}
+	for (off = 0; off < size; off += cc) {
+		if ((cc = pread(fd, data + off, size - off, off)) <= 0) {
+			if (cc < 0 && errno == EINTR) {
+				cc = 0;
+				continue;
+			}
+			dprintf(LOG_ERR, FNAME, "failed to read %s", path);
+			goto fail;
+		}
+	}
+	close(fd);
+
+	memcpy(&hdr, data, size < sizeof(hdr) ? size : sizeof(hdr));
+	if (size < sizeof(hdr) || hdr.lh_magic != LEASEDB_MAGIC ||
+	    hdr.lh_version != LEASEDB_VERSION) {
+		dprintf(LOG_ERR, FNAME, "%s is not a lease database", path);
+		free(data);
+		return (-1);
+	}
+
+	*datap = data;
+	*sizep = size;
+	return (0);
+
+  fail:
+	if (data)
+		free(data);
+	close(fd);
+	return (-1);
+}
+
+static void
+leasedb_arm_timer()
+{
+	struct timeval timo;
+
+	if (db_timer_armed)
+		return;
+
+	timo.tv_sec = LEASEDB_SYNC_INTERVAL;
+	timo.tv_usec = 0;
+	dhcp6_set_timer(&timo, db_timer);
+	db_timer_armed = 1;
+}
+
+static struct dhcp6_timer *
+leasedb_timo(arg)
+	void *arg;
+{
+	db_timer_armed = 0;
+
+	if (db_dirty) {
+		/* a full socket means that a request is already pending */
+		if (db_syncsock < 0 || (send(db_syncsock, "", 1,
+		    MSG_DONTWAIT|MSG_NOSIGNAL) < 0 && errno != EAGAIN &&
+		    errno != EWOULDBLOCK)) {
+			if (db_syncsock >= 0) {
+				dprintf(LOG_WARNING, FNAME,
+				    "lost the sync helper: %s",
+				    strerror(errno));
+				close(db_syncsock);
+				(void)waitpid(db_sync_pid, NULL, 0);
+				db_syncsock = -1;
+				db_sync_pid = 0;
+			}
+			if (fdatasync(db_fd) != 0) {
+				dprintf(LOG_WARNING, FNAME,
+				    "fdatasync(%s): %s",
+				    db_path, strerror(errno));
+			}
+		}
+		db_dirty = 0;
+	}
+
+	if (db_compact_pid > 0) {
+		leasedb_compact_finish();
+		if (db_compact_pid > 0)
+			leasedb_arm_timer();
+	}
+
+	return (db_timer);
+}
+
+/*
+ * Fork the process that syncs the journal on request, so that the server
+ * does not block in fdatasync(2).  Without it the server syncs by itself.
+ */
+static void
+leasedb_sync_start()
+{
+	int sv[2];
+	pid_t pid;
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) != 0) {
+		dprintf(LOG_WARNING, FNAME, "socketpair: %s", strerror(errno));
+		return;
+	}
+	if ((pid = fork()) < 0) {
+		dprintf(LOG_WARNING, FNAME, "fork: %s", strerror(errno));
+		close(sv[0]);
+		close(sv[1]);
+		return;
+	}
+	if (pid == 0) {
+		close(sv[0]);
+		leasedb_sync_loop(sv[1]);
+		/* NOTREACHED */
+	}
+
+	close(sv[1]);
+	db_syncsock = sv[0];
+	db_sync_pid = pid;
+}
+
+static void
+leasedb_sync_loop(sock)
+	int sock;
+{
+	char buf[64];
+	ssize_t cc;
+	int fd;
+
+	for (;;) {
+		/* requests made while we were syncing are served at once */
+		if ((cc = read(sock, buf, sizeof(buf))) < 0) {
+			if (errno == EINTR)
+				continue;
+			_exit(1);
+		}
+		if (cc == 0)
+			_exit(0);	/* the server has gone */
+
+		/*
+		 * The path rather than db_fd, which a compaction replaces.
+		 * The records written to the old journal since the snapshot
+		 * have been synced in the new one already.
+		 */
+		if ((fd = open(db_path, O_WRONLY)) < 0 || fdatasync(fd) != 0) {
+			dprintf(LOG_WARNING, FNAME, "fdatasync(%s): %s",
+			    db_path, strerror(errno));
+			flushlog();
+		}
+		if (fd >= 0)
+			close(fd);
+	}
+}
+
+static void
+leasedb_compact_start(nlive)
+	int nlive;
+{
+	struct leasedb_hdr hdr;
+	pid_t pid;
+	int fd;
+
+	/* records produced before the fork are covered by the snapshot */
+	(void)leasedb_writebuf(db_fd, &db_pending);
+	db_dirty = 1;
+
+	if ((fd = open(db_tmppath, O_WRONLY|O_CREAT|O_TRUNC, 0600)) < 0) {
+		dprintf(LOG_ERR, FNAME, "failed to open %s: %s",
+		    db_tmppath, strerror(errno));
+		return;
+	}
+	hdr.lh_magic = LEASEDB_MAGIC;
+	hdr.lh_version = LEASEDB_VERSION;
+	if (write(fd, &hdr, sizeof(hdr)) != sizeof(hdr)) {
+		dprintf(LOG_ERR, FNAME, "failed to write %s", db_tmppath);
+		goto fail;
+	}
+
+	if ((pid = fork()) < 0) {
+		dprintf(LOG_ERR, FNAME, "fork: %s", strerror(errno));
+		goto fail;
+	}
+
+	if (pid == 0) {
+		/* child: dump the current bindings into the new file */
+		db_fd = fd;
+		(*db_dump)();
+		if (leasedb_writebuf(db_fd, &db_pending) != 0 ||
+		    fsync(db_fd) != 0) {
+			_exit(1);
+		}
+		_exit(0);
+	}
+
+	close(fd);
+	dprintf(LOG_DEBUG, FNAME, "compacting %s (%ld records, %d bindings)",
+	    db_path, db_nrecords, nlive);
+	db_compact_pid = pid;
+	db_compact_nlive = nlive;
+	db_rewrite.len = 0;
+	db_rwrecords = 0;
+	leasedb_arm_timer();
+	return;
+
+  fail:
+	close(fd);
+	(void)unlink(db_tmppath);
+}
+
+static void
+leasedb_compact_finish()
+{
+	int status, fd = -1;
+	pid_t pid;
+
+	if ((pid = waitpid(db_compact_pid, &status, WNOHANG)) == 0)
+		return;		/* still running */
+	if (pid < 0 && errno == EINTR)
+		return;
+	db_compact_pid = 0;
+
+	if (pid < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+		dprintf(LOG_WARNING, FNAME, "failed to compact %s", db_path);
+		goto fail;
+	}
+
+	/* append what has happened since the snapshot was taken */
+	if ((fd = open(db_tmppath, O_WRONLY|O_APPEND)) < 0) {
+		dprintf(LOG_ERR, FNAME, "failed to open %s: %s",
+		    db_tmppath, strerror(errno));
+		goto fail;
+	}
+	if (leasedb_writebuf(fd, &db_rewrite) != 0 || fsync(fd) != 0)
+		goto fail;
+	if (rename(db_tmppath, db_path) != 0) {
+		dprintf(LOG_ERR, FNAME, "rename(%s, %s): %s",
+		    db_tmppath, db_path, strerror(errno));
+		goto fail;
+	}
+
+	/* the old journal may still have pending records; they're stale */
+	db_pending.len = 0;
+	close(db_fd);
+	db_fd = fd;
+	db_dirty = 0;
+	db_nrecords = db_compact_nlive + db_rwrecords;
+	dprintf(LOG_DEBUG, FNAME, "compacted %s to %ld records",
+	    db_path, db_nrecords);
+	return;
+
+  fail:
+	if (fd >= 0)
+		close(fd);
+	(void)unlink(db_tmppath);
+	db_rewrite.len = 0;
+}
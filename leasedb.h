@@ -0,0 +1,54 @@
+/*
+ * Copyright (C) 2026 WIDE Project.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the project nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE PROJECT AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE PROJECT OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef __LEASEDB_H_DEFINED
+#define __LEASEDB_H_DEFINED
+
+/* journal record types */
+#define LEASEDB_OP_SET		1	/* the whole state of a binding */
+#define LEASEDB_OP_REMOVE	2	/* the binding has gone */
+
+/* replay callback: op, client DUID, IA type, IAID, update time, values */
+typedef int (*leasedb_replay_t) __P((int, struct duid *, int, u_int32_t,
+    time_t, struct dhcp6_list *));
+/* snapshot callback: call leasedb_set() for every live binding */
+typedef void (*leasedb_dump_t) __P((void));
+/* partition callback: the process owning a client DUID */
+typedef int (*leasedb_owner_t) __P((struct duid *));
+
+extern int leasedb_open __P((char *, leasedb_replay_t, leasedb_dump_t));
+extern void leasedb_close __P((void));
+extern void leasedb_set __P((struct duid *, int, u_int32_t, time_t,
+    struct dhcp6_list *));
+extern void leasedb_remove __P((struct duid *, int, u_int32_t));
+extern void leasedb_flush __P((int));
+extern int leasedb_partition __P((char *, int, leasedb_owner_t));
+extern int leasedb_scan __P((char *, leasedb_replay_t));
+
+#endif
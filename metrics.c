@@ -0,0 +1,376 @@
+/*
+ * Copyright (C) 2026 WIDE Project.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the project nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE PROJECT AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE PROJECT OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * A minimal HTTP listener serving the OpenMetrics exposition of the
+ * statistics, for dhcp6s and dhcp6relay.
+ *
+ * Like the control channel of dhcp6_ctl.c, it runs in the event loop of
+ * the daemon and never blocks: a request is read as it arrives, and the
+ * response is written as far as the socket takes it, the rest when the
+ * socket becomes writable.  Each connection serves one request and is
+ * closed.  There are at most METRICS_MAXCONN connections, each with a
+ * response buffer allocated at the start, so serving a scrape doesn't
+ * allocate memory; if they are all busy, the oldest is dropped.
+ */
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/queue.h>
+
+#include <netinet/in.h>
+
+#include <errno.h>
+#include <netdb.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <unistd.h>
+
+#include "dhcp6.h"
+#include "config.h"
+#include "common.h"
+#include "evloop.h"
+#include "metrics.h"
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+#define METRICS_REQSIZE	1024	/* the largest request header */
+#define METRICS_HDRROOM	256	/* room for the response header */
+
+#define METRICS_CONTENTTYPE \
+	"application/openmetrics-text; version=1.0.0; charset=utf-8"
+
+struct metrics_conn {
+	int s;			/* -1 if not in use */
+	u_int32_t seq;		/* the order of acceptance */
+	char req[METRICS_REQSIZE];
+	size_t reqlen;
+	char *buf;		/* the response */
+	char *out;		/* what is still to be sent */
+	size_t outlen;
+};
+
+static struct metrics_conn metrics_conns[METRICS_MAXCONN];
+static metrics_format_t metrics_format;
+static u_int32_t metrics_seq;
+
+static void metrics_accept __P((int, void *));
+static void metrics_read __P((int, void *));
+static void metrics_write __P((int, void *));
+static void metrics_respond __P((struct metrics_conn *));
+static void metrics_close __P((struct metrics_conn *));
+
+/*
+ * Listen on addr, which is "port", "host:port" or "[host]:port".  Without
+ * a host, the listener is on the IPv6 loopback address only; "[::]:port"
+ * exposes it to the network.
+ */
+int
+metrics_init(addr, format)
+	char *addr;
+	metrics_format_t format;
+{
+	struct addrinfo hints, *res = NULL;
+	char host[NI_MAXHOST], *port;
+	struct metrics_conn *conn;
+	size_t hostlen;
+	int s = -1, on, error, i;
+
+	/* split the host and the port */
+	if ((port = strrchr(addr, ':')) == NULL) {
+		port = addr;
+		hostlen = 0;
+	} else {
+		hostlen = port++ - addr;
+		if (hostlen >= 2 &&
+		    addr[0] == '[' && addr[hostlen - 1] == ']') {
+			addr++;
+			hostlen -= 2;
+		}
+	}
+	if (hostlen >= sizeof(host) || *port == '\0') {
+		dprintf(LOG_ERR, FNAME, "invalid metrics address: %s", addr);
+		return (-1);
+	}
+	if (hostlen == 0)
+		strlcpy(host, "::1", sizeof(host));
+	else {
+		memcpy(host, addr, hostlen);
+		host[hostlen] = '\0';
+	}
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_protocol = IPPROTO_TCP;
+	hints.ai_flags = AI_PASSIVE;
+	error = getaddrinfo(host, port, &hints, &res);
+	if (error) {
+		dprintf(LOG_ERR, FNAME, "getaddrinfo: %s",
+		    gai_strerror(error));
+		return (-1);
+	}
+	if ((s = socket(res->ai_family, res->ai_socktype,
+	    res->ai_protocol)) < 0) {
+		dprintf(LOG_ERR, FNAME, "socket(metrics sock): %s",
+		    strerror(errno));
+		goto fail;
+	}
+	on = 1;
+	if (setsockopt(s, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)) < 0) {
+		dprintf(LOG_ERR, FNAME,
+		    "setsockopt(metrics sock, SO_REUSEADDR): %s",
+		    strerror(errno));
+		goto fail;
+	}
+	if (bind(s, res->ai_addr, res->ai_addrlen) < 0) {
+		dprintf(LOG_ERR, FNAME, "bind(metrics sock): %s",
+		    strerror(errno));
+		goto fail;
+	}
+	freeaddrinfo(res);
+	res = NULL;
+	if (listen(s, METRICS_MAXCONN) < 0) {
+		dprintf(LOG_ERR, FNAME, "listen(metrics sock): %s",
+		    strerror(errno));
+		goto fail;
+	}
+
+	for (i = 0; i < METRICS_MAXCONN; i++) {
+		conn = &metrics_conns[i];
+		conn->s = -1;
+		if (conn->buf == NULL &&
+		    (conn->buf = malloc(METRICS_BUFSIZE)) == NULL) {
+			dprintf(LOG_ERR, FNAME, "memory allocation failed");
+			goto fail;
+		}
+	}
+	metrics_format = format;
+
+	if (evloop_add(s, EVLOOP_EDGE, metrics_accept, NULL) != 0)
+		goto fail;
+
+	return (0);
+
+  fail:
+	if (res != NULL)
+		freeaddrinfo(res);
+	if (s >= 0)
+		close(s);
+	return (-1);
+}
+
+static void
+metrics_accept(sl, arg)
+	int sl;
+	void *arg;
+{
+	struct metrics_conn *conn, *oldest;
+	int s, i;
+
+	while ((s = accept(sl, NULL, NULL)) >= 0) {
+		oldest = NULL;
+		for (i = 0; i < METRICS_MAXCONN; i++) {
+			conn = &metrics_conns[i];
+			if (conn->s < 0)
+				break;
+			if (oldest == NULL ||
+			    (int32_t)(conn->seq - oldest->seq) < 0)
+				oldest = conn;
+		}
+		if (i == METRICS_MAXCONN) {
+			dprintf(LOG_INFO, FNAME, "too many metrics "
+			    "connections. drop the oldest one (fd=%d)",
+			    oldest->s);
+			metrics_close(oldest);
+			conn = oldest;
+		}
+
+		conn->s = s;
+		conn->seq = metrics_seq++;
+		conn->reqlen = 0;
+		conn->outlen = 0;
+		if (evloop_add(s, EVLOOP_EDGE, metrics_read, conn) != 0)
+			metrics_close(conn);
+	}
+	if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR &&
+	    errno != ECONNABORTED) {
+		dprintf(LOG_WARNING, FNAME,
+		    "failed to accept metrics connection: %s",
+		    strerror(errno));
+	}
+}
+
+static void
+metrics_read(s, arg)
+	int s;
+	void *arg;
+{
+	struct metrics_conn *conn = arg;
+	ssize_t cc;
+
+	for (;;) {
+		cc = read(s, conn->req + conn->reqlen,
+		    sizeof(conn->req) - 1 - conn->reqlen);
+		if (cc < 0) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				return;	/* the rest is yet to come */
+			if (errno == EINTR)
+				continue;
+			dprintf(LOG_INFO, FNAME, "read failed: %s",
+			    strerror(errno));
+			metrics_close(conn);
+			return;
+		}
+		if (cc == 0) {
+			metrics_close(conn);
+			return;
+		}
+		conn->reqlen += cc;
+		conn->req[conn->reqlen] = '\0';
+
+		/* the header ends with an empty line */
+		if (strstr(conn->req, "\r\n\r\n") != NULL ||
+		    strstr(conn->req, "\n\n") != NULL) {
+			metrics_respond(conn);
+			return;
+		}
+		if (conn->reqlen == sizeof(conn->req) - 1) {
+			dprintf(LOG_INFO, FNAME, "too large request");
+			metrics_close(conn);
+			return;
+		}
+	}
+}
+
+/* parse the request and start sending the response */
+static void
+metrics_respond(conn)
+	struct metrics_conn *conn;
+{
+	char *body = conn->buf + METRICS_HDRROOM;
+	size_t bodysize = METRICS_BUFSIZE - METRICS_HDRROOM, len;
+	char *method, *path, *status, *type, *p;
+	char hdr[METRICS_HDRROOM];
+	int hdrlen;
+
+	method = conn->req;
+	if ((p = strchr(method, ' ')) == NULL) {
+		metrics_close(conn);
+		return;
+	}
+	*p++ = '\0';
+	path = p;
+	p += strcspn(p, " ?\r\n");
+	*p = '\0';
+
+	type = "text/plain; charset=utf-8";
+	if (strcmp(method, "GET") != 0) {
+		status = "405 Method Not Allowed";
+		len = strlcpy(body, "method not allowed\n", bodysize);
+	} else if (strcmp(path, "/metrics") != 0 && strcmp(path, "/") != 0) {
+		status = "404 Not Found";
+		len = strlcpy(body, "not found\n", bodysize);
+	} else {
+		status = "200 OK";
+		type = METRICS_CONTENTTYPE;
+		len = (*metrics_format)(body, bodysize);
+		if (len >= bodysize - 1) {
+			dprintf(LOG_WARNING, FNAME,
+			    "metrics don't fit in the buffer");
+			status = "500 Internal Server Error";
+			type = "text/plain; charset=utf-8";
+			len = strlcpy(body, "too many metrics\n", bodysize);
+		}
+	}
+
+	/* put the header just in front of the body */
+	hdrlen = snprintf(hdr, sizeof(hdr), "HTTP/1.0 %s\r\n"
+	    "Content-Type: %s\r\nContent-Length: %lu\r\n"
+	    "Connection: close\r\n\r\n", status, type, (unsigned long)len);
+	if (hdrlen < 0 || hdrlen >= sizeof(hdr)) {
+		metrics_close(conn);
+		return;
+	}
+	conn->out = body - hdrlen;
+	memcpy(conn->out, hdr, hdrlen);
+	conn->outlen = hdrlen + len;
+
+	metrics_write(conn->s, conn);
+}
+
+static void
+metrics_write(s, arg)
+	int s;
+	void *arg;
+{
+	struct metrics_conn *conn = arg;
+	ssize_t cc;
+
+	while (conn->outlen > 0) {
+		cc = send(s, conn->out, conn->outlen,
+		    MSG_DONTWAIT | MSG_NOSIGNAL);
+		if (cc < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno != EAGAIN && errno != EWOULDBLOCK) {
+				dprintf(LOG_INFO, FNAME, "send failed: %s",
+				    strerror(errno));
+				metrics_close(conn);
+				return;
+			}
+
+			/* wait until the socket takes more */
+			evloop_remove(s);
+			if (evloop_add(s, EVLOOP_EDGE | EVLOOP_WRITE,
+			    metrics_write, conn) != 0) {
+				conn->s = -1;
+				close(s);
+			}
+			return;
+		}
+		conn->out += cc;
+		conn->outlen -= cc;
+	}
+
+	metrics_close(conn);
+}
+
+static void
+metrics_close(conn)
+	struct metrics_conn *conn;
+{
+	evloop_remove(conn->s);
+	close(conn->s);
+	conn->s = -1;
+}
@@ -0,0 +1,532 @@
+/*
+ * Copyright (C) 2026 WIDE Project.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the project nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE PROJECT AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE PROJECT OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE		/* recvmmsg(2), sendmmsg(2) */
+#endif
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/queue.h>
+
+#include <netinet/in.h>
+
+#include <unistd.h>
+#include <syslog.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "dhcp6.h"
+#include "config.h"
+#include "common.h"
+#include "pktbatch.h"
+
+/*
+ * Receive buffers for up to `size' datagrams, each with its own data,
+ * source address and control message area, so that a single recvmmsg(2)
+ * call can drain a burst of packets from a socket.  Where recvmmsg is not
+ * available, pktbatch_recv() falls back to a series of recvmsg(2) calls.
+ *
+ * Each receive buffer can have some room before and after the data, so
+ * that a received packet can be encapsulated in place (as a relay agent
+ * does) without being copied.
+ *
+ * The transmit side is similar: pktbatch_send() copies an outgoing
+ * packet, its destination and its ancillary data (outgoing interface and
+ * hop limit) into the next slot, and pktbatch_tx_flush() sends all the
+ * queued packets with sendmmsg(2).  The queue is flushed automatically
+ * when it is full or when a packet for another socket is queued.
+ */
+struct pktbatch_rx {
+	int size;
+	size_t bufsize;
+	size_t cmsgsize;
+	char *bufs;
+	char *cmsgbufs;
+	struct sockaddr_storage *from;
+	struct iovec *iov;
+#ifdef __linux__
+	struct mmsghdr *msgs;
+#else
+	struct msghdr *msgs;
+	ssize_t *lens;
+#endif
+	struct pktbatch_stats stats;
+};
+
+struct pktbatch_tx {
+	int size;
+	int count;		/* number of queued packets */
+	int sock;		/* socket of the queued packets */
+	size_t bufsize;
+	size_t cmsgsize;
+	char *bufs;
+	char *cmsgbufs;
+	struct sockaddr_in6 *dst;
+	struct iovec *iov;
+#ifdef __linux__
+	struct mmsghdr *msgs;
+#else
+	struct msghdr *msgs;
+#endif
+	struct pktbatch_stats stats;
+};
+
+#ifdef __linux__
+#define PKTBATCH_HDR(b, i)	(&(b)->msgs[(i)].msg_hdr)
+#else
+#define PKTBATCH_HDR(b, i)	(&(b)->msgs[(i)])
+#endif
+
+static int pktbatch_msgcontrol __P((struct msghdr *, void *, socklen_t,
+    struct in6_pktinfo *, int));
+static void pktbatch_logstats __P((struct pktbatch_stats *, char *, char *,
+    int));
+
+struct pktbatch_rx *
+pktbatch_rx_create(size, bufsize, room)
+	int size;
+	size_t bufsize, room;
+{
+	struct pktbatch_rx *b;
+	struct msghdr *mh;
+	size_t headroom, slotsize;
+	int i;
+
+	if (size < 1 || size > PKTBATCH_MAX) {
+		dprintf(LOG_ERR, FNAME, "invalid batch size: %d", size);
+		return (NULL);
+	}
+
+	if ((b = malloc(sizeof(*b))) == NULL)
+		goto nomem;
+	memset(b, 0, sizeof(*b));
+	b->size = size;
+	b->bufsize = bufsize;
+	b->cmsgsize = CMSG_SPACE(sizeof(struct in6_pktinfo)) +
+	    CMSG_SPACE(sizeof(int));
+
+	/* keep the received data aligned after the headroom */
+	headroom = (room + 7) & ~7;
+	slotsize = (headroom + bufsize + room + 7) & ~7;
+
+	if ((b->bufs = malloc(size * slotsize)) == NULL ||
+	    (b->cmsgbufs = malloc(size * b->cmsgsize)) == NULL ||
+	    (b->from = malloc(size * sizeof(*b->from))) == NULL ||
+	    (b->iov = malloc(size * sizeof(*b->iov))) == NULL ||
+	    (b->msgs = malloc(size * sizeof(*b->msgs))) == NULL) {
+		goto nomem;
+	}
+#ifndef __linux__
+	if ((b->lens = malloc(size * sizeof(*b->lens))) == NULL)
+		goto nomem;
+#endif
+	memset(b->msgs, 0, size * sizeof(*b->msgs));
+
+	for (i = 0; i < size; i++) {
+		b->iov[i].iov_base = b->bufs + i * slotsize + headroom;
+		b->iov[i].iov_len = bufsize;
+
+		mh = PKTBATCH_HDR(b, i);
+		mh->msg_name = &b->from[i];
+		mh->msg_iov = &b->iov[i];
+		mh->msg_iovlen = 1;
+		mh->msg_control = b->cmsgbufs + i * b->cmsgsize;
+	}
+
+	return (b);
+
+  nomem:
+	dprintf(LOG_ERR, FNAME, "memory allocation failed");
+	pktbatch_rx_free(b);
+	return (NULL);
+}
+
+void
+pktbatch_rx_free(b)
+	struct pktbatch_rx *b;
+{
+	if (b == NULL)
+		return;
+
+	if (b->bufs)
+		free(b->bufs);
+	if (b->cmsgbufs)
+		free(b->cmsgbufs);
+	if (b->from)
+		free(b->from);
+	if (b->iov)
+		free(b->iov);
+	if (b->msgs)
+		free(b->msgs);
+#ifndef __linux__
+	if (b->lens)
+		free(b->lens);
+#endif
+	free(b);
+}
+
+int
+pktbatch_rx_size(b)
+	struct pktbatch_rx *b;
+{
+	return (b->size);
+}
+
+/*
+ * Receive as many packets as are queued on the socket, up to the batch
+ * size, without blocking.  Returns the number of packets received, which
+ * is 0 if there was none, or -1 on error.
+ */
+int
+pktbatch_recv(s, b)
+	int s;
+	struct pktbatch_rx *b;
+{
+	struct msghdr *mh;
+	int i, n;
+
+	for (i = 0; i < b->size; i++) {
+		mh = PKTBATCH_HDR(b, i);
+		mh->msg_namelen = sizeof(b->from[i]);
+		mh->msg_controllen = b->cmsgsize;
+		mh->msg_flags = 0;
+	}
+
+#ifdef __linux__
+	while ((n = recvmmsg(s, b->msgs, b->size, MSG_DONTWAIT, NULL)) < 0 &&
+	    errno == EINTR)
+		;
+#else
+	for (n = 0; n < b->size; n++) {
+		if ((b->lens[n] = recvmsg(s, PKTBATCH_HDR(b, n),
+		    MSG_DONTWAIT)) < 0) {
+			if (errno == EINTR) {
+				n--;
+				continue;
+			}
+			break;
+		}
+	}
+	if (n == 0)
+		n = -1;		/* keep errno from the failed call */
+#endif
+	if (n < 0) {
+		if (errno == EAGAIN || errno == EWOULDBLOCK)
+			return (0);
+		return (-1);
+	}
+
+	if (n > 0) {
+		b->stats.calls++;
+		b->stats.packets += n;
+		if (n == b->size)
+			b->stats.full++;
+	}
+
+	return (n);
+}
+
+/* get the i-th packet received by the last pktbatch_recv() */
+struct msghdr *
+pktbatch_rx_msg(b, i, lenp)
+	struct pktbatch_rx *b;
+	int i;
+	ssize_t *lenp;
+{
+#ifdef __linux__
+	*lenp = (ssize_t)b->msgs[i].msg_len;
+#else
+	*lenp = b->lens[i];
+#endif
+	return (PKTBATCH_HDR(b, i));
+}
+
+struct pktbatch_stats *
+pktbatch_rx_stats(b)
+	struct pktbatch_rx *b;
+{
+	return (&b->stats);
+}
+
+void
+pktbatch_rx_logstats(b, name)
+	struct pktbatch_rx *b;
+	char *name;
+{
+	pktbatch_logstats(&b->stats, name, "received", b->size);
+}
+
+struct pktbatch_tx *
+pktbatch_tx_create(size, bufsize)
+	int size;
+	size_t bufsize;
+{
+	struct pktbatch_tx *b;
+	struct msghdr *mh;
+	int i;
+
+	if (size < 1 || size > PKTBATCH_MAX) {
+		dprintf(LOG_ERR, FNAME, "invalid batch size: %d", size);
+		return (NULL);
+	}
+
+	if ((b = malloc(sizeof(*b))) == NULL)
+		goto nomem;
+	memset(b, 0, sizeof(*b));
+	b->size = size;
+	b->sock = -1;
+	b->bufsize = bufsize;
+	b->cmsgsize = CMSG_SPACE(sizeof(struct in6_pktinfo)) +
+	    CMSG_SPACE(sizeof(int));
+
+	if ((b->bufs = malloc(size * bufsize)) == NULL ||
+	    (b->cmsgbufs = malloc(size * b->cmsgsize)) == NULL ||
+	    (b->dst = malloc(size * sizeof(*b->dst))) == NULL ||
+	    (b->iov = malloc(size * sizeof(*b->iov))) == NULL ||
+	    (b->msgs = malloc(size * sizeof(*b->msgs))) == NULL) {
+		goto nomem;
+	}
+	memset(b->msgs, 0, size * sizeof(*b->msgs));
+
+	for (i = 0; i < size; i++) {
+		b->iov[i].iov_base = b->bufs + i * bufsize;
+
+		mh = PKTBATCH_HDR(b, i);
+		mh->msg_name = &b->dst[i];
+		mh->msg_namelen = sizeof(b->dst[i]);
+		mh->msg_iov = &b->iov[i];
+		mh->msg_iovlen = 1;
+	}
+
+	return (b);
+
+  nomem:
+	dprintf(LOG_ERR, FNAME, "memory allocation failed");
+	pktbatch_tx_free(b);
+	return (NULL);
+}
+
+void
+pktbatch_tx_free(b)
+	struct pktbatch_tx *b;
+{
+	if (b == NULL)
+		return;
+
+	if (b->bufs)
+		free(b->bufs);
+	if (b->cmsgbufs)
+		free(b->cmsgbufs);
+	if (b->dst)
+		free(b->dst);
+	if (b->iov)
+		free(b->iov);
+	if (b->msgs)
+		free(b->msgs);
+	free(b);
+}
+
+/*
+ * Queue a packet to be sent on socket s to dst.  If pktinfo is not NULL
+ * or hlim is positive, the outgoing interface/source address or the hop
+ * limit is specified as ancillary data.  Returns -1 if the packet cannot
+ * be queued.
+ */
+int
+pktbatch_send(s, b, buf, len, dst, pktinfo, hlim)
+	int s;
+	struct pktbatch_tx *b;
+	void *buf;
+	size_t len;
+	struct sockaddr_in6 *dst;
+	struct in6_pktinfo *pktinfo;
+	int hlim;
+{
+	struct msghdr *mh;
+	int i;
+
+	if (len > b->bufsize) {
+		dprintf(LOG_ERR, FNAME, "too large packet (%lu bytes)",
+		    (unsigned long)len);
+		return (-1);
+	}
+
+	if (b->count > 0 && b->sock != s)
+		(void)pktbatch_tx_flush(b);
+
+	i = b->count;
+	mh = PKTBATCH_HDR(b, i);
+	memcpy(b->iov[i].iov_base, buf, len);
+	b->iov[i].iov_len = len;
+	b->dst[i] = *dst;
+	if (pktinfo == NULL && hlim <= 0) {
+		mh->msg_control = NULL;
+		mh->msg_controllen = 0;
+	} else if (pktbatch_msgcontrol(mh, b->cmsgbufs + i * b->cmsgsize,
+	    b->cmsgsize, pktinfo, hlim)) {
+		dprintf(LOG_WARNING, FNAME,
+		    "failed to make message control data");
+		return (-1);
+	}
+	b->sock = s;
+	b->count++;
+
+	if (b->count == b->size)
+		(void)pktbatch_tx_flush(b);
+
+	return (0);
+}
+
+/* send all the queued packets; returns the number of failed packets */
+int
+pktbatch_tx_flush(b)
+	struct pktbatch_tx *b;
+{
+	int i, n, failed = 0;
+#ifdef __linux__
+	int k;
+#endif
+
+	for (i = 0; i < b->count; i += n) {
+#ifdef __linux__
+		n = sendmmsg(b->sock, &b->msgs[i], b->count - i, 0);
+#else
+		n = (sendmsg(b->sock, PKTBATCH_HDR(b, i), 0) < 0) ? -1 : 1;
+#endif
+		if (n < 0) {
+			if (errno == EINTR) {
+				n = 0;
+				continue;
+			}
+
+			/* the first packet failed; skip it */
+			dprintf(LOG_WARNING, FNAME, "sendmsg to %s failed: %s",
+			    addr2str((struct sockaddr *)&b->dst[i]),
+			    strerror(errno));
+			b->stats.errors++;
+			failed++;
+			n = 1;
+			continue;
+		}
+
+		b->stats.calls++;
+		b->stats.packets += n;
+		if (n == b->size)
+			b->stats.full++;
+#ifdef __linux__
+		for (k = i; k < i + n; k++) {
+			if (b->msgs[k].msg_len != b->iov[k].iov_len) {
+				dprintf(LOG_WARNING, FNAME,
+				    "failed to send a complete packet to %s",
+				    addr2str((struct sockaddr *)&b->dst[k]));
+				b->stats.errors++;
+				failed++;
+			}
+		}
+#endif
+	}
+	b->count = 0;
+
+	return (failed);
+}
+
+struct pktbatch_stats *
+pktbatch_tx_stats(b)
+	struct pktbatch_tx *b;
+{
+	return (&b->stats);
+}
+
+void
+pktbatch_tx_logstats(b, name)
+	struct pktbatch_tx *b;
+	char *name;
+{
+	pktbatch_logstats(&b->stats, name, "sent", b->size);
+}
+
+static int
+pktbatch_msgcontrol(mh, ctlbuf, buflen, pktinfo, hlim)
+	struct msghdr *mh;
+	void *ctlbuf;
+	socklen_t buflen;
+	struct in6_pktinfo *pktinfo;
+	int hlim;
+{
+	struct cmsghdr *cm;
+	socklen_t controllen;
+
+	controllen = 0;
+	if (pktinfo)
+		controllen += CMSG_SPACE(sizeof (*pktinfo));
+	if (hlim > 0)
+		controllen += CMSG_SPACE(sizeof (hlim));
+	if (buflen < controllen)
+		return (-1);
+
+	memset(ctlbuf, 0, buflen);
+	mh->msg_controllen = controllen;
+	mh->msg_control = ctlbuf;
+
+	cm = (struct cmsghdr *)CMSG_FIRSTHDR(mh);
+	if (pktinfo) {
+		cm->cmsg_len = CMSG_LEN(sizeof (*pktinfo));
+		cm->cmsg_level = IPPROTO_IPV6;
+		cm->cmsg_type = IPV6_PKTINFO;
+		memcpy(CMSG_DATA((struct cmsghdr *)cm), pktinfo,
+		    sizeof (*pktinfo));
+
+		cm = CMSG_NXTHDR(mh, cm);
+	}
+
+	if (hlim > 0) {
+		cm->cmsg_len = CMSG_LEN(sizeof (hlim));
+		cm->cmsg_level = IPPROTO_IPV6;
+		cm->cmsg_type = IPV6_HOPLIMIT;
+		*(int *)CMSG_DATA((struct cmsghdr *)cm) = hlim;
+	}
+
+	return (0);
+}
+
+static void
+pktbatch_logstats(st, name, verb, size)
+	struct pktbatch_stats *st;
+	char *name, *verb;
+	int size;
+{
+	dprintf(LOG_INFO, FNAME, "%s: %llu packets %s in %llu batches "
+	    "(%.1f per batch, %llu full batches of %d, %llu errors)", name,
+	    (unsigned long long)st->packets, verb,
+	    (unsigned long long)st->calls,
+	    st->calls ? (double)st->packets / st->calls : 0.0,
+	    (unsigned long long)st->full, size,
+	    (unsigned long long)st->errors);
+}
@@ -0,0 +1,64 @@
+/*
+ * Copyright (C) 2026 WIDE Project.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the project nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE PROJECT AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE PROJECT OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef __PKTBATCH_H_DEFINED
+#define __PKTBATCH_H_DEFINED
+
+/* default and maximum number of packets received or sent at a time */
+#define PKTBATCH_DEFAULT	32
+#define PKTBATCH_MAX		1024
+
+struct pktbatch_stats {
+	u_int64_t calls;	/* system calls that moved packets */
+	u_int64_t packets;	/* packets received or sent */
+	u_int64_t full;		/* calls that moved a whole batch */
+	u_int64_t errors;	/* packets that failed to be sent */
+};
+
+struct pktbatch_rx;	/* opaque type */
+struct pktbatch_tx;	/* opaque type */
+
+extern struct pktbatch_rx *pktbatch_rx_create __P((int, size_t, size_t));
+extern void pktbatch_rx_free __P((struct pktbatch_rx *));
+extern int pktbatch_rx_size __P((struct pktbatch_rx *));
+extern int pktbatch_recv __P((int, struct pktbatch_rx *));
+extern struct msghdr *pktbatch_rx_msg __P((struct pktbatch_rx *, int,
+    ssize_t *));
+extern struct pktbatch_stats *pktbatch_rx_stats __P((struct pktbatch_rx *));
+extern void pktbatch_rx_logstats __P((struct pktbatch_rx *, char *));
+
+extern struct pktbatch_tx *pktbatch_tx_create __P((int, size_t));
+extern void pktbatch_tx_free __P((struct pktbatch_tx *));
+extern int pktbatch_send __P((int, struct pktbatch_tx *, void *, size_t,
+    struct sockaddr_in6 *, struct in6_pktinfo *, int));
+extern int pktbatch_tx_flush __P((struct pktbatch_tx *));
+extern struct pktbatch_stats *pktbatch_tx_stats __P((struct pktbatch_tx *));
+extern void pktbatch_tx_logstats __P((struct pktbatch_tx *, char *));
+
+#endif
@@ -0,0 +1,1020 @@
+/*
+ * Copyright (C) 2026 WIDE Project.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the project nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE PROJECT AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE PROJECT OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Persistent rtnetlink channels, used on Linux to configure the
+ * addresses of dhcp6c and to know the interfaces and addresses of the
+ * system.
+ *
+ * Address requests are queued by rtnl_ifaddr() and sent in a batch, with
+ * a single sendmsg(), by rtnl_flush() at the end of each round of the
+ * event loop, or as soon as RTNL_BUFSIZE is filled.  The kernel
+ * acknowledges each of them, and the acknowledgements are read from the
+ * event loop like any other input, so a failure is only logged.
+ *
+ * The interfaces and their IPv6 addresses are dumped once into a cache,
+ * which is then kept current by the RTNLGRP_LINK and RTNLGRP_IPV6_IFADDR
+ * notifications.  They are read, without blocking, whenever the cache is
+ * looked up, so that a lookup costs no more than a recv() however many
+ * addresses the system has; if the notifications overflow, the cache is
+ * dumped again.
+ */
+
+#ifdef __linux__
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/queue.h>
+#include <sys/uio.h>
+
+#include <net/if.h>
+#include <netinet/in.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <unistd.h>
+
+#include "dhcp6.h"
+#include "config.h"
+#include "common.h"
+#include "evloop.h"
+#include "rtnl.h"
+
+#ifndef SOL_NETLINK
+#define SOL_NETLINK	270
+#endif
+
+/* a request waiting for its acknowledgement, for the log */
+struct rtnl_req {
+	u_int32_t seq;
+	ifaddrconf_cmd_t cmd;
+	unsigned int ifindex;
+	struct in6_addr addr;
+	int plen;
+};
+
+static int rtnl_sock = -1;
+static u_int32_t rtnl_sbuf[RTNL_BUFSIZE / sizeof(u_int32_t)];
+static size_t rtnl_slen;	/* requests queued in rtnl_sbuf */
+static int rtnl_queued;
+static u_int32_t rtnl_seq;
+static int rtnl_pending;	/* requests sent and not acknowledged */
+static struct rtnl_req rtnl_reqs[RTNL_MAXREQ];
+
+/* an IPv6 address of an interface */
+struct rtnl_addr {
+	TAILQ_ENTRY(rtnl_addr) link;	/* on the interface */
+	LIST_ENTRY(rtnl_addr) hlink;	/* in the hash by the upper 64 bits */
+	LIST_ENTRY(rtnl_addr) xlink;	/* in the hash by the whole address */
+	unsigned int ifindex;
+	struct in6_addr addr;
+	int plen;
+};
+TAILQ_HEAD(rtnl_addrlist, rtnl_addr);
+LIST_HEAD(rtnl_addrchain, rtnl_addr);
+
+struct rtnl_link {
+	LIST_ENTRY(rtnl_link) hlink;	/* in the hash by name */
+	unsigned int index;
+	char name[IF_NAMESIZE];		/* empty until the link is known */
+	u_int16_t type;			/* ARPHRD_xxx */
+	int hwlen;
+	u_char hwaddr[RTNL_HWADDRLEN];
+	struct rtnl_addrlist addrs;
+};
+LIST_HEAD(rtnl_linkchain, rtnl_link);
+
+static int rtnl_mon = -1;	/* the socket notifications arrive on */
+static int rtnl_stale;		/* the cache must be dumped again */
+static u_int32_t rtnl_monseq;
+
+/* the interfaces indexed by interface index, and hashed by name */
+static struct rtnl_link **rtnl_links;
+static unsigned int rtnl_nlinks;
+static struct rtnl_linkchain rtnl_linkhash[RTNL_LINKHASH];
+
+/*
+ * The addresses hashed by their upper 64 bits, which any prefix of /64 or
+ * longer determines, so that an address within such a prefix is found
+ * in constant time.  Exact lookups use a second hash of the whole
+ * address, as the addresses in a /64 all share a chain of the first.
+ * Both have rtnl_addrhashsize chains.
+ */
+static struct rtnl_addrchain *rtnl_addrhash;
+static struct rtnl_addrchain *rtnl_exacthash;
+static unsigned int rtnl_addrhashsize;
+static unsigned int rtnl_naddrs;
+
+static int rtnl_open __P((void));
+static unsigned int rtnl_ifindex __P((char *));
+static void rtnl_addattr __P((struct nlmsghdr *, int, void *, size_t));
+static void rtnl_input __P((int, void *));
+static void rtnl_ack __P((struct nlmsghdr *));
+static char *rtnl_ifname __P((unsigned int, char *));
+static int rtnl_sync __P((void));
+static int rtnl_monopen __P((void));
+static int rtnl_dump __P((int));
+static int rtnl_monread __P((u_int32_t));
+static void rtnl_update __P((struct nlmsghdr *));
+static void rtnl_newlink __P((struct ifinfomsg *, size_t));
+static void rtnl_newaddr __P((struct nlmsghdr *));
+static struct rtnl_link *rtnl_getlink __P((unsigned int, int));
+static void rtnl_dellink __P((struct rtnl_link *));
+static struct rtnl_link *rtnl_findlink __P((char *));
+static void rtnl_deladdr __P((struct rtnl_addr *));
+static int rtnl_growhash __P((void));
+static void rtnl_clear __P((void));
+static u_int32_t rtnl_namehash __P((char *));
+static u_int32_t rtnl_hash64 __P((struct in6_addr *));
+static u_int32_t rtnl_hash128 __P((struct in6_addr *));
+static int rtnl_prefixmatch __P((struct in6_addr *, struct in6_addr *, int));
+
+static int
+rtnl_open()
+{
+	struct sockaddr_nl snl;
+	int on = 1;
+
+	if ((rtnl_sock = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC,
+	    NETLINK_ROUTE)) < 0) {
+		dprintf(LOG_ERR, FNAME, "socket(NETLINK_ROUTE): %s",
+		    strerror(errno));
+		return (-1);
+	}
+	memset(&snl, 0, sizeof(snl));
+	snl.nl_family = AF_NETLINK;
+	if (bind(rtnl_sock, (struct sockaddr *)&snl, sizeof(snl)) < 0) {
+		dprintf(LOG_ERR, FNAME, "bind(NETLINK_ROUTE): %s",
+		    strerror(errno));
+		goto fail;
+	}
+#ifdef NETLINK_CAP_ACK
+	/* the acknowledgements needn't carry the requests back */
+	(void)setsockopt(rtnl_sock, SOL_NETLINK, NETLINK_CAP_ACK, &on,
+	    sizeof(on));
+#endif
+	if (evloop_add(rtnl_sock, EVLOOP_EDGE, rtnl_input, NULL) != 0)
+		goto fail;
+
+	return (0);
+
+  fail:
+	close(rtnl_sock);
+	rtnl_sock = -1;
+	return (-1);
+}
+
+/*
+ * Queue a request to add or remove an address.  An address being added
+ * replaces the one already there, so that its lifetimes are updated.
+ */
+int
+rtnl_ifaddr(cmd, ifname, addr, plen, pltime, vltime)
+	ifaddrconf_cmd_t cmd;
+	char *ifname;
+	struct in6_addr *addr;
+	int plen;
+	u_int32_t pltime, vltime;
+{
+	struct nlmsghdr *nlh;
+	struct ifaddrmsg *ifa;
+	struct ifa_cacheinfo ci;
+	struct rtnl_req *req;
+	unsigned int ifindex;
+	size_t len;
+
+	if (rtnl_sock < 0 && rtnl_open() != 0)
+		return (-1);
+	if ((ifindex = rtnl_ifindex(ifname)) == 0)
+		return (-1);
+
+	len = NLMSG_SPACE(sizeof(*ifa)) + RTA_SPACE(sizeof(*addr)) +
+	    RTA_SPACE(sizeof(ci));
+	if (rtnl_slen + len > sizeof(rtnl_sbuf))
+		rtnl_flush(0);
+
+	nlh = (struct nlmsghdr *)((char *)rtnl_sbuf + rtnl_slen);
+	memset(nlh, 0, len);
+	nlh->nlmsg_len = NLMSG_LENGTH(sizeof(*ifa));
+	nlh->nlmsg_flags = NLM_F_REQUEST | NLM_F_ACK;
+	nlh->nlmsg_seq = ++rtnl_seq;
+	switch (cmd) {
+	case IFADDRCONF_ADD:
+		nlh->nlmsg_type = RTM_NEWADDR;
+		nlh->nlmsg_flags |= NLM_F_CREATE | NLM_F_REPLACE;
+		break;
+	case IFADDRCONF_REMOVE:
+		nlh->nlmsg_type = RTM_DELADDR;
+		break;
+	default:
+		return (-1);
+	}
+	ifa = NLMSG_DATA(nlh);
+	ifa->ifa_family = AF_INET6;
+	ifa->ifa_prefixlen = plen;
+	ifa->ifa_index = ifindex;
+	rtnl_addattr(nlh, IFA_ADDRESS, addr, sizeof(*addr));
+	if (cmd == IFADDRCONF_ADD) {
+		/* DHCP6_DURATION_INFINITE is the kernel's infinity, too */
+		memset(&ci, 0, sizeof(ci));
+		ci.ifa_prefered = pltime;
+		ci.ifa_valid = vltime;
+		rtnl_addattr(nlh, IFA_CACHEINFO, &ci, sizeof(ci));
+	}
+	rtnl_slen += NLMSG_ALIGN(nlh->nlmsg_len);
+	rtnl_queued++;
+
+	req = &rtnl_reqs[nlh->nlmsg_seq % RTNL_MAXREQ];
+	req->seq = nlh->nlmsg_seq;
+	req->cmd = cmd;
+	req->ifindex = ifindex;
+	req->addr = *addr;
+	req->plen = plen;
+
+	return (0);
+}
+
+/*
+ * Send the queued requests.  If wait is non-zero, also wait (for a few
+ * seconds at most) until all the requests sent are acknowledged.
+ */
+void
+rtnl_flush(wait)
+	int wait;
+{
+	struct sockaddr_nl snl;
+	struct msghdr msg;
+	struct iovec iov;
+	struct pollfd pfd;
+	int n;
+
+	if (rtnl_slen > 0) {
+		memset(&snl, 0, sizeof(snl));
+		snl.nl_family = AF_NETLINK;
+		iov.iov_base = rtnl_sbuf;
+		iov.iov_len = rtnl_slen;
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_name = &snl;
+		msg.msg_namelen = sizeof(snl);
+		msg.msg_iov = &iov;
+		msg.msg_iovlen = 1;
+		if (sendmsg(rtnl_sock, &msg, 0) < 0) {
+			dprintf(LOG_ERR, FNAME, "sendmsg(NETLINK_ROUTE): %s",
+			    strerror(errno));
+		} else
+			rtnl_pending += rtnl_queued;
+		rtnl_slen = 0;
+		rtnl_queued = 0;
+	}
+
+	for (n = 0; wait && rtnl_pending > 0 && n < 3; n++) {
+		pfd.fd = rtnl_sock;
+		pfd.events = POLLIN;
+		if (poll(&pfd, 1, 1000) > 0)
+			rtnl_input(rtnl_sock, NULL);
+	}
+}
+
+static unsigned int
+rtnl_ifindex(ifname)
+	char *ifname;
+{
+	unsigned int ifindex;
+
+	if ((ifindex = rtnl_nametoindex(ifname)) == 0) {
+		dprintf(LOG_NOTICE, FNAME, "failed to get the index of %s",
+		    ifname);
+	}
+
+	return (ifindex);
+}
+
+static void
+rtnl_addattr(nlh, type, data, len)
+	struct nlmsghdr *nlh;
+	int type;
+	void *data;
+	size_t len;
+{
+	struct rtattr *rta;
+
+	rta = (struct rtattr *)((char *)nlh + NLMSG_ALIGN(nlh->nlmsg_len));
+	rta->rta_type = type;
+	rta->rta_len = RTA_LENGTH(len);
+	memcpy(RTA_DATA(rta), data, len);
+	nlh->nlmsg_len = NLMSG_ALIGN(nlh->nlmsg_len) + RTA_ALIGN(rta->rta_len);
+}
+
+static void
+rtnl_input(fd, arg)
+	int fd;
+	void *arg;
+{
+	u_int32_t buf[RTNL_BUFSIZE / sizeof(u_int32_t)];
+	struct nlmsghdr *nlh;
+	ssize_t len;
+
+	while ((len = recv(fd, buf, sizeof(buf), MSG_DONTWAIT)) != 0) {
+		if (len < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno == ENOBUFS) {
+				/* the acknowledgements were lost */
+				dprintf(LOG_WARNING, FNAME,
+				    "rtnetlink replies overflowed");
+				rtnl_pending = 0;
+				continue;
+			}
+			if (errno != EAGAIN && errno != EWOULDBLOCK) {
+				dprintf(LOG_ERR, FNAME,
+				    "recv(NETLINK_ROUTE): %s",
+				    strerror(errno));
+			}
+			break;
+		}
+		for (nlh = (struct nlmsghdr *)buf; NLMSG_OK(nlh, len);
+		    nlh = NLMSG_NEXT(nlh, len)) {
+			if (nlh->nlmsg_type == NLMSG_ERROR)
+				rtnl_ack(nlh);
+		}
+	}
+}
+
+static void
+rtnl_ack(nlh)
+	struct nlmsghdr *nlh;
+{
+	struct nlmsgerr *nle;
+	struct rtnl_req *req;
+	char ifname[IF_NAMESIZE + 16];
+	char *cmdstr;
+	int error;
+
+	if (nlh->nlmsg_len < NLMSG_LENGTH(sizeof(*nle)))
+		return;
+	nle = NLMSG_DATA(nlh);
+	error = -nle->error;
+	if (rtnl_pending > 0)
+		rtnl_pending--;
+
+	req = &rtnl_reqs[nlh->nlmsg_seq % RTNL_MAXREQ];
+	if (req->seq != nlh->nlmsg_seq) {
+		/* too many requests to remember this one */
+		if (error) {
+			dprintf(LOG_NOTICE, FNAME,
+			    "failed to configure an address: %s",
+			    strerror(error));
+		}
+		return;
+	}
+	cmdstr = (req->cmd == IFADDRCONF_ADD) ? "add" : "remove";
+
+	if (error == 0) {
+		dprintf(LOG_DEBUG, FNAME, "%s an address %s/%d on %s", cmdstr,
+		    in6addr2str(&req->addr, 0), req->plen,
+		    rtnl_ifname(req->ifindex, ifname));
+	} else if (req->cmd == IFADDRCONF_REMOVE && error == EADDRNOTAVAIL) {
+		/* it has expired in the kernel */
+		dprintf(LOG_DEBUG, FNAME, "address %s/%d on %s is gone",
+		    in6addr2str(&req->addr, 0), req->plen,
+		    rtnl_ifname(req->ifindex, ifname));
+	} else {
+		dprintf(LOG_NOTICE, FNAME,
+		    "failed to %s an address %s/%d on %s: %s", cmdstr,
+		    in6addr2str(&req->addr, 0), req->plen,
+		    rtnl_ifname(req->ifindex, ifname), strerror(error));
+	}
+}
+
+/* the name of an interface, looked up only for a message to be logged */
+static char *
+rtnl_ifname(ifindex, buf)
+	unsigned int ifindex;
+	char *buf;
+{
+	if (ifindex < rtnl_nlinks && rtnl_links[ifindex] != NULL &&
+	    rtnl_links[ifindex]->name[0] != '\0')
+		strlcpy(buf, rtnl_links[ifindex]->name, IF_NAMESIZE);
+	else
+		sprintf(buf, "#%u", ifindex);
+
+	return (buf);
+}
+
+/*
+ * Interface lookups.  Each of them first brings the cache up to date.
+ */
+unsigned int
+rtnl_nametoindex(ifname)
+	char *ifname;
+{
+	struct rtnl_link *lp;
+
+	if (rtnl_sync() != 0 || (lp = rtnl_findlink(ifname)) == NULL)
+		return (0);
+
+	return (lp->index);
+}
+
+/* the interface an address is configured on */
+unsigned int
+rtnl_addrtoindex(addr)
+	struct in6_addr *addr;
+{
+	struct rtnl_addr *ap;
+
+	if (rtnl_sync() != 0 || rtnl_naddrs == 0)
+		return (0);
+
+	LIST_FOREACH(ap, &rtnl_exacthash[rtnl_hash128(addr) &
+	    (rtnl_addrhashsize - 1)], xlink) {
+		if (IN6_ARE_ADDR_EQUAL(&ap->addr, addr))
+			return (ap->ifindex);
+	}
+
+	return (0);
+}
+
+/*
+ * Find an address within prefix/plen, on the interface of ifindex or, if
+ * ifindex is 0, on any interface.  With RTNL_NOLINKLOCAL, link-local
+ * addresses don't count.
+ */
+int
+rtnl_findaddr(ifindex, prefix, plen, flags, addr)
+	unsigned int ifindex;
+	struct in6_addr *prefix;
+	int plen, flags;
+	struct in6_addr *addr;
+{
+	struct rtnl_addr *ap = NULL;
+	unsigned int i;
+
+	if (rtnl_sync() != 0 || rtnl_naddrs == 0)
+		return (-1);
+
+	if (plen >= 64) {
+		LIST_FOREACH(ap, &rtnl_addrhash[rtnl_hash64(prefix) &
+		    (rtnl_addrhashsize - 1)], hlink) {
+			if ((ifindex == 0 || ap->ifindex == ifindex) &&
+			    !((flags & RTNL_NOLINKLOCAL) &&
+			    IN6_IS_ADDR_LINKLOCAL(&ap->addr)) &&
+			    rtnl_prefixmatch(&ap->addr, prefix, plen))
+				break;
+		}
+	} else {
+		/* a short prefix leaves no choice but to look at them all */
+		for (i = ifindex; i < rtnl_nlinks; i++) {
+			if (rtnl_links[i] != NULL) {
+				TAILQ_FOREACH(ap, &rtnl_links[i]->addrs, link) {
+					if (!((flags & RTNL_NOLINKLOCAL) &&
+					    IN6_IS_ADDR_LINKLOCAL(&ap->addr)) &&
+					    rtnl_prefixmatch(&ap->addr, prefix,
+					    plen))
+						break;
+				}
+			}
+			if (ap != NULL || ifindex != 0)
+				break;
+		}
+	}
+	if (ap == NULL)
+		return (-1);
+
+	*addr = ap->addr;
+	return (0);
+}
+
+/*
+ * Copy the link-layer address of an interface to buf, and return its
+ * length.
+ */
+int
+rtnl_gethwaddr(ifname, buf, len, hwtypep)
+	char *ifname;
+	u_char *buf;
+	size_t len;
+	u_int16_t *hwtypep;
+{
+	struct rtnl_link *lp;
+
+	if (rtnl_sync() != 0 || (lp = rtnl_findlink(ifname)) == NULL ||
+	    lp->hwlen == 0 || lp->hwlen > len)
+		return (-1);
+
+	memcpy(buf, lp->hwaddr, lp->hwlen);
+	if (hwtypep != NULL)
+		*hwtypep = lp->type;
+
+	return (lp->hwlen);
+}
+
+/* read the notifications queued, or dump everything if we've lost some */
+static int
+rtnl_sync()
+{
+	int n;
+
+	if (rtnl_mon < 0 && rtnl_monopen() != 0)
+		return (-1);
+
+	if (!rtnl_stale)
+		(void)rtnl_monread(0);
+
+	for (n = 0; rtnl_stale && n < 3; n++) {
+		rtnl_clear();
+		rtnl_stale = 0;
+		if (rtnl_dump(RTM_GETLINK) != 0 || rtnl_dump(RTM_GETADDR) != 0) {
+			rtnl_stale = 1;
+			return (-1);
+		}
+	}
+
+	return (0);
+}
+
+static int
+rtnl_monopen()
+{
+	struct sockaddr_nl snl;
+	int bufsiz = RTNL_MONBUFSIZE;
+
+	if ((rtnl_mon = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC,
+	    NETLINK_ROUTE)) < 0) {
+		dprintf(LOG_ERR, FNAME, "socket(NETLINK_ROUTE): %s",
+		    strerror(errno));
+		return (-1);
+	}
+	/* a burst of changes shouldn't cost a dump */
+	(void)setsockopt(rtnl_mon, SOL_SOCKET, SO_RCVBUF, &bufsiz,
+	    sizeof(bufsiz));
+	memset(&snl, 0, sizeof(snl));
+	snl.nl_family = AF_NETLINK;
+	snl.nl_groups = RTMGRP_LINK | RTMGRP_IPV6_IFADDR;
+	if (bind(rtnl_mon, (struct sockaddr *)&snl, sizeof(snl)) < 0) {
+		dprintf(LOG_ERR, FNAME, "bind(NETLINK_ROUTE): %s",
+		    strerror(errno));
+		close(rtnl_mon);
+		rtnl_mon = -1;
+		return (-1);
+	}
+	rtnl_stale = 1;
+
+	return (0);
+}
+
+/*
+ * Dump the interfaces or the IPv6 addresses.  The notifications arriving
+ * meanwhile are applied in order with the dump.
+ */
+static int
+rtnl_dump(type)
+	int type;
+{
+	struct {
+		struct nlmsghdr nlh;
+		union {
+			struct ifinfomsg ifi;
+			struct ifaddrmsg ifa;
+		} u;
+	} req;
+	struct sockaddr_nl snl;
+
+	memset(&req, 0, sizeof(req));
+	req.nlh.nlmsg_type = type;
+	req.nlh.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+	req.nlh.nlmsg_seq = ++rtnl_monseq;
+	if (type == RTM_GETLINK) {
+		req.nlh.nlmsg_len = NLMSG_LENGTH(sizeof(req.u.ifi));
+		req.u.ifi.ifi_family = AF_UNSPEC;
+	} else {
+		req.nlh.nlmsg_len = NLMSG_LENGTH(sizeof(req.u.ifa));
+		req.u.ifa.ifa_family = AF_INET6;
+	}
+	memset(&snl, 0, sizeof(snl));
+	snl.nl_family = AF_NETLINK;
+	if (sendto(rtnl_mon, &req, req.nlh.nlmsg_len, 0,
+	    (struct sockaddr *)&snl, sizeof(snl)) < 0) {
+		dprintf(LOG_ERR, FNAME, "sendto(NETLINK_ROUTE): %s",
+		    strerror(errno));
+		return (-1);
+	}
+
+	return (rtnl_monread(rtnl_monseq));
+}
+
+/*
+ * Apply the messages received.  If seq is non-zero, wait for the end of
+ * the dump of that sequence number; otherwise read what is queued.
+ */
+static int
+rtnl_monread(seq)
+	u_int32_t seq;
+{
+	u_int32_t buf[RTNL_RCVBUFSIZE / sizeof(u_int32_t)];
+	struct nlmsghdr *nlh;
+	ssize_t len;
+
+	for (;;) {
+		len = recv(rtnl_mon, buf, sizeof(buf), seq ? 0 : MSG_DONTWAIT);
+		if (len < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno == ENOBUFS) {
+				dprintf(LOG_INFO, FNAME,
+				    "rtnetlink notifications overflowed");
+				rtnl_stale = 1;
+				if (seq)
+					continue;
+				return (0);
+			}
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				return (0);
+			dprintf(LOG_ERR, FNAME, "recv(NETLINK_ROUTE): %s",
+			    strerror(errno));
+			rtnl_stale = 1;
+			return (-1);
+		}
+		if (len == 0)
+			return (0);
+
+		for (nlh = (struct nlmsghdr *)buf; NLMSG_OK(nlh, len);
+		    nlh = NLMSG_NEXT(nlh, len)) {
+			if (seq == 0 || nlh->nlmsg_seq != seq) {
+				rtnl_update(nlh);
+				continue;
+			}
+			if ((nlh->nlmsg_flags & NLM_F_DUMP_INTR))
+				rtnl_stale = 1;
+			if (nlh->nlmsg_type == NLMSG_DONE)
+				return (0);
+			if (nlh->nlmsg_type == NLMSG_ERROR) {
+				dprintf(LOG_ERR, FNAME,
+				    "rtnetlink dump failed");
+				rtnl_stale = 1;
+				return (-1);
+			}
+			rtnl_update(nlh);
+		}
+	}
+}
+
+static void
+rtnl_update(nlh)
+	struct nlmsghdr *nlh;
+{
+	struct rtnl_link *lp;
+	struct ifinfomsg *ifi;
+
+	switch (nlh->nlmsg_type) {
+	case RTM_NEWLINK:
+	case RTM_DELLINK:
+		if (nlh->nlmsg_len < NLMSG_LENGTH(sizeof(*ifi)))
+			return;
+		ifi = NLMSG_DATA(nlh);
+		/*
+		 * Only the generic messages tell about the interface itself;
+		 * e.g. the bridge sends an AF_BRIDGE RTM_DELLINK when a port
+		 * leaves it, and the port stays.
+		 */
+		if (ifi->ifi_family != AF_UNSPEC)
+			return;
+		if (nlh->nlmsg_type == RTM_NEWLINK)
+			rtnl_newlink(ifi, IFLA_PAYLOAD(nlh));
+		else if ((lp = rtnl_getlink(ifi->ifi_index, 0)) != NULL)
+			rtnl_dellink(lp);
+		break;
+	case RTM_NEWADDR:
+	case RTM_DELADDR:
+		rtnl_newaddr(nlh);
+		break;
+	}
+}
+
+static void
+rtnl_newlink(ifi, len)
+	struct ifinfomsg *ifi;
+	size_t len;
+{
+	struct rtnl_link *lp;
+	struct rtattr *rta;
+	int n;
+
+	if ((lp = rtnl_getlink(ifi->ifi_index, 1)) == NULL)
+		return;
+	lp->type = ifi->ifi_type;
+
+	for (rta = IFLA_RTA(ifi); RTA_OK(rta, len); rta = RTA_NEXT(rta, len)) {
+		switch (rta->rta_type) {
+		case IFLA_IFNAME:
+			if (strncmp(lp->name, RTA_DATA(rta),
+			    sizeof(lp->name)) == 0)
+				break;
+			/* renamed, or just known */
+			if (lp->name[0] != '\0')
+				LIST_REMOVE(lp, hlink);
+			strlcpy(lp->name, RTA_DATA(rta), sizeof(lp->name));
+			LIST_INSERT_HEAD(&rtnl_linkhash[rtnl_namehash(lp->name) %
+			    RTNL_LINKHASH], lp, hlink);
+			break;
+		case IFLA_ADDRESS:
+			if ((n = RTA_PAYLOAD(rta)) > sizeof(lp->hwaddr))
+				n = 0;
+			memcpy(lp->hwaddr, RTA_DATA(rta), n);
+			lp->hwlen = n;
+			break;
+		}
+	}
+}
+
+static void
+rtnl_newaddr(nlh)
+	struct nlmsghdr *nlh;
+{
+	struct ifaddrmsg *ifa;
+	struct rtattr *rta;
+	struct in6_addr *addr = NULL, *local = NULL;
+	struct rtnl_addr *ap;
+	struct rtnl_link *lp;
+	size_t len;
+
+	if (nlh->nlmsg_len < NLMSG_LENGTH(sizeof(*ifa)))
+		return;
+	ifa = NLMSG_DATA(nlh);
+	if (ifa->ifa_family != AF_INET6)
+		return;
+	len = IFA_PAYLOAD(nlh);
+	for (rta = IFA_RTA(ifa); RTA_OK(rta, len); rta = RTA_NEXT(rta, len)) {
+		if (RTA_PAYLOAD(rta) < sizeof(struct in6_addr))
+			continue;
+		if (rta->rta_type == IFA_ADDRESS)
+			addr = RTA_DATA(rta);
+		else if (rta->rta_type == IFA_LOCAL)
+			local = RTA_DATA(rta);
+	}
+	/* IFA_ADDRESS is the peer on a point-to-point link */
+	if (local != NULL)
+		addr = local;
+	if (addr == NULL)
+		return;
+
+	if (rtnl_naddrs > 0) {
+		LIST_FOREACH(ap, &rtnl_exacthash[rtnl_hash128(addr) &
+		    (rtnl_addrhashsize - 1)], xlink) {
+			if (ap->ifindex == ifa->ifa_index &&
+			    IN6_ARE_ADDR_EQUAL(&ap->addr, addr))
+				break;
+		}
+	} else
+		ap = NULL;
+
+	if (nlh->nlmsg_type == RTM_DELADDR) {
+		if (ap != NULL)
+			rtnl_deladdr(ap);
+		return;
+	}
+	if (ap != NULL) {
+		ap->plen = ifa->ifa_prefixlen;
+		return;
+	}
+
+	if ((lp = rtnl_getlink(ifa->ifa_index, 1)) == NULL ||
+	    rtnl_growhash() != 0) {
+		rtnl_stale = 1;
+		return;
+	}
+	if ((ap = malloc(sizeof(*ap))) == NULL) {
+		dprintf(LOG_ERR, FNAME, "memory allocation failed");
+		rtnl_stale = 1;
+		return;
+	}
+	ap->ifindex = ifa->ifa_index;
+	ap->addr = *addr;
+	ap->plen = ifa->ifa_prefixlen;
+	TAILQ_INSERT_TAIL(&lp->addrs, ap, link);
+	LIST_INSERT_HEAD(&rtnl_addrhash[rtnl_hash64(addr) &
+	    (rtnl_addrhashsize - 1)], ap, hlink);
+	LIST_INSERT_HEAD(&rtnl_exacthash[rtnl_hash128(addr) &
+	    (rtnl_addrhashsize - 1)], ap, xlink);
+	rtnl_naddrs++;
+}
+
+/* the interface of an index, made if create is non-zero */
+static struct rtnl_link *
+rtnl_getlink(ifindex, create)
+	unsigned int ifindex;
+	int create;
+{
+	struct rtnl_link *lp, **newlinks;
+	unsigned int newsize;
+
+	if (ifindex < rtnl_nlinks && rtnl_links[ifindex] != NULL)
+		return (rtnl_links[ifindex]);
+	if (!create || ifindex == 0)
+		return (NULL);
+
+	if (ifindex >= rtnl_nlinks) {
+		for (newsize = rtnl_nlinks ? rtnl_nlinks : 16;
+		    newsize <= ifindex; newsize *= 2)
+			;
+		if ((newlinks = realloc(rtnl_links,
+		    newsize * sizeof(*newlinks))) == NULL) {
+			dprintf(LOG_ERR, FNAME, "memory allocation failed");
+			return (NULL);
+		}
+		memset(newlinks + rtnl_nlinks, 0,
+		    (newsize - rtnl_nlinks) * sizeof(*newlinks));
+		rtnl_links = newlinks;
+		rtnl_nlinks = newsize;
+	}
+
+	if ((lp = malloc(sizeof(*lp))) == NULL) {
+		dprintf(LOG_ERR, FNAME, "memory allocation failed");
+		return (NULL);
+	}
+	memset(lp, 0, sizeof(*lp));
+	lp->index = ifindex;
+	TAILQ_INIT(&lp->addrs);
+	rtnl_links[ifindex] = lp;
+
+	return (lp);
+}
+
+static void
+rtnl_dellink(lp)
+	struct rtnl_link *lp;
+{
+	struct rtnl_addr *ap;
+
+	while ((ap = TAILQ_FIRST(&lp->addrs)) != NULL)
+		rtnl_deladdr(ap);
+	if (lp->name[0] != '\0')
+		LIST_REMOVE(lp, hlink);
+	rtnl_links[lp->index] = NULL;
+	free(lp);
+}
+
+static struct rtnl_link *
+rtnl_findlink(ifname)
+	char *ifname;
+{
+	struct rtnl_link *lp;
+
+	LIST_FOREACH(lp, &rtnl_linkhash[rtnl_namehash(ifname) %
+	    RTNL_LINKHASH], hlink) {
+		if (strncmp(lp->name, ifname, sizeof(lp->name)) == 0)
+			return (lp);
+	}
+
+	return (NULL);
+}
+
+static void
+rtnl_deladdr(ap)
+	struct rtnl_addr *ap;
+{
+	TAILQ_REMOVE(&rtnl_links[ap->ifindex]->addrs, ap, link);
+	LIST_REMOVE(ap, hlink);
+	LIST_REMOVE(ap, xlink);
+	rtnl_naddrs--;
+	free(ap);
+}
+
+/* keep the address hashes at least as large as the number of addresses */
+static int
+rtnl_growhash()
+{
+	struct rtnl_addrchain *newhash, *newexact;
+	struct rtnl_addr *ap;
+	unsigned int newsize, i;
+
+	if (rtnl_naddrs < rtnl_addrhashsize)
+		return (0);
+
+	newsize = rtnl_addrhashsize ? rtnl_addrhashsize * 2 : 64;
+	if ((newhash = malloc(newsize * sizeof(*newhash))) == NULL) {
+		dprintf(LOG_ERR, FNAME, "memory allocation failed");
+		return (-1);
+	}
+	if ((newexact = malloc(newsize * sizeof(*newexact))) == NULL) {
+		dprintf(LOG_ERR, FNAME, "memory allocation failed");
+		free(newhash);
+		return (-1);
+	}
+	for (i = 0; i < newsize; i++) {
+		LIST_INIT(&newhash[i]);
+		LIST_INIT(&newexact[i]);
+	}
+	for (i = 0; i < rtnl_addrhashsize; i++) {
+		while ((ap = LIST_FIRST(&rtnl_addrhash[i])) != NULL) {
+			LIST_REMOVE(ap, hlink);
+			LIST_INSERT_HEAD(&newhash[rtnl_hash64(&ap->addr) &
+			    (newsize - 1)], ap, hlink);
+		}
+		while ((ap = LIST_FIRST(&rtnl_exacthash[i])) != NULL) {
+			LIST_REMOVE(ap, xlink);
+			LIST_INSERT_HEAD(&newexact[rtnl_hash128(&ap->addr) &
+			    (newsize - 1)], ap, xlink);
+		}
+	}
+	free(rtnl_addrhash);
+	free(rtnl_exacthash);
+	rtnl_addrhash = newhash;
+	rtnl_exacthash = newexact;
+	rtnl_addrhashsize = newsize;
+
+	return (0);
+}
+
+static void
+rtnl_clear()
+{
+	unsigned int i;
+
+	for (i = 0; i < rtnl_nlinks; i++) {
+		if (rtnl_links[i] != NULL)
+			rtnl_dellink(rtnl_links[i]);
+	}
+}
+
+static u_int32_t
+rtnl_namehash(ifname)
+	char *ifname;
+{
+	u_int32_t h = 2166136261U;
+	int i;
+
+	for (i = 0; i < IF_NAMESIZE && ifname[i] != '\0'; i++)
+		h = (h ^ (u_char)ifname[i]) * 16777619U;
+
+	return (h);
+}
+
+static u_int32_t
+rtnl_hash64(addr)
+	struct in6_addr *addr;
+{
+	u_int32_t w[2], h;
+
+	memcpy(w, addr, sizeof(w));
+	h = (w[0] ^ (w[1] * 0x9e3779b1U)) * 0x85ebca6bU;
+
+	return (h ^ (h >> 16));
+}
+
+static u_int32_t
+rtnl_hash128(addr)
+	struct in6_addr *addr;
+{
+	return (dhcp6_hash(addr, sizeof(*addr), 0));
+}
+
+static int
+rtnl_prefixmatch(addr, prefix, plen)
+	struct in6_addr *addr, *prefix;
+	int plen;
+{
+	int n = plen / 8, m = plen % 8;
+
+	if (memcmp(addr, prefix, n) != 0)
+		return (0);
+	if (m != 0 && ((addr->s6_addr[n] ^ prefix->s6_addr[n]) &
+	    (0xff00 >> m) & 0xff) != 0)
+		return (0);
+
+	return (1);
+}
+
+#endif /* __linux__ */
@@ -0,0 +1,52 @@
+/*
+ * Copyright (C) 2026 WIDE Project.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the project nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE PROJECT AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE PROJECT OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef __RTNL_H_DEFINED
+#define __RTNL_H_DEFINED
+
+#define RTNL_BUFSIZE	8192	/* requests sent in one batch */
+#define RTNL_MAXREQ	256	/* requests remembered for their replies */
+#define RTNL_RCVBUFSIZE	32768	/* a message of a dump */
+#define RTNL_MONBUFSIZE	(256 * 1024)	/* notifications kept unread */
+#define RTNL_LINKHASH	64	/* buckets of the interfaces by name */
+#define RTNL_HWADDRLEN	32	/* link-layer address of an interface */
+
+/* rtnl_findaddr() flags */
+#define RTNL_NOLINKLOCAL	0x1
+
+extern int rtnl_ifaddr __P((ifaddrconf_cmd_t, char *,
+    struct in6_addr *, int, u_int32_t, u_int32_t));
+extern void rtnl_flush __P((int));
+extern unsigned int rtnl_nametoindex __P((char *));
+extern unsigned int rtnl_addrtoindex __P((struct in6_addr *));
+extern int rtnl_findaddr __P((unsigned int, struct in6_addr *, int, int,
+    struct in6_addr *));
+extern int rtnl_gethwaddr __P((char *, u_char *, size_t, u_int16_t *));
+
+#endif
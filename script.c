@@ -0,0 +1,393 @@
+/*
+ * Copyright (C) 2026 WIDE Project.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the project nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE PROJECT AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE PROJECT OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Hook scripts of dhcp6c and dhcp6relay, run without waiting for them so
+ * that the daemon keeps handling packets and timers meanwhile.
+ *
+ * A script is run for a key, such as an interface or a client.  Up to
+ * SCRIPT_MAXRUN scripts run at a time and up to SCRIPT_MAXQUEUE wait in a
+ * queue; those of the same key run one after another in order.  A newer
+ * script for a key supersedes the one still waiting for it, as only the
+ * latest state is of interest to the script.  The children are reaped
+ * when SIGCHLD arrives, through a signalfd on Linux and a pipe written by
+ * the signal handler elsewhere.
+ */
+
+#include <sys/types.h>
+#include <sys/queue.h>
+#include <sys/wait.h>
+#ifdef __linux__
+#include <sys/signalfd.h>
+#endif
+
+#include <netinet/in.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <spawn.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <unistd.h>
+
+#include "dhcp6.h"
+#include "config.h"
+#include "common.h"
+#include "evloop.h"
+#include "script.h"
+
+struct script_job {
+	TAILQ_ENTRY(script_job) link;
+	char *path;
+	char *key;
+	char **envp;		/* freed once the script is started */
+	pid_t pid;
+};
+TAILQ_HEAD(script_joblist, script_job);
+
+static struct script_joblist script_running;
+static struct script_joblist script_queue;
+static int script_nrunning, script_nqueued;
+static int script_fd = -1;	/* readable when SIGCHLD arrives */
+#ifndef __linux__
+static int script_pipe = -1;	/* the other end of script_fd */
+#endif
+
+static void script_input __P((int, void *));
+#ifndef __linux__
+static void script_signal __P((int));
+#endif
+static int script_reap __P((int));
+static void script_start __P((void));
+static int script_spawn __P((struct script_job *));
+static void script_freeenv __P((char **));
+
+int
+script_init()
+{
+	sigset_t mask;
+#ifndef __linux__
+	int fds[2];
+#endif
+
+	TAILQ_INIT(&script_running);
+	TAILQ_INIT(&script_queue);
+
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGCHLD);
+#ifdef __linux__
+	if (sigprocmask(SIG_BLOCK, &mask, NULL) < 0) {
+		dprintf(LOG_ERR, FNAME, "sigprocmask: %s", strerror(errno));
+		return (-1);
+	}
+	if ((script_fd = signalfd(-1, &mask, SFD_CLOEXEC)) < 0) {
+		dprintf(LOG_ERR, FNAME, "signalfd: %s", strerror(errno));
+		return (-1);
+	}
+#else
+	if (pipe(fds) < 0) {
+		dprintf(LOG_ERR, FNAME, "pipe: %s", strerror(errno));
+		return (-1);
+	}
+	if (fcntl(fds[1], F_SETFL, O_NONBLOCK) < 0) {
+		dprintf(LOG_ERR, FNAME, "fcntl: %s", strerror(errno));
+		close(fds[0]);
+		close(fds[1]);
+		return (-1);
+	}
+	(void)fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+	(void)fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+	script_fd = fds[0];
+	script_pipe = fds[1];
+	if (signal(SIGCHLD, script_signal) == SIG_ERR) {
+		dprintf(LOG_ERR, FNAME, "failed to set signal: %s",
+		    strerror(errno));
+		return (-1);
+	}
+#endif
+	if (evloop_add(script_fd, EVLOOP_EDGE, script_input, NULL) != 0)
+		return (-1);
+
+	return (0);
+}
+
+/*
+ * Run the script at path for key with the environment envp, a list of
+ * malloc'ed strings terminated by NULL, which is freed here.
+ */
+int
+script_run(path, key, envp)
+	char *path, *key;
+	char **envp;
+{
+	struct script_job *job;
+	size_t plen, klen;
+
+	for (job = TAILQ_FIRST(&script_queue); job;
+	    job = TAILQ_NEXT(job, link)) {
+		if (strcmp(job->key, key) == 0 &&
+		    strcmp(job->path, path) == 0) {
+			dprintf(LOG_DEBUG, FNAME,
+			    "script \"%s\" for %s superseded", path, key);
+			script_freeenv(job->envp);
+			job->envp = envp;
+			return (0);
+		}
+	}
+
+	if (script_nqueued >= SCRIPT_MAXQUEUE) {
+		dprintf(LOG_WARNING, FNAME,
+		    "too many scripts waiting: \"%s\" for %s is not run",
+		    path, key);
+		script_freeenv(envp);
+		return (-1);
+	}
+
+	plen = strlen(path) + 1;
+	klen = strlen(key) + 1;
+	if ((job = malloc(sizeof(*job) + plen + klen)) == NULL) {
+		dprintf(LOG_ERR, FNAME, "memory allocation failed");
+		script_freeenv(envp);
+		return (-1);
+	}
+	memset(job, 0, sizeof(*job));
+	job->path = (char *)(job + 1);
+	memcpy(job->path, path, plen);
+	job->key = job->path + plen;
+	memcpy(job->key, key, klen);
+	job->envp = envp;
+	TAILQ_INSERT_TAIL(&script_queue, job, link);
+	script_nqueued++;
+
+	script_start();
+
+	return (0);
+}
+
+/* run the scripts left, waiting for all of them to finish */
+void
+script_wait()
+{
+	script_start();
+	while (script_nrunning > 0) {
+		if (script_reap(0) < 0)
+			break;
+		script_start();
+	}
+}
+
+static void
+script_input(fd, arg)
+	int fd;
+	void *arg;
+{
+#ifdef __linux__
+	struct signalfd_siginfo si[4];
+#else
+	char si[16];
+#endif
+
+	/* SIGCHLDs may be merged, so reap whatever has exited */
+	while (read(fd, si, sizeof(si)) > 0)
+		;
+	(void)script_reap(WNOHANG);
+	script_start();
+}
+
+#ifndef __linux__
+static void
+script_signal(sig)
+	int sig;
+{
+	int save_errno = errno;
+
+	(void)write(script_pipe, "", 1);
+	errno = save_errno;
+}
+#endif
+
+/*
+ * Reap the scripts that have exited, or, without WNOHANG in options, wait
+ * for one to exit.
+ */
+static int
+script_reap(options)
+	int options;
+{
+	struct script_job *job;
+	pid_t pid;
+	int wstatus;
+
+	for (;;) {
+		if ((pid = waitpid(-1, &wstatus, options)) < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno != ECHILD || script_nrunning > 0) {
+				dprintf(LOG_ERR, FNAME, "waitpid: %s",
+				    strerror(errno));
+			}
+			return (-1);
+		}
+		if (pid == 0)
+			return (0);
+
+		for (job = TAILQ_FIRST(&script_running); job;
+		    job = TAILQ_NEXT(job, link)) {
+			if (job->pid == pid)
+				break;
+		}
+		if (job == NULL)
+			continue;
+
+		if (WIFSIGNALED(wstatus)) {
+			dprintf(LOG_NOTICE, FNAME,
+			    "script \"%s\" for %s killed by signal %d",
+			    job->path, job->key, WTERMSIG(wstatus));
+		} else if (WIFEXITED(wstatus) && WEXITSTATUS(wstatus) != 0) {
+			dprintf(LOG_INFO, FNAME,
+			    "script \"%s\" for %s exited with status %d",
+			    job->path, job->key, WEXITSTATUS(wstatus));
+		} else {
+			dprintf(LOG_DEBUG, FNAME,
+			    "script \"%s\" for %s terminated",
+			    job->path, job->key);
+		}
+		TAILQ_REMOVE(&script_running, job, link);
+		script_nrunning--;
+		free(job);
+
+		if (!(options & WNOHANG))
+			return (0);
+	}
+}
+
+/* start the waiting scripts as far as they can be */
+static void
+script_start()
+{
+	struct script_job *job, *job_next, *run;
+
+	for (job = TAILQ_FIRST(&script_queue);
+	    job && script_nrunning < SCRIPT_MAXRUN; job = job_next) {
+		job_next = TAILQ_NEXT(job, link);
+
+		/* keep the order of the scripts of a key */
+		for (run = TAILQ_FIRST(&script_running); run;
+		    run = TAILQ_NEXT(run, link)) {
+			if (strcmp(run->key, job->key) == 0)
+				break;
+		}
+		if (run != NULL)
+			continue;
+
+		TAILQ_REMOVE(&script_queue, job, link);
+		script_nqueued--;
+		if (script_spawn(job) != 0) {
+			script_freeenv(job->envp);
+			free(job);
+			continue;
+		}
+		script_freeenv(job->envp);
+		job->envp = NULL;
+		TAILQ_INSERT_TAIL(&script_running, job, link);
+		script_nrunning++;
+	}
+}
+
+static int
+script_spawn(job)
+	struct script_job *job;
+{
+	posix_spawn_file_actions_t actions;
+	posix_spawnattr_t attr;
+	sigset_t mask;
+	char *argv[2];
+	int error;
+
+	if (safefile(job->path)) {
+		dprintf(LOG_ERR, FNAME,
+		    "script \"%s\" cannot be executed safely", job->path);
+		return (-1);
+	}
+
+	argv[0] = job->path;
+	argv[1] = NULL;
+
+	if ((error = posix_spawn_file_actions_init(&actions)) != 0) {
+		dprintf(LOG_ERR, FNAME, "posix_spawn_file_actions_init: %s",
+		    strerror(error));
+		return (-1);
+	}
+	if ((error = posix_spawnattr_init(&attr)) != 0) {
+		dprintf(LOG_ERR, FNAME, "posix_spawnattr_init: %s",
+		    strerror(error));
+		posix_spawn_file_actions_destroy(&actions);
+		return (-1);
+	}
+	if (foreground == 0) {
+		(void)posix_spawn_file_actions_addopen(&actions, STDIN_FILENO,
+		    "/dev/null", O_RDWR, 0);
+		(void)posix_spawn_file_actions_adddup2(&actions, STDIN_FILENO,
+		    STDOUT_FILENO);
+		(void)posix_spawn_file_actions_adddup2(&actions, STDIN_FILENO,
+		    STDERR_FILENO);
+	}
+	/* nothing is blocked in the script, though SIGCHLD may be here */
+	sigemptyset(&mask);
+	(void)posix_spawnattr_setsigmask(&attr, &mask);
+	(void)posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGMASK);
+
+	error = posix_spawn(&job->pid, job->path, &actions, &attr, argv,
+	    job->envp);
+	posix_spawnattr_destroy(&attr);
+	posix_spawn_file_actions_destroy(&actions);
+	if (error != 0) {
+		dprintf(LOG_ERR, FNAME, "failed to run script \"%s\": %s",
+		    job->path, strerror(error));
+		return (-1);
+	}
+
+	dprintf(LOG_DEBUG, FNAME, "script \"%s\" for %s started (pid %d)",
+	    job->path, job->key, (int)job->pid);
+
+	return (0);
+}
+
+static void
+script_freeenv(envp)
+	char **envp;
+{
+	char **ep;
+
+	for (ep = envp; *ep != NULL; ep++)
+		free(*ep);
+	free(envp);
+}
@@ -0,0 +1,431 @@
+/*
+ * Copyright (C) 2026 WIDE Project.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the project nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE PROJECT AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE PROJECT OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Worker processes for dhcp6s.
+ *
+ * With -w, dhcp6s forks the given number of workers after parsing the
+ * configuration file.  The client DUID space is partitioned among them
+ * by a hash of the DUID, and each worker owns the bindings, lease journal,
+ * timers and address pool slices for its partition; since the workers
+ * share nothing, they need no locking.  The parent process is the
+ * dispatcher: it receives the packets, finds the client DUID in each,
+ * and passes the packet with its source address and packet information
+ * to the owning worker over a SOCK_SEQPACKET socket pair.  The workers
+ * send their replies directly.  Control commands are also handled by the
+ * dispatcher and forwarded to the workers.
+ *
+ * With -R, a single worker is fed from a packet trace (see trace.c) by a
+ * child process instead, as fast as the worker takes the packets.
+ */
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/wait.h>
+#include <sys/queue.h>
+
+#include <netinet/in.h>
+
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <unistd.h>
+
+#include "dhcp6.h"
+#include "config.h"
+#include "common.h"
+#include "shard.h"
+#include "trace.h"
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+#define SHARD_SOCKBUF	(1024 * 1024)	/* socket buffer size */
+
+struct shard {
+	pid_t pid;
+	int sock;		/* dispatcher's end of the socket pair */
+	u_int64_t packets;	/* packets passed to the worker */
+	u_int64_t drops;	/* packets dropped as the worker was busy */
+};
+
+int shard_count = 0;
+int shard_id = -1;
+
+static struct shard shards[SHARD_MAX];
+
+static int shard_clientid __P((char *, size_t, struct duid *));
+static void shard_feed __P((char *, int));
+
+/*
+ * Fork n workers.  In each worker, shard_id is set to its index and *sockp
+ * to the socket the worker receives its messages on; the dispatcher
+ * returns with shard_id -1.
+ */
+int
+shard_start(n, sockp)
+	int n;
+	int *sockp;
+{
+	int i, j, sv[2], bufsiz = SHARD_SOCKBUF;
+	pid_t pid;
+
+	if (n < 1 || n > SHARD_MAX) {
+		dprintf(LOG_ERR, FNAME, "invalid number of workers: %d", n);
+		return (-1);
+	}
+
+	for (i = 0; i < n; i++) {
+		if (socketpair(AF_UNIX, SOCK_SEQPACKET, 0, sv) < 0) {
+			dprintf(LOG_ERR, FNAME, "socketpair: %s",
+			    strerror(errno));
+			goto fail;
+		}
+		(void)setsockopt(sv[0], SOL_SOCKET, SO_SNDBUF, &bufsiz,
+		    sizeof(bufsiz));
+		(void)setsockopt(sv[1], SOL_SOCKET, SO_RCVBUF, &bufsiz,
+		    sizeof(bufsiz));
+
+		if ((pid = fork()) < 0) {
+			dprintf(LOG_ERR, FNAME, "fork: %s", strerror(errno));
+			close(sv[0]);
+			close(sv[1]);
+			goto fail;
+		}
+		if (pid == 0) {
+			/* worker: drop the other workers' sockets */
+			for (j = 0; j < i; j++)
+				close(shards[j].sock);
+			close(sv[0]);
+			memset(shards, 0, sizeof(shards));
+			shard_count = n;
+			shard_id = i;
+			*sockp = sv[1];
+			return (0);
+		}
+
+		close(sv[1]);
+		memset(&shards[i], 0, sizeof(shards[i]));
+		shards[i].pid = pid;
+		shards[i].sock = sv[0];
+		shard_count = i + 1;
+
+		dprintf(LOG_INFO, FNAME, "started worker %d (pid %d)", i,
+		    (int)pid);
+	}
+
+	return (0);
+
+  fail:
+	shard_stop();
+	return (-1);
+}
+
+/*
+ * Make this process the only worker, and fork a child that passes it the
+ * packets received in the trace file, blocking while the worker is busy.
+ * The child closes the socket at the end of the trace.
+ */
+int
+shard_replay(path, sockp)
+	char *path;
+	int *sockp;
+{
+	int sv[2], bufsiz = SHARD_SOCKBUF;
+	pid_t pid;
+
+	if (socketpair(AF_UNIX, SOCK_SEQPACKET, 0, sv) < 0) {
+		dprintf(LOG_ERR, FNAME, "socketpair: %s", strerror(errno));
+		return (-1);
+	}
+	(void)setsockopt(sv[0], SOL_SOCKET, SO_SNDBUF, &bufsiz,
+	    sizeof(bufsiz));
+	(void)setsockopt(sv[1], SOL_SOCKET, SO_RCVBUF, &bufsiz,
+	    sizeof(bufsiz));
+
+	if ((pid = fork()) < 0) {
+		dprintf(LOG_ERR, FNAME, "fork: %s", strerror(errno));
+		close(sv[0]);
+		close(sv[1]);
+		return (-1);
+	}
+	if (pid == 0) {
+		close(sv[1]);
+		shard_feed(path, sv[0]);
+		/* NOTREACHED */
+	}
+
+	close(sv[0]);
+	shard_count = 1;
+	shard_id = 0;
+	*sockp = sv[1];
+
+	return (0);
+}
+
+static void
+shard_feed(path, s)
+	char *path;
+	int s;
+{
+	struct trace_header *hdr;
+	struct trace_record *rec;
+	struct shard_msg msg;
+	struct msghdr mh;
+	struct iovec iov[2];
+	u_int64_t packets = 0;
+
+	if ((hdr = trace_map(path)) == NULL)
+		_exit(1);
+
+	memset(&msg, 0, sizeof(msg));
+	msg.type = SHARD_MSG_PACKET;
+	msg.from.sin6_family = AF_INET6;
+#ifdef HAVE_SA_LEN
+	msg.from.sin6_len = sizeof(msg.from);
+#endif
+	/* replies go to the loopback address, never out of the host */
+	msg.from.sin6_addr = in6addr_loopback;
+
+	iov[0].iov_base = (void *)&msg;
+	iov[0].iov_len = sizeof(msg);
+	memset(&mh, 0, sizeof(mh));
+	mh.msg_iov = iov;
+	mh.msg_iovlen = 2;
+
+	for (rec = trace_next(hdr, NULL); rec; rec = trace_next(hdr, rec)) {
+		if (rec->type != TRACE_RECV)
+			continue;
+
+		/* an interface of this host takes the place of a foreign one */
+		msg.pktinfo.ipi6_ifindex = find_ifconfbyid(rec->ifindex) ?
+		    rec->ifindex : dhcp6_if->ifid;
+		msg.pktinfo.ipi6_addr = rec->local;
+		msg.from.sin6_port = rec->port;
+		iov[1].iov_base = (void *)(rec + 1);
+		iov[1].iov_len = rec->datalen;
+
+		if (sendmsg(s, &mh, MSG_NOSIGNAL) < 0) {
+			dprintf(LOG_ERR, FNAME, "failed to send to the worker: "
+			    "%s", strerror(errno));
+			_exit(1);
+		}
+		packets++;
+	}
+
+	dprintf(LOG_INFO, FNAME, "fed %llu packets from %s",
+	    (unsigned long long)packets, path);
+	close(s);
+	_exit(0);
+}
+
+/* terminate the workers and wait for them to exit */
+void
+shard_stop()
+{
+	int i;
+
+	for (i = 0; i < shard_count; i++) {
+		if (shards[i].pid > 0)
+			(void)kill(shards[i].pid, SIGTERM);
+	}
+	for (i = 0; i < shard_count; i++) {
+		if (shards[i].pid > 0)
+			(void)waitpid(shards[i].pid, NULL, 0);
+		shards[i].pid = 0;
+		if (shards[i].sock >= 0)
+			close(shards[i].sock);
+		shards[i].sock = -1;
+	}
+	shard_count = 0;
+}
+
+/* collect exited workers; returns the number of them */
+int
+shard_reap()
+{
+	int i, n = 0, status;
+
+	for (i = 0; i < shard_count; i++) {
+		if (shards[i].pid <= 0 ||
+		    waitpid(shards[i].pid, &status, WNOHANG) != shards[i].pid)
+			continue;
+
+		dprintf(LOG_ERR, FNAME, "worker %d (pid %d) exited "
+		    "(status 0x%x)", i, (int)shards[i].pid, status);
+		shards[i].pid = 0;
+		n++;
+	}
+
+	return (n);
+}
+
+/* the worker that owns the client */
+int
+shard_duid(duid)
+	struct duid *duid;
+{
+	if (shard_count <= 1)
+		return (0);
+
+	return (duidhash(duid) % shard_count);
+}
+
+/*
+ * The worker that should process a packet: the owner of the client ID,
+ * looking into relayed messages if necessary.  Packets without a client
+ * ID (e.g. some Information-requests) don't affect any binding, and are
+ * spread by their source address.
+ */
+int
+shard_lookup(buf, len, from)
+	char *buf;
+	size_t len;
+	struct sockaddr_in6 *from;
+{
+	struct duid duid;
+
+	if (shard_count <= 1)
+		return (0);
+
+	if (shard_clientid(buf, len, &duid) == 0)
+		return (shard_duid(&duid));
+
+	return (dhcp6_hash(&from->sin6_addr, sizeof(from->sin6_addr), 0) %
+	    shard_count);
+}
+
+/*
+ * Pass a message to worker i.  The message is dropped if the worker's
+ * socket buffer is full, as it would be on a busy UDP socket.
+ */
+int
+shard_send(i, msg, data, len)
+	int i;
+	struct shard_msg *msg;
+	void *data;
+	size_t len;
+{
+	struct msghdr mh;
+	struct iovec iov[2];
+
+	if (i < 0 || i >= shard_count || shards[i].sock < 0)
+		return (-1);
+
+	iov[0].iov_base = (void *)msg;
+	iov[0].iov_len = sizeof(*msg);
+	iov[1].iov_base = data;
+	iov[1].iov_len = len;
+	memset(&mh, 0, sizeof(mh));
+	mh.msg_iov = iov;
+	mh.msg_iovlen = data ? 2 : 1;
+
+	if (sendmsg(shards[i].sock, &mh, MSG_DONTWAIT | MSG_NOSIGNAL) < 0) {
+		if (errno == EAGAIN || errno == ENOBUFS) {
+			shards[i].drops++;
+			return (-1);
+		}
+		dprintf(LOG_WARNING, FNAME, "failed to send to worker %d: %s",
+		    i, strerror(errno));
+		return (-1);
+	}
+	if (msg->type == SHARD_MSG_PACKET)
+		shards[i].packets++;
+
+	return (0);
+}
+
+void
+shard_logstats()
+{
+	int i;
+
+	for (i = 0; i < shard_count; i++) {
+		dprintf(LOG_INFO, FNAME, "worker %d: %llu packets, %llu drops",
+		    i, (unsigned long long)shards[i].packets,
+		    (unsigned long long)shards[i].drops);
+	}
+}
+
+/* find the client ID option, descending into relay messages */
+static int
+shard_clientid(buf, len, duid)
+	char *buf;
+	size_t len;
+	struct duid *duid;
+{
+	struct dhcp6opt opt;
+	char *bp, *ep;
+	int hops;
+	size_t optlen;
+
+	for (hops = 0; hops <= DHCP6_RELAY_HOP_COUNT_LIMIT; hops++) {
+		if (len < sizeof(struct dhcp6))
+			return (-1);
+
+		if (*(u_int8_t *)buf == DH6_RELAY_FORW) {
+			if (len < sizeof(struct dhcp6_relay))
+				return (-1);
+			bp = buf + sizeof(struct dhcp6_relay);
+		} else
+			bp = buf + sizeof(struct dhcp6);
+		ep = buf + len;
+
+		for (; bp + sizeof(opt) <= ep; bp += sizeof(opt) + optlen) {
+			memcpy(&opt, bp, sizeof(opt));
+			optlen = ntohs(opt.dh6opt_len);
+			if (optlen > ep - bp - sizeof(opt))
+				return (-1);
+
+			if (*(u_int8_t *)buf == DH6_RELAY_FORW) {
+				if (ntohs(opt.dh6opt_type) == DH6OPT_RELAY_MSG)
+					break;
+			} else if (ntohs(opt.dh6opt_type) == DH6OPT_CLIENTID) {
+				if (optlen == 0)
+					return (-1);
+				duid->duid_len = optlen;
+				duid->duid_id = bp + sizeof(opt);
+				return (0);
+			}
+		}
+		if (bp + sizeof(opt) > ep)
+			return (-1);	/* no such option */
+
+		/* look into the relayed message */
+		buf = bp + sizeof(opt);
+		len = optlen;
+	}
+
+	return (-1);
+}
@@ -0,0 +1,63 @@
+/*
+ * Copyright (C) 2026 WIDE Project.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the project nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE PROJECT AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE PROJECT OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef __SHARD_H_DEFINED
+#define __SHARD_H_DEFINED
+
+/* maximum number of worker processes */
+#define SHARD_MAX	64
+
+/* messages from the dispatcher to a worker */
+#define SHARD_MSG_PACKET	1	/* a received packet follows */
+#define SHARD_MSG_RELOAD	2	/* reload the configuration file */
+#define SHARD_MSG_REMOVE	3	/* remove an IA; the client DUID follows */
+
+struct shard_msg {
+	int type;
+	u_int32_t iaid;			/* SHARD_MSG_REMOVE */
+	struct sockaddr_in6 from;	/* SHARD_MSG_PACKET */
+	struct in6_pktinfo pktinfo;	/* SHARD_MSG_PACKET */
+};
+
+extern int shard_count;		/* number of workers; 0 if not sharded */
+extern int shard_id;		/* index of this worker; -1 in the dispatcher */
+
+#define SHARD_WORKER()		(shard_id >= 0)
+#define SHARD_DISPATCHER()	(shard_count > 0 && shard_id < 0)
+
+extern int shard_start __P((int, int *));
+extern int shard_replay __P((char *, int *));
+extern void shard_stop __P((void));
+extern int shard_reap __P((void));
+extern int shard_duid __P((struct duid *));
+extern int shard_lookup __P((char *, size_t, struct sockaddr_in6 *));
+extern int shard_send __P((int, struct shard_msg *, void *, size_t));
+extern void shard_logstats __P((void));
+
+#endif
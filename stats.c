@@ -0,0 +1,767 @@
+/*
+ * Copyright (C) 2026 WIDE Project.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the project nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE PROJECT AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE PROJECT OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Runtime statistics of dhcp6s and dhcp6relay.
+ *
+ * Every process has its own struct stats and only ever writes to it, with
+ * plain increments.  The structures are allocated in one shared mapping
+ * before the workers are forked, so the dispatcher can add up the
+ * counters of all the workers when it is asked for them, by dhcp6ctl or
+ * by SIGUSR1.  A reader may see a counter that is a packet behind, which
+ * doesn't matter for statistics.
+ *
+ * Latencies are kept in log-linear histograms: four buckets for every
+ * power of two nanoseconds, so a percentile read from a histogram is off
+ * by at most a quarter.
+ *
+ * The counters are written as a table for dhcp6ctl and SIGUSR1, and in
+ * the OpenMetrics text format for the metrics listener of metrics.c.
+ * Formatting doesn't allocate memory; the caller provides the buffer.
+ */
+
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/queue.h>
+
+#include <net/if.h>
+#include <netinet/in.h>
+
+#include <errno.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "dhcp6.h"
+#include "config.h"
+#include "common.h"
+#include "pktbatch.h"
+#include "stats.h"
+
+#ifndef MAP_ANON
+#define MAP_ANON MAP_ANONYMOUS
+#endif
+
+/* keep the counters of different processes in different cache lines */
+#define STATS_SLOTSIZE	((sizeof(struct stats) + 63) & ~(size_t)63)
+#define STATS_SLOT(i)	((struct stats *)(stats_slots + (i) * STATS_SLOTSIZE))
+
+static struct stats stats_local;	/* until stats_init() */
+struct stats *stats = &stats_local;
+
+static char *stats_slots;
+static int stats_nslots;
+
+/* the registered interfaces, the same in every process */
+static struct {
+	char name[IFNAMSIZ];
+	unsigned int ifindex;
+} stats_ifs[STATS_IFS];
+static int stats_nifs;
+
+static char *dropnames[STATS_DROP_MAX] = {
+	"short packet", "no interface", "invalid unicast", "bad type",
+	"bad relay message", "bad options", "auth failure", "invalid",
+	"worker busy", "hop limit", "no relay link"
+};
+/* the same as label values */
+static char *dropkeys[STATS_DROP_MAX] = {
+	"short", "no_interface", "invalid_unicast", "bad_type",
+	"bad_relay", "bad_options", "auth_failure", "invalid",
+	"busy", "hop_limit", "no_link"
+};
+static char *stagenames[STATS_STAGES] = {
+	"parse", "lookup", "alloc", "encode", "send", "total"
+};
+
+/* OpenMetrics histogram buckets: every power of two from 256ns to 8.6s */
+#define STATS_OM_MINLOG	8
+#define STATS_OM_MAXLOG	33
+
+static int stats_bucket __P((u_int64_t));
+static double stats_percentile __P((struct stats_hist *, double));
+static void stats_addhist __P((struct stats_hist *, struct stats_hist *));
+static char *stats_ifname __P((int));
+static void stats_text __P((struct stats *, int, char **, size_t *));
+static void stats_openmetrics __P((struct stats *, int, char **, size_t *));
+static void stats_family __P((char **, size_t *, char *, char *, char *));
+static char *stats_label __P((char *, size_t, char *, size_t));
+static int stats_printf __P((char **, size_t *, const char *, ...));
+
+/*
+ * Allocate the counters of n processes, and start using the first ones.
+ * This must be done before forking the processes.
+ */
+int
+stats_init(n)
+	int n;
+{
+	void *p;
+
+	if ((p = mmap(NULL, n * STATS_SLOTSIZE, PROT_READ | PROT_WRITE,
+	    MAP_SHARED | MAP_ANON, -1, 0)) == MAP_FAILED) {
+		dprintf(LOG_ERR, FNAME, "mmap: %s", strerror(errno));
+		return (-1);
+	}
+	stats_slots = p;
+	stats_nslots = n;
+	stats = STATS_SLOT(0);
+
+	return (0);
+}
+
+/* use the i-th counters */
+void
+stats_attach(i)
+	int i;
+{
+	if (i < 0 || i >= stats_nslots) {
+		dprintf(LOG_ERR, FNAME, "no statistics slot %d", i);
+		return;
+	}
+	stats = STATS_SLOT(i);
+}
+
+/*
+ * Register an interface whose messages are counted separately.  Returns
+ * its slot.
+ */
+int
+stats_addif(ifname, ifindex)
+	char *ifname;
+	unsigned int ifindex;
+{
+	int i;
+
+	if ((i = stats_ifslot(ifindex)) != STATS_IFS - 1)
+		return (i);
+	if (stats_nifs == STATS_IFS - 1) {
+		dprintf(LOG_NOTICE, FNAME, "too many interfaces; "
+		    "%s is counted with the others", ifname);
+		return (STATS_IFS - 1);
+	}
+
+	i = stats_nifs++;
+	strncpy(stats_ifs[i].name, ifname, sizeof(stats_ifs[i].name) - 1);
+	stats_ifs[i].ifindex = ifindex;
+
+	return (i);
+}
+
+/* the slot of an interface, which is the last one if not registered */
+int
+stats_ifslot(ifindex)
+	unsigned int ifindex;
+{
+	int i;
+
+	for (i = 0; i < stats_nifs; i++) {
+		if (stats_ifs[i].ifindex == ifindex)
+			return (i);
+	}
+	return (STATS_IFS - 1);
+}
+
+/* monotonic time in nanoseconds */
+u_int64_t
+stats_clock()
+{
+	struct timespec ts;
+
+	(void)clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((u_int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec);
+}
+
+/*
+ * Record that a stage took from t to now.  Returns the current time, as
+ * the start of the next stage.
+ */
+u_int64_t
+stats_time(stage, t)
+	int stage;
+	u_int64_t t;
+{
+	struct stats_hist *h = &stats->hist[stage];
+	u_int64_t now, d;
+
+	now = stats_clock();
+	d = now - t;
+	h->count++;
+	h->sum += d;
+	h->bucket[stats_bucket(d)]++;
+
+	return (now);
+}
+
+void
+stats_setpool(i, name, size, free)
+	int i;
+	char *name;
+	u_int64_t size, free;
+{
+	struct stats_pool *p;
+
+	if (i >= STATS_POOLS)
+		return;
+	p = &stats->pool[i];
+
+	/* the last byte stays NUL for the readers */
+	strncpy(p->name, name, sizeof(p->name) - 1);
+	p->size = size;
+	p->free = free;
+}
+
+/* add up the counters of all the processes */
+void
+stats_sum(sum)
+	struct stats *sum;
+{
+	struct stats *st;
+	struct stats_pool *p, *q;
+	int i, j, k, t;
+
+	memset(sum, 0, sizeof(*sum));
+	for (i = 0; i < (stats_nslots ? stats_nslots : 1); i++) {
+		st = stats_nslots ? STATS_SLOT(i) : stats;
+
+		for (j = 0; j < STATS_IFS; j++) {
+			for (t = 0; t < STATS_MSGTYPES; t++) {
+				sum->ifs[j].rx[t] += st->ifs[j].rx[t];
+				sum->ifs[j].tx[t] += st->ifs[j].tx[t];
+			}
+		}
+		for (t = 0; t < STATS_MSGTYPES; t++)
+			sum->dropped[t] += st->dropped[t];
+		sum->relayed += st->relayed;
+		for (j = 0; j < STATS_HOPS; j++)
+			sum->hops[j] += st->hops[j];
+		for (j = 0; j < STATS_DROP_MAX; j++)
+			sum->drops[j] += st->drops[j];
+		sum->noaddrs += st->noaddrs;
+		for (j = 0; j < STATS_STAGES; j++)
+			stats_addhist(&sum->hist[j], &st->hist[j]);
+
+		sum->bindings += st->bindings;
+		sum->leases += st->leases;
+		sum->timers += st->timers;
+		sum->hostconf.size += st->hostconf.size;
+		sum->hostconf.entries += st->hostconf.entries;
+		sum->hostconf.bytes += st->hostconf.bytes;
+		sum->hostconf.inserts += st->hostconf.inserts;
+		sum->hostconf.evictions += st->hostconf.evictions;
+		sum->hostconf.hits += st->hostconf.hits;
+		sum->rxbatch.calls += st->rxbatch.calls;
+		sum->rxbatch.packets += st->rxbatch.packets;
+		sum->rxbatch.full += st->rxbatch.full;
+		sum->rxbatch.errors += st->rxbatch.errors;
+		sum->txbatch.calls += st->txbatch.calls;
+		sum->txbatch.packets += st->txbatch.packets;
+		sum->txbatch.full += st->txbatch.full;
+		sum->txbatch.errors += st->txbatch.errors;
+		sum->arena_allocs += st->arena_allocs;
+		sum->arena_overflows += st->arena_overflows;
+
+		/* the workers have a part of each pool */
+		for (j = 0; j < st->npools && j < STATS_POOLS; j++) {
+			p = &st->pool[j];
+			for (k = 0; k < sum->npools; k++) {
+				if (strncmp(p->name, sum->pool[k].name,
+				    STATS_POOLNAME) == 0)
+					break;
+			}
+			if (k == STATS_POOLS)
+				continue;
+			q = &sum->pool[k];
+			if (k == sum->npools) {
+				memcpy(q->name, p->name, sizeof(q->name));
+				q->name[sizeof(q->name) - 1] = '\0';
+				sum->npools++;
+			}
+			q->size += p->size;
+			q->free += p->free;
+		}
+	}
+}
+
+/*
+ * Write the counters into buf, in the format fmt.  Returns the length of
+ * the text, which is truncated if it doesn't fit.
+ */
+size_t
+stats_format(st, fmt, buf, len)
+	struct stats *st;
+	int fmt;
+	char *buf;
+	size_t len;
+{
+	char *bp = buf;
+
+	if (len == 0)
+		return (0);
+	*bp = '\0';
+
+	if ((fmt & STATS_FMT_OPENMETRICS))
+		stats_openmetrics(st, fmt, &bp, &len);
+	else
+		stats_text(st, fmt, &bp, &len);
+
+	return (bp - buf);
+}
+
+static void
+stats_text(st, fmt, bpp, lenp)
+	struct stats *st;
+	int fmt;
+	char **bpp;
+	size_t *lenp;
+{
+	struct stats_hist *h;
+	struct stats_pool *p;
+	u_int64_t rx, tx;
+	int i, j;
+
+	(void)stats_printf(bpp, lenp, "%-20s %12s %12s %12s\n", "messages",
+	    "received", "sent", "dropped");
+	for (i = 0; i < STATS_MSGTYPES; i++) {
+		for (rx = tx = 0, j = 0; j < STATS_IFS; j++) {
+			rx += st->ifs[j].rx[i];
+			tx += st->ifs[j].tx[i];
+		}
+		if (rx == 0 && tx == 0 && st->dropped[i] == 0)
+			continue;
+		(void)stats_printf(bpp, lenp, "%-20s %12llu %12llu %12llu\n",
+		    i == 0 ? "other" : dhcp6msgstr(i), (unsigned long long)rx,
+		    (unsigned long long)tx,
+		    (unsigned long long)st->dropped[i]);
+	}
+	(void)stats_printf(bpp, lenp, "%-20s %12llu\n", "relayed",
+	    (unsigned long long)st->relayed);
+	if (!(fmt & STATS_FMT_RELAY)) {
+		(void)stats_printf(bpp, lenp, "%-20s %12llu\n", "noaddrsavail",
+		    (unsigned long long)st->noaddrs);
+	}
+
+	(void)stats_printf(bpp, lenp, "\n%-20s %12s\n", "drops", "messages");
+	for (i = 0; i < STATS_DROP_MAX; i++) {
+		(void)stats_printf(bpp, lenp, "%-20s %12llu\n", dropnames[i],
+		    (unsigned long long)st->drops[i]);
+	}
+
+	if ((fmt & STATS_FMT_RELAY))
+		goto io;
+
+	(void)stats_printf(bpp, lenp, "\n%-8s %12s %10s %10s %10s %10s\n",
+	    "stage", "count", "mean(us)", "p50(us)", "p99(us)", "p99.9(us)");
+	for (i = 0; i < STATS_STAGES; i++) {
+		h = &st->hist[i];
+		(void)stats_printf(bpp, lenp,
+		    "%-8s %12llu %10.1f %10.1f %10.1f %10.1f\n", stagenames[i],
+		    (unsigned long long)h->count,
+		    h->count ? h->sum / 1000.0 / h->count : 0.0,
+		    stats_percentile(h, 0.5) / 1000.0,
+		    stats_percentile(h, 0.99) / 1000.0,
+		    stats_percentile(h, 0.999) / 1000.0);
+	}
+
+	(void)stats_printf(bpp, lenp, "\nbindings %llu, leases %llu, "
+	    "timers %llu\n", (unsigned long long)st->bindings,
+	    (unsigned long long)st->leases, (unsigned long long)st->timers);
+	(void)stats_printf(bpp, lenp, "host configurations: %llu of %llu "
+	    "made (%llu bytes), %llu hits, %llu reused\n",
+	    (unsigned long long)st->hostconf.entries,
+	    (unsigned long long)st->hostconf.size,
+	    (unsigned long long)st->hostconf.bytes,
+	    (unsigned long long)st->hostconf.hits,
+	    (unsigned long long)st->hostconf.evictions);
+	for (i = 0; i < st->npools; i++) {
+		p = &st->pool[i];
+		(void)stats_printf(bpp, lenp,
+		    "pool %.*s: %llu of %llu addresses used (%.1f%%)\n",
+		    (int)sizeof(p->name), p->name,
+		    (unsigned long long)(p->size - p->free),
+		    (unsigned long long)p->size,
+		    p->size ? (p->size - p->free) * 100.0 / p->size : 0.0);
+	}
+
+  io:
+	(void)stats_printf(bpp, lenp, "received %llu packets in %llu calls "
+	    "(%llu full)\n", (unsigned long long)st->rxbatch.packets,
+	    (unsigned long long)st->rxbatch.calls,
+	    (unsigned long long)st->rxbatch.full);
+	(void)stats_printf(bpp, lenp, "sent %llu packets in %llu calls "
+	    "(%llu full), %llu errors\n",
+	    (unsigned long long)st->txbatch.packets,
+	    (unsigned long long)st->txbatch.calls,
+	    (unsigned long long)st->txbatch.full,
+	    (unsigned long long)st->txbatch.errors);
+	if (!(fmt & STATS_FMT_RELAY)) {
+		(void)stats_printf(bpp, lenp, "arena: %llu allocations, "
+		    "%llu passed to malloc\n",
+		    (unsigned long long)st->arena_allocs,
+		    (unsigned long long)st->arena_overflows);
+	}
+}
+
+/*
+ * The OpenMetrics text exposition.  Series of messages and hop counts
+ * that are still zero are left out, the others are always there.
+ */
+static void
+stats_openmetrics(st, fmt, bpp, lenp)
+	struct stats *st;
+	int fmt;
+	char **bpp;
+	size_t *lenp;
+{
+	struct stats_hist *h;
+	struct stats_pool *p;
+	char label[2 * STATS_POOLNAME];
+	u_int64_t n;
+	int i, j, k;
+
+	stats_family(bpp, lenp, "dhcp6_received_messages", "counter",
+	    "DHCPv6 messages received, by interface and message type.");
+	for (i = 0; i < STATS_IFS; i++) {
+		(void)stats_label(stats_ifname(i), IFNAMSIZ, label,
+		    sizeof(label));
+		for (j = 0; j < STATS_MSGTYPES; j++) {
+			if (st->ifs[i].rx[j] == 0)
+				continue;
+			(void)stats_printf(bpp, lenp,
+			    "dhcp6_received_messages_total"
+			    "{interface=\"%s\",type=\"%s\"} %llu\n",
+			    label, j == 0 ? "other" : dhcp6msgstr(j),
+			    (unsigned long long)st->ifs[i].rx[j]);
+		}
+	}
+	stats_family(bpp, lenp, "dhcp6_sent_messages", "counter",
+	    "DHCPv6 messages sent, by interface and message type.");
+	for (i = 0; i < STATS_IFS; i++) {
+		(void)stats_label(stats_ifname(i), IFNAMSIZ, label,
+		    sizeof(label));
+		for (j = 0; j < STATS_MSGTYPES; j++) {
+			if (st->ifs[i].tx[j] == 0)
+				continue;
+			(void)stats_printf(bpp, lenp,
+			    "dhcp6_sent_messages_total"
+			    "{interface=\"%s\",type=\"%s\"} %llu\n",
+			    label, j == 0 ? "other" : dhcp6msgstr(j),
+			    (unsigned long long)st->ifs[i].tx[j]);
+		}
+	}
+	stats_family(bpp, lenp, "dhcp6_dropped_messages", "counter",
+	    "Received messages that were dropped, by reason.");
+	for (i = 0; i < STATS_DROP_MAX; i++) {
+		(void)stats_printf(bpp, lenp,
+		    "dhcp6_dropped_messages_total{reason=\"%s\"} %llu\n",
+		    dropkeys[i], (unsigned long long)st->drops[i]);
+	}
+	stats_family(bpp, lenp, "dhcp6_relay_hops", "counter",
+	    (fmt & STATS_FMT_RELAY) ?
+	    "Relay-forward messages sent, by hop count." :
+	    "Relay-forward messages received, by hop count.");
+	for (i = 0; i < STATS_HOPS; i++) {
+		if (st->hops[i] == 0)
+			continue;
+		(void)stats_printf(bpp, lenp,
+		    "dhcp6_relay_hops_total{hops=\"%d\"} %llu\n", i,
+		    (unsigned long long)st->hops[i]);
+	}
+
+	if ((fmt & STATS_FMT_RELAY))
+		goto io;
+
+	stats_family(bpp, lenp, "dhcp6_noaddrsavail_replies", "counter",
+	    "Replies with the NoAddrsAvail status.");
+	(void)stats_printf(bpp, lenp, "dhcp6_noaddrsavail_replies_total %llu\n",
+	    (unsigned long long)st->noaddrs);
+	stats_family(bpp, lenp, "dhcp6_bindings", "gauge",
+	    "Bindings of clients.");
+	(void)stats_printf(bpp, lenp, "dhcp6_bindings %llu\n",
+	    (unsigned long long)st->bindings);
+	stats_family(bpp, lenp, "dhcp6_leases", "gauge",
+	    "Leased addresses and prefixes.");
+	(void)stats_printf(bpp, lenp, "dhcp6_leases %llu\n",
+	    (unsigned long long)st->leases);
+	stats_family(bpp, lenp, "dhcp6_timers", "gauge", "Armed timers.");
+	(void)stats_printf(bpp, lenp, "dhcp6_timers %llu\n",
+	    (unsigned long long)st->timers);
+	stats_family(bpp, lenp, "dhcp6_hostconf_capacity", "gauge",
+	    "Host configurations that can be made for clients of pools.");
+	(void)stats_printf(bpp, lenp, "dhcp6_hostconf_capacity %llu\n",
+	    (unsigned long long)st->hostconf.size);
+	stats_family(bpp, lenp, "dhcp6_hostconfs", "gauge",
+	    "Host configurations made for clients of pools.");
+	(void)stats_printf(bpp, lenp, "dhcp6_hostconfs %llu\n",
+	    (unsigned long long)st->hostconf.entries);
+	stats_family(bpp, lenp, "dhcp6_hostconf_bytes", "gauge",
+	    "Memory taken by the host configurations.");
+	(void)stats_printf(bpp, lenp, "# UNIT dhcp6_hostconf_bytes bytes\n");
+	(void)stats_printf(bpp, lenp, "dhcp6_hostconf_bytes %llu\n",
+	    (unsigned long long)st->hostconf.bytes);
+	stats_family(bpp, lenp, "dhcp6_hostconf_created", "counter",
+	    "Host configurations made, including reused ones.");
+	(void)stats_printf(bpp, lenp, "dhcp6_hostconf_created_total %llu\n",
+	    (unsigned long long)st->hostconf.inserts);
+	stats_family(bpp, lenp, "dhcp6_hostconf_evictions", "counter",
+	    "Host configurations reused for another client.");
+	(void)stats_printf(bpp, lenp,
+	    "dhcp6_hostconf_evictions_total %llu\n",
+	    (unsigned long long)st->hostconf.evictions);
+	stats_family(bpp, lenp, "dhcp6_hostconf_hits", "counter",
+	    "Lookups that found a host configuration made before.");
+	(void)stats_printf(bpp, lenp, "dhcp6_hostconf_hits_total %llu\n",
+	    (unsigned long long)st->hostconf.hits);
+	stats_family(bpp, lenp, "dhcp6_pool_addresses", "gauge",
+	    "Addresses in the pool.");
+	for (i = 0; i < st->npools; i++) {
+		p = &st->pool[i];
+		(void)stats_printf(bpp, lenp,
+		    "dhcp6_pool_addresses{pool=\"%s\"} %llu\n",
+		    stats_label(p->name, sizeof(p->name), label, sizeof(label)),
+		    (unsigned long long)p->size);
+	}
+	stats_family(bpp, lenp, "dhcp6_pool_free_addresses", "gauge",
+	    "Addresses in the pool that are not leased.");
+	for (i = 0; i < st->npools; i++) {
+		p = &st->pool[i];
+		(void)stats_printf(bpp, lenp,
+		    "dhcp6_pool_free_addresses{pool=\"%s\"} %llu\n",
+		    stats_label(p->name, sizeof(p->name), label, sizeof(label)),
+		    (unsigned long long)p->free);
+	}
+
+	stats_family(bpp, lenp, "dhcp6_stage_duration_seconds", "histogram",
+	    "Time taken by each stage of processing a message.");
+	(void)stats_printf(bpp, lenp,
+	    "# UNIT dhcp6_stage_duration_seconds seconds\n");
+	for (i = 0; i < STATS_STAGES; i++) {
+		h = &st->hist[i];
+
+		/* bucket 4 * (k - 2) + 3 is the last one below 2^k ns */
+		for (n = 0, j = 0, k = STATS_OM_MINLOG; k <= STATS_OM_MAXLOG;
+		    k++) {
+			for (; j <= 4 * (k - 2) + 3; j++)
+				n += h->bucket[j];
+			(void)stats_printf(bpp, lenp,
+			    "dhcp6_stage_duration_seconds_bucket"
+			    "{stage=\"%s\",le=\"%.9g\"} %llu\n", stagenames[i],
+			    (double)((u_int64_t)1 << k) / 1e9,
+			    (unsigned long long)n);
+		}
+		(void)stats_printf(bpp, lenp,
+		    "dhcp6_stage_duration_seconds_bucket"
+		    "{stage=\"%s\",le=\"+Inf\"} %llu\n"
+		    "dhcp6_stage_duration_seconds_count{stage=\"%s\"} %llu\n"
+		    "dhcp6_stage_duration_seconds_sum{stage=\"%s\"} %.9f\n",
+		    stagenames[i], (unsigned long long)h->count,
+		    stagenames[i], (unsigned long long)h->count,
+		    stagenames[i], h->sum / 1e9);
+	}
+
+  io:
+	stats_family(bpp, lenp, "dhcp6_io_calls", "counter",
+	    "System calls to receive and send packets.");
+	(void)stats_printf(bpp, lenp,
+	    "dhcp6_io_calls_total{direction=\"receive\"} %llu\n"
+	    "dhcp6_io_calls_total{direction=\"send\"} %llu\n",
+	    (unsigned long long)st->rxbatch.calls,
+	    (unsigned long long)st->txbatch.calls);
+	stats_family(bpp, lenp, "dhcp6_io_packets", "counter",
+	    "Packets received and sent.");
+	(void)stats_printf(bpp, lenp,
+	    "dhcp6_io_packets_total{direction=\"receive\"} %llu\n"
+	    "dhcp6_io_packets_total{direction=\"send\"} %llu\n",
+	    (unsigned long long)st->rxbatch.packets,
+	    (unsigned long long)st->txbatch.packets);
+	stats_family(bpp, lenp, "dhcp6_io_send_errors", "counter",
+	    "Packets that could not be sent.");
+	(void)stats_printf(bpp, lenp, "dhcp6_io_send_errors_total %llu\n",
+	    (unsigned long long)st->txbatch.errors);
+
+	(void)stats_printf(bpp, lenp, "# EOF\n");
+}
+
+static void
+stats_family(bpp, lenp, name, type, help)
+	char **bpp;
+	size_t *lenp;
+	char *name, *type, *help;
+{
+	(void)stats_printf(bpp, lenp, "# TYPE %s %s\n# HELP %s %s\n",
+	    name, type, name, help);
+}
+
+static char *
+stats_ifname(i)
+	int i;
+{
+	if (i < stats_nifs)
+		return (stats_ifs[i].name);
+	return ("other");
+}
+
+/* escape a string of up to len bytes as a label value */
+static char *
+stats_label(s, len, buf, buflen)
+	char *s;
+	size_t len;
+	char *buf;
+	size_t buflen;
+{
+	char *bp = buf;
+
+	for (; len > 0 && *s != '\0' && bp + 2 < buf + buflen; s++, len--) {
+		switch (*s) {
+		case '\\':
+		case '"':
+			*bp++ = '\\';
+			*bp++ = *s;
+			break;
+		case '\n':
+			*bp++ = '\\';
+			*bp++ = 'n';
+			break;
+		default:
+			*bp++ = *s;
+			break;
+		}
+	}
+	*bp = '\0';
+
+	return (buf);
+}
+
+/* write the statistics of all the processes to a file */
+int
+stats_dump(path)
+	char *path;
+{
+	static char buf[16384];
+	struct stats sum;
+	size_t len;
+	FILE *fp;
+
+	stats_sum(&sum);
+	len = stats_format(&sum, STATS_FMT_TEXT, buf, sizeof(buf));
+
+	if ((fp = fopen(path, "w")) == NULL) {
+		dprintf(LOG_WARNING, FNAME, "failed to open %s: %s", path,
+		    strerror(errno));
+		return (-1);
+	}
+	if (fwrite(buf, 1, len, fp) != len) {
+		dprintf(LOG_WARNING, FNAME, "failed to write %s", path);
+		fclose(fp);
+		return (-1);
+	}
+	fclose(fp);
+
+	return (0);
+}
+
+static int
+stats_bucket(d)
+	u_int64_t d;
+{
+	int l;
+
+	if (d < 4)
+		return ((int)d);
+	if (d >= (u_int64_t)1 << 34)
+		return (STATS_BUCKETS - 1);
+#ifdef __GNUC__
+	l = 63 - __builtin_clzll(d);
+#else
+	for (l = 2; d >> (l + 1); l++)
+		;
+#endif
+	return (4 * (l - 1) + (int)((d >> (l - 2)) & 3));
+}
+
+/* the upper bound of the bucket holding the q-quantile, in nanoseconds */
+static double
+stats_percentile(h, q)
+	struct stats_hist *h;
+	double q;
+{
+	u_int64_t n = 0, rank;
+	int i, l;
+
+	if (h->count == 0)
+		return (0.0);
+
+	rank = (u_int64_t)(q * h->count);
+	if (rank >= h->count)
+		rank = h->count - 1;
+	for (i = 0; i < STATS_BUCKETS - 1; i++) {
+		if ((n += h->bucket[i]) > rank)
+			break;
+	}
+	if (i < 4)
+		return ((double)(i + 1));
+	l = i / 4 + 1;
+	return ((double)((u_int64_t)(4 + i % 4 + 1) << (l - 2)));
+}
+
+static void
+stats_addhist(sum, h)
+	struct stats_hist *sum, *h;
+{
+	int i;
+
+	sum->count += h->count;
+	sum->sum += h->sum;
+	for (i = 0; i < STATS_BUCKETS; i++)
+		sum->bucket[i] += h->bucket[i];
+}
+
+static int
+stats_printf(char **bpp, size_t *lenp, const char *fmt, ...)
+{
+	va_list ap;
+	int n;
+
+	va_start(ap, fmt);
+	n = vsnprintf(*bpp, *lenp, fmt, ap);
+	va_end(ap);
+	if (n < 0)
+		return (-1);
+	if ((size_t)n >= *lenp)
+		n = *lenp - 1;	/* truncated */
+	*bpp += n;
+	*lenp -= n;
+
+	return (0);
+}
@@ -0,0 +1,143 @@
+/*
+ * Copyright (C) 2026 WIDE Project.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the project nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE PROJECT AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE PROJECT OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef __STATS_H_DEFINED
+#define __STATS_H_DEFINED
+
+/* message types counted separately; the others are counted as type 0 */
+#define STATS_MSGTYPES		32
+#define STATS_MSGTYPE(t)	((t) < STATS_MSGTYPES ? (t) : 0)
+
+/* reasons for dropping a received message */
+#define STATS_DROP_SHORT	0	/* shorter than the header */
+#define STATS_DROP_NOIF		1	/* on an interface we don't serve */
+#define STATS_DROP_UNICAST	2	/* unicast where it must be multicast */
+#define STATS_DROP_BADTYPE	3	/* a type a server doesn't take */
+#define STATS_DROP_RELAY	4	/* malformed Relay-forward message */
+#define STATS_DROP_OPTIONS	5	/* malformed options */
+#define STATS_DROP_AUTH		6	/* authentication failure */
+#define STATS_DROP_INVALID	7	/* fails the checks of the message type */
+#define STATS_DROP_BUSY		8	/* the worker was too busy to take it */
+#define STATS_DROP_HOPLIMIT	9	/* relayed too many times */
+#define STATS_DROP_NOLINK	10	/* no link to relay it on */
+#define STATS_DROP_MAX		11
+
+/* stages of processing a message, timed separately */
+#define STATS_STAGE_PARSE	0	/* relay decapsulation, options */
+#define STATS_STAGE_LOOKUP	1	/* a binding lookup */
+#define STATS_STAGE_ALLOC	2	/* allocation of a new IA */
+#define STATS_STAGE_ENCODE	3	/* building the reply */
+#define STATS_STAGE_SEND	4	/* sending a batch of replies */
+#define STATS_STAGE_TOTAL	5	/* the whole message */
+#define STATS_STAGES		6
+
+/*
+ * Latency histograms have four buckets for each power of two nanoseconds
+ * (the first four buckets hold 0-3ns), up to 2^34ns.
+ */
+#define STATS_BUCKETS		132
+
+struct stats_hist {
+	u_int64_t count;
+	u_int64_t sum;		/* nanoseconds */
+	u_int64_t bucket[STATS_BUCKETS];
+};
+
+/*
+ * Messages are counted by interface.  The interfaces are registered by
+ * stats_addif() before the workers are forked, in the same order in every
+ * process; the last slot is shared by the others.
+ */
+#define STATS_IFS		16
+
+struct stats_if {
+	u_int64_t rx[STATS_MSGTYPES];	/* by the type of the message */
+	u_int64_t tx[STATS_MSGTYPES];
+};
+
+/* hop counts of Relay-forward messages */
+#define STATS_HOPS		(DHCP6_RELAY_HOP_COUNT_LIMIT + 1)
+#define STATS_HOP(h)	((h) < STATS_HOPS ? (h) : STATS_HOPS - 1)
+
+/* address pool utilization */
+#define STATS_POOLS		32
+#define STATS_POOLNAME		32
+
+struct stats_pool {
+	char name[STATS_POOLNAME];
+	u_int64_t size;		/* addresses in the pool (or our part) */
+	u_int64_t free;
+};
+
+/*
+ * Counters of one process.  Each process only writes its own, so they
+ * need no locking; the counters of the workers are in memory shared with
+ * the dispatcher, which adds them up when asked.
+ */
+struct stats {
+	struct stats_if ifs[STATS_IFS];
+	u_int64_t dropped[STATS_MSGTYPES];
+	u_int64_t relayed;		/* received in Relay-forward */
+	u_int64_t hops[STATS_HOPS];	/* Relay-forward by hop count */
+	u_int64_t drops[STATS_DROP_MAX];
+	u_int64_t noaddrs;		/* replies with NoAddrsAvail */
+	struct stats_hist hist[STATS_STAGES];
+
+	/* gauges and I/O counters, refreshed by the owner at each round */
+	u_int64_t bindings;
+	u_int64_t leases;
+	u_int64_t timers;
+	struct dynamic_hostconf_stats hostconf;
+	struct pktbatch_stats rxbatch;
+	struct pktbatch_stats txbatch;
+	u_int64_t arena_allocs;
+	u_int64_t arena_overflows;
+	int npools;
+	struct stats_pool pool[STATS_POOLS];
+};
+
+extern struct stats *stats;	/* the counters of this process */
+
+/* formats of stats_format() */
+#define STATS_FMT_TEXT		0	/* a table for dhcp6ctl */
+#define STATS_FMT_OPENMETRICS	1	/* OpenMetrics text exposition */
+#define STATS_FMT_RELAY		0x10	/* no server counters */
+
+extern int stats_init __P((int));
+extern void stats_attach __P((int));
+extern int stats_addif __P((char *, unsigned int));
+extern int stats_ifslot __P((unsigned int));
+extern u_int64_t stats_clock __P((void));
+extern u_int64_t stats_time __P((int, u_int64_t));
+extern void stats_setpool __P((int, char *, u_int64_t, u_int64_t));
+extern void stats_sum __P((struct stats *));
+extern size_t stats_format __P((struct stats *, int, char *, size_t));
+extern int stats_dump __P((char *));
+
+#endif
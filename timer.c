@@ -49,18 +49,32 @@
 
 #define MILLION 1000000
 
-LIST_HEAD(, dhcp6_timer) timer_head;
-static struct timeval tm_sentinel;
+/*
+ * Armed timers are kept in a binary min-heap ordered by expiration time,
+ * so that arming, re-arming and removing a timer costs O(log N) and
+ * dhcp6_check_timer() only needs to look at the timers that have actually
+ * expired.  Timers that are allocated but not armed (or that have already
+ * fired) are not in the heap; their heap_index is -1.
+ */
+#define TIMER_HEAP_INITSIZE 64
+
+static struct dhcp6_timer **timer_heap;
+static int timer_heap_size;	/* number of allocated slots */
+static int timer_heap_len;	/* number of armed timers */
+static int timer_count;		/* number of allocated timers */
 static struct timeval tm_max = {0x7fffffff, 0x7fffffff};
 
 static void timeval_add __P((struct timeval *, struct timeval *,
 			     struct timeval *));
+static void timer_heap_up __P((int));
+static void timer_heap_down __P((int));
+static void timer_heap_delete __P((struct dhcp6_timer *));
 
 void
 dhcp6_timer_init()
 {
-	LIST_INIT(&timer_head);
-	tm_sentinel = tm_max;
+	timer_heap_len = 0;
+	timer_count = 0;
 }
 
 struct dhcp6_timer *
@@ -70,6 +84,25 @@ dhcp6_add_timer(timeout, timeodata)
 {
 	struct dhcp6_timer *newtimer;
 
+	/*
+	 * Make sure that the heap has room for every allocated timer, so
+	 * that dhcp6_set_timer() never has to allocate memory.
+	 */
+	if (timer_count >= timer_heap_size) {
+		struct dhcp6_timer **newheap;
+		int newsize;
+
+		newsize = timer_heap_size ?
+		    timer_heap_size * 2 : TIMER_HEAP_INITSIZE;
+		if ((newheap = realloc(timer_heap,
+		    newsize * sizeof(*newheap))) == NULL) {
+			dprintf(LOG_ERR, FNAME, "can't allocate memory");
+			return (NULL);
+		}
+		timer_heap = newheap;
+		timer_heap_size = newsize;
+	}
+
 	if ((newtimer = malloc(sizeof(*newtimer))) == NULL) {
 		dprintf(LOG_ERR, FNAME, "can't allocate memory");
 		return (NULL);
@@ -84,8 +117,9 @@ dhcp6_add_timer(timeout, timeodata)
 	newtimer->expire = timeout;
 	newtimer->expire_data = timeodata;
 	newtimer->tm = tm_max;
+	newtimer->heap_index = -1;
 
-	LIST_INSERT_HEAD(&timer_head, newtimer, link);
+	timer_count++;
 
 	return (newtimer);
 }
@@ -94,7 +128,9 @@ void
 dhcp6_remove_timer(timer)
 	struct dhcp6_timer **timer;
 {
-	LIST_REMOVE(*timer, link);
+	if ((*timer)->heap_index >= 0)
+		timer_heap_delete(*timer);
+	timer_count--;
 	free(*timer);
 	*timer = NULL;
 }
@@ -104,16 +140,23 @@ dhcp6_set_timer(tm, timer)
 	struct timeval *tm;
 	struct dhcp6_timer *timer;
 {
-	struct timeval now;
+	struct timeval now, old;
 
 	/* reset the timer */
 	gettimeofday(&now, NULL);
 
+	old = timer->tm;
 	timeval_add(&now, tm, &timer->tm);
 
-	/* update the next expiration time */
-	if (TIMEVAL_LT(timer->tm, tm_sentinel))
-		tm_sentinel = timer->tm;
+	/* update the position in the heap */
+	if (timer->heap_index < 0) {
+		timer->heap_index = timer_heap_len++;
+		timer_heap[timer->heap_index] = timer;
+		timer_heap_up(timer->heap_index);
+	} else if (TIMEVAL_LT(timer->tm, old))
+		timer_heap_up(timer->heap_index);
+	else
+		timer_heap_down(timer->heap_index);
 
 	return;
 }
@@ -128,34 +171,55 @@ dhcp6_check_timer()
 {
 	static struct timeval returnval;
 	struct timeval now;
-	struct dhcp6_timer *tm, *tm_next;
+	struct dhcp6_timer *tm;
 
 	gettimeofday(&now, NULL);
 
-	tm_sentinel = tm_max;
-	for (tm = LIST_FIRST(&timer_head); tm; tm = tm_next) {
-		tm_next = LIST_NEXT(tm, link);
-		
-		if (TIMEVAL_LEQ(tm->tm, now)) {
-			if ((*tm->expire)(tm->expire_data) == NULL)
-				continue; /* timer has been freed */
-		}
-
-		if (TIMEVAL_LT(tm->tm, tm_sentinel))
-			tm_sentinel = tm->tm;
+	/*
+	 * An expired timer is taken off the heap before its expire function
+	 * is called.  The function either re-arms it with dhcp6_set_timer(),
+	 * frees it (and returns NULL), or leaves it idle.
+	 */
+	while (timer_heap_len > 0 && TIMEVAL_LEQ(timer_heap[0]->tm, now)) {
+		tm = timer_heap[0];
+		timer_heap_delete(tm);
+		(void)(*tm->expire)(tm->expire_data);
 	}
 
-	if (TIMEVAL_EQUAL(tm_max, tm_sentinel)) {
+	if (timer_heap_len == 0) {
 		/* no need to timeout */
 		return (NULL);
-	} else if (TIMEVAL_LT(tm_sentinel, now)) {
+	}
+
+	gettimeofday(&now, NULL);
+	if (TIMEVAL_LT(timer_heap[0]->tm, now)) {
 		/* this may occur when the interval is too small */
 		returnval.tv_sec = returnval.tv_usec = 0;
 	} else
-		timeval_sub(&tm_sentinel, &now, &returnval);
+		timeval_sub(&timer_heap[0]->tm, &now, &returnval);
 	return (&returnval);
 }
 
+/*
+ * Return the expiration time of the earliest armed timer, or NULL if no
+ * timer is armed.
+ */
+struct timeval *
+dhcp6_timer_deadline()
+{
+	if (timer_heap_len == 0)
+		return (NULL);
+
+	return (&timer_heap[0]->tm);
+}
+
+/* the number of armed timers */
+int
+dhcp6_timer_count()
+{
+	return (timer_heap_len);
+}
+
 struct timeval *
 dhcp6_timer_rest(timer)
 	struct dhcp6_timer *timer;
@@ -174,6 +238,66 @@ dhcp6_timer_rest(timer)
 	return (&returnval);
 }
 
+static void
+timer_heap_up(idx)
+	int idx;
+{
+	struct dhcp6_timer *tm = timer_heap[idx];
+	int parent;
+
+	while (idx > 0) {
+		parent = (idx - 1) / 2;
+		if (!TIMEVAL_LT(tm->tm, timer_heap[parent]->tm))
+			break;
+		timer_heap[idx] = timer_heap[parent];
+		timer_heap[idx]->heap_index = idx;
+		idx = parent;
+	}
+	timer_heap[idx] = tm;
+	tm->heap_index = idx;
+}
+
+static void
+timer_heap_down(idx)
+	int idx;
+{
+	struct dhcp6_timer *tm = timer_heap[idx];
+	int child;
+
+	while ((child = idx * 2 + 1) < timer_heap_len) {
+		if (child + 1 < timer_heap_len &&
+		    TIMEVAL_LT(timer_heap[child + 1]->tm, timer_heap[child]->tm))
+			child++;
+		if (!TIMEVAL_LT(timer_heap[child]->tm, tm->tm))
+			break;
+		timer_heap[idx] = timer_heap[child];
+		timer_heap[idx]->heap_index = idx;
+		idx = child;
+	}
+	timer_heap[idx] = tm;
+	tm->heap_index = idx;
+}
+
+static void
+timer_heap_delete(timer)
+	struct dhcp6_timer *timer;
+{
+	int idx = timer->heap_index;
+	struct dhcp6_timer *last;
+
+	timer->heap_index = -1;
+	last = timer_heap[--timer_heap_len];
+	if (last == timer)
+		return;
+
+	timer_heap[idx] = last;
+	last->heap_index = idx;
+	if (idx > 0 && TIMEVAL_LT(last->tm, timer_heap[(idx - 1) / 2]->tm))
+		timer_heap_up(idx);
+	else
+		timer_heap_down(idx);
+}
+
 /* result = a + b */
 static void
 timeval_add(a, b, result)
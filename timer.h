@@ -42,7 +42,7 @@
 			     (a).tv_usec == (b).tv_usec)
 
 struct dhcp6_timer {
-	LIST_ENTRY(dhcp6_timer) link;
+	int heap_index;		/* position in the timer heap, -1 if idle */
 
 	struct timeval tm;
 
@@ -56,6 +56,8 @@ struct dhcp6_timer *dhcp6_add_timer __P((struct dhcp6_timer *(*) __P((void *)),
 void dhcp6_set_timer __P((struct timeval *, struct dhcp6_timer *));
 void dhcp6_remove_timer __P((struct dhcp6_timer **));
 struct timeval * dhcp6_check_timer __P((void));
+struct timeval * dhcp6_timer_deadline __P((void));
+int dhcp6_timer_count __P((void));
 struct timeval * dhcp6_timer_rest __P((struct dhcp6_timer *));
 
 void timeval_sub __P((struct timeval *, struct timeval *,
@@ -0,0 +1,365 @@
+/*
+ * Copyright (C) 2026 WIDE Project.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the project nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE PROJECT AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE PROJECT OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Packet trace capture for dhcp6s and dhcp6relay.
+ *
+ * With -T, every datagram received or sent is recorded with its
+ * interface, peer address, packet information and a timestamp into a
+ * ring in a memory-mapped file, so that the cost of tracing is a memcpy()
+ * per packet.  When the ring is full, the oldest records are overwritten.
+ * The file can be read once the daemon has exited (the header is updated
+ * with each record, so it can also be copied while the daemon runs), and
+ * a trace of dhcp6s can be replayed with dhcp6s -R.
+ *
+ * File format (host byte order, the file is not meant to be portable):
+ *	struct trace_header, then struct trace_record's up to the end
+ * Each record is followed by the datagram and padded to a multiple of 8
+ * bytes.  Records are written at the head, wrapping around to hdrlen at
+ * a TRACE_PAD record or where no record fits any more; the records from
+ * the tail to the head are valid, oldest first.
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/queue.h>
+
+#include <netinet/in.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "dhcp6.h"
+#include "config.h"
+#include "common.h"
+#include "trace.h"
+
+#define TRACE_ALIGN(n)	(((n) + 7) & ~7)
+#define TRACE_HDRLEN	TRACE_ALIGN(sizeof(struct trace_header))
+
+static struct trace_header *trace;
+static u_int64_t trace_lastrecv;	/* time of the last TRACE_RECV */
+
+static u_int64_t trace_now __P((void));
+static struct trace_record *trace_alloc __P((size_t));
+static int trace_skip __P((struct trace_header *, u_int64_t));
+
+/*
+ * Start tracing into path.  The size of an existing file is kept, so a
+ * larger ring can be prepared with truncate(1); otherwise the file is made
+ * size bytes.
+ */
+int
+trace_open(path, size)
+	char *path;
+	size_t size;
+{
+	struct stat st;
+	void *p;
+	int fd, error;
+
+	if ((fd = open(path, O_RDWR | O_CREAT, 0644)) < 0) {
+		dprintf(LOG_ERR, FNAME, "failed to open %s: %s", path,
+		    strerror(errno));
+		return (-1);
+	}
+	if (fstat(fd, &st) < 0) {
+		dprintf(LOG_ERR, FNAME, "fstat %s: %s", path, strerror(errno));
+		goto fail;
+	}
+	if (st.st_size >= TRACE_HDRLEN + 65536)
+		size = st.st_size;
+	size &= ~7;
+	if (ftruncate(fd, size) < 0) {
+		dprintf(LOG_ERR, FNAME, "ftruncate %s: %s", path,
+		    strerror(errno));
+		goto fail;
+	}
+	/* a store to a hole the disk has no room for would raise SIGBUS */
+	if ((error = posix_fallocate(fd, 0, size)) != 0) {
+		dprintf(LOG_ERR, FNAME, "posix_fallocate %s: %s", path,
+		    strerror(error));
+		goto fail;
+	}
+#ifdef MAP_POPULATE
+	p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+	    fd, 0);
+#else
+	p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+#endif
+	if (p == MAP_FAILED) {
+		dprintf(LOG_ERR, FNAME, "mmap %s: %s", path, strerror(errno));
+		goto fail;
+	}
+	close(fd);
+
+	trace = (struct trace_header *)p;
+	memset(trace, 0, TRACE_HDRLEN);
+	memcpy(trace->magic, TRACE_MAGIC, sizeof(trace->magic));
+	trace->version = TRACE_VERSION;
+	trace->hdrlen = TRACE_HDRLEN;
+	trace->size = size;
+	trace->head = trace->tail = TRACE_HDRLEN;
+
+	dprintf(LOG_INFO, FNAME, "tracing packets into %s (%lu bytes)",
+	    path, (unsigned long)size);
+	return (0);
+
+  fail:
+	close(fd);
+	return (-1);
+}
+
+void
+trace_close()
+{
+	if (trace == NULL)
+		return;
+
+	dprintf(LOG_INFO, FNAME, "traced %llu packets%s",
+	    (unsigned long long)trace->records,
+	    trace->wrapped ? " (older ones overwritten)" : "");
+	(void)msync(trace, trace->size, MS_ASYNC);
+	(void)munmap(trace, trace->size);
+	trace = NULL;
+}
+
+void
+trace_recv(ifindex, from, dst, data, len)
+	unsigned int ifindex;
+	struct sockaddr_in6 *from;
+	struct in6_addr *dst;
+	void *data;
+	size_t len;
+{
+	struct trace_record *rec;
+
+	if (trace == NULL || (rec = trace_alloc(len)) == NULL)
+		return;
+
+	rec->type = TRACE_RECV;
+	rec->ifindex = ifindex;
+	rec->time = trace_lastrecv = trace_now();
+	rec->latency = 0;
+	rec->port = from->sin6_port;
+	rec->peer = from->sin6_addr;
+	if (dst)
+		rec->local = *dst;
+	else
+		memset(&rec->local, 0, sizeof(rec->local));
+	memcpy(rec + 1, data, len);
+}
+
+void
+trace_send(ifindex, to, data, len)
+	unsigned int ifindex;
+	struct sockaddr_in6 *to;
+	void *data;
+	size_t len;
+{
+	struct trace_record *rec;
+
+	if (trace == NULL || (rec = trace_alloc(len)) == NULL)
+		return;
+
+	rec->type = TRACE_SEND;
+	rec->ifindex = ifindex;
+	rec->time = trace_now();
+	rec->latency = trace_lastrecv ?
+	    (u_int32_t)(rec->time - trace_lastrecv) : 0;
+	rec->port = to->sin6_port;
+	rec->peer = to->sin6_addr;
+	memset(&rec->local, 0, sizeof(rec->local));
+	memcpy(rec + 1, data, len);
+}
+
+static u_int64_t
+trace_now()
+{
+	struct timespec ts;
+
+	(void)clock_gettime(CLOCK_REALTIME, &ts);
+	return ((u_int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec);
+}
+
+/* is off past the last record before the end of the ring? */
+static int
+trace_skip(hdr, off)
+	struct trace_header *hdr;
+	u_int64_t off;
+{
+	return (off >= hdr->size ||
+	    ((struct trace_record *)((char *)hdr + off))->type == TRACE_PAD);
+}
+
+/*
+ * Reserve room for a record at the head, overwriting the oldest records
+ * as needed.
+ */
+static struct trace_record *
+trace_alloc(len)
+	size_t len;
+{
+	struct trace_record *rec;
+	u_int64_t head, reclen, next;
+
+	reclen = TRACE_ALIGN(sizeof(*rec) + len);
+	/* the length must fit in rec->reclen */
+	if (reclen > 0xffff || reclen > trace->size - trace->hdrlen)
+		return (NULL);
+
+	head = trace->head;
+	if (head + reclen > trace->size) {
+		/* the records from here to the end are gone */
+		if (head < trace->size) {
+			rec = (struct trace_record *)((char *)trace + head);
+			rec->type = TRACE_PAD;
+		}
+		if (trace->wrapped && trace->tail >= head)
+			trace->tail = trace->hdrlen;
+		trace->wrapped = 1;
+		head = trace->hdrlen;
+	}
+	while (trace->wrapped &&
+	    trace->tail >= head && trace->tail < head + reclen) {
+		rec = (struct trace_record *)((char *)trace + trace->tail);
+		next = trace->tail + rec->reclen;
+		if (trace_skip(trace, next))
+			next = trace->hdrlen;
+		trace->tail = next;
+	}
+
+	rec = (struct trace_record *)((char *)trace + head);
+	rec->reclen = (u_int16_t)reclen;
+	rec->flags = 0;
+	rec->datalen = (u_int16_t)len;
+	trace->head = head + reclen;
+	trace->records++;
+
+	return (rec);
+}
+
+/*
+ * Map a trace file for reading.
+ */
+struct trace_header *
+trace_map(path)
+	char *path;
+{
+	struct trace_header *hdr;
+	struct stat st;
+	void *p;
+	int fd;
+
+	if ((fd = open(path, O_RDONLY)) < 0) {
+		dprintf(LOG_ERR, FNAME, "failed to open %s: %s", path,
+		    strerror(errno));
+		return (NULL);
+	}
+	if (fstat(fd, &st) < 0) {
+		dprintf(LOG_ERR, FNAME, "fstat %s: %s", path, strerror(errno));
+		close(fd);
+		return (NULL);
+	}
+	if (st.st_size < TRACE_HDRLEN) {
+		dprintf(LOG_ERR, FNAME, "%s is not a trace file", path);
+		close(fd);
+		return (NULL);
+	}
+	p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (p == MAP_FAILED) {
+		dprintf(LOG_ERR, FNAME, "mmap %s: %s", path, strerror(errno));
+		return (NULL);
+	}
+
+	hdr = (struct trace_header *)p;
+	if (memcmp(hdr->magic, TRACE_MAGIC, sizeof(hdr->magic)) != 0 ||
+	    hdr->version != TRACE_VERSION || hdr->size != st.st_size ||
+	    hdr->hdrlen < TRACE_HDRLEN || hdr->head > hdr->size ||
+	    hdr->tail > hdr->size) {
+		dprintf(LOG_ERR, FNAME, "%s is not a trace file", path);
+		(void)munmap(p, st.st_size);
+		return (NULL);
+	}
+
+	return (hdr);
+}
+
+void
+trace_unmap(hdr)
+	struct trace_header *hdr;
+{
+	(void)munmap(hdr, hdr->size);
+}
+
+/*
+ * Return the record after rec, or the oldest one if rec is NULL.  NULL is
+ * returned at the end of the trace, or when a record is broken.
+ */
+struct trace_record *
+trace_next(hdr, rec)
+	struct trace_header *hdr;
+	struct trace_record *rec;
+{
+	u_int64_t off;
+
+	if (rec == NULL) {
+		if (hdr->records == 0)
+			return (NULL);
+		off = hdr->tail;
+	} else {
+		off = (char *)rec - (char *)hdr + rec->reclen;
+		if (off == hdr->head)
+			return (NULL);
+	}
+	if (trace_skip(hdr, off)) {
+		off = hdr->hdrlen;
+		if (rec != NULL && off == hdr->head)
+			return (NULL);
+	}
+
+	rec = (struct trace_record *)((char *)hdr + off);
+	if (rec->reclen < sizeof(*rec) || off + rec->reclen > hdr->size ||
+	    sizeof(*rec) + rec->datalen > rec->reclen) {
+		dprintf(LOG_ERR, FNAME, "broken record at offset %llu",
+		    (unsigned long long)off);
+		return (NULL);
+	}
+
+	return (rec);
+}
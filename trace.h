@@ -0,0 +1,83 @@
+/*
+ * Copyright (C) 2026 WIDE Project.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the project nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE PROJECT AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE PROJECT OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef __TRACE_H_DEFINED
+#define __TRACE_H_DEFINED
+
+/*
+ * Packet trace file.  See trace.c for the layout; all fields are in the
+ * byte order of the host that wrote the file.
+ */
+#define TRACE_MAGIC		"DH6TRACE"
+#define TRACE_VERSION		1
+#define TRACE_SIZE_DEFAULT	(32 * 1024 * 1024)
+
+/* record types */
+#define TRACE_PAD	0	/* the rest of the ring is unused */
+#define TRACE_RECV	1	/* a datagram received */
+#define TRACE_SEND	2	/* a datagram sent */
+
+struct trace_header {
+	char magic[8];		/* TRACE_MAGIC, not terminated */
+	u_int32_t version;	/* TRACE_VERSION */
+	u_int32_t hdrlen;	/* offset of the first record */
+	u_int64_t size;		/* size of the file */
+	u_int64_t head;		/* offset the next record is written at */
+	u_int64_t tail;		/* offset of the oldest record */
+	u_int64_t wrapped;	/* non-0 once old records are overwritten */
+	u_int64_t records;	/* records ever written */
+};
+
+struct trace_record {
+	u_int16_t reclen;	/* of the record, a multiple of 8 */
+	u_int8_t type;		/* TRACE_xxx */
+	u_int8_t flags;		/* unused */
+	u_int32_t ifindex;	/* arrival or outgoing interface, or 0 */
+	u_int64_t time;		/* nanoseconds since the Epoch */
+	u_int32_t latency;	/* TRACE_SEND: ns since the last TRACE_RECV */
+	u_int16_t port;		/* of the peer, in network byte order */
+	u_int16_t datalen;	/* length of the datagram */
+	struct in6_addr peer;	/* source or destination of the datagram */
+	struct in6_addr local;	/* TRACE_RECV: destination (packet info) */
+	/* the datagram follows */
+};
+
+extern int trace_open __P((char *, size_t));
+extern void trace_close __P((void));
+extern void trace_recv __P((unsigned int, struct sockaddr_in6 *,
+    struct in6_addr *, void *, size_t));
+extern void trace_send __P((unsigned int, struct sockaddr_in6 *,
+    void *, size_t));
+
+extern struct trace_header *trace_map __P((char *));
+extern void trace_unmap __P((struct trace_header *));
+extern struct trace_record *trace_next __P((struct trace_header *,
+    struct trace_record *));
+
+#endif